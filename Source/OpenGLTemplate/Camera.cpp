@@ -9,6 +9,7 @@ CCamera::CCamera()
 	m_vUpVector = glm::vec3(0.0f, 1.0f, 0.0f);
 	m_speed = 0.025f;
 	m_dir = 1.f;
+	m_fRotationX = 0.0f;
 }
 CCamera::~CCamera()
 {}
@@ -22,36 +23,52 @@ void CCamera::Set(glm::vec3 &vPosition, glm::vec3 &vViewpoint, glm::vec3 &vUpVec
 
 }
 
-// Respond to mouse movement
-void CCamera::SetViewByMouse()
-{  
-	int iMiddle_x = GameWindow::SCREEN_WIDTH >> 1;
-	int iMiddle_y = GameWindow::SCREEN_HEIGHT >> 1;
+// Read the input for the free-look camera.  The mouse is measured from the centre of the screen and put back there.
+CameraInput CCamera::SampleInput(bool bMouse)
+{
+	CameraInput input;
+	if (GetKeyState(VK_UP) & 0x80 || GetKeyState('W') & 0x80)
+		input.moveKeys |= CAMERA_FORWARD;
+	if (GetKeyState(VK_DOWN) & 0x80 || GetKeyState('S') & 0x80)
+		input.moveKeys |= CAMERA_BACK;
+	if (GetKeyState(VK_LEFT) & 0x80 || GetKeyState('A') & 0x80)
+		input.moveKeys |= CAMERA_LEFT;
+	if (GetKeyState(VK_RIGHT) & 0x80 || GetKeyState('D') & 0x80)
+		input.moveKeys |= CAMERA_RIGHT;
 
-	float fAngle_y = 0.0f;
-	float fAngle_z = 0.0f;
-	static float fRotation_x = 0.0f;
+	if (bMouse) {
+		int iMiddle_x = GameWindow::SCREEN_WIDTH >> 1;
+		int iMiddle_y = GameWindow::SCREEN_HEIGHT >> 1;
 
-	POINT mouse;
-	GetCursorPos(&mouse);
+		POINT mouse;
+		GetCursorPos(&mouse);
+		if (mouse.x != iMiddle_x || mouse.y != iMiddle_y) {
+			SetCursorPos(iMiddle_x, iMiddle_y);
+			input.mouseX = mouse.x - iMiddle_x;
+			input.mouseY = mouse.y - iMiddle_y;
+		}
+	}
+	return input;
+}
 
-	if (mouse.x == iMiddle_x && mouse.y == iMiddle_y) {
+// Respond to mouse movement
+void CCamera::RotateByMouse(int iMouseX, int iMouseY)
+{  
+	if (iMouseX == 0 && iMouseY == 0) {
 		return;
 	}
 
-	SetCursorPos(iMiddle_x, iMiddle_y);
-
-	fAngle_y = (float) (iMiddle_x - mouse.x) / 1000.0f;
-	fAngle_z = (float) (iMiddle_y - mouse.y) / 1000.0f;
+	float fAngle_y = (float) -iMouseX / 1000.0f;
+	float fAngle_z = (float) -iMouseY / 1000.0f;
 
-	fRotation_x -= fAngle_z;
+	m_fRotationX -= fAngle_z;
 
 	float fMaxAngle = 1.56f; // Just a little bit below PI / 2
 
-	if (fRotation_x > fMaxAngle) {
-		fRotation_x = fMaxAngle;
-	} else if (fRotation_x < -fMaxAngle) {
-		fRotation_x = -fMaxAngle;
+	if (m_fRotationX > fMaxAngle) {
+		m_fRotationX = fMaxAngle;
+	} else if (m_fRotationX < -fMaxAngle) {
+		m_fRotationX = -fMaxAngle;
 	} else {
 		glm::vec3 cross = glm::cross(m_vView - m_vPosition, m_vUpVector);
 		glm::vec3 axis = glm::normalize(cross);
@@ -96,35 +113,32 @@ void CCamera::Advance(double fDirection)
 
 }
 
-// Update the camera to respond to mouse motion for rotations and keyboard for translation
-void CCamera::Update(double fDt, bool mouse)
+// Update the camera to respond to mouse motion for rotations and keys for translation
+void CCamera::Update(double fDt, const CameraInput &input)
 {
 	glm::vec3 vCross = glm::cross(m_vView - m_vPosition, m_vUpVector);
 	m_vStrafeVector = glm::normalize(vCross);
 
-	if (mouse) {
-		SetViewByMouse();
-	}
-	
-	TranslateByKeyboard(fDt);
+	RotateByMouse(input.mouseX, input.mouseY);
+	TranslateByKeys(fDt, input.moveKeys);
 }
 
 // Update the camera to respond to key presses for translation
-void CCamera::TranslateByKeyboard(double dt)
+void CCamera::TranslateByKeys(double dt, unsigned char moveKeys)
 {
-	if (GetKeyState(VK_UP) & 0x80 || GetKeyState('W') & 0x80) {
+	if (moveKeys & CAMERA_FORWARD) {
 		Advance(3.0 * dt);
 	}
 
-	if (GetKeyState(VK_DOWN) & 0x80 || GetKeyState('S') & 0x80) {
+	if (moveKeys & CAMERA_BACK) {
 		Advance(-3.0 * dt);
 	}
 
-	if (GetKeyState(VK_LEFT) & 0x80 || GetKeyState('A') & 0x80) {
+	if (moveKeys & CAMERA_LEFT) {
 		Strafe(-3.0 * dt);
 	}
 
-	if (GetKeyState(VK_RIGHT) & 0x80 || GetKeyState('D') & 0x80) {
+	if (moveKeys & CAMERA_RIGHT) {
 		Strafe(3.0 * dt);
 	}
 
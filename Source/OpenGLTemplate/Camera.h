@@ -3,6 +3,18 @@
 #include "./include/glm/gtc/type_ptr.hpp"
 #include "./include/glm/gtc/matrix_transform.hpp"
 
+// The free-look camera's input for one simulation tick: the movement keys held, as CameraMoveKey bits, and how far the mouse
+// has moved from the centre of the screen since the last tick
+enum CameraMoveKey { CAMERA_FORWARD = 1, CAMERA_BACK = 2, CAMERA_LEFT = 4, CAMERA_RIGHT = 8 };
+struct CameraInput
+{
+	CameraInput() : moveKeys(0), mouseX(0), mouseY(0) {}
+	bool IsEmpty() const { return moveKeys == 0 && mouseX == 0 && mouseY == 0; }
+
+	unsigned char moveKeys;
+	int mouseX, mouseY;
+};
+
 class CCamera {
 public:
 	CCamera();										// Constructor - sets default values for camera position, viewvector, upvector, and speed
@@ -25,11 +37,15 @@ public:
 	// Rotate the camera viewpoint -- this effectively rotates the camera
 	void RotateViewPoint(float fAngle, glm::vec3 &vPoint);
 
+	// Read the movement keys and, with bMouse, the mouse, putting the cursor back in the centre of the screen.  Only the
+	// thread that owns the window sees its keyboard state, so call this there and hand the input to Update.
+	static CameraInput SampleInput(bool bMouse);
+
 	// Respond to mouse movement to rotate the camera
-	void SetViewByMouse();
+	void RotateByMouse(int iMouseX, int iMouseY);
 
-	// Respond to keyboard presses on arrow keys to translate the camera
-	void TranslateByKeyboard(double fDt);
+	// Respond to the arrow and WASD keys to translate the camera
+	void TranslateByKeys(double fDt, unsigned char moveKeys);
 
 	// Strafe the camera (move it side to side)
 	void Strafe(double fDirection);
@@ -37,8 +53,8 @@ public:
 	// Advance the camera (move it forward or backward)
 	void Advance(double fDirection);
 
-	// Update the camera
-	void Update(double fDt, bool mouse);
+	// Update the camera from one tick's input
+	void Update(double fDt, const CameraInput &input);
 
 	// Set the projection matrices
 	void SetPerspectiveProjectionMatrix(float fFOV, float fAspectRatio, float fNear, float fFar);
@@ -54,6 +70,7 @@ private:
 
 	float m_speed;					// How fast the camera moves
 	float m_dir;
+	float m_fRotationX;				// Pitch from the mouse so far, kept within a little of straight up and down
 
 	glm::mat4 m_mPerspectiveProjection;		// Perspective projection matrix
 	glm::mat4 m_mOrthographicProjection;	// Orthographic projection matrix
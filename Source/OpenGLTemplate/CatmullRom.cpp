@@ -1,12 +1,23 @@
 #include "CatmullRom.h"
+#include "Frustum.h"
+#include "FrameProfiler.h"
+#include "Shaders.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <algorithm>
+#include <cfloat>
 
 
 
 CCatmullRom::CCatmullRom()
 {
 	m_vertexCount = 0;
+	m_iNumVisibleSegments = 0;
+	m_vaoCentreline = m_vaoLeftline = m_vaoRightline = m_vaoTrack = 0;
+	m_vaoTrackPatches = 0;
+	m_trackWidth = 100.f;
+	m_gridCellSize = 0.f;
+	m_gridSizeX = m_gridSizeZ = 0;
 	texture.Load("resources\\textures\\road.jpg");
 }
 
@@ -28,6 +39,17 @@ glm::vec3 CCatmullRom::Interpolate(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2,
 
 }
 
+// First and second derivatives (with respect to t) of the Catmull Rom segment between p1 and p2
+void CCatmullRom::InterpolateDerivatives(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::vec3& p3, float t, glm::vec3& d1, glm::vec3& d2)
+{
+	glm::vec3 b = 0.5f * (-p0 + p2);
+	glm::vec3 c = 0.5f * (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3);
+	glm::vec3 d = 0.5f * (-p0 + 3.0f * p1 - 3.0f * p2 + p3);
+
+	d1 = b + 2.0f * c * t + 3.0f * d * t * t;
+	d2 = 2.0f * c + 6.0f * d * t;
+}
+
 
 void CCatmullRom::SetControlPoints()
 {
@@ -93,14 +115,7 @@ bool CCatmullRom::Sample(float d, glm::vec3& p, glm::vec3 up)
 	float fLength = d - (int)(d / fTotalLength) * fTotalLength;
 
 	// Find the current segment
-	int j = -1;
-	for (int i = 0; i < (int)m_distances.size(); i++) {
-		if (fLength >= m_distances[i] && fLength < m_distances[i + 1]) {
-			j = i; // found it!
-			break;
-		}
-	}
-
+	int j = FindSegment(fLength);
 	if (j == -1)
 		return false;
 
@@ -123,6 +138,47 @@ bool CCatmullRom::Sample(float d, glm::vec3& p, glm::vec3 up)
 	return true;
 }
 
+// Find the segment j of the control polygon with m_distances[j] <= fLength < m_distances[j + 1] using a binary search
+int CCatmullRom::FindSegment(float fLength)
+{
+	int j = (int)(upper_bound(m_distances.begin(), m_distances.end(), fLength) - m_distances.begin()) - 1;
+	if (j < 0 || j >= (int)m_distances.size() - 1)
+		return -1;
+	return j;
+}
+
+// Return the point at distance d along the centreline, together with its first and second derivatives with respect to d
+bool CCatmullRom::SampleDerivatives(float d, glm::vec3& p, glm::vec3& dp, glm::vec3& ddp)
+{
+	int M = (int)m_controlPoints.size();
+	if (d < 0 || M == 0)
+		return false;
+
+	float fTotalLength = m_distances[m_distances.size() - 1];
+	float fLength = d - (int)(d / fTotalLength) * fTotalLength;
+
+	int j = FindSegment(fLength);
+	if (j == -1)
+		return false;
+
+	float fSegmentLength = m_distances[j + 1] - m_distances[j];
+	float t = (fLength - m_distances[j]) / fSegmentLength;
+
+	int iPrev = ((j - 1) + M) % M;
+	int iCur = j;
+	int iNext = (j + 1) % M;
+	int iNextNext = (j + 2) % M;
+
+	p = Interpolate(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], t);
+	InterpolateDerivatives(m_controlPoints[iPrev], m_controlPoints[iCur], m_controlPoints[iNext], m_controlPoints[iNextNext], t, dp, ddp);
+
+	// Convert from derivatives in t to derivatives in d
+	dp /= fSegmentLength;
+	ddp /= fSegmentLength * fSegmentLength;
+
+	return true;
+}
+
 
 
 // Sample a set of control points using an open Catmull-Rom spline, to produce a set of iNumSamples that are (roughly) equally spaced
@@ -148,7 +204,7 @@ void CCatmullRom::UniformlySampleControlPoints(int numSamples)
 
 
 	// Repeat once more for truly equidistant points
-	m_controlPoints = m_centrelinePoints;
+	m_controlPoints.assign(m_centrelinePoints.begin(), m_centrelinePoints.end());
 	m_controlUpVectors = m_centrelineUpVectors;
 	m_centrelinePoints.clear();
 	m_centrelineUpVectors.clear();
@@ -175,14 +231,16 @@ void CCatmullRom::CreateCentreline()
 
 	// Call UniformlySampleControlPoints with the number of samples required
 	UniformlySampleControlPoints(600);
+	CreateSegmentGrid();
 
 	// Create a VAO called m_vaoCentreline and a VBO to get the points onto the graphics card
 	glGenVertexArrays(1, &m_vaoCentreline);
 	glBindVertexArray(m_vaoCentreline);
 
-	CVertexBufferObject vbo;
+	CVertexBufferBuilder<CVertex> &vbo = m_vboCentreline;
 	vbo.Create();
 	vbo.Bind();
+	vbo.Reserve(600);
 
 	int M = (int)m_controlPoints.size();
 
@@ -191,10 +249,7 @@ void CCatmullRom::CreateCentreline()
 	glm::vec3 normal(0.0f, 1.0f, 0.0f);
 	for (unsigned int i = 0; i < 600; i++) {
 		float t = (float)i / 100.0f;
-		glm::vec3 v = m_centrelinePoints[i];
-		vbo.AddData(&v, sizeof(glm::vec3));
-		vbo.AddData(&texCoord, sizeof(glm::vec2));
-		vbo.AddData(&normal, sizeof(glm::vec3));
+		vbo.EmplaceVertex(m_centrelinePoints[i], texCoord, normal);
 
 	}
 
@@ -215,20 +270,67 @@ void CCatmullRom::CreateCentreline()
 }
 
 
-void CCatmullRom::CreateOffsetCurves()
+// Choose the arc lengths the track is built on.  The loop starts as spans no longer than the track is wide, and each span is
+// halved until it is flat enough.  An explicit stack holds the ends of the spans still to check, so the samples come out in
+// order.
+void CCatmullRom::AdaptivelySampleTrack(float fChordTolerance, float fMaxTurnAngle)
+{
+	const float fMinSpacing = 0.5f;
+	float fTotalLength = GetTotalLength();
+	float fCosMaxTurn = cos(glm::radians(fMaxTurnAngle));
+	int iNumSpans = max((int) ceil(fTotalLength / m_trackWidth), 3);
+
+	m_trackSampleDistances.clear();
+	vector<float> spanEnds;
+	for (int i = 0; i < iNumSpans; i++) {
+		float d0 = fTotalLength * i / iNumSpans;
+		spanEnds.push_back(fTotalLength * (i + 1) / iNumSpans);
+		while (!spanEnds.empty()) {
+			float d1 = spanEnds.back();
+			if (d1 - d0 > 2.0f * fMinSpacing && TrackSpanNeedsSplit(d0, d1, fChordTolerance, fCosMaxTurn)) {
+				spanEnds.push_back(0.5f * (d0 + d1));
+				continue;
+			}
+			m_trackSampleDistances.push_back(d0);
+			d0 = d1;
+			spanEnds.pop_back();
+		}
+	}
+
+	// The last sample is the first again, which closes the loop
+	m_trackSampleDistances.push_back(fTotalLength);
+}
+
+bool CCatmullRom::TrackSpanNeedsSplit(float d0, float d1, float fChordTolerance, float fCosMaxTurn)
 {
+	glm::vec3 p0, p1, pMid, dp0, dp1, ddp;
+	if (!SampleDerivatives(d0, p0, dp0, ddp) || !SampleDerivatives(d1, p1, dp1, ddp) || !Sample(0.5f * (d0 + d1), pMid))
+		return false;
+
+	if (glm::dot(glm::normalize(dp0), glm::normalize(dp1)) < fCosMaxTurn)
+		return true;
+
+	glm::vec3 chord = p1 - p0;
+	float t = glm::clamp(glm::dot(pMid - p0, chord) / glm::dot(chord, chord), 0.0f, 1.0f);
+	return glm::length(pMid - (p0 + t * chord)) > fChordTolerance;
+}
+
+void CCatmullRom::CreateOffsetCurves(float fChordTolerance, float fMaxTurnAngle)
+{
+	AdaptivelySampleTrack(fChordTolerance, fMaxTurnAngle);
+
 	// Compute the offset curves, one left, and one right.  Store the points in m_leftOffsetPoints and m_rightOffsetPoints respectively
 	glm::vec3 p;
-	glm::vec3 pNext;
+	glm::vec3 dp;
+	glm::vec3 ddp;
 	glm::vec3 l;
 	glm::vec3 r;
-	float w = 100.f;
-	for (int i = 0; i < m_centrelinePoints.size() - 1; i++) {
-		p = m_centrelinePoints[i];
-		pNext = m_centrelinePoints[i + 1.f];
+	float w = m_trackWidth;
+	for (unsigned int i = 0; i < m_trackSampleDistances.size(); i++) {
+		SampleDerivatives(m_trackSampleDistances[i], p, dp, ddp);
 
-		//TNB frame
-		glm::vec3 T = glm::normalize(pNext - p);
+		//TNB frame, as ProjectOntoTrack computes it
+		glm::vec3 T = glm::normalize(dp);
 		glm::vec3 N = glm::normalize(glm::cross(T, glm::vec3(0, 1.f, 0)));
 		glm::vec3 B = glm::normalize(glm::cross(N, T));
 
@@ -245,9 +347,10 @@ void CCatmullRom::CreateOffsetCurves()
 	glGenVertexArrays(1, &m_vaoLeftline);
 	glBindVertexArray(m_vaoLeftline);
 
-	CVertexBufferObject vboLeft;
+	CVertexBufferBuilder<CVertex> &vboLeft = m_vboLeftline;
 	vboLeft.Create();
 	vboLeft.Bind();
+	vboLeft.Reserve((UINT) m_leftOffsetPoints.size());
 	int M = (int)m_leftOffsetPoints.size();
 
 
@@ -255,10 +358,7 @@ void CCatmullRom::CreateOffsetCurves()
 	glm::vec3 normal(0.0f, 1.0f, 0.0f);
 	for (unsigned int i = 0; i < m_leftOffsetPoints.size(); i++) {
 		float t = (float)i / 100.0f;
-		glm::vec3 v = m_leftOffsetPoints[i];
-		vboLeft.AddData(&v, sizeof(glm::vec3));
-		vboLeft.AddData(&texCoord, sizeof(glm::vec2));
-		vboLeft.AddData(&normal, sizeof(glm::vec3));
+		vboLeft.EmplaceVertex(m_leftOffsetPoints[i], texCoord, normal);
 
 	}
 	// Upload the VBO to the GPU
@@ -282,19 +382,17 @@ void CCatmullRom::CreateOffsetCurves()
 	glGenVertexArrays(1, &m_vaoRightline);
 	glBindVertexArray(m_vaoRightline);
 
-	CVertexBufferObject vboRight;
+	CVertexBufferBuilder<CVertex> &vboRight = m_vboRightline;
 	vboRight.Create();
 	vboRight.Bind();
+	vboRight.Reserve((UINT) m_rightOffsetPoints.size());
 	M = (int)m_rightOffsetPoints.size();
 
 
 
 	for (unsigned int i = 0; i < m_rightOffsetPoints.size(); i++) {
 		float t = (float)i / 100.0f;
-		glm::vec3 v = m_rightOffsetPoints[i];
-		vboRight.AddData(&v, sizeof(glm::vec3));
-		vboRight.AddData(&texCoord, sizeof(glm::vec2));
-		vboRight.AddData(&normal, sizeof(glm::vec3));
+		vboRight.EmplaceVertex(m_rightOffsetPoints[i], texCoord, normal);
 
 	}
 
@@ -318,39 +416,37 @@ void CCatmullRom::CreateOffsetCurves()
 }
 
 
-void CCatmullRom::CreateTrack()
+void CCatmullRom::CreateTrack(float fSegmentLength)
 {
 
 	// Generate a VAO called m_vaoTrack and a VBO to get the offset curve points and indices on the graphics card
 	glGenVertexArrays(1, &m_vaoTrack);
 	glBindVertexArray(m_vaoTrack);
 
-	CVertexBufferObject vboTrack;
+	CVertexBufferBuilder<CVertex> &vboTrack = m_vboTrack;
 	vboTrack.Create();
 	vboTrack.Bind();
+	vboTrack.Reserve(2 * (UINT) m_leftOffsetPoints.size());
 
 	m_vertexCount = 0.f;
 
+	// The road texture repeats six times round the loop, as it did when the track had 600 even samples
+	float fTextureLength = GetTotalLength() / 6.0f;
+
 	glm::vec2 texCoord(0.0f, 0.0f);
 	glm::vec3 normal(0.0f, 1.0f, 0.0f);
 	for (unsigned int i = 0; i < m_leftOffsetPoints.size(); i++) {
-		float t = (float)i / 100.0f;
+		float t = m_trackSampleDistances[i] / fTextureLength;
 
 		glm::vec2 leftTex(0.0f, t);
 		glm::vec2 rightTex(1.f, t);
 
 		//left
-		glm::vec3 l = m_leftOffsetPoints[i];
-		vboTrack.AddData(&l, sizeof(glm::vec3));
-		vboTrack.AddData(&leftTex, sizeof(glm::vec2));
-		vboTrack.AddData(&normal, sizeof(glm::vec3));
+		vboTrack.EmplaceVertex(m_leftOffsetPoints[i], leftTex, normal);
 		m_vertexCount++;
 
 		//right
-		glm::vec3 r = m_rightOffsetPoints[i];
-		vboTrack.AddData(&r, sizeof(glm::vec3));
-		vboTrack.AddData(&rightTex, sizeof(glm::vec2));
-		vboTrack.AddData(&normal, sizeof(glm::vec3));
+		vboTrack.EmplaceVertex(m_rightOffsetPoints[i], rightTex, normal);
 		m_vertexCount++;
 
 		
@@ -371,6 +467,156 @@ void CCatmullRom::CreateTrack()
 	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
 		(void*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
 
+	CreateTrackSegments(fSegmentLength);
+}
+
+// Split the strip into runs about fSegmentLength long.  Runs start on a pair, an even vertex, so the strip winding is kept.
+void CCatmullRom::CreateTrackSegments(float fSegmentLength)
+{
+	m_trackSegments.clear();
+	int iNumPairs = (int) m_leftOffsetPoints.size();
+	if (iNumPairs < 2)
+		return;
+
+	const TrackedVector<float> &distances = m_trackSampleDistances;
+	int iStart = 0;
+	while (iStart < iNumPairs - 1) {
+		int iEnd = iStart + 1;
+		while (iEnd < iNumPairs - 1 && distances[iEnd] - distances[iStart] < fSegmentLength)
+			iEnd++;
+
+		CTrackSegment segment;
+		segment.iFirstVertex = 2 * iStart;
+		segment.iNumVertices = 2 * (iEnd - iStart + 1);
+		segment.fStartDistance = distances[iStart];
+		segment.fEndDistance = distances[iEnd];
+		segment.vMin = glm::min(m_leftOffsetPoints[iStart], m_rightOffsetPoints[iStart]);
+		segment.vMax = glm::max(m_leftOffsetPoints[iStart], m_rightOffsetPoints[iStart]);
+		for (int i = iStart + 1; i <= iEnd; i++) {
+			segment.vMin = glm::min(segment.vMin, glm::min(m_leftOffsetPoints[i], m_rightOffsetPoints[i]));
+			segment.vMax = glm::max(segment.vMax, glm::max(m_leftOffsetPoints[i], m_rightOffsetPoints[i]));
+		}
+
+		// Span j runs from m_distances[j] to m_distances[j + 1]
+		int iLastSpan = (int) m_distances.size() - 2;
+		int iFirstPatch = (int) (upper_bound(m_distances.begin(), m_distances.end(), segment.fStartDistance) - m_distances.begin()) - 1;
+		int iLastPatch = (int) (lower_bound(m_distances.begin(), m_distances.end(), segment.fEndDistance) - m_distances.begin()) - 1;
+		segment.iFirstPatch = min(max(iFirstPatch, 0), iLastSpan);
+		segment.iNumPatches = min(max(iLastPatch, segment.iFirstPatch), iLastSpan) - segment.iFirstPatch + 1;
+		m_trackSegments.push_back(segment);
+		iStart = iEnd;
+	}
+
+	// Until the first cull, draw everything.  No cull can find more ranges than there are segments.
+	m_visibleFirsts.clear();
+	m_visibleCounts.clear();
+	m_visibleFirsts.reserve(m_trackSegments.size());
+	m_visibleCounts.reserve(m_trackSegments.size());
+	m_visiblePatchFirsts.clear();
+	m_visiblePatchCounts.clear();
+	m_visiblePatchFirsts.reserve(m_trackSegments.size());
+	m_visiblePatchCounts.reserve(m_trackSegments.size());
+	m_visiblePatchOffsets.reserve(m_trackSegments.size());
+	m_iNumVisibleSegments = 0;
+	for (unsigned int i = 0; i < m_trackSegments.size(); i++)
+		AddVisibleTrackSegment(i);
+}
+
+// A segment that follows the last visible one continues its range, less the pair they share.  Its patches continue theirs
+// too, less any span the two segments both lie on.
+void CCatmullRom::AddVisibleTrackSegment(int iSegment)
+{
+	const CTrackSegment &segment = m_trackSegments[iSegment];
+	if (!m_visibleFirsts.empty() && m_visibleFirsts.back() + m_visibleCounts.back() - 2 == segment.iFirstVertex)
+		m_visibleCounts.back() += segment.iNumVertices - 2;
+	else {
+		m_visibleFirsts.push_back(segment.iFirstVertex);
+		m_visibleCounts.push_back(segment.iNumVertices);
+	}
+
+	GLint iFirstIndex = 4 * segment.iFirstPatch;
+	GLint iEndIndex = iFirstIndex + 4 * segment.iNumPatches;
+	if (!m_visiblePatchFirsts.empty() && iFirstIndex >= m_visiblePatchFirsts.back() &&
+		iFirstIndex <= m_visiblePatchFirsts.back() + m_visiblePatchCounts.back())
+		m_visiblePatchCounts.back() = max(m_visiblePatchCounts.back(), iEndIndex - m_visiblePatchFirsts.back());
+	else {
+		m_visiblePatchFirsts.push_back(iFirstIndex);
+		m_visiblePatchCounts.push_back(iEndIndex - iFirstIndex);
+	}
+	m_iNumVisibleSegments++;
+}
+
+void CCatmullRom::CullTrack(const CFrustum &frustum)
+{
+	m_visibleFirsts.clear();
+	m_visibleCounts.clear();
+	m_visiblePatchFirsts.clear();
+	m_visiblePatchCounts.clear();
+	m_iNumVisibleSegments = 0;
+	for (unsigned int i = 0; i < m_trackSegments.size(); i++) {
+		if (frustum.IntersectsBox(m_trackSegments[i].vMin, m_trackSegments[i].vMax))
+			AddVisibleTrackSegment(i);
+	}
+}
+
+void CCatmullRom::CullTrack(const CFrustum &frustum, float fDistance, float fBehind, float fAhead)
+{
+	int iNumSegments = (int) m_trackSegments.size();
+	float fTotalLength = GetTotalLength();
+	if (iNumSegments == 0 || fBehind + fAhead >= fTotalLength) {
+		CullTrack(frustum);
+		return;
+	}
+
+	m_visibleFirsts.clear();
+	m_visibleCounts.clear();
+	m_visiblePatchFirsts.clear();
+	m_visiblePatchCounts.clear();
+	m_iNumVisibleSegments = 0;
+
+	// Find the segment the window starts in, wrapping the distance onto the loop
+	float fStart = fmod(fDistance - fBehind, fTotalLength);
+	if (fStart < 0.0f)
+		fStart += fTotalLength;
+	TrackedVector<CTrackSegment>::iterator it = upper_bound(m_trackSegments.begin(), m_trackSegments.end(), fStart,
+		[](float fDistance, const CTrackSegment &segment) { return fDistance < segment.fStartDistance; });
+	int iSegment = max((int) (it - m_trackSegments.begin()) - 1, 0);
+
+	// Walk forward, round the loop if need be, until the window is covered
+	float fCovered = m_trackSegments[iSegment].fStartDistance - fStart;
+	for (int i = 0; i < iNumSegments && fCovered < fBehind + fAhead; i++) {
+		const CTrackSegment &segment = m_trackSegments[iSegment];
+		if (frustum.IntersectsBox(segment.vMin, segment.vMax))
+			AddVisibleTrackSegment(iSegment);
+		fCovered += segment.fEndDistance - segment.fStartDistance;
+		iSegment = (iSegment + 1) % iNumSegments;
+	}
+}
+
+int CCatmullRom::GetNumTrackSegments()
+{
+	return (int) m_trackSegments.size();
+}
+
+int CCatmullRom::GetNumVisibleTrackSegments()
+{
+	return m_iNumVisibleSegments;
+}
+
+void CCatmullRom::Release()
+{
+	glDeleteVertexArrays(1, &m_vaoCentreline);
+	glDeleteVertexArrays(1, &m_vaoLeftline);
+	glDeleteVertexArrays(1, &m_vaoRightline);
+	glDeleteVertexArrays(1, &m_vaoTrack);
+	glDeleteVertexArrays(1, &m_vaoTrackPatches);
+	m_vaoCentreline = m_vaoLeftline = m_vaoRightline = m_vaoTrack = m_vaoTrackPatches = 0;
+	m_vboCentreline.Release();
+	m_vboLeftline.Release();
+	m_vboRightline.Release();
+	m_vboTrack.Release();
+	m_vboTrackPatches.Release();
+	texture.Release();
 }
 
 
@@ -381,6 +627,7 @@ void CCatmullRom::RenderCentreline()
 	glLineWidth(5.0f);
 	glBindVertexArray(m_vaoCentreline);
 	glDrawArrays(GL_POINTS, 0, 500);
+	CFrameProfiler::CountDraws();
 	//glDrawArrays(GL_LINE_LOOP, 0, 250);
 
 }
@@ -390,14 +637,16 @@ void CCatmullRom::RenderOffsetCurves()
 	// Bind the VAO m_vaoLeftOffsetCurve and render it
 	glPointSize(10.f);
 	glLineWidth(5.0f);
+	GLsizei count = (GLsizei) m_leftOffsetPoints.size();
 	glBindVertexArray(m_vaoLeftline);
-	glDrawArrays(GL_POINTS, 0, 500);
-	glDrawArrays(GL_LINE_STRIP, 0, 500);
+	glDrawArrays(GL_POINTS, 0, count);
+	glDrawArrays(GL_LINE_STRIP, 0, count);
 
 	// Bind the VAO m_vaoRightOffsetCurve and render it
 	glBindVertexArray(m_vaoRightline);
-	glDrawArrays(GL_POINTS, 0, 500);
-	glDrawArrays(GL_LINE_STRIP, 0, 500);
+	glDrawArrays(GL_POINTS, 0, count);
+	glDrawArrays(GL_LINE_STRIP, 0, count);
+	CFrameProfiler::CountDraws(4);
 }
 
 
@@ -409,10 +658,65 @@ void CCatmullRom::RenderTrack()
 	glLineWidth(5.0f);
 	glBindVertexArray(m_vaoTrack);
 	texture.Bind();
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, m_vertexCount);
+	if (!m_visibleFirsts.empty()) {
+		glMultiDrawArrays(GL_TRIANGLE_STRIP, &m_visibleFirsts[0], &m_visibleCounts[0], (GLsizei) m_visibleFirsts.size());
+		CFrameProfiler::CountDraws();
+	}
 
 }
 
+// Span j of the centreline runs from control point j to j + 1 and is shaped by the points either side, so the loop is stored
+// from the last control point to the second, and patch j is the four points from j.  The distances carry on past the ends of
+// the loop, so each span's distances increase from its start to its end as Sample's do.
+void CCatmullRom::CreateTrackPatches()
+{
+	int M = (int) m_controlPoints.size();
+	float fTotalLength = GetTotalLength();
+
+	glGenVertexArrays(1, &m_vaoTrackPatches);
+	glBindVertexArray(m_vaoTrackPatches);
+	m_vboTrackPatches.Create(true);
+	m_vboTrackPatches.Bind();
+	m_vboTrackPatches.Reserve(M + 3, 4 * M);
+	for (int i = -1; i <= M + 1; i++) {
+		int j = (i + M) % M;
+		float fDistance = m_distances[j] + (i < 0 ? -fTotalLength : i >= M ? fTotalLength : 0.0f);
+		m_vboTrackPatches.AddVertex(glm::vec4(m_controlPoints[j], fDistance));
+	}
+	for (int j = 0; j < M; j++) {
+		for (int k = 0; k < 4; k++)
+			m_vboTrackPatches.AddIndex(j + k);
+	}
+	m_vboTrackPatches.UploadDataToGPU(GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+	glBindVertexArray(0);
+}
+
+void CCatmullRom::RenderTrackPatches()
+{
+	if (m_visiblePatchFirsts.empty())
+		return;
+
+	m_visiblePatchOffsets.clear();
+	for (unsigned int i = 0; i < m_visiblePatchFirsts.size(); i++)
+		m_visiblePatchOffsets.push_back((const GLvoid*) (m_visiblePatchFirsts[i] * sizeof(GLuint)));
+
+	glBindVertexArray(m_vaoTrackPatches);
+	texture.Bind();
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glMultiDrawElements(GL_PATCHES, &m_visiblePatchCounts[0], GL_UNSIGNED_INT, &m_visiblePatchOffsets[0],
+		(GLsizei) m_visiblePatchFirsts.size());
+	CFrameProfiler::CountDraws();
+}
+
+void CCatmullRom::SetTrackPatchUniforms(CShaderProgram *pProgram)
+{
+	pProgram->SetUniform("track.fWidth", m_trackWidth);
+	// The road texture repeats six times round the loop, as on the baked strip
+	pProgram->SetUniform("track.fTextureLength", GetTotalLength() / 6.0f);
+}
+
 int CCatmullRom::CurrentLap(float d)
 {
 
@@ -420,13 +724,154 @@ int CCatmullRom::CurrentLap(float d)
 
 }
 
+// The track edges at the even centreline samples, so gameplay placement does not depend on how the mesh is sampled
 vector<glm::vec3> CCatmullRom::GetTrackPoints() {
 
 	vector<glm::vec3> TrackPoints;
-	for (int i = 0; i < m_rightOffsetPoints.size(); i++) {
-		TrackPoints.push_back(m_leftOffsetPoints[i]);
-		TrackPoints.push_back(m_rightOffsetPoints[i]);
+	float w = m_trackWidth;
+	for (unsigned int i = 0; i + 1 < m_centrelinePoints.size(); i++) {
+		glm::vec3 T = glm::normalize(m_centrelinePoints[i + 1] - m_centrelinePoints[i]);
+		glm::vec3 N = glm::normalize(glm::cross(T, glm::vec3(0, 1.f, 0)));
+		TrackPoints.push_back(m_centrelinePoints[i] - (w / 2) * N);
+		TrackPoints.push_back(m_centrelinePoints[i] + (w / 2) * N);
 	}
 
 	return TrackPoints;
-}
\ No newline at end of file
+}
+
+float CCatmullRom::GetTrackWidth()
+{
+	return m_trackWidth;
+}
+
+float CCatmullRom::GetTotalLength()
+{
+	return m_distances.back();
+}
+
+// Bin the centreline segments into a coarse xz grid.  Each segment is added to every cell overlapped by its bounding box grown 
+// by one track width, so any point within a track width of the centreline finds its nearest segment in its own cell.
+void CCatmullRom::CreateSegmentGrid()
+{
+	int n = (int)m_centrelinePoints.size();
+	float fRadius = m_trackWidth;
+	m_gridCellSize = m_trackWidth;
+
+	glm::vec2 vMin(m_centrelinePoints[0].x, m_centrelinePoints[0].z);
+	glm::vec2 vMax = vMin;
+	for (int i = 1; i < n; i++) {
+		vMin = glm::min(vMin, glm::vec2(m_centrelinePoints[i].x, m_centrelinePoints[i].z));
+		vMax = glm::max(vMax, glm::vec2(m_centrelinePoints[i].x, m_centrelinePoints[i].z));
+	}
+	m_gridOrigin = vMin - glm::vec2(fRadius);
+	m_gridSizeX = (int)((vMax.x - vMin.x + 2 * fRadius) / m_gridCellSize) + 1;
+	m_gridSizeZ = (int)((vMax.y - vMin.y + 2 * fRadius) / m_gridCellSize) + 1;
+
+	int numCells = m_gridSizeX * m_gridSizeZ;
+	m_gridCellStart.assign(numCells + 1, 0);
+	vector<int> cursor;
+
+	// The first pass counts the segments in each cell, the second pass fills them in
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < n; i++) {
+			glm::vec3 a = m_centrelinePoints[i];
+			glm::vec3 b = m_centrelinePoints[(i + 1) % n];
+			int x0 = (int)((min(a.x, b.x) - fRadius - m_gridOrigin.x) / m_gridCellSize);
+			int x1 = (int)((max(a.x, b.x) + fRadius - m_gridOrigin.x) / m_gridCellSize);
+			int z0 = (int)((min(a.z, b.z) - fRadius - m_gridOrigin.y) / m_gridCellSize);
+			int z1 = (int)((max(a.z, b.z) + fRadius - m_gridOrigin.y) / m_gridCellSize);
+			for (int z = max(z0, 0); z <= min(z1, m_gridSizeZ - 1); z++) {
+				for (int x = max(x0, 0); x <= min(x1, m_gridSizeX - 1); x++) {
+					int c = x + z * m_gridSizeX;
+					if (pass == 0)
+						m_gridCellStart[c + 1]++;
+					else
+						m_gridSegments[cursor[c]++] = i;
+				}
+			}
+		}
+
+		if (pass == 0) {
+			for (int c = 0; c < numCells; c++)
+				m_gridCellStart[c + 1] += m_gridCellStart[c];
+			m_gridSegments.resize(m_gridCellStart[numCells]);
+			cursor.assign(m_gridCellStart.begin(), m_gridCellStart.end() - 1);
+		}
+	}
+}
+
+// Project a world position onto the track.  The nearest centreline segment is found from the grid cell containing p, and the 
+// arc length is then refined with Newton's method on the spline itself.
+bool CCatmullRom::ProjectOntoTrack(const glm::vec3 &p, TrackFrame &frame)
+{
+	int n = (int)m_centrelinePoints.size();
+	if (n < 2 || m_gridCellStart.empty())
+		return false;
+
+	float fTotalLength = m_distances[m_distances.size() - 1];
+	float fSpacing = fTotalLength / n;
+
+	// Candidate segments come from the cell containing p.  Far away from the track the cell is empty, so test every segment.
+	int cx = (int)floor((p.x - m_gridOrigin.x) / m_gridCellSize);
+	int cz = (int)floor((p.z - m_gridOrigin.y) / m_gridCellSize);
+	int iFirst = 0, iLast = 0;
+	bool bUseGrid = false;
+	if (cx >= 0 && cx < m_gridSizeX && cz >= 0 && cz < m_gridSizeZ) {
+		int c = cx + cz * m_gridSizeX;
+		iFirst = m_gridCellStart[c];
+		iLast = m_gridCellStart[c + 1];
+		bUseGrid = iLast > iFirst;
+	}
+	if (!bUseGrid) {
+		iFirst = 0;
+		iLast = n;
+	}
+
+	// Closest point on the sampled centreline polyline
+	float fBestDist2 = FLT_MAX;
+	float d = 0.0f;
+	for (int k = iFirst; k < iLast; k++) {
+		int i = bUseGrid ? m_gridSegments[k] : k;
+		glm::vec3 a = m_centrelinePoints[i];
+		glm::vec3 ab = m_centrelinePoints[(i + 1) % n] - a;
+		float t = glm::clamp(glm::dot(p - a, ab) / glm::dot(ab, ab), 0.0f, 1.0f);
+		glm::vec3 q = a + t * ab;
+		float fDist2 = glm::dot(p - q, p - q);
+		if (fDist2 < fBestDist2) {
+			fBestDist2 = fDist2;
+			d = (i + t) * fSpacing;
+		}
+	}
+
+	// Newton iterations on g(d) = (S(d) - p).S'(d), which is zero at the nearest point on the spline S
+	glm::vec3 s, ds, dds;
+	for (int iter = 0; iter < 3; iter++) {
+		if (!SampleDerivatives(d, s, ds, dds))
+			return false;
+		glm::vec3 r = s - p;
+		float g = glm::dot(r, ds);
+		float dg = glm::dot(ds, ds) + glm::dot(r, dds);
+		if (dg <= 0.0f)
+			break;
+		float fStep = glm::clamp(g / dg, -fSpacing, fSpacing);
+		d -= fStep;
+		if (d < 0.0f)
+			d += fTotalLength;
+		else if (d >= fTotalLength)
+			d -= fTotalLength;
+		if (fabs(fStep) < 0.001f)
+			break;
+	}
+	if (!SampleDerivatives(d, s, ds, dds))
+		return false;
+
+	// Same TNB frame as used to build the offset curves
+	frame.distance = d;
+	frame.point = s;
+	frame.T = glm::normalize(ds);
+	frame.N = glm::normalize(glm::cross(frame.T, glm::vec3(0, 1.f, 0)));
+	frame.B = glm::normalize(glm::cross(frame.N, frame.T));
+	frame.lateralOffset = glm::dot(p - s, frame.N);
+
+	return true;
+}
@@ -2,8 +2,21 @@
 #include "Common.h"
 #include "vertexBufferObject.h"
 #include "vertexBufferObjectIndexed.h"
+#include "VertexBufferBuilder.h"
+#include "Vertex.h"
 #include "Texture.h"
 
+class CFrustum;
+class CShaderProgram;
+
+// Result of projecting a world position onto the track centreline
+struct TrackFrame
+{
+	float distance;			// Arc length of the nearest centreline point (in the same units as Sample)
+	float lateralOffset;	// Signed offset from the centreline along N (positive to the right)
+	glm::vec3 point;		// Nearest point on the centreline
+	glm::vec3 T, N, B;		// Tangent, normal and binormal at the nearest point
+};
 
 class CCatmullRom
 {
@@ -14,11 +27,30 @@ public:
 	void CreateCentreline();
 	void RenderCentreline();
 
-	void CreateOffsetCurves();
+	// The offset curves, and the track mesh built on them, follow an adaptive sampling of the centreline: a span is split while
+	// its middle is more than fChordTolerance from its chord or its tangent turns more than fMaxTurnAngle degrees, so straight
+	// runs stay coarse and tight turns get the vertices
+	void CreateOffsetCurves(float fChordTolerance = 0.25f, float fMaxTurnAngle = 4.0f);
 	void RenderOffsetCurves();
 
-	void CreateTrack();
-	void RenderTrack();
+	void CreateTrack(float fSegmentLength = 50.0f);
+	void RenderTrack();		// Draws the segments chosen by the last CullTrack, or all of them
+
+	// Choose the track segments that RenderTrack draws: those in the frustum and, with a window, those that overlap the
+	// arc length from fDistance - fBehind to fDistance + fAhead.  The window is found by a binary search, so only its segments
+	// are tested against the frustum.
+	void CullTrack(const CFrustum &frustum);
+	void CullTrack(const CFrustum &frustum, float fDistance, float fBehind, float fAhead);
+	int GetNumTrackSegments();
+	int GetNumVisibleTrackSegments();
+
+	// The track as one patch per span of the centreline, each its four control points, for the trackTess shaders to place on
+	// the spline.  RenderTrackPatches draws the spans under the segments chosen by the last CullTrack, or all of them; the
+	// shaders then drop any span outside the view and tessellate the rest.
+	void CreateTrackPatches();
+	void RenderTrackPatches();
+	void SetTrackPatchUniforms(CShaderProgram *pProgram);	// pProgram must be in use
+	void Release();			// Deletes the curves' and the track's vertex arrays, buffers and texture
 
 	int CurrentLap(float d); // Return the currvent lap (starting from 0) based on distance along the control curve.
 
@@ -26,12 +58,37 @@ public:
 
 	vector<glm::vec3> GetTrackPoints();
 
+	bool ProjectOntoTrack(const glm::vec3 &p, TrackFrame &frame); // Find the nearest centreline point and local frame for a world position
+	float GetTrackWidth();
+	float GetTotalLength();
+
 private:
 
 	void SetControlPoints();
 	void ComputeLengthsAlongControlPoints();
 	void UniformlySampleControlPoints(int numSamples);
 	glm::vec3 Interpolate(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::vec3& p3, float t);
+	void InterpolateDerivatives(glm::vec3& p0, glm::vec3& p1, glm::vec3& p2, glm::vec3& p3, float t, glm::vec3& d1, glm::vec3& d2);
+	bool SampleDerivatives(float d, glm::vec3& p, glm::vec3& dp, glm::vec3& ddp);
+	int FindSegment(float fLength);
+	void CreateSegmentGrid();
+	void AdaptivelySampleTrack(float fChordTolerance, float fMaxTurnAngle);
+	bool TrackSpanNeedsSplit(float d0, float d1, float fChordTolerance, float fCosMaxTurn);
+	void CreateTrackSegments(float fSegmentLength);
+	void AddVisibleTrackSegment(int iSegment);
+
+	// A run of the track strip, in sample pairs, with its bounds.  Each run shares its first pair with the end of the last.
+	struct CTrackSegment
+	{
+		GLint iFirstVertex;
+		GLsizei iNumVertices;
+		float fStartDistance;				// Arc length at the first pair
+		float fEndDistance;
+		int iFirstPatch;					// The centreline spans the run overlaps, which are the track patches under it
+		int iNumPatches;
+		glm::vec3 vMin;
+		glm::vec3 vMax;
+	};
 
 
 	vector<float> m_distances;
@@ -45,17 +102,40 @@ private:
 	GLuint m_vaoLeftOffsetCurve;
 	GLuint m_vaoRightOffsetCurve;
 	GLuint m_vaoTrack;
+	CVertexBufferBuilder<CVertex> m_vboCentreline;
+	CVertexBufferBuilder<CVertex> m_vboLeftline;
+	CVertexBufferBuilder<CVertex> m_vboRightline;
+	CVertexBufferBuilder<CVertex> m_vboTrack;
+	GLuint m_vaoTrackPatches;
+	CVertexBufferBuilder<glm::vec4> m_vboTrackPatches;	// Control points round the loop and on past its ends, each with its distance in w
 
 	vector<glm::vec3> m_controlPoints;		// Control points, which are interpolated to produce the centreline points
 	vector<glm::vec3> m_controlUpVectors;	// Control upvectors, which are interpolated to produce the centreline upvectors
-	vector<glm::vec3> m_centrelinePoints;	// Centreline points
+	TrackedVector<glm::vec3> m_centrelinePoints;	// Centreline points, evenly spaced in arc length, for gameplay queries
 	vector<glm::vec3> m_centrelineUpVectors;// Centreline upvectors
 
-	vector<glm::vec3> m_leftOffsetPoints;	// Left offset curve points
-	vector<glm::vec3> m_rightOffsetPoints;	// Right offset curve points
+	TrackedVector<float> m_trackSampleDistances;	// Arc lengths of the adaptive samples the track is built on, from 0 to the full loop
+	TrackedVector<glm::vec3> m_leftOffsetPoints;	// Left offset curve points, one per adaptive sample
+	TrackedVector<glm::vec3> m_rightOffsetPoints;	// Right offset curve points
 
 
 	unsigned int m_vertexCount;				// Number of vertices in the track VBO
+	TrackedVector<CTrackSegment> m_trackSegments;	// In order along the track
+	vector<GLint> m_visibleFirsts;			// glMultiDrawArrays ranges for the visible segments, neighbours merged
+	vector<GLsizei> m_visibleCounts;
+	vector<GLint> m_visiblePatchFirsts;		// The same for the patches under them, as glMultiDrawElements index ranges
+	vector<GLsizei> m_visiblePatchCounts;
+	vector<const GLvoid*> m_visiblePatchOffsets;	// m_visiblePatchFirsts as byte offsets, filled as they are drawn
+	int m_iNumVisibleSegments;
+	float m_trackWidth;						// Distance between the left and right offset curves
+
+	// Coarse uniform grid over the xz extent of the centreline, used to find candidate segments for ProjectOntoTrack.
+	// Cell c holds the centreline segments m_gridSegments[m_gridCellStart[c] .. m_gridCellStart[c+1]-1]
+	glm::vec2 m_gridOrigin;
+	float m_gridCellSize;
+	int m_gridSizeX, m_gridSizeZ;
+	vector<int> m_gridCellStart;
+	vector<int> m_gridSegments;
 
 	CTexture texture;
 };
@@ -1,4 +1,6 @@
 #include "Cube.h"
+#include "StaticBatch.h"
+#include "FrameProfiler.h"
 	
 CCube::CCube()
 {}
@@ -10,7 +12,18 @@ CCube::~CCube()
 
 void CCube::Create(string filename)
 {
-	m_tTexture.Load(filename);
+	Decode(filename);
+	Upload();
+}
+
+bool CCube::Decode(string filename)
+{
+	return m_tTexture.Decode(filename);
+}
+
+void CCube::Upload()
+{
+	m_tTexture.Upload();
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -185,6 +198,16 @@ void CCube::Render()
 	glDrawArrays(GL_TRIANGLE_STRIP, 16, 4);
 	glDrawArrays(GL_TRIANGLE_STRIP, 20, 4);
 	glDrawArrays(GL_TRIANGLE_STRIP, 24, 4);
+	CFrameProfiler::CountDraws(7);
+}
+
+// The six faces as one triangle list, from the same buffer Render draws
+void CCube::AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds)
+{
+	vector<unsigned int> indices;
+	for (int i = 0; i < 6; i++)
+		CStaticBatch::AppendStripIndices(i*4, 4, indices);
+	meshIds.push_back(pBatch->AddMesh(m_VBO.GetBufferID(), 24, indices, &m_tTexture));
 }
 
 void CCube::Release()
@@ -4,6 +4,8 @@
 #include "Texture.h"
 #include "VertexBufferObject.h"
 
+class CStaticBatch;
+
 // Class for generating a unit cube
 class CCube
 {
@@ -11,7 +13,10 @@ public:
 	CCube();
 	~CCube();
 	void Create(string filename);
+	bool Decode(string filename);	// Reads the texture; safe on a worker thread
+	void Upload();					// Creates the OpenGL objects
 	void Render();
+	void AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds);	// Adds the cube's mesh; draws still go through Render
 	void Release();
 private:
 	GLuint m_uiVAO;
@@ -0,0 +1,104 @@
+#include "EntityBenchmark.h"
+#include "EntityStore.h"
+#include "Frustum.h"
+#include "HighResolutionTimer.h"
+#include <fstream>
+#include <algorithm>
+
+#include "include\glm\gtc\matrix_transform.hpp"
+
+static const int NUM_FRAMES = 60;
+
+// A repeatable spread of points over the area the walls enclose
+static glm::vec3 RandomPosition()
+{
+	float x = -500.0f + 1000.0f * (rand() / (float) RAND_MAX);
+	float y = 20.0f * (rand() / (float) RAND_MAX);
+	float z = -1700.0f + 1950.0f * (rand() / (float) RAND_MAX);
+	return glm::vec3(x, y, z);
+}
+
+// The camera for frame iFrame, circling the middle of the area and looking outwards, as the game's camera would
+static CFrustum FrameFrustum(int iFrame)
+{
+	float fAngle = 360.0f * iFrame / NUM_FRAMES;
+	glm::vec3 vEye(0.0f, 20.0f, -725.0f);
+	glm::vec3 vDirection = glm::vec3(glm::rotate(glm::mat4(1.0f), fAngle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
+	glm::mat4 projectionMatrix = glm::perspective(45.0f, 4.0f / 3.0f, 0.5f, 5000.0f);
+	glm::mat4 viewMatrix = glm::lookAt(vEye, vEye + vDirection, glm::vec3(0.0f, 1.0f, 0.0f));
+	CFrustum frustum;
+	frustum.Extract(projectionMatrix * viewMatrix);
+	return frustum;
+}
+
+// Median of one time per frame
+template <class TFunction>
+static double MedianPerFrame(TFunction function)
+{
+	vector<double> times;
+	CHighResolutionTimer timer;
+	for (int i = 0; i < NUM_FRAMES; i++) {
+		timer.Start();
+		function(i);
+		times.push_back(timer.Elapsed());
+	}
+	sort(times.begin(), times.end());
+	return times[NUM_FRAMES / 2];
+}
+
+void RunEntityBenchmark(const string &sFilename)
+{
+	std::ofstream file(sFilename.c_str());
+	file << "entities,cull_ms,visible,overlap_ms,collect_ms,move_ms\n";
+
+	vector<glm::vec3> route;
+	for (int i = 0; i < 6; i++)
+		route.push_back(RandomPosition());
+
+	UINT entityCounts[] = { 1000, 10000, 100000 };
+	for (int i = 0; i < 3; i++) {
+		srand(1);
+		UINT uiCount = entityCounts[i];
+		CEntityStore store;
+		store.Create(1, uiCount);
+		int iRoute = store.AddPickupRoute(route);
+		vector<EntityID> ids;
+		for (UINT j = 0; j < uiCount; j++) {
+			EntityID id = store.CreateEntity(RandomPosition(), 1.0f + 4.0f * (rand() / (float) RAND_MAX), 0.0f, 0);
+			store.SetCollider(id, 2.0f);
+			// One in a hundred is a pickup
+			if (j % 100 == 0) {
+				store.SetCollider(id, 5.0f);
+				store.SetPickup(id, iRoute);
+			}
+			ids.push_back(id);
+		}
+
+		UINT uiVisible = 0;
+		double dCull = MedianPerFrame([&](int iFrame) {
+			store.Cull(FrameFrustum(iFrame));
+			uiVisible += (UINT) store.GetDrawList(0).size();
+		});
+
+		vector<EntityID> hits;
+		double dOverlap = MedianPerFrame([&](int iFrame) {
+			hits.clear();
+			store.FindOverlaps(RandomPosition(), 20.0f, hits);
+		});
+
+		double dCollect = MedianPerFrame([&](int iFrame) {
+			store.CollectPickups(RandomPosition());
+		});
+
+		// Every entity moves a little each frame, and its matrix and bounds follow
+		double dMove = MedianPerFrame([&](int iFrame) {
+			for (UINT j = 0; j < uiCount; j++) {
+				EntityID id = ids[j];
+				store.SetTransform(id, store.GetPosition(id) + glm::vec3(0.01f, 0.0f, 0.0f), 1.0f, (float) iFrame);
+			}
+		});
+
+		file << uiCount << "," << dCull << "," << uiVisible / NUM_FRAMES << "," << dOverlap << "," << dCollect << "," << dMove << "\n";
+		store.Release();
+	}
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "Common.h"
+
+// Times the entity store's systems (culling against a moving frustum, sphere overlap queries, pickup collection and moving
+// every entity) at 1k, 10k and 100k entities scattered over the play area.  Needs no OpenGL context.  Results go to a CSV file.
+void RunEntityBenchmark(const string &sFilename);
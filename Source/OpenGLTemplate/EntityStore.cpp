@@ -0,0 +1,277 @@
+#include "EntityStore.h"
+#include "Frustum.h"
+
+#include "include\glm\gtc\matrix_transform.hpp"
+
+CEntityStore::CEntityStore()
+{}
+
+CEntityStore::~CEntityStore()
+{}
+
+void CEntityStore::Create(int iNumMeshes, UINT uiCapacity)
+{
+	m_drawLists.resize(iNumMeshes);
+	m_ids.reserve(uiCapacity);
+	m_positions.reserve(uiCapacity);
+	m_scales.reserve(uiCapacity);
+	m_yaws.reserve(uiCapacity);
+	m_modelMatrices.reserve(uiCapacity);
+	m_localMins.reserve(uiCapacity);
+	m_localMaxs.reserve(uiCapacity);
+	m_worldMins.reserve(uiCapacity);
+	m_worldMaxs.reserve(uiCapacity);
+	m_meshes.reserve(uiCapacity);
+	m_colliderRadii.reserve(uiCapacity);
+	m_pickupRoutes.reserve(uiCapacity);
+	m_pickupStops.reserve(uiCapacity);
+	m_slots.reserve(uiCapacity);
+}
+
+void CEntityStore::Release()
+{
+	m_ids.clear();
+	m_positions.clear();
+	m_scales.clear();
+	m_yaws.clear();
+	m_modelMatrices.clear();
+	m_localMins.clear();
+	m_localMaxs.clear();
+	m_worldMins.clear();
+	m_worldMaxs.clear();
+	m_meshes.clear();
+	m_colliderRadii.clear();
+	m_pickupRoutes.clear();
+	m_pickupStops.clear();
+	m_slots.clear();
+	m_freeIDs.clear();
+	m_routes.clear();
+	m_drawLists.clear();
+}
+
+EntityID CEntityStore::CreateEntity(const glm::vec3 &vPosition, float fScale, float fYaw, int iMesh)
+{
+	EntityID id;
+	if (!m_freeIDs.empty()) {
+		id = m_freeIDs.back();
+		m_freeIDs.pop_back();
+	}
+	else {
+		id = (EntityID) m_slots.size();
+		m_slots.push_back(INVALID_ENTITY);
+	}
+
+	UINT uiSlot = (UINT) m_ids.size();
+	m_slots[id] = uiSlot;
+	m_ids.push_back(id);
+	m_positions.push_back(vPosition);
+	m_scales.push_back(fScale);
+	m_yaws.push_back(fYaw);
+	m_modelMatrices.push_back(glm::mat4(1.0f));
+	m_localMins.push_back(glm::vec3(-1.0f));
+	m_localMaxs.push_back(glm::vec3(1.0f));
+	m_worldMins.push_back(glm::vec3(0.0f));
+	m_worldMaxs.push_back(glm::vec3(0.0f));
+	m_meshes.push_back(iMesh);
+	m_colliderRadii.push_back(0.0f);
+	m_pickupRoutes.push_back(-1);
+	m_pickupStops.push_back(0);
+	UpdateWorldTransform(uiSlot);
+	return id;
+}
+
+// Move the last entity into the destroyed one's slot, so the arrays stay dense
+void CEntityStore::DestroyEntity(EntityID id)
+{
+	if (!IsAlive(id))
+		return;
+
+	UINT uiSlot = m_slots[id];
+	UINT uiLast = (UINT) m_ids.size() - 1;
+	if (uiSlot != uiLast) {
+		m_ids[uiSlot] = m_ids[uiLast];
+		m_positions[uiSlot] = m_positions[uiLast];
+		m_scales[uiSlot] = m_scales[uiLast];
+		m_yaws[uiSlot] = m_yaws[uiLast];
+		m_modelMatrices[uiSlot] = m_modelMatrices[uiLast];
+		m_localMins[uiSlot] = m_localMins[uiLast];
+		m_localMaxs[uiSlot] = m_localMaxs[uiLast];
+		m_worldMins[uiSlot] = m_worldMins[uiLast];
+		m_worldMaxs[uiSlot] = m_worldMaxs[uiLast];
+		m_meshes[uiSlot] = m_meshes[uiLast];
+		m_colliderRadii[uiSlot] = m_colliderRadii[uiLast];
+		m_pickupRoutes[uiSlot] = m_pickupRoutes[uiLast];
+		m_pickupStops[uiSlot] = m_pickupStops[uiLast];
+		m_slots[m_ids[uiSlot]] = uiSlot;
+	}
+
+	m_ids.pop_back();
+	m_positions.pop_back();
+	m_scales.pop_back();
+	m_yaws.pop_back();
+	m_modelMatrices.pop_back();
+	m_localMins.pop_back();
+	m_localMaxs.pop_back();
+	m_worldMins.pop_back();
+	m_worldMaxs.pop_back();
+	m_meshes.pop_back();
+	m_colliderRadii.pop_back();
+	m_pickupRoutes.pop_back();
+	m_pickupStops.pop_back();
+
+	m_slots[id] = INVALID_ENTITY;
+	m_freeIDs.push_back(id);
+}
+
+bool CEntityStore::IsAlive(EntityID id)
+{
+	return id < m_slots.size() && m_slots[id] != INVALID_ENTITY;
+}
+
+UINT CEntityStore::GetNumEntities()
+{
+	return (UINT) m_ids.size();
+}
+
+void CEntityStore::SetTransform(EntityID id, const glm::vec3 &vPosition, float fScale, float fYaw)
+{
+	UINT uiSlot = m_slots[id];
+	m_positions[uiSlot] = vPosition;
+	m_scales[uiSlot] = fScale;
+	m_yaws[uiSlot] = fYaw;
+	UpdateWorldTransform(uiSlot);
+}
+
+const glm::vec3& CEntityStore::GetPosition(EntityID id)
+{
+	return m_positions[m_slots[id]];
+}
+
+const glm::mat4& CEntityStore::GetModelMatrix(EntityID id)
+{
+	return m_modelMatrices[m_slots[id]];
+}
+
+void CEntityStore::SetLocalBounds(EntityID id, const glm::vec3 &vMin, const glm::vec3 &vMax)
+{
+	UINT uiSlot = m_slots[id];
+	m_localMins[uiSlot] = vMin;
+	m_localMaxs[uiSlot] = vMax;
+	UpdateWorldTransform(uiSlot);
+}
+
+void CEntityStore::GetWorldBounds(EntityID id, glm::vec3 &vMin, glm::vec3 &vMax)
+{
+	UINT uiSlot = m_slots[id];
+	vMin = m_worldMins[uiSlot];
+	vMax = m_worldMaxs[uiSlot];
+}
+
+void CEntityStore::SetCollider(EntityID id, float fRadius)
+{
+	m_colliderRadii[m_slots[id]] = fRadius;
+}
+
+int CEntityStore::AddPickupRoute(const vector<glm::vec3> &points)
+{
+	m_routes.push_back(points);
+	return (int) m_routes.size() - 1;
+}
+
+// Puts the pickup at the first stop of its route
+void CEntityStore::SetPickup(EntityID id, int iRoute)
+{
+	UINT uiSlot = m_slots[id];
+	m_pickupRoutes[uiSlot] = iRoute;
+	m_pickupStops[uiSlot] = 0;
+	m_positions[uiSlot] = m_routes[iRoute][0];
+	UpdateWorldTransform(uiSlot);
+}
+
+int CEntityStore::GetPickupStop(EntityID id)
+{
+	return m_pickupStops[m_slots[id]];
+}
+
+// The model matrix is translate * rotate * scale, as the matrix stack built it.  The world box is the local box's centre
+// transformed, with each half extent the sum of the local half extents scaled by the absolute matrix entries.
+void CEntityStore::UpdateWorldTransform(UINT uiSlot)
+{
+	glm::mat4 modelMatrix = glm::translate(glm::mat4(1.0f), m_positions[uiSlot]);
+	if (m_yaws[uiSlot] != 0.0f)
+		modelMatrix = glm::rotate(modelMatrix, m_yaws[uiSlot], glm::vec3(0.0f, 1.0f, 0.0f));
+	modelMatrix = glm::scale(modelMatrix, glm::vec3(m_scales[uiSlot]));
+	m_modelMatrices[uiSlot] = modelMatrix;
+
+	glm::vec3 vCentre = 0.5f * (m_localMins[uiSlot] + m_localMaxs[uiSlot]);
+	glm::vec3 vHalf = 0.5f * (m_localMaxs[uiSlot] - m_localMins[uiSlot]);
+	glm::vec3 vWorldCentre = glm::vec3(modelMatrix * glm::vec4(vCentre, 1.0f));
+	glm::vec3 vWorldHalf(0.0f);
+	for (int i = 0; i < 3; i++)
+		vWorldHalf += glm::abs(glm::vec3(modelMatrix[i])) * vHalf[i];
+	m_worldMins[uiSlot] = vWorldCentre - vWorldHalf;
+	m_worldMaxs[uiSlot] = vWorldCentre + vWorldHalf;
+}
+
+void CEntityStore::Cull(const CFrustum &frustum)
+{
+	// Room for every entity, so the lists never grow while rendering
+	for (unsigned int i = 0; i < m_drawLists.size(); i++) {
+		m_drawLists[i].clear();
+		m_drawLists[i].reserve(m_ids.size());
+	}
+
+	UINT uiNumEntities = (UINT) m_ids.size();
+	for (UINT i = 0; i < uiNumEntities; i++) {
+		int iMesh = m_meshes[i];
+		if (iMesh != NO_MESH && frustum.IntersectsBox(m_worldMins[i], m_worldMaxs[i]))
+			m_drawLists[iMesh].push_back(m_modelMatrices[i]);
+	}
+}
+
+const vector<glm::mat4>& CEntityStore::GetDrawList(int iMesh)
+{
+	return m_drawLists[iMesh];
+}
+
+void CEntityStore::FindOverlaps(const glm::vec3 &vCentre, float fRadius, vector<EntityID> &hits)
+{
+	UINT uiNumEntities = (UINT) m_ids.size();
+	for (UINT i = 0; i < uiNumEntities; i++) {
+		float fReach = m_colliderRadii[i] + fRadius;
+		if (m_colliderRadii[i] > 0.0f && glm::dot(m_positions[i] - vCentre, m_positions[i] - vCentre) <= fReach * fReach)
+			hits.push_back(m_ids[i]);
+	}
+}
+
+// The game's pickup rule: the player must have passed the pickup in |z|, and be no further than the collider radius short of
+// it in |x| and |z|.  Reaching the last stop sends the pickup there and starts its route again, without scoring the next
+// collection from the last stop.
+int CEntityStore::CollectPickups(const glm::vec3 &vPlayer, vector<EntityID> *pCollected)
+{
+	int iScored = 0;
+	UINT uiNumEntities = (UINT) m_ids.size();
+	for (UINT i = 0; i < uiNumEntities; i++) {
+		int iRoute = m_pickupRoutes[i];
+		if (iRoute < 0)
+			continue;
+		const glm::vec3 &vPickup = m_positions[i];
+		float fRadius = m_colliderRadii[i];
+		if (abs(vPickup.z) <= abs(vPlayer.z) || abs(vPickup.x) - abs(vPlayer.x) > fRadius || abs(vPickup.z) - abs(vPlayer.z) > fRadius)
+			continue;
+
+		const vector<glm::vec3> &route = m_routes[iRoute];
+		int iLastStop = (int) route.size() - 1;
+		if (m_pickupStops[i] < iLastStop) {
+			m_pickupStops[i]++;
+			iScored++;
+			if (pCollected != NULL)
+				pCollected->push_back(m_ids[i]);
+		}
+		m_positions[i] = route[m_pickupStops[i]];
+		if (m_pickupStops[i] == iLastStop)
+			m_pickupStops[i] = 0;
+		UpdateWorldTransform(i);
+	}
+	return iScored;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Common.h"
+
+class CFrustum;
+
+typedef UINT EntityID;
+
+// World objects stored as a structure of arrays.  Each component (transform, bounds, mesh, collider, pickup state) is its own
+// array, indexed by the entity's slot, and the live entities fill slots 0 to GetNumEntities() - 1 with no gaps, so a system
+// reads only the arrays it needs, front to back.  Destroying an entity moves the last one into its slot; an EntityID stays
+// valid through that, a slot does not.
+//
+// After startup only the simulation thread changes entities, and only those without a mesh (the pickups), so the render
+// thread can cull the rest without a lock.
+class CEntityStore
+{
+public:
+	static const EntityID INVALID_ENTITY = 0xFFFFFFFF;
+	static const int NO_MESH = -1;
+
+	CEntityStore();
+	~CEntityStore();
+
+	// iNumMeshes is the number of draw lists Cull fills.  uiCapacity entities fit without the arrays growing.
+	void Create(int iNumMeshes, UINT uiCapacity);
+	void Release();
+
+	// Adds an entity with no collider and no pickup state.  Its local bounds are the unit box from -1 to 1, as the cube and
+	// tetrahedron are made.
+	EntityID CreateEntity(const glm::vec3 &vPosition, float fScale, float fYaw, int iMesh);
+	void DestroyEntity(EntityID id);
+	bool IsAlive(EntityID id);
+	UINT GetNumEntities();
+
+	// Transform: a translation, a uniform scale and a rotation about y in degrees.  Setting it updates the model matrix and
+	// the world bounds.
+	void SetTransform(EntityID id, const glm::vec3 &vPosition, float fScale, float fYaw);
+	const glm::vec3& GetPosition(EntityID id);
+	const glm::mat4& GetModelMatrix(EntityID id);
+
+	void SetLocalBounds(EntityID id, const glm::vec3 &vMin, const glm::vec3 &vMax);
+	void GetWorldBounds(EntityID id, glm::vec3 &vMin, glm::vec3 &vMax);
+
+	// A collider of radius 0 collides with nothing
+	void SetCollider(EntityID id, float fRadius);
+
+	// Pickups move along a route of points, one stop further each time they are collected
+	int AddPickupRoute(const vector<glm::vec3> &points);
+	void SetPickup(EntityID id, int iRoute);
+	int GetPickupStop(EntityID id);
+
+	// Systems.  Each runs over the dense arrays of the components it uses.
+
+	// Fills one draw list per mesh with the model matrices of the entities whose world bounds are in the frustum
+	void Cull(const CFrustum &frustum);
+	const vector<glm::mat4>& GetDrawList(int iMesh);
+
+	// Appends the entities whose collider overlaps the sphere at vCentre
+	void FindOverlaps(const glm::vec3 &vCentre, float fRadius, vector<EntityID> &hits);
+
+	// Moves on every pickup the player at vPlayer has reached, and returns how many of them scored.  Those that scored are
+	// appended to pCollected if it is not NULL.
+	int CollectPickups(const glm::vec3 &vPlayer, vector<EntityID> *pCollected = NULL);
+
+private:
+	void UpdateWorldTransform(UINT uiSlot);
+
+	// Components, by slot
+	vector<EntityID> m_ids;
+	vector<glm::vec3> m_positions;
+	vector<float> m_scales;
+	vector<float> m_yaws;
+	vector<glm::mat4> m_modelMatrices;
+	vector<glm::vec3> m_localMins;
+	vector<glm::vec3> m_localMaxs;
+	vector<glm::vec3> m_worldMins;
+	vector<glm::vec3> m_worldMaxs;
+	vector<int> m_meshes;
+	vector<float> m_colliderRadii;
+	vector<int> m_pickupRoutes;				// -1 if not a pickup
+	vector<int> m_pickupStops;
+
+	vector<UINT> m_slots;					// By EntityID; the entity's slot, or INVALID_ENTITY once destroyed
+	vector<EntityID> m_freeIDs;
+
+	vector<vector<glm::vec3> > m_routes;
+	vector<vector<glm::mat4> > m_drawLists;	// By mesh, refilled by Cull
+};
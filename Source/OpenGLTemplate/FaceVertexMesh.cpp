@@ -1,8 +1,16 @@
 #include "FaceVertexMesh.h"
+#include "StaticBatch.h"
+#include "FrameProfiler.h"
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 CFaceVertexMesh::CFaceVertexMesh()
-{}
+{
+	m_uiVAO = 0;
+	m_uiVBOVertices = 0;
+	m_uiVBOIndices = 0;
+	m_uiNumVertices = 0;
+	m_uiNumIndices = 0;
+}
 
 CFaceVertexMesh::~CFaceVertexMesh()
 {}
@@ -52,10 +60,19 @@ void CFaceVertexMesh::ComputeVertexNormals()
 
 
 bool CFaceVertexMesh::CreateFromTriangleList(const std::vector<CVertex>& vertices, const std::vector<unsigned int>& triangles)
+{
+	BuildFromTriangleList(vertices, triangles);
+	Upload();
+
+	return true;
+}
+
+// Set up the mesh and compute normals and texture coordinates.  Does not touch OpenGL, so it can run on a worker thread.
+void CFaceVertexMesh::BuildFromTriangleList(const std::vector<CVertex>& vertices, const std::vector<unsigned int>& triangles)
 {
 	// Set the vertices and indices
-	m_vertices = vertices;
-	m_triangles = triangles;
+	m_vertices.assign(vertices.begin(), vertices.end());
+	m_triangles.assign(triangles.begin(), triangles.end());
 
 	// Now we must fill the onTriangle list
 	m_onTriangle.resize(m_vertices.size());
@@ -69,25 +86,29 @@ bool CFaceVertexMesh::CreateFromTriangleList(const std::vector<CVertex>& vertice
 	// Compute vertex normals and texture coords
 	ComputeVertexNormals();
 	ComputeTextureCoordsXZ(20.0f, 20.0f);
+}
 
+// Create the VAO and buffers from the mesh built by BuildFromTriangleList
+void CFaceVertexMesh::Upload()
+{
 	// Create a VAO 
 	glGenVertexArrays(1, &m_uiVAO);
 	glBindVertexArray(m_uiVAO);
 
 	// Create a VBO for the vertex data
-	GLuint uiVBOVertices;
-	glGenBuffers(1, &uiVBOVertices);
-	glBindBuffer(GL_ARRAY_BUFFER, uiVBOVertices);
+	glGenBuffers(1, &m_uiVBOVertices);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiVBOVertices);
 
 	// Fill the vertices VBO
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(CVertex), &m_vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(CVertex), &m_vertices[0], GL_STATIC_DRAW);
+	CMemoryTracker::TrackBuffer(m_uiVBOVertices, m_vertices.size() * sizeof(CVertex));
 
 	// Generate a VGO for the indices and bind it
-	GLuint uiVBOIndices;
-	glGenBuffers(1, &uiVBOIndices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, uiVBOIndices);
+	glGenBuffers(1, &m_uiVBOIndices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIndices);
 
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_triangles.size() * sizeof(GLuint), &m_triangles[0], GL_STATIC_DRAW);
+	CMemoryTracker::TrackBuffer(m_uiVBOIndices, m_triangles.size() * sizeof(GLuint));
 
 
 	GLsizei stride = 2 * sizeof(glm::vec3) + sizeof(glm::vec2);
@@ -102,8 +123,22 @@ bool CFaceVertexMesh::CreateFromTriangleList(const std::vector<CVertex>& vertice
 	glEnableVertexAttribArray(2);
 	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
 
+	// Nothing reads the mesh on the CPU once it is in the buffers
+	m_uiNumVertices = (UINT) m_vertices.size();
+	m_uiNumIndices = (UINT) m_triangles.size();
+	TrackedVector<CVertex>().swap(m_vertices);
+	TrackedVector<unsigned int>().swap(m_triangles);
+	TrackedVector<TriangleList>().swap(m_onTriangle);
+}
 
-	return true;
+void CFaceVertexMesh::Release()
+{
+	CMemoryTracker::ForgetBuffer(m_uiVBOVertices);
+	CMemoryTracker::ForgetBuffer(m_uiVBOIndices);
+	glDeleteBuffers(1, &m_uiVBOVertices);
+	glDeleteBuffers(1, &m_uiVBOIndices);
+	glDeleteVertexArrays(1, &m_uiVAO);
+	m_uiVBOVertices = m_uiVBOIndices = m_uiVAO = 0;
 }
 
 void CFaceVertexMesh::Render()
@@ -113,6 +148,13 @@ void CFaceVertexMesh::Render()
 	glBindVertexArray(m_uiVAO);
 
 	// Draw
-	glDrawElements(GL_TRIANGLES, m_triangles.size(), GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+	glDrawElements(GL_TRIANGLES, m_uiNumIndices, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+	CFrameProfiler::CountDraws();
+
+}
 
+// Adds the mesh's buffers to a static batch, to be drawn with pTexture
+int CFaceVertexMesh::AddToStaticBatch(CStaticBatch *pBatch, CTexture *pTexture)
+{
+	return pBatch->AddMesh(m_uiVBOVertices, m_uiNumVertices, m_uiVBOIndices, m_uiNumIndices, pTexture);
 }
@@ -0,0 +1,145 @@
+#include "FrameArena.h"
+#include "MemoryTracker.h"
+
+#ifdef _DEBUG
+#include <crtdbg.h>
+#endif
+
+thread_local CFrameArena *CFrameArena::t_pCurrent = NULL;
+
+// Heap allocations counted by the debug heap hook, for the thread that is checking
+static thread_local bool t_bCheckingHeap = false;
+static thread_local UINT t_uiHeapAllocations = 0;
+
+#ifdef _DEBUG
+static _CRT_ALLOC_HOOK s_previousHook = NULL;
+
+// Runs inside the CRT for every debug heap operation, so it must not allocate
+static int __cdecl CountHeapAllocations(int iAllocType, void *pUserData, size_t size, int iBlockUse, long lRequest,
+	const unsigned char *szFile, int iLine)
+{
+	if (t_bCheckingHeap && iBlockUse != _CRT_BLOCK && (iAllocType == _HOOK_ALLOC || iAllocType == _HOOK_REALLOC))
+		t_uiHeapAllocations++;
+	if (s_previousHook != NULL)
+		return s_previousHook(iAllocType, pUserData, size, iBlockUse, lRequest, szFile, iLine);
+	return TRUE;
+}
+#endif
+
+CFrameArena::CFrameArena()
+{
+	m_pMemory = NULL;
+	m_capacity = 0;
+	m_used = 0;
+	m_overflowUsed = 0;
+	m_peak = 0;
+	m_pOverflow = NULL;
+	m_uiNumOverflows = 0;
+}
+
+CFrameArena::~CFrameArena()
+{
+	Release();
+}
+
+bool CFrameArena::Create(size_t capacity)
+{
+	m_pMemory = new BYTE[capacity];
+	m_capacity = capacity;
+	m_used = 0;
+	CMemoryTracker::AddCpu(MEMORY_RENDERER, capacity);
+	return true;
+}
+
+void CFrameArena::Release()
+{
+	if (t_pCurrent == this)
+		t_pCurrent = NULL;
+	Reset();
+	if (m_pMemory != NULL) {
+		CMemoryTracker::RemoveCpu(MEMORY_RENDERER, m_capacity);
+		delete[] m_pMemory;
+		m_pMemory = NULL;
+	}
+	m_capacity = 0;
+}
+
+void* CFrameArena::Allocate(size_t size, size_t alignment)
+{
+	if (m_pMemory != NULL) {
+		// Align the address rather than the offset, so the block's own alignment does not matter
+		uintptr_t start = ((uintptr_t) (m_pMemory + m_used) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+		size_t end = (size_t) (start - (uintptr_t) m_pMemory) + size;
+		if (end <= m_capacity) {
+			m_used = end;
+			return (void*) start;
+		}
+	}
+
+	// Out of room for this frame.  The header is a multiple of any fundamental alignment, so the block after it is aligned.
+	BYTE *pBlock = (BYTE*) ::operator new(size + OVERFLOW_HEADER_SIZE);
+	COverflow *pOverflow = (COverflow*) pBlock;
+	pOverflow->pNext = m_pOverflow;
+	pOverflow->size = size;
+	m_pOverflow = pOverflow;
+	m_overflowUsed += size;
+	m_uiNumOverflows++;
+	return pBlock + OVERFLOW_HEADER_SIZE;
+}
+
+void CFrameArena::Reset()
+{
+	m_peak = max(m_peak, m_used + m_overflowUsed);
+	while (m_pOverflow != NULL) {
+		COverflow *pNext = m_pOverflow->pNext;
+		::operator delete(m_pOverflow);
+		m_pOverflow = pNext;
+	}
+	m_used = 0;
+	m_overflowUsed = 0;
+}
+
+size_t CFrameArena::GetCapacity()
+{
+	return m_capacity;
+}
+
+size_t CFrameArena::GetPeak()
+{
+	return max(m_peak, m_used + m_overflowUsed);
+}
+
+UINT CFrameArena::GetNumOverflows()
+{
+	return m_uiNumOverflows;
+}
+
+CFrameArena* CFrameArena::GetCurrent()
+{
+	return t_pCurrent;
+}
+
+void CFrameArena::SetCurrent(CFrameArena *pArena)
+{
+	t_pCurrent = pArena;
+}
+
+void CFrameArena::BeginHeapCheck()
+{
+#ifdef _DEBUG
+	// The hook is process wide; installing it once is enough
+	static bool bInstalled = false;
+	if (!bInstalled) {
+		s_previousHook = _CrtSetAllocHook(CountHeapAllocations);
+		bInstalled = true;
+	}
+#endif
+	t_uiHeapAllocations = 0;
+	t_bCheckingHeap = true;
+}
+
+UINT CFrameArena::EndHeapCheck()
+{
+	t_bCheckingHeap = false;
+	return t_uiHeapAllocations;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Common.h"
+
+// A bump allocator for memory that only lives until the end of the frame.  Allocation moves a pointer through one block made at
+// startup and Reset, called once the frame has been swapped, makes the whole block free again, so nothing is freed one piece at
+// a time.  If a frame needs more than the block holds, the rest comes from the heap and is freed at Reset; GetNumOverflows
+// says when the capacity should grow.
+//
+// While an arena is current on a thread, CFrameAllocator takes its memory from it, so containers built during the frame use
+// the arena without being told about it.
+class CFrameArena
+{
+public:
+	CFrameArena();
+	~CFrameArena();
+
+	bool Create(size_t capacity);
+	void Release();
+
+	// Never returns NULL.  alignment must be a power of two.
+	void* Allocate(size_t size, size_t alignment);
+	// Frees everything allocated since the last Reset
+	void Reset();
+
+	size_t GetCapacity();
+	size_t GetPeak();					// Most bytes any frame has used, including overflow
+	UINT GetNumOverflows();				// Allocations that did not fit, since Create
+
+	// The arena CFrameAllocator uses on this thread, or NULL for the heap
+	static CFrameArena* GetCurrent();
+	static void SetCurrent(CFrameArena *pArena);
+
+	// Count the general heap allocations made on this thread between the two calls.  Only debug builds, with the CRT's debug
+	// heap, can see them; release builds always count 0.
+	static void BeginHeapCheck();
+	static UINT EndHeapCheck();
+
+private:
+	// Heap blocks for allocations that did not fit, chained through a header in front of each
+	struct COverflow
+	{
+		COverflow *pNext;
+		size_t size;
+	};
+	static const size_t OVERFLOW_HEADER_SIZE = 16;
+
+	BYTE *m_pMemory;
+	size_t m_capacity;
+	size_t m_used;
+	size_t m_overflowUsed;
+	size_t m_peak;
+	COverflow *m_pOverflow;
+	UINT m_uiNumOverflows;
+
+	static thread_local CFrameArena *t_pCurrent;
+};
+
+// A standard allocator that takes memory from the arena current on this thread when it was made, or from the heap if there was
+// none.  Memory from an arena is not freed individually, so a container using it must not outlive the frame it was made in.
+template <class T>
+class CFrameAllocator
+{
+public:
+	typedef T value_type;
+
+	CFrameAllocator() : m_pArena(CFrameArena::GetCurrent()) {}
+	template <class U>
+	CFrameAllocator(const CFrameAllocator<U> &other) : m_pArena(other.m_pArena) {}
+
+	T* allocate(size_t n)
+	{
+		if (m_pArena == NULL)
+			return (T*) ::operator new(n * sizeof(T));
+		return (T*) m_pArena->Allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T *p, size_t)
+	{
+		if (m_pArena == NULL)
+			::operator delete(p);
+	}
+
+	template <class U>
+	bool operator==(const CFrameAllocator<U> &other) const { return m_pArena == other.m_pArena; }
+	template <class U>
+	bool operator!=(const CFrameAllocator<U> &other) const { return m_pArena != other.m_pArena; }
+
+private:
+	template <class U>
+	friend class CFrameAllocator;
+
+	CFrameArena *m_pArena;
+};
+
+template <class T>
+using FrameVector = vector<T, CFrameAllocator<T> >;
@@ -0,0 +1,201 @@
+#include "FrameCapture.h"
+#include "MemoryTracker.h"
+#include "include\freeimage\FreeImage.h"
+#include <fstream>
+
+CFrameCapture::CFrameCapture()
+{
+	m_iWidth = m_iHeight = 0;
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		m_uiBuffers[i] = 0;
+		m_fences[i] = NULL;
+	}
+	m_iNext = 0;
+	m_bStopping = false;
+}
+
+CFrameCapture::~CFrameCapture()
+{
+	if (m_worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bStopping = true;
+			m_wake.notify_one();
+		}
+		m_worker.join();
+	}
+}
+
+bool CFrameCapture::Create(int iWidth, int iHeight, const string &sOutputDirectory, const string &sGoldenDirectory)
+{
+	m_iWidth = iWidth;
+	m_iHeight = iHeight;
+	m_sOutputDirectory = sOutputDirectory;
+	m_sGoldenDirectory = sGoldenDirectory;
+	if (!m_sOutputDirectory.empty())
+		CreateDirectory(m_sOutputDirectory.c_str(), NULL);
+
+	glGenBuffers(NUM_BUFFERS, m_uiBuffers);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, iWidth * iHeight * 4, NULL, GL_STREAM_READ);
+		CMemoryTracker::TrackBuffer(m_uiBuffers[i], iWidth * iHeight * 4);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_bStopping = false;
+	m_worker = std::thread(&CFrameCapture::WorkerLoop, this);
+	return true;
+}
+
+void CFrameCapture::Capture(const string &sName)
+{
+	// This buffer's last frame was retired two Captures ago, so it is free
+	int iBuffer = m_iNext;
+	m_iNext = (m_iNext + 1) % NUM_BUFFERS;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[iBuffer]);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, m_iWidth, m_iHeight, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	m_fences[iBuffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_names[iBuffer] = sName;
+
+	// Read the frame copied two Captures ago, which frees its buffer for the next Capture
+	Retire(m_iNext);
+}
+
+// Waits for a buffer's copy, then hands its pixels to the worker
+void CFrameCapture::Retire(int iBuffer)
+{
+	GLsync fence = m_fences[iBuffer];
+	if (fence == NULL)
+		return;
+
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	while (result == GL_TIMEOUT_EXPIRED)
+		result = glClientWaitSync(fence, 0, 1000000000);
+	glDeleteSync(fence);
+	m_fences[iBuffer] = NULL;
+
+	CFrame *pFrame = new CFrame;
+	pFrame->sName = m_names[iBuffer];
+	pFrame->pixels.resize(m_iWidth * m_iHeight * 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_uiBuffers[iBuffer]);
+	void *pMapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pFrame->pixels.size(), GL_MAP_READ_BIT);
+	if (pMapped != NULL) {
+		memcpy(&pFrame->pixels[0], pMapped, pFrame->pixels.size());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_space.wait(lock, [this] { return (int) m_queue.size() < MAX_QUEUED; });
+	m_queue.push_back(pFrame);
+	m_wake.notify_one();
+}
+
+void CFrameCapture::WorkerLoop()
+{
+	while (true) {
+		CFrame *pFrame;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return m_bStopping || !m_queue.empty(); });
+			if (m_queue.empty())
+				return;
+			pFrame = m_queue.front();
+			m_queue.pop_front();
+			m_space.notify_one();
+		}
+		Process(*pFrame);
+		delete pFrame;
+	}
+}
+
+// Saves the frame and compares it with its golden image, on the worker thread
+void CFrameCapture::Process(CFrame &frame)
+{
+	FIBITMAP *dib = FreeImage_ConvertFromRawBits(&frame.pixels[0], m_iWidth, m_iHeight, m_iWidth * 4, 32,
+		FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+	if (dib == NULL)
+		return;
+	if (!m_sOutputDirectory.empty())
+		FreeImage_Save(FIF_PNG, dib, (m_sOutputDirectory + "\\" + frame.sName + ".png").c_str(), PNG_Z_BEST_SPEED);
+	FreeImage_Unload(dib);
+
+	if (m_sGoldenDirectory.empty())
+		return;
+
+	CResult result;
+	result.sName = frame.sName;
+	result.iDifferentPixels = -1;
+	result.iMaxDifference = 0;
+	FIBITMAP *golden = FreeImage_Load(FIF_PNG, (m_sGoldenDirectory + "\\" + frame.sName + ".png").c_str());
+	if (golden != NULL && (int) FreeImage_GetWidth(golden) == m_iWidth && (int) FreeImage_GetHeight(golden) == m_iHeight) {
+		FIBITMAP *golden32 = FreeImage_ConvertTo32Bits(golden);
+		result.iDifferentPixels = 0;
+		for (int y = 0; y < m_iHeight; y++) {
+			const BYTE *pGolden = FreeImage_GetScanLine(golden32, y);
+			const BYTE *pFrame = &frame.pixels[y * m_iWidth * 4];
+			for (int x = 0; x < m_iWidth; x++) {
+				int iDifference = 0;
+				for (int c = 0; c < 3; c++)
+					iDifference = max(iDifference, abs((int) pGolden[x * 4 + c] - (int) pFrame[x * 4 + c]));
+				if (iDifference > CHANNEL_TOLERANCE)
+					result.iDifferentPixels++;
+				result.iMaxDifference = max(result.iMaxDifference, iDifference);
+			}
+		}
+		FreeImage_Unload(golden32);
+	}
+	if (golden != NULL)
+		FreeImage_Unload(golden);
+	m_results.push_back(result);
+}
+
+bool CFrameCapture::Finish()
+{
+	// Oldest first, so the worker sees the frames in order
+	for (int i = 0; i < NUM_BUFFERS; i++)
+		Retire((m_iNext + i) % NUM_BUFFERS);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStopping = true;
+		m_wake.notify_one();
+	}
+	if (m_worker.joinable())
+		m_worker.join();
+
+	if (m_sGoldenDirectory.empty())
+		return true;
+
+	std::ofstream file("capture_diff.csv");
+	file << "frame,different_pixels,max_channel_difference\n";
+	int iFailed = 0;
+	for (unsigned int i = 0; i < m_results.size(); i++) {
+		const CResult &result = m_results[i];
+		file << result.sName << "," << result.iDifferentPixels << "," << result.iMaxDifference << "\n";
+		if (result.iDifferentPixels != 0)
+			iFailed++;
+	}
+
+	char szLine[256];
+	sprintf_s(szLine, "Golden image check: %d of %u frames differ\n", iFailed, (UINT) m_results.size());
+	OutputDebugString(szLine);
+	return iFailed == 0;
+}
+
+void CFrameCapture::Release()
+{
+	for (int i = 0; i < NUM_BUFFERS; i++)
+		CMemoryTracker::ForgetBuffer(m_uiBuffers[i]);
+	glDeleteBuffers(NUM_BUFFERS, m_uiBuffers);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		if (m_fences[i] != NULL)
+			glDeleteSync(m_fences[i]);
+		m_fences[i] = NULL;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Common.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Reads rendered frames back without stalling the pipeline.  Each frame's back buffer is copied into one of a ring of pixel
+// pack buffers, with a fence after the copy, and mapped two frames later, when the copy has long finished.  The pixels then go
+// to a worker thread that saves them as PNGs, compares them with golden images, or both.
+//
+// If the worker falls more than MAX_QUEUED frames behind, Capture waits for it rather than dropping frames.
+class CFrameCapture
+{
+public:
+	CFrameCapture();
+	~CFrameCapture();
+
+	// Captures iWidth by iHeight pixels from the bottom left of the back buffer.  Frames are saved to sOutputDirectory if it is
+	// not empty, and compared with the images of the same name in sGoldenDirectory if that is not empty.
+	bool Create(int iWidth, int iHeight, const string &sOutputDirectory, const string &sGoldenDirectory);
+	// Call after the frame's last draw and before SwapBuffers.  sName names the frame's image, without the extension.
+	void Capture(const string &sName);
+	// Reads back the frames still in flight and waits for the worker to finish them.  With golden images, writes a row per
+	// frame to capture_diff.csv and returns false if any frame differed.
+	bool Finish();
+	void Release();
+
+private:
+	static const int NUM_BUFFERS = 3;
+	static const int MAX_QUEUED = 8;
+	static const int CHANNEL_TOLERANCE = 2;		// Channel difference from the golden image ignored as driver noise
+
+	struct CFrame
+	{
+		string sName;
+		vector<BYTE> pixels;		// BGRA, bottom row first
+	};
+
+	struct CResult
+	{
+		string sName;
+		int iDifferentPixels;		// -1 if the golden image was missing or a different size
+		int iMaxDifference;
+	};
+
+	void Retire(int iBuffer);
+	void WorkerLoop();
+	void Process(CFrame &frame);
+
+	int m_iWidth, m_iHeight;
+	string m_sOutputDirectory;
+	string m_sGoldenDirectory;
+
+	GLuint m_uiBuffers[NUM_BUFFERS];
+	GLsync m_fences[NUM_BUFFERS];		// Set while the buffer holds a frame not yet read
+	string m_names[NUM_BUFFERS];
+	int m_iNext;						// Buffer the next frame is copied into
+
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;		// Signals the worker that there is work or it should stop
+	std::condition_variable m_space;	// Signals Capture that the queue has room
+	std::deque<CFrame*> m_queue;
+	bool m_bStopping;
+	vector<CResult> m_results;			// Written by the worker only
+};
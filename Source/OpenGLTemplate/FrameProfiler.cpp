@@ -0,0 +1,121 @@
+#include "FrameProfiler.h"
+#include <fstream>
+#include <algorithm>
+
+UINT CFrameProfiler::s_uiDrawCalls = 0;
+
+CFrameProfiler::CFrameProfiler()
+{
+	for (int i = 0; i < QUERY_FRAMES; i++) {
+		m_uiTimeQueries[i] = m_uiPrimitiveQueries[i] = 0;
+		m_iPendingFrame[i] = -1;
+	}
+	m_iSlot = 0;
+}
+
+CFrameProfiler::~CFrameProfiler()
+{}
+
+void CFrameProfiler::Create()
+{
+	glGenQueries(QUERY_FRAMES, m_uiTimeQueries);
+	glGenQueries(QUERY_FRAMES, m_uiPrimitiveQueries);
+}
+
+void CFrameProfiler::BeginFrame(int iLap, float fDistance)
+{
+	// The slot's last frame was issued QUERY_FRAMES frames ago, so its results should be ready
+	ReadQueries(m_iSlot);
+
+	CFrame frame;
+	frame.iLap = iLap;
+	frame.fDistance = fDistance;
+	frame.dCpuMs = frame.dGpuMs = 0.0;
+	frame.uiDrawCalls = 0;
+	frame.uiPrimitives = 0;
+	m_iPendingFrame[m_iSlot] = (int) m_frames.size();
+	m_frames.push_back(frame);
+
+	s_uiDrawCalls = 0;
+	glBeginQuery(GL_TIME_ELAPSED, m_uiTimeQueries[m_iSlot]);
+	glBeginQuery(GL_PRIMITIVES_GENERATED, m_uiPrimitiveQueries[m_iSlot]);
+	m_timer.Start();
+}
+
+void CFrameProfiler::EndFrame()
+{
+	CFrame &frame = m_frames.back();
+	frame.dCpuMs = m_timer.Elapsed();
+	frame.uiDrawCalls = s_uiDrawCalls;
+	glEndQuery(GL_PRIMITIVES_GENERATED);
+	glEndQuery(GL_TIME_ELAPSED);
+	m_iSlot = (m_iSlot + 1) % QUERY_FRAMES;
+}
+
+void CFrameProfiler::ReadQueries(int iSlot)
+{
+	int iFrame = m_iPendingFrame[iSlot];
+	if (iFrame < 0)
+		return;
+
+	GLuint64 uiNanoseconds = 0;
+	glGetQueryObjectui64v(m_uiTimeQueries[iSlot], GL_QUERY_RESULT, &uiNanoseconds);
+	glGetQueryObjectuiv(m_uiPrimitiveQueries[iSlot], GL_QUERY_RESULT, &m_frames[iFrame].uiPrimitives);
+	m_frames[iFrame].dGpuMs = uiNanoseconds / 1.0e6;
+	m_iPendingFrame[iSlot] = -1;
+}
+
+// The value below which dPercentile percent of the sorted times fall
+static double Percentile(const vector<double> &sorted, double dPercentile)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t index = (size_t) (dPercentile / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+void CFrameProfiler::WriteResults(const string &sFilename, const string &sSummaryFilename, const char *szName)
+{
+	for (int i = 0; i < QUERY_FRAMES; i++)
+		ReadQueries(i);
+
+	std::ofstream file(sFilename.c_str());
+	file << "frame,lap,distance,cpu_ms,gpu_ms,draw_calls,primitives\n";
+	vector<double> cpuTimes, gpuTimes;
+	double dDrawCalls = 0.0, dPrimitives = 0.0;
+	for (unsigned int i = 0; i < m_frames.size(); i++) {
+		const CFrame &frame = m_frames[i];
+		file << i << "," << frame.iLap << "," << frame.fDistance << "," << frame.dCpuMs << "," << frame.dGpuMs << ","
+			<< frame.uiDrawCalls << "," << frame.uiPrimitives << "\n";
+		cpuTimes.push_back(frame.dCpuMs);
+		gpuTimes.push_back(frame.dGpuMs);
+		dDrawCalls += frame.uiDrawCalls;
+		dPrimitives += frame.uiPrimitives;
+	}
+	sort(cpuTimes.begin(), cpuTimes.end());
+	sort(gpuTimes.begin(), gpuTimes.end());
+	size_t numFrames = std::max<size_t>(m_frames.size(), 1);
+
+	// Write the header only when starting a new summary file
+	bool bNewSummary = !std::ifstream(sSummaryFilename.c_str()).good();
+	std::ofstream summary(sSummaryFilename.c_str(), std::ios::app);
+	if (bNewSummary)
+		summary << "run,frames,cpu_p50_ms,cpu_p95_ms,cpu_p99_ms,gpu_p50_ms,gpu_p95_ms,gpu_p99_ms,mean_draw_calls,mean_primitives\n";
+	summary << szName << "," << m_frames.size() << "," << Percentile(cpuTimes, 50) << "," << Percentile(cpuTimes, 95) << ","
+		<< Percentile(cpuTimes, 99) << "," << Percentile(gpuTimes, 50) << "," << Percentile(gpuTimes, 95) << ","
+		<< Percentile(gpuTimes, 99) << "," << dDrawCalls / numFrames << "," << dPrimitives / numFrames << "\n";
+
+	char szLine[512];
+	sprintf_s(szLine, "Flythrough %s: %u frames, CPU p50 %.3f p95 %.3f p99 %.3f ms, GPU p50 %.3f p95 %.3f p99 %.3f ms, %.0f draw calls\n",
+		szName, (UINT) m_frames.size(), Percentile(cpuTimes, 50), Percentile(cpuTimes, 95), Percentile(cpuTimes, 99),
+		Percentile(gpuTimes, 50), Percentile(gpuTimes, 95), Percentile(gpuTimes, 99), dDrawCalls / numFrames);
+	OutputDebugString(szLine);
+
+	m_frames.clear();
+}
+
+void CFrameProfiler::Release()
+{
+	glDeleteQueries(QUERY_FRAMES, m_uiTimeQueries);
+	glDeleteQueries(QUERY_FRAMES, m_uiPrimitiveQueries);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Common.h"
+#include "HighResolutionTimer.h"
+
+// Per-frame CPU time, GPU time, draw calls and primitives, for the flythrough benchmark.  The GPU figures come from
+// GL_TIME_ELAPSED and GL_PRIMITIVES_GENERATED queries kept in a ring of QUERY_FRAMES frames, so each is read several frames
+// after it was issued and the CPU does not wait for it.  Draw calls are counted by the Render methods calling CountDraws.
+class CFrameProfiler
+{
+public:
+	CFrameProfiler();
+	~CFrameProfiler();
+
+	void Create();
+	// Bracket everything a frame submits, up to but not including SwapBuffers
+	void BeginFrame(int iLap, float fDistance);
+	void EndFrame();
+	// Reads the results still in flight, waiting for them if need be, then writes a row per frame to sFilename and appends
+	// p50, p95 and p99 frame times to sSummaryFilename under szName.  Clears the frames for the next run.
+	void WriteResults(const string &sFilename, const string &sSummaryFilename, const char *szName);
+	void Release();
+
+	// Called next to every draw call, on the render thread
+	static void CountDraws(UINT uiDraws = 1) { s_uiDrawCalls += uiDraws; }
+
+private:
+	static const int QUERY_FRAMES = 4;
+
+	struct CFrame
+	{
+		int iLap;
+		float fDistance;
+		double dCpuMs;
+		double dGpuMs;
+		UINT uiDrawCalls;
+		GLuint uiPrimitives;
+	};
+
+	void ReadQueries(int iSlot);		// Waits for the slot's results if they are not ready
+
+	static UINT s_uiDrawCalls;
+
+	vector<CFrame> m_frames;
+	GLuint m_uiTimeQueries[QUERY_FRAMES];
+	GLuint m_uiPrimitiveQueries[QUERY_FRAMES];
+	int m_iPendingFrame[QUERY_FRAMES];		// Index in m_frames whose queries are in each slot, or -1
+	int m_iSlot;
+	CHighResolutionTimer m_timer;
+};
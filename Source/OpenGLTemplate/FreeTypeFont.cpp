@@ -1,4 +1,5 @@
 #include "FreeTypeFont.h"
+#include "FrameProfiler.h"
 #include <minmax.h>
 
 #pragma comment(lib, "lib/freetype2410.lib")
@@ -6,6 +7,9 @@
 CFreeTypeFont::CFreeTypeFont()
 {
 	m_bLoaded = false;
+	m_uiVAO = 0;
+	m_pStreamingBuffer = NULL;
+	m_drawnChars.reserve(512);		// As long as a Render string can be, so printing never grows it
 }
 CFreeTypeFont::~CFreeTypeFont()
 {}
@@ -58,21 +62,11 @@ void CFreeTypeFont::CreateChar(int iIndex)
 
 	m_iNewLine = max(m_iNewLine, int(m_ftFace->glyph->metrics.height>>6));
 
-	// Rendering data, texture coordinates are always the same, so now we waste a little memory
-	glm::vec2 vQuad[] =
-	{
-		glm::vec2(0.0f, float(-m_iAdvY[iIndex]+iTH)),
-		glm::vec2(0.0f, float(-m_iAdvY[iIndex])),
-		glm::vec2(float(iTW), float(-m_iAdvY[iIndex]+iTH)),
-		glm::vec2(float(iTW), float(-m_iAdvY[iIndex]))
-	};
-	glm::vec2 vTexQuad[] = {glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, 0.0f)};
-
-	// Add this char to VBO
-	for (int i = 0; i < 4; i++) {
-		m_vboData.AddData(&vQuad[i], sizeof(glm::vec2));
-		m_vboData.AddData(&vTexQuad[i], sizeof(glm::vec2));
-	}
+	// Quad corners at the loaded size, placed and scaled per character in Print
+	m_vCharQuads[iIndex][0] = glm::vec2(0.0f, float(-m_iAdvY[iIndex]+iTH));
+	m_vCharQuads[iIndex][1] = glm::vec2(0.0f, float(-m_iAdvY[iIndex]));
+	m_vCharQuads[iIndex][2] = glm::vec2(float(iTW), float(-m_iAdvY[iIndex]+iTH));
+	m_vCharQuads[iIndex][3] = glm::vec2(float(iTW), float(-m_iAdvY[iIndex]));
 	delete[] bData;
 }
 
@@ -92,19 +86,17 @@ bool CFreeTypeFont::LoadFont(string sFile, int iPXSize)
 	FT_Set_Pixel_Sizes(m_ftFace, iPXSize, iPXSize);
 	m_iLoadedPixelSize = iPXSize;
 
-	glGenVertexArrays(1, &m_uiVAO);
-	glBindVertexArray(m_uiVAO);
-	m_vboData.Create();
-	m_vboData.Bind();
-
 	for (int i = 0; i < 128; i++)
 		CreateChar(i);
 	m_bLoaded = true;
 
 	FT_Done_Face(m_ftFace);
 	FT_Done_FreeType(m_ftLib);
-	
-	m_vboData.UploadDataToGPU(GL_STATIC_DRAW);
+
+	// Positions and texture coordinates are interleaved in the streaming buffer
+	glGenVertexArrays(1, &m_uiVAO);
+	glBindVertexArray(m_uiVAO);
+	m_pStreamingBuffer->Bind(GL_ARRAY_BUFFER);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2)*2, 0);
 	glEnableVertexAttribArray(1);
@@ -125,20 +117,27 @@ bool CFreeTypeFont::LoadSystemFont(string sName, int iPXSize)
 
 
 // Prints text at the specified location (x, y) with the given pixel size (iPXSize)
-void CFreeTypeFont::Print(string sText, int x, int y, int iPXSize)
+void CFreeTypeFont::Print(const char *sText, int x, int y, int iPXSize)
 {
 	if(!m_bLoaded)
 		return;
 
-	glBindVertexArray(m_uiVAO);
-	m_shShaderProgram->SetUniform("sampler0", 0);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	int iLength = (int) strlen(sText);
+
+	// Each character is a strip of four vertices, each a position and a texture coordinate
+	const UINT uiStride = sizeof(glm::vec2)*2;
+	GLintptr offset;
+	glm::vec2* pVertices = (glm::vec2*) m_pStreamingBuffer->AllocateVertices((UINT) iLength*4*uiStride, uiStride, offset);
+	if(pVertices == NULL)
+		return;
+
 	int iCurX = x, iCurY = y;
 	if(iPXSize == -1)
 		iPXSize = m_iLoadedPixelSize;
 	float fScale = float(iPXSize)/float(m_iLoadedPixelSize);
-	for (int i = 0; i < (int) sText.size(); i++) {
+	const glm::vec2 vTexQuad[] = {glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, 0.0f)};
+	m_drawnChars.clear();
+	for (int i = 0; i < iLength; i++) {
 		if(sText[i] == '\n')
 		{
 			iCurX = x;
@@ -149,16 +148,30 @@ void CFreeTypeFont::Print(string sText, int x, int y, int iPXSize)
 		iCurX += m_iBearingX[iIndex]*iPXSize/m_iLoadedPixelSize;
 		if(sText[i] != ' ')
 		{
-			m_tCharTextures[iIndex].Bind();
-			glm::mat4 mModelView = glm::translate(glm::mat4(1.0f), glm::vec3(float(iCurX), float(iCurY), 0.0f));
-			mModelView = glm::scale(mModelView, glm::vec3(fScale));
-			m_shShaderProgram->SetUniform("matrices.modelViewMatrix", mModelView);
-			// Draw character
-			glDrawArrays(GL_TRIANGLE_STRIP, iIndex*4, 4);
+			glm::vec2 vPos = glm::vec2(float(iCurX), float(iCurY));
+			for (int j = 0; j < 4; j++) {
+				*pVertices++ = vPos + m_vCharQuads[iIndex][j]*fScale;
+				*pVertices++ = vTexQuad[j];
+			}
+			m_drawnChars.push_back(iIndex);
 		}
 
 		iCurX += (m_iAdvX[iIndex]-m_iBearingX[iIndex])*iPXSize/m_iLoadedPixelSize;
 	}
+	m_pStreamingBuffer->Commit();
+
+	glBindVertexArray(m_uiVAO);
+	m_shShaderProgram->SetUniform("sampler0", 0);
+	m_shShaderProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1.0f));
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLint iFirst = GLint(offset/uiStride);
+	for (int i = 0; i < (int) m_drawnChars.size(); i++) {
+		// Draw character
+		m_tCharTextures[m_drawnChars[i]].Bind();
+		glDrawArrays(GL_TRIANGLE_STRIP, iFirst + i*4, 4);
+	}
+	CFrameProfiler::CountDraws((UINT) m_drawnChars.size());
 	glDisable(GL_BLEND);
 }
 
@@ -179,7 +192,6 @@ void CFreeTypeFont::ReleaseFont()
 {
 	for (int i = 0; i < 128; i++) 
 		m_tCharTextures[i].Release();
-	m_vboData.Release();
 	glDeleteVertexArrays(1, &m_uiVAO);
 }
 
@@ -187,4 +199,10 @@ void CFreeTypeFont::ReleaseFont()
 void CFreeTypeFont::SetShaderProgram(CShaderProgram* a_shShaderProgram)
 {
 	m_shShaderProgram = a_shShaderProgram;
+}
+
+// Sets the buffer that Print streams its quads through
+void CFreeTypeFont::SetStreamingBuffer(CStreamingBuffer* pStreamingBuffer)
+{
+	m_pStreamingBuffer = pStreamingBuffer;
 }
\ No newline at end of file
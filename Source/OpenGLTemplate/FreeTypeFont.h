@@ -6,7 +6,7 @@
 #include "Common.h"
 #include "Texture.h"
 #include "Shaders.h"
-#include "VertexBufferObject.h"
+#include "StreamingBuffer.h"
 
 
 // This class is a wrapper for FreeType fonts and their usage with OpenGL
@@ -21,12 +21,13 @@ public:
 
 	int GetTextWidth(string sText, int iPXSize);
 
-	void Print(string sText, int x, int y, int iPXSize = -1);
+	void Print(const char *sText, int x, int y, int iPXSize = -1);
 	void Render(int x, int y, int iPXSize, char* sText, ...);
 
 	void ReleaseFont();
 
 	void SetShaderProgram(CShaderProgram* a_shShaderProgram);
+	void SetStreamingBuffer(CStreamingBuffer* pStreamingBuffer);	// Call before loading; text quads are written here each frame
 
 private:
 	void CreateChar(int iIndex);
@@ -36,11 +37,13 @@ private:
 	int m_iBearingX[256], m_iBearingY[256];
 	int m_iCharWidth[256], m_iCharHeight[256];
 	int m_iLoadedPixelSize, m_iNewLine;
+	glm::vec2 m_vCharQuads[256][4];
 
 	bool m_bLoaded;
 
 	UINT m_uiVAO;
-	CVertexBufferObject m_vboData;
+	CStreamingBuffer* m_pStreamingBuffer;
+	vector<int> m_drawnChars;					// Characters written to the streaming buffer by the current Print
 
 	FT_Library m_ftLib;
 	FT_Face m_ftFace;
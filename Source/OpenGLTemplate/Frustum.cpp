@@ -0,0 +1,37 @@
+#include "Frustum.h"
+
+CFrustum::CFrustum()
+{
+	for (int i = 0; i < 6; i++)
+		m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+CFrustum::~CFrustum()
+{}
+
+// Each plane is the last row of the matrix plus or minus one of the others (Gribb and Hartmann)
+void CFrustum::Extract(const glm::mat4 &viewProjectionMatrix)
+{
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProjectionMatrix[0][i], viewProjectionMatrix[1][i], viewProjectionMatrix[2][i], viewProjectionMatrix[3][i]);
+
+	m_planes[0] = rows[3] + rows[0];	// Left
+	m_planes[1] = rows[3] - rows[0];	// Right
+	m_planes[2] = rows[3] + rows[1];	// Bottom
+	m_planes[3] = rows[3] - rows[1];	// Top
+	m_planes[4] = rows[3] + rows[2];	// Near
+	m_planes[5] = rows[3] - rows[2];	// Far
+}
+
+// Test the corner of the box furthest along each plane's normal
+bool CFrustum::IntersectsBox(const glm::vec3 &vMin, const glm::vec3 &vMax) const
+{
+	for (int i = 0; i < 6; i++) {
+		const glm::vec4 &plane = m_planes[i];
+		glm::vec3 vCorner(plane.x >= 0.0f ? vMax.x : vMin.x, plane.y >= 0.0f ? vMax.y : vMin.y, plane.z >= 0.0f ? vMax.z : vMin.z);
+		if (glm::dot(glm::vec3(plane), vCorner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
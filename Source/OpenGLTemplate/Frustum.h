@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Common.h"
+
+// The six planes of a view frustum, taken from a view-projection matrix, for culling bounding boxes
+class CFrustum
+{
+public:
+	CFrustum();
+	~CFrustum();
+
+	void Extract(const glm::mat4 &viewProjectionMatrix);
+	// False only if the box is wholly outside one of the planes, so a few boxes near the corners are kept that could go
+	bool IntersectsBox(const glm::vec3 &vMin, const glm::vec3 &vMax) const;
+
+private:
+	glm::vec4 m_planes[6];		// xyz is the inward normal and w the offset, so inside is dot(xyz, p) + w >= 0
+};
@@ -29,6 +29,7 @@ Source code drawn from a number of sources and examples, including contributions
 #include "Skybox.h"
 #include "Plane.h"
 #include "Shaders.h"
+#include "ShaderProgramCache.h"
 #include "FreeTypeFont.h"
 #include "Sphere.h"
 #include "MatrixStack.h"
@@ -37,7 +38,66 @@ Source code drawn from a number of sources and examples, including contributions
 #include "CatmullRom.h"
 #include "Tetrahedron.h"
 #include "HeightMapTerrain.h"
-
+#include "TiledTerrain.h"
+#include "JobSystem.h"
+#include "StreamingBuffer.h"
+#include "StaticBatch.h"
+#include "OcclusionCuller.h"
+#include "Frustum.h"
+#include "InputReplay.h"
+#include "FrameProfiler.h"
+#include "FrameCapture.h"
+#include "MemoryTracker.h"
+#include "FrameArena.h"
+#include "VertexBufferBenchmark.h"
+#include "EntityBenchmark.h"
+#include "TransformHierarchy.h"
+#include "ParticleSystem.h"
+#include "LightGrid.h"
+#include "ShadowMap.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <assert.h>
+
+
+// Passes of the static batch.  The occluders, the terrain and the space ship, are what the depth pre-pass draws.  Each wall
+// cluster is a pass of its own, STATIC_PASS_WALLS + its index, so it can be drawn inside its conditional render.  The track is
+// not in the batch; CCatmullRom culls and draws it by segment.
+enum StaticPass { STATIC_PASS_OCCLUDERS, STATIC_PASS_WALLS };
+
+const float Game::TRACK_WINDOW_BEHIND = 100.0f;
+const float Game::TRACK_WINDOW_AHEAD = 1500.0f;
+const float Game::FLYTHROUGH_SPEED = 2.0f;
+const float Game::DYNAMIC_CASTER_RADIUS = 15.0f;
+const float Game::TESS_PIXELS_PER_EDGE = 12.0f;
+const float Game::TERRAIN_STREAM_RADIUS = 2500.0f;
+
+static const char *FLYTHROUGH_VIEW_NAMES[] = { "chase", "map", "free" };
+
+// CPU and GPU budgets for each subsystem, in MB, in MemoryTag order.  0 is unlimited.
+static const float MEMORY_BUDGETS_MB[NUM_MEMORY_TAGS][2] = {
+	{ 0.0f, 0.0f },			// Untagged
+	{ 16.0f, 16.0f },		// Terrain: the plane and heightmap textures and mesh, or the resident tiles
+	{ 4.0f, 16.0f },		// Track: curves, mesh and road texture
+	{ 64.0f, 128.0f },		// Meshes: the OBJ models and their textures, the walls and obstacles
+	{ 4.0f, 8.0f },			// Fonts
+	{ 32.0f, 32.0f },		// Skybox: six 1024 square faces
+	{ 32.0f, 64.0f },		// Renderer: streaming buffer, static batch, occlusion boxes, capture buffers
+	{ 1.0f, 80.0f },		// Particles: two buffers of a million particles
+	{ 1.0f, 24.0f },		// Shadows: the static and dynamic shadow maps
+};
+
+// Fills order with the indices of positions, nearest to vEye first
+static void SortFrontToBack(const vector<glm::vec3> &positions, const glm::vec3 &vEye, vector<int> &order)
+{
+	order.resize(positions.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), [&](int a, int b) {
+		return glm::length(positions[a] - vEye) < glm::length(positions[b] - vEye);
+	});
+}
 
 // Constructor
 Game::Game()
@@ -54,6 +114,37 @@ Game::Game()
 	m_pWall = NULL;
 	m_pObst = NULL;
 	m_pHeightmapTerrain = NULL;
+	m_pTiledTerrain = NULL;
+	m_pJobSystem = NULL;
+	m_pStreamingBuffer = NULL;
+	m_pStaticBatch = NULL;
+	m_pOcclusionCuller = NULL;
+	m_pEntities = NULL;
+	m_pTransforms = NULL;
+	m_pParticles = NULL;
+	m_pLightGrid = NULL;
+	m_pShadowMap = NULL;
+	m_pParticleUpdateProgram = NULL;
+	m_pDepthProgram = NULL;
+	m_pOverdrawProgram = NULL;
+	m_pStaticProgram = NULL;
+	m_pStaticDepthProgram = NULL;
+	m_pTerrainProgram = NULL;
+	m_pTerrainDepthProgram = NULL;
+	m_pTerrainTessProgram = NULL;
+	m_pTerrainTessDepthProgram = NULL;
+	m_pTrackTessProgram = NULL;
+	m_pTrackTessDepthProgram = NULL;
+	m_pTileProgram = NULL;
+	m_pTileDepthProgram = NULL;
+	m_fTessProjScale = 1.0f;
+	m_pParticleRenderProgram = NULL;
+	m_uiBurstsSeen = 0;
+	m_uiNumBursts = 0;
+	for (int i = 0; i < 4; i++) {
+		m_burstPositions[i] = glm::vec3(0.0f);
+		m_burstKinds[i] = 0;
+	}
 	m_pPickUp = NULL;
 	m_spacePod = NULL;
 	
@@ -61,7 +152,28 @@ Game::Game()
 	m_pCatmullRom = NULL;
 
 	m_dt = 0.0;
+	m_simDt = 1000.0 / TICKS_PER_SECOND;
 	m_iFramesPerSecond = 0;
+	m_bAppActive = false;
+	m_bSimulationRunning = false;
+	m_uiTick = 0;
+	m_pReplay = NULL;
+	m_bHeadless = false;
+	m_bReplayFinished = false;
+	m_iFlythroughView = m_iFlythroughLastView = FLYTHROUGH_NONE;
+	m_iFlythroughLaps = 1;
+	m_pFrameProfiler = NULL;
+	m_iFlythroughFrame = -1;
+	m_pFrameCapture = NULL;
+	m_bDepthPrepass = true;
+	m_bOverdrawView = false;
+	m_uiOverdrawQueries[0] = m_uiOverdrawQueries[1] = 0;
+	m_uiOverdrawVAO = 0;
+	m_iOverdrawFrame = 0;
+	m_fOverdraw = 0.0f;
+	m_bMemoryView = false;
+	m_pFrameArena = NULL;
+	m_uiFramesRendered = 0;
 	playerAngle = 0.f;
 
 	m_boundary = 0.f;
@@ -77,6 +189,7 @@ Game::Game()
 
 	m_currentDistance = 0.0f;
 	m_cameraMovement = 0.0f;
+	m_offTrack = false;
 	p_speed = 2.5f;
 
 	time_el = 0.f;
@@ -99,6 +212,7 @@ Game::~Game()
 	delete m_pWall;
 	delete m_pObst;
 	delete m_pHeightmapTerrain;
+	delete m_pTiledTerrain;
 	delete m_pPickUp;
 	delete m_spacePod;
 
@@ -114,6 +228,19 @@ Game::~Game()
 	delete m_pShaderPrograms;
 
 	//setup objects
+	delete m_pJobSystem;
+	delete m_pStreamingBuffer;
+	delete m_pStaticBatch;
+	delete m_pOcclusionCuller;
+	delete m_pEntities;
+	delete m_pTransforms;
+	delete m_pParticles;
+	delete m_pLightGrid;
+	delete m_pShadowMap;
+	delete m_pReplay;
+	delete m_pFrameProfiler;
+	delete m_pFrameCapture;
+	delete m_pFrameArena;
 	delete m_pHighResolutionTimer;
 }
 
@@ -124,7 +251,17 @@ void Game::Initialise()
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f);
 
+	// Anything not loaded under a subsystem's own scope below belongs to the renderer
+	CMemoryScope memoryScope(MEMORY_RENDERER);
+	for (int i = 0; i < NUM_MEMORY_TAGS; i++)
+		CMemoryTracker::SetBudget(i, (size_t) (MEMORY_BUDGETS_MB[i][0] * 1048576), (size_t) (MEMORY_BUDGETS_MB[i][1] * 1048576));
+
 	/// Create objects
+	m_pJobSystem = new CJobSystem;
+	m_pStreamingBuffer = new CStreamingBuffer;
+	m_pOcclusionCuller = new COcclusionCuller;
+	m_pEntities = new CEntityStore;
+	m_pTransforms = new CTransformHierarchy;
 	m_pCamera = new CCamera;
 	m_pSkybox = new CSkybox;
 	m_pShaderPrograms = new vector <CShaderProgram *>;
@@ -135,10 +272,16 @@ void Game::Initialise()
 	m_spacePod = new COpenAssetImportMesh;
 	m_pSphere = new CSphere;
 	m_pCube = new CCube;
-	m_pCatmullRom = new CCatmullRom;
+	{
+		CMemoryScope trackScope(MEMORY_TRACK);		// The track loads its texture as it is constructed
+		m_pCatmullRom = new CCatmullRom;
+	}
 	m_pWall = new CCube;
 	m_pObst = new CTetrahedron;
-	m_pHeightmapTerrain = new CHeightMapTerrain;
+	if (STREAMING_TERRAIN)
+		m_pTiledTerrain = new CTiledTerrain;
+	else
+		m_pHeightmapTerrain = new CHeightMapTerrain;
 
 	
 
@@ -151,107 +294,234 @@ void Game::Initialise()
 	m_pCamera->SetOrthographicProjectionMatrix(width, height); 
 	m_pCamera->SetPerspectiveProjectionMatrix(45.0f, (float) width / (float) height, 0.5f, 5000.0f);
 
-	// Load shaders
-	vector<CShader> shShaders;
-	vector<string> sShaderFileNames;
-	sShaderFileNames.push_back("mainShader.vert");
-	sShaderFileNames.push_back("mainShader.frag");
-	sShaderFileNames.push_back("textShader.vert");
-	sShaderFileNames.push_back("textShader.frag");
-	sShaderFileNames.push_back("sphereShader.vert");
-	sShaderFileNames.push_back("sphereShader.frag");
-	sShaderFileNames.push_back("lightShader.vert");
-	sShaderFileNames.push_back("lightShader.frag");
-
-	for (int i = 0; i < (int) sShaderFileNames.size(); i++) {
-		string sExt = sShaderFileNames[i].substr((int) sShaderFileNames[i].size()-4, 4);
-		int iShaderType;
-		if (sExt == "vert") iShaderType = GL_VERTEX_SHADER;
-		else if (sExt == "frag") iShaderType = GL_FRAGMENT_SHADER;
-		else if (sExt == "geom") iShaderType = GL_GEOMETRY_SHADER;
-		else if (sExt == "tcnl") iShaderType = GL_TESS_CONTROL_SHADER;
-		else iShaderType = GL_TESS_EVALUATION_SHADER;
-		CShader shader;
-		shader.LoadShader("resources\\shaders\\"+sShaderFileNames[i], iShaderType);
-		shShaders.push_back(shader);
-	}
-
-	// Create the main shader program
-	CShaderProgram *pMainProgram = new CShaderProgram;
-	pMainProgram->CreateProgram();
-	pMainProgram->AddShaderToProgram(&shShaders[0]);
-	pMainProgram->AddShaderToProgram(&shShaders[1]);
-	pMainProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pMainProgram);
-
-	// Create a shader program for fonts
-	CShaderProgram *pFontProgram = new CShaderProgram;
-	pFontProgram->CreateProgram();
-	pFontProgram->AddShaderToProgram(&shShaders[2]);
-	pFontProgram->AddShaderToProgram(&shShaders[3]);
-	pFontProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pFontProgram);
-
-	CShaderProgram* pSphereProgram = new CShaderProgram;
-	pSphereProgram->CreateProgram();
-	pSphereProgram->AddShaderToProgram(&shShaders[4]);
-	pSphereProgram->AddShaderToProgram(&shShaders[5]);
-	pSphereProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pSphereProgram);
-
-	// You can follow this pattern to load additional shaders
-	CShaderProgram* pLightProgram = new CShaderProgram;
-	pLightProgram->CreateProgram();
-	pLightProgram->AddShaderToProgram(&shShaders[6]);
-	pLightProgram->AddShaderToProgram(&shShaders[7]);
-	pLightProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pLightProgram);
+	// 1 MB per frame in flight for data that is rewritten every frame
+	m_pStreamingBuffer->Create(1 << 20, 3);
+	m_pFtFont->SetStreamingBuffer(m_pStreamingBuffer);
+
+	// Render's temporary containers come from here, so a frame does not go to the heap
+	m_pFrameArena = new CFrameArena;
+	m_pFrameArena->Create(FRAME_ARENA_SIZE);
+
+	// Leave one core for this thread.  With SERIAL_STARTUP everything runs here, one job at a time, for comparing traces.
+	int iNumWorkers = (int) std::thread::hardware_concurrency() - 1;
+	m_pJobSystem->Start(SERIAL_STARTUP ? 0 : max(iNumWorkers, 1));
+
+	// Load the assets as a graph of jobs.  Reading and decoding files runs on the worker threads; anything that touches
+	// OpenGL is a main thread job, since this thread owns the context.
+	m_pJobSystem->BeginTrace();
+	vector<CJob*> jobs;
+
+	// Adds a decode job on a worker, and an upload job on the main thread that runs once the decode is done.  Both charge
+	// their memory to iTag.
+	auto AddLoad = [&](const string &sName, int iTag, std::function<void()> decode, std::function<void()> upload) {
+		CJob *pDecode = m_pJobSystem->CreateJob("Decode " + sName, [iTag, decode] { CMemoryScope scope(iTag); decode(); });
+		CJob *pUpload = m_pJobSystem->CreateJob("Upload " + sName, [iTag, upload] { CMemoryScope scope(iTag); upload(); }, true);
+		m_pJobSystem->AddDependency(pUpload, pDecode);
+		jobs.push_back(pDecode);
+		jobs.push_back(pUpload);
+	};
+
+	CJob *pShaders = m_pJobSystem->CreateJob("Compile shaders", [this] { LoadShaders(); }, true);
+	jobs.push_back(pShaders);
+
+	CJob *pFont = m_pJobSystem->CreateJob("Load font", [this] {
+		CMemoryScope scope(MEMORY_FONTS);
+		m_pFtFont->LoadSystemFont("arial.ttf", 32);
+		m_pFtFont->SetShaderProgram((*m_pShaderPrograms)[1]);
+	}, true);
+	m_pJobSystem->AddDependency(pFont, pShaders);
+	jobs.push_back(pFont);
 
 	// Create the skybox
 	// Skybox downloaded from http://www.akimbo.in/forum/viewtopic.php?f=10&t=9
-	//m_pSkybox->Create("resources\\skyboxes\\jajdarkland1\\", "jajdarkland1_ft.jpg", "jajdarkland1_bk.jpg", "jajdarkland1_lf.jpg", "jajdarkland1_rt.jpg", "jajdarkland1_up.jpg", "jajdarkland1_dn.jpg", 2500.0f);
-	m_pSkybox->Create("resources\\skyboxes\\space\\", "space_ft.png", "space_bk.png", "space_lf.png", "space_rt.png", "space_up.png", "space_dn.png", 2500.0f);
+	//m_pSkybox->Create("resources\\skyboxes\\jajdarkland1\\", "jajdarkland1_ft.jpg", "jajdarkland1_bk.jpg", "jajdarkland1_lf.jpg", "jajdarkland1_rt.jpg", "jajdarkland1_up.jpg", "jajdarkland1_dn.jpg");
+	// The six faces are decoded in parallel, then uploaded together into one cubemap
+	CJob *pSkyboxUpload = m_pJobSystem->CreateJob("Upload skybox", [this] { CMemoryScope scope(MEMORY_SKYBOX); m_pSkybox->Upload(); }, true);
+	const char *szSkyboxFaces[] = { "space_ft.png", "space_bk.png", "space_lf.png", "space_rt.png", "space_up.png", "space_dn.png" };
+	for (int i = 0; i < 6; i++) {
+		string sPath = string("resources\\skyboxes\\space\\") + szSkyboxFaces[i];
+		CJob *pFace = m_pJobSystem->CreateJob("Decode skybox " + string(szSkyboxFaces[i]), [this, i, sPath] {
+			CMemoryScope scope(MEMORY_SKYBOX);
+			m_pSkybox->DecodeFace(i, sPath);
+		});
+		m_pJobSystem->AddDependency(pSkyboxUpload, pFace);
+		jobs.push_back(pFace);
+	}
+	jobs.push_back(pSkyboxUpload);
 	// Create the planar terrain
-	m_pPlanarTerrain->Create("resources\\textures\\", "grassfloor01.jpg", 4000.0f, 4000.0f, 50.0f); // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
-
-	m_pFtFont->LoadSystemFont("arial.ttf", 32);
-	m_pFtFont->SetShaderProgram(pFontProgram);
+	AddLoad("plane", MEMORY_TERRAIN,
+		[this] { m_pPlanarTerrain->Decode("resources\\textures\\", "grassfloor01.jpg"); }, // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
+		[this] { m_pPlanarTerrain->Upload(4000.0f, 4000.0f, 50.0f); });
 
 	// Load some meshes in OBJ format
-	
-	m_pPlayerMesh->Load("resources\\models\\flyingDisk\\Ashtar Flying Disk.obj");  // Downloaded from http://opengameart.org/content/horse-lowpoly on 24 Jan 2013
-	m_pPickUp->Load("resources\\models\\PickUp\\PickUp.obj");
-	m_spacePod->Load("resources\\models\\ship\\Arc170.obj");
+	AddLoad("player mesh", MEMORY_MESHES,
+		[this] { m_pPlayerMesh->Import("resources\\models\\flyingDisk\\Ashtar Flying Disk.obj"); },  // Downloaded from http://opengameart.org/content/horse-lowpoly on 24 Jan 2013
+		[this] { m_pPlayerMesh->Upload(); });
+	AddLoad("pickup mesh", MEMORY_MESHES,
+		[this] { m_pPickUp->Import("resources\\models\\PickUp\\PickUp.obj"); },
+		[this] { m_pPickUp->Upload(); });
+	AddLoad("ship mesh", MEMORY_MESHES,
+		[this] { m_spacePod->Import("resources\\models\\ship\\Arc170.obj"); },
+		[this] { m_spacePod->Upload(); });
 
-	
-	  
+	//Create the wall as cube
+	AddLoad("wall", MEMORY_MESHES,
+		[this] { m_pWall->Decode("resources\\textures\\gren.jpg"); },
+		[this] { m_pWall->Upload(); });
+	AddLoad("obstacle", MEMORY_MESHES,
+		[this] { m_pObst->Decode("resources\\textures\\path.jpg"); },
+		[this] { m_pObst->Upload(); });
+
+	if (m_pTiledTerrain != NULL) {
+		// The tile file is cut from the heightmap on the first run, and again if it has been truncated or corrupted, and only
+		// mapped after that
+		AddLoad("tiled terrain", MEMORY_TERRAIN,
+			[this] {
+				const char *szTileFile = "terraincache\\terrainHeightMap201.tiles";
+				if (!CTiledTerrain::CheckTileFile(szTileFile)) {
+					// Built under another name and only then moved into place, so a failed or interrupted build never
+					// leaves a partial tile file to be mapped on the next run
+					const char *szBuildFile = "terraincache\\terrainHeightMap201.tiles.tmp";
+					CreateDirectory("terraincache\\", NULL);
+					if (!CTiledTerrain::BuildTileFile("resources\\textures\\terrainHeightMap201.bmp", szBuildFile, TERRAIN_TILE_SIZE, glm::vec3(0, 0, 0), 4000.0f, 4000.0f, 50.5f) ||
+						!MoveFileEx(szBuildFile, szTileFile, MOVEFILE_REPLACE_EXISTING)) {
+						DeleteFile(szBuildFile);
+						char message[1024];
+						sprintf_s(message, "Cannot build terrain tiles\n%s\n", szTileFile);
+						MessageBox(NULL, message, "Error", MB_ICONERROR);
+						return;
+					}
+				}
+				m_pTiledTerrain->Decode(szTileFile, "resources\\textures\\back.jpg", TERRAIN_TILE_BUDGET, TERRAIN_TILE_LOADERS);
+			},
+			[this] { m_pTiledTerrain->Upload(); });
+	}
+	else {
+		AddLoad("heightmap terrain", MEMORY_TERRAIN,
+			[this] { m_pHeightmapTerrain->Decode("resources\\textures\\terrainHeightMap201.bmp", "resources\\textures\\back.jpg", glm::vec3(0, 0, 0), 4000.0f, 4000.0f, 50.5f, GPU_TERRAIN); }, //http://spiralgraphics.biz
+			[this] { m_pHeightmapTerrain->Upload(); });
+	}
 
-	
-	
-	glEnable(GL_CULL_FACE);
+	CJob *pTrack = m_pJobSystem->CreateJob("Build track", [this] {
+		CMemoryScope scope(MEMORY_TRACK);
+		m_pCatmullRom->CreateCentreline();
+		m_pCatmullRom->CreateOffsetCurves();
+		m_pCatmullRom->CreateTrack();
+		m_pCatmullRom->CreateTrackPatches();
+	}, true);
+	jobs.push_back(pTrack);
+
+	for (unsigned int i = 0; i < jobs.size(); i++)
+		m_pJobSystem->Submit(jobs[i]);
+	m_pJobSystem->WaitAll();
+
+	m_pJobSystem->EndTrace(SERIAL_STARTUP ? "startup_trace_serial.json" : "startup_trace.json");
+	m_pJobSystem->Reset();
+
+	if (VERTEX_BUFFER_BENCHMARK)
+		RunVertexBufferBenchmark(m_pCatmullRom, "vertex_buffer_benchmark.csv");
+	if (ENTITY_BENCHMARK)
+		RunEntityBenchmark("entity_benchmark.csv");
+
+	// The walls never move, so their model matrices are made once and shared by both static paths.  They are drawn by
+	// cluster, not from the entity store's draw lists.
+	vector<glm::vec3> trackPoints = m_pCatmullRom->GetTrackPoints();
+	m_pEntities->Create(NUM_ENTITY_MESHES, 1024 + (UINT) trackPoints.size());
+	auto AddWall = [&](glm::vec3 position, bool bRotate) {
+		m_wallEntities.push_back(m_pEntities->CreateEntity(position, 5.0f, bRotate ? 90.f : 0.0f, CEntityStore::NO_MESH));
+	};
+	for (float i = -500; i < 500.f; i = i + 10.f)
+		AddWall(glm::vec3(i, 10, 250), false);
+	for (float i = -500; i < 500.f; i = i + 10.f)
+		AddWall(glm::vec3(i, 10, -1700), false);
+	for (float i = -1700.f; i < 250.f; i = i + 10.f)
+		AddWall(glm::vec3(-500, 10, i), true);
+	for (float i = -1700; i < 250.f; i = i + 10.f)
+		AddWall(glm::vec3(500, 10, i), false);
+
+	// Consecutive walls are neighbours along one side, so each run of them is a long thin box for occlusion culling
+	for (unsigned int i = 0; i < m_wallEntities.size(); i += WALLS_PER_CLUSTER) {
+		unsigned int uiEnd = min(i + WALLS_PER_CLUSTER, (unsigned int) m_wallEntities.size());
+		glm::vec3 vMin(FLT_MAX), vMax(-FLT_MAX);
+		for (unsigned int j = i; j < uiEnd; j++) {
+			glm::vec3 vWallMin, vWallMax;
+			m_pEntities->GetWorldBounds(m_wallEntities[j], vWallMin, vWallMax);
+			vMin = glm::min(vMin, vWallMin);
+			vMax = glm::max(vMax, vWallMax);
+		}
+		int iCluster = m_pOcclusionCuller->AddCluster(vMin, vMax, uiEnd - i);
+		m_wallClusterCentres.push_back(m_pOcclusionCuller->GetCentre(iCluster));
+	}
+	m_pOcclusionCuller->Create();
 
-	//Create the wall as cube
-	m_pWall->Create("resources\\textures\\gren.jpg");
+	m_pLightGrid = new CLightGrid;
+	m_pLightGrid->Create();
 
-	
+	// The sun's static shadows cover the walled area, from the ground to above the highest terrain
+	{
+		CMemoryScope scope(MEMORY_SHADOWS);
+		m_pShadowMap = new CShadowMap;
+		m_pShadowMap->Create(STATIC_SHADOW_MAP_SIZE, DYNAMIC_SHADOW_MAP_SIZE);
+	}
+	glm::vec3 vSceneMin(FLT_MAX), vSceneMax(-FLT_MAX);
+	for (unsigned int i = 0; i < m_wallEntities.size(); i++) {
+		glm::vec3 vWallMin, vWallMax;
+		m_pEntities->GetWorldBounds(m_wallEntities[i], vWallMin, vWallMax);
+		vSceneMin = glm::min(vSceneMin, vWallMin);
+		vSceneMax = glm::max(vSceneMax, vWallMax);
+	}
+	vSceneMin.y = min(vSceneMin.y, 0.0f);
+	vSceneMax.y = max(vSceneMax.y, 60.0f);
+	m_pShadowMap->SetDirectionalLight(glm::vec3(-1, 1, -1), vSceneMin, vSceneMax);
+
+	if (m_iFlythroughView != FLYTHROUGH_NONE) {
+		m_pFrameProfiler = new CFrameProfiler;
+		m_pFrameProfiler->Create();
+
+		if (!m_sCaptureDirectory.empty() || !m_sGoldenDirectory.empty()) {
+			RECT dimensions = m_gameWindow.GetDimensions();
+			m_pFrameCapture = new CFrameCapture;
+			m_pFrameCapture->Create(dimensions.right - dimensions.left, dimensions.bottom - dimensions.top, m_sCaptureDirectory,
+				m_sGoldenDirectory);
+		}
+	}
 
-	m_pObst->Create("resources\\textures\\path.jpg");
+	// The scene graph.  The terrain and the track are where they were made; the space ship sits in the centre.
+	m_iSceneNodes[NODE_SCENERY] = m_pTransforms->AddNode(CTransformHierarchy::ROOT);
+	m_iSceneNodes[NODE_TERRAIN] = m_pTransforms->AddNode(m_iSceneNodes[NODE_SCENERY]);
+	m_iSceneNodes[NODE_TRACK] = m_pTransforms->AddNode(m_iSceneNodes[NODE_SCENERY]);
+	m_iSceneNodes[NODE_POD] = m_pTransforms->AddNode(m_iSceneNodes[NODE_SCENERY]);
+	m_pTransforms->SetLocal(m_iSceneNodes[NODE_POD], glm::vec3(0, 5, -400.f), glm::vec3(0, 1, 0), 90.f, 0.15f);
+	m_iSceneNodes[NODE_PICKUPS] = m_pTransforms->AddNode(CTransformHierarchy::ROOT);
+	m_iSceneNodes[NODE_SPHERE_PICKUP] = m_pTransforms->AddNode(m_iSceneNodes[NODE_PICKUPS]);
+	m_iSceneNodes[NODE_CUBE_PICKUP] = m_pTransforms->AddNode(m_iSceneNodes[NODE_PICKUPS]);
+	m_iSceneNodes[NODE_PLAYER] = m_pTransforms->AddNode(CTransformHierarchy::ROOT);
+	m_pTransforms->Update();
 
+	{
+		CMemoryScope scope(MEMORY_PARTICLES);
+		m_pParticles = new CParticleSystem;
+		m_pParticles->Create(PARTICLE_CAPACITY, m_pParticleUpdateProgram, m_pParticleRenderProgram);
+	}
 
+	if (m_pStaticProgram != NULL)
+		BuildStaticBatch();
 
-	
+	glGenQueries(2, m_uiOverdrawQueries);
+	glGenVertexArrays(1, &m_uiOverdrawVAO);
 
-	m_pCatmullRom->CreateCentreline();
-	m_pCatmullRom->CreateOffsetCurves();
-	m_pCatmullRom->CreateTrack();
+	glEnable(GL_CULL_FACE);
 
-	wallPoints = m_pCatmullRom->GetTrackPoints();
+	// The tetrahedra along both edges of the track
+	for (unsigned int i = 0; i < trackPoints.size(); i++)
+		m_pEntities->CreateEntity(trackPoints[i], 8.0f, 0.0f, ENTITY_MESH_MARKER);
 
 
 	//game starts at lvlOne
 	mapMode = true;
 
 	//specifying pickUp points for the sphere
+	vector<glm::vec3> pickupPoints, pickupPoints2;
 	pickupPoints.push_back(glm::vec3(125.f, 7.f, -20.f));
 	pickupPoints.push_back(glm::vec3(320.f, 7.f, -430.f));
 	pickupPoints.push_back(glm::vec3(0.f, 7.f, -820.f));
@@ -271,15 +541,15 @@ void Game::Initialise()
 	finalPickUp2 = glm::vec3(-320.f, 7.f, -600.f);
 
 
-	currentPickUp = 0;
-	currentPickUp2 = 0;
 	gameOver = false;
 
-	m_objPos = pickupPoints[0];
-	m_objPos2 = pickupPoints2[0];
-
-	//specifying obstacle points that will be rendered as a tetrahedron
-	obstaclePoints.push_back(glm::vec3(210.f, 7.f, -160.f));
+	// The pickups are drawn from the snapshot, spinning, so they have no mesh in the store.  They are collected within 5 units.
+	int iRoutes[2] = { m_pEntities->AddPickupRoute(pickupPoints), m_pEntities->AddPickupRoute(pickupPoints2) };
+	for (int i = 0; i < 2; i++) {
+		m_pickupEntities[i] = m_pEntities->CreateEntity(glm::vec3(0.0f), 1.0f, 0.0f, CEntityStore::NO_MESH);
+		m_pEntities->SetCollider(m_pickupEntities[i], 5.0f);
+		m_pEntities->SetPickup(m_pickupEntities[i], iRoutes[i]);
+	}
 	
 	glow = 0.f;
 	glow_fade = false;
@@ -287,20 +557,468 @@ void Game::Initialise()
 	time_el = 0.f;
 	fadeout = 1.f;
 
-	m_pHeightmapTerrain->Create("resources\\textures\\terrainHeightMap201.bmp", "resources\\textures\\back.jpg", glm::vec3(0, 0, 0), 4000.0f, 4000.0f, 50.5f); //http://spiralgraphics.biz
-	
+	// Give the renderer a valid state before the simulation thread starts
+	PublishSnapshot();
 
+	CMemoryTracker::CheckBudgets();
+}
+
+// Load the shaders and create the shader programs.  Program 0 is the main shader, 1 is for fonts, 2 is for spheres, 3 is for lights,
+// and 4 is for the skybox.  The programs after them are held by name as well.
+void Game::LoadShaders()
+{
+	// Linked programs are cached as binaries in shadercache, so later launches skip compiling
+	CShaderProgramCache programCache("shadercache\\");
+	vector<string> sShaderFileNames;
+
+	// Create the main shader program
+	sShaderFileNames.push_back("mainShader.vert");
+	sShaderFileNames.push_back("mainShader.frag");
+	m_pShaderPrograms->push_back(programCache.AddProgram(sShaderFileNames));
+
+	// Create a shader program for fonts
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("textShader.vert");
+	sShaderFileNames.push_back("textShader.frag");
+	m_pShaderPrograms->push_back(programCache.AddProgram(sShaderFileNames));
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("sphereShader.vert");
+	sShaderFileNames.push_back("sphereShader.frag");
+	m_pShaderPrograms->push_back(programCache.AddProgram(sShaderFileNames));
+
+	// You can follow this pattern to load additional shaders
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("lightShader.vert");
+	sShaderFileNames.push_back("lightShader.frag");
+	m_pShaderPrograms->push_back(programCache.AddProgram(sShaderFileNames));
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("skyboxShader.vert");
+	sShaderFileNames.push_back("skyboxShader.frag");
+	m_pShaderPrograms->push_back(programCache.AddProgram(sShaderFileNames));
+
+	// The depth pre-pass shares the main shader's vertex stage, so its depths are the same
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("mainShader.vert");
+	sShaderFileNames.push_back("depthShader.frag");
+	m_pDepthProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pDepthProgram);
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("overdrawShader.vert");
+	sShaderFileNames.push_back("overdrawShader.frag");
+	m_pOverdrawProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pOverdrawProgram);
+
+	// The static batch and its depth pre-pass need GL 4.3 features that a 4.0 context may not have.  Without them the static
+	// programs stay NULL and the batch is not built.
+	if (CStaticBatch::IsSupported()) {
+		sShaderFileNames.clear();
+		sShaderFileNames.push_back("staticShader.vert");
+		sShaderFileNames.push_back("mainShader.frag");
+		m_pStaticProgram = programCache.AddProgram(sShaderFileNames);
+		m_pShaderPrograms->push_back(m_pStaticProgram);
+
+		sShaderFileNames.back() = "depthShader.frag";
+		m_pStaticDepthProgram = programCache.AddProgram(sShaderFileNames);
+		m_pShaderPrograms->push_back(m_pStaticDepthProgram);
+	}
+
+	// The displaced heightmap terrain, shaded and depth only
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("terrainShader.vert");
+	sShaderFileNames.push_back("mainShader.frag");
+	m_pTerrainProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTerrainProgram);
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("terrainShader.vert");
+	sShaderFileNames.push_back("depthShader.frag");
+	m_pTerrainDepthProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTerrainDepthProgram);
+
+	// The streamed terrain tiles, shaded and depth only
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("terrainTile.vert");
+	sShaderFileNames.push_back("mainShader.frag");
+	m_pTileProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTileProgram);
+
+	sShaderFileNames.back() = "depthShader.frag";
+	m_pTileDepthProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTileDepthProgram);
+
+	// The tessellated terrain and track.  Each depth-only program shares its shaded twin's stages up to the fragment shader.
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("terrainTess.vert");
+	sShaderFileNames.push_back("terrainTess.tcnl");
+	sShaderFileNames.push_back("terrainTess.tevl");
+	sShaderFileNames.push_back("mainShader.frag");
+	m_pTerrainTessProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTerrainTessProgram);
+
+	sShaderFileNames.back() = "depthShader.frag";
+	m_pTerrainTessDepthProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTerrainTessDepthProgram);
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("trackTess.vert");
+	sShaderFileNames.push_back("trackTess.tcnl");
+	sShaderFileNames.push_back("trackTess.tevl");
+	sShaderFileNames.push_back("lightShader.frag");
+	m_pTrackTessProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTrackTessProgram);
+
+	sShaderFileNames.back() = "depthShader.frag";
+	m_pTrackTessDepthProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pTrackTessDepthProgram);
+
+	// The particles are simulated by a vertex shader alone, with its outputs captured into a buffer
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("particleUpdate.vert");
+	vector<string> sFeedbackVaryings;
+	sFeedbackVaryings.push_back("vPosition");
+	sFeedbackVaryings.push_back("vVelocity");
+	sFeedbackVaryings.push_back("vColour");
+	m_pParticleUpdateProgram = programCache.AddProgram(sShaderFileNames, sFeedbackVaryings);
+	m_pShaderPrograms->push_back(m_pParticleUpdateProgram);
+
+	sShaderFileNames.clear();
+	sShaderFileNames.push_back("particleRender.vert");
+	sShaderFileNames.push_back("particleRender.frag");
+	m_pParticleRenderProgram = programCache.AddProgram(sShaderFileNames);
+	m_pShaderPrograms->push_back(m_pParticleRenderProgram);
+
+	programCache.Build();
+}
+
+// Merge the static scene geometry into one batch.  The transforms and materials match the per-object draws in Render.
+void Game::BuildStaticBatch()
+{
+	m_pStaticBatch = new CStaticBatch;
+
+	int iTerrainMaterial = m_pStaticBatch->AddMaterial(glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(0.0f), 15.0f);
+	int iObjectMaterial = m_pStaticBatch->AddMaterial(glm::vec3(0.5f), glm::vec3(0.5f), glm::vec3(1.0f), 15.0f);
+
+	vector<int> planeMeshes, terrainMeshes, wallMeshes, podMeshes;
+	m_pPlanarTerrain->AddToStaticBatch(m_pStaticBatch, planeMeshes);
+	if (m_pHeightmapTerrain != NULL)
+		m_pHeightmapTerrain->AddToStaticBatch(m_pStaticBatch, terrainMeshes);
+	m_pWall->AddToStaticBatch(m_pStaticBatch, wallMeshes);
+	m_spacePod->AddToStaticBatch(m_pStaticBatch, podMeshes);
+
+	auto AddDraws = [this](int iPass, const vector<int> &meshes, const glm::mat4 &modelMatrix, int iMaterial) {
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			m_pStaticBatch->AddDraw(iPass, meshes[i], modelMatrix, iMaterial);
+	};
+
+	glutil::MatrixStack modelMatrixStack;
+	modelMatrixStack.SetIdentity();
+	AddDraws(STATIC_PASS_OCCLUDERS, planeMeshes, modelMatrixStack.Top(), iTerrainMaterial);
+	AddDraws(STATIC_PASS_OCCLUDERS, terrainMeshes, modelMatrixStack.Top(), iTerrainMaterial);
+	AddDraws(STATIC_PASS_OCCLUDERS, podMeshes, m_pTransforms->GetWorldMatrix(m_iSceneNodes[NODE_POD]), iObjectMaterial);
+
+	// The four walls
+	for (unsigned int i = 0; i < m_wallEntities.size(); i++)
+		AddDraws(STATIC_PASS_WALLS + i / WALLS_PER_CLUSTER, wallMeshes, m_pEntities->GetModelMatrix(m_wallEntities[i]), iObjectMaterial);
+
+	m_pStaticBatch->Build();
+}
+
+// Draw one pass of the static batch with the given view matrix and light position in eye coordinates
+void Game::RenderStaticBatch(int iPass, const glm::mat4 &viewMatrix, const glm::vec4 &lightEye)
+{
+	m_pStaticProgram->UseProgram();
+	m_pStaticProgram->SetUniform("bUseTexture", true);
+	m_pStaticProgram->SetUniform("sampler0", 0);
+	m_pStaticProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	m_pStaticProgram->SetUniform("matrices.viewMatrix", viewMatrix);
+	m_pStaticProgram->SetUniform("light1.position", lightEye);
+	m_pStaticProgram->SetUniform("light1.La", glm::vec3(1.0f));
+	m_pStaticProgram->SetUniform("light1.Ld", glm::vec3(1.0f));
+	m_pStaticProgram->SetUniform("light1.Ls", glm::vec3(1.0f));
+	m_pShadowMap->Bind(m_pStaticProgram, viewMatrix, SHADOW_TEXTURE_UNIT);
+	m_pStaticBatch->Render(iPass);
+}
+
+// Draw the terrain, the space ship and the track into the depth buffer only.  They cover most of the screen, so the shading
+// passes that follow can reject what they hide before shading it, and the wall clusters are tested against them.  Leaves the
+// depth test at LEQUAL, so the same surfaces pass when drawn again.
+void Game::RenderDepthPrepass(bool bBatched, const glm::mat4 &viewMatrix)
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	if (bBatched) {
+		m_pStaticDepthProgram->UseProgram();
+		m_pStaticDepthProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+		m_pStaticDepthProgram->SetUniform("matrices.viewMatrix", viewMatrix);
+		m_pStaticBatch->Render(STATIC_PASS_OCCLUDERS);
+	}
+
+	// The modelview matrices are the ones the shading passes use, so the depths match exactly
+	m_pDepthProgram->UseProgram();
+	m_pDepthProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	RenderTrack(m_pDepthProgram, true, viewMatrix);
+	if (!bBatched) {
+		SetModelMatrices(m_pDepthProgram, viewMatrix, m_iSceneNodes[NODE_TERRAIN]);
+		m_pPlanarTerrain->Render();
+		RenderHeightmapTerrain(m_pDepthProgram, true, TESSELLATION, m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix);
+
+		SetModelMatrices(m_pDepthProgram, viewMatrix, m_iSceneNodes[NODE_POD]);
+		m_spacePod->Render();
+	}
+	else if (IsTerrainDrawnApart())
+		RenderHeightmapTerrain(NULL, true, TESSELLATION, m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthFunc(GL_LEQUAL);
+}
+
+// Draw the heightmap terrain.  The baked mesh is drawn with pProgram, which must be in use with the terrain's model matrices
+// set.  The displaced grid and the streamed tiles are drawn with their own program, or its depth-only twin, the grid with
+// bTessellate as patches sized to the camera's view, after which pProgram, if any, is put back in use.  The passes that must
+// match in depth tessellate alike.
+void Game::RenderHeightmapTerrain(CShaderProgram *pProgram, bool bDepthOnly, bool bTessellate, glm::mat4 *pProjectionMatrix, const glm::mat4 &viewMatrix)
+{
+	if (!IsTerrainDrawnApart()) {
+		m_pHeightmapTerrain->Render();
+		return;
+	}
+
+	CShaderProgram *pTerrainProgram = GetTerrainProgram(bDepthOnly, bTessellate);
+	pTerrainProgram->UseProgram();
+	pTerrainProgram->SetUniform("matrices.projMatrix", pProjectionMatrix);
+	SetModelMatrices(pTerrainProgram, viewMatrix, m_iSceneNodes[NODE_TERRAIN]);
+	if (m_pTiledTerrain != NULL) {
+		// The tiles are culled in the terrain's model space
+		CFrustum frustum;
+		frustum.Extract(*pProjectionMatrix * viewMatrix * m_pTransforms->GetWorldMatrix(m_iSceneNodes[NODE_TERRAIN]));
+		m_pTiledTerrain->Render(pTerrainProgram, frustum, TERRAIN_HEIGHT_TEXTURE_UNIT);
+	}
+	else {
+		m_pHeightmapTerrain->BindDisplacement(pTerrainProgram, TERRAIN_HEIGHT_TEXTURE_UNIT);
+		if (bTessellate) {
+			SetTessellationUniforms(pTerrainProgram);
+			m_pHeightmapTerrain->RenderTessellated();
+		}
+		else
+			m_pHeightmapTerrain->Render();
+	}
+	if (pProgram != NULL)
+		pProgram->UseProgram();
+}
+
+// The displaced and the streamed terrain are drawn by their own programs, so they are left out of the static batch and of
+// the per-object draws with the main program
+bool Game::IsTerrainDrawnApart()
+{
+	return m_pTiledTerrain != NULL || m_pHeightmapTerrain->IsDisplaced();
+}
+
+// The program RenderHeightmapTerrain draws the terrain with when IsTerrainDrawnApart.  The tiles are never tessellated.
+CShaderProgram* Game::GetTerrainProgram(bool bDepthOnly, bool bTessellate)
+{
+	if (m_pTiledTerrain != NULL)
+		return bDepthOnly ? m_pTileDepthProgram : m_pTileProgram;
+	if (bTessellate)
+		return bDepthOnly ? m_pTerrainTessDepthProgram : m_pTerrainTessProgram;
+	return bDepthOnly ? m_pTerrainDepthProgram : m_pTerrainProgram;
+}
+
+// Draw the track from the camera.  The baked strip is drawn with pProgram, which must be in use.  With TESSELLATION the
+// spline patches are drawn instead, with the track program, or its depth-only twin, after which pProgram is put back in use.
+void Game::RenderTrack(CShaderProgram *pProgram, bool bDepthOnly, const glm::mat4 &viewMatrix)
+{
+	if (!TESSELLATION) {
+		SetModelMatrices(pProgram, viewMatrix, m_iSceneNodes[NODE_TRACK]);
+		m_pCatmullRom->RenderTrack();
+		return;
+	}
+
+	CShaderProgram *pTrackProgram = bDepthOnly ? m_pTrackTessDepthProgram : m_pTrackTessProgram;
+	pTrackProgram->UseProgram();
+	pTrackProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	SetModelMatrices(pTrackProgram, viewMatrix, m_iSceneNodes[NODE_TRACK]);
+	SetTessellationUniforms(pTrackProgram);
+	m_pCatmullRom->SetTrackPatchUniforms(pTrackProgram);
+	m_pCatmullRom->RenderTrackPatches();
+	pProgram->UseProgram();
+}
+
+void Game::SetTessellationUniforms(CShaderProgram *pProgram)
+{
+	pProgram->SetUniform("tessellation.fProjScale", m_fTessProjScale);
+	pProgram->SetUniform("tessellation.fPixelsPerEdge", TESS_PIXELS_PER_EDGE);
+}
+
+// Bring the sun's shadow maps up to date.  The static casters are drawn only when the cached map has been invalidated; the
+// moving ones, the player and the two pickups, are drawn every frame into the small map fitted around them.  The track lies on
+// the ground and only receives.
+void Game::RenderShadowMaps(bool bBatched, int iWidth, int iHeight)
+{
+	const glm::mat4 &lightView = m_pShadowMap->GetViewMatrix();
+	if (m_pShadowMap->BeginStatic()) {
+		if (bBatched) {
+			m_pStaticDepthProgram->UseProgram();
+			m_pStaticDepthProgram->SetUniform("matrices.projMatrix", m_pShadowMap->GetProjectionMatrix());
+			m_pStaticDepthProgram->SetUniform("matrices.viewMatrix", lightView);
+			m_pStaticBatch->Render(STATIC_PASS_OCCLUDERS);
+			for (int i = 0; i < m_pOcclusionCuller->GetNumClusters(); i++)
+				m_pStaticBatch->Render(STATIC_PASS_WALLS + i);
+			if (IsTerrainDrawnApart())
+				RenderHeightmapTerrain(NULL, true, false, m_pShadowMap->GetProjectionMatrix(), lightView);
+		}
+		else {
+			m_pDepthProgram->UseProgram();
+			m_pDepthProgram->SetUniform("matrices.projMatrix", m_pShadowMap->GetProjectionMatrix());
+			SetModelMatrices(m_pDepthProgram, lightView, m_iSceneNodes[NODE_TERRAIN]);
+			m_pPlanarTerrain->Render();
+			RenderHeightmapTerrain(m_pDepthProgram, true, false, m_pShadowMap->GetProjectionMatrix(), lightView);
+			SetModelMatrices(m_pDepthProgram, lightView, m_iSceneNodes[NODE_POD]);
+			m_spacePod->Render();
+			for (unsigned int i = 0; i < m_wallEntities.size(); i++) {
+				m_pDepthProgram->SetUniform("matrices.modelViewMatrix", lightView * m_pEntities->GetModelMatrix(m_wallEntities[i]));
+				m_pWall->Render();
+			}
+		}
+	}
+
+	static const int casterNodes[3] = { NODE_PLAYER, NODE_SPHERE_PICKUP, NODE_CUBE_PICKUP };
+	glm::vec3 vMin(FLT_MAX), vMax(-FLT_MAX);
+	for (int i = 0; i < 3; i++) {
+		glm::vec3 vPosition(m_pTransforms->GetWorldMatrix(m_iSceneNodes[casterNodes[i]])[3]);
+		vMin = glm::min(vMin, vPosition - glm::vec3(DYNAMIC_CASTER_RADIUS));
+		vMax = glm::max(vMax, vPosition + glm::vec3(DYNAMIC_CASTER_RADIUS));
+	}
+	m_pShadowMap->BeginDynamic(vMin, vMax);
+	m_pDepthProgram->UseProgram();
+	m_pDepthProgram->SetUniform("matrices.projMatrix", m_pShadowMap->GetProjectionMatrix());
+	SetModelMatrices(m_pDepthProgram, lightView, m_iSceneNodes[NODE_PLAYER]);
+	m_pPlayerMesh->Render();
+	SetModelMatrices(m_pDepthProgram, lightView, m_iSceneNodes[NODE_SPHERE_PICKUP]);
+	m_pPickUp->Render();
+	SetModelMatrices(m_pDepthProgram, lightView, m_iSceneNodes[NODE_CUBE_PICKUP]);
+	m_pWall->Render();
+	m_pShadowMap->End(iWidth, iHeight);
+}
+
+// Set a program's modelview and normal matrices for a scene graph node.  The view matrix is a rotation and translation, so
+// its upper 3x3 carries the node's cached normal matrix into eye space.
+void Game::SetModelMatrices(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, int iNode)
+{
+	pProgram->SetUniform("matrices.modelViewMatrix", viewMatrix * m_pTransforms->GetWorldMatrix(iNode));
+	pProgram->SetUniform("matrices.normalMatrix", glm::mat3(viewMatrix) * m_pTransforms->GetNormalMatrix(iNode));
+}
+
+// Count the fragments that pass the depth test from here on, per pixel in the stencil buffer and in total with a query
+void Game::BeginOverdraw()
+{
+	glEnable(GL_STENCIL_TEST);
+	glStencilFunc(GL_ALWAYS, 0, 0xFF);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+	glBeginQuery(GL_SAMPLES_PASSED, m_uiOverdrawQueries[m_iOverdrawFrame % 2]);
+}
+
+// Stop counting, read last frame's total, and colour each pixel by its count: dark blue for once through to red for seven
+// times, and white for eight or more
+void Game::EndOverdraw(int iWidth, int iHeight)
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	if (m_iOverdrawFrame > 0) {
+		GLuint uiAvailable = 0;
+		GLuint uiQuery = m_uiOverdrawQueries[(m_iOverdrawFrame + 1) % 2];
+		glGetQueryObjectuiv(uiQuery, GL_QUERY_RESULT_AVAILABLE, &uiAvailable);
+		if (uiAvailable) {
+			GLuint64 uiSamples = 0;
+			glGetQueryObjectui64v(uiQuery, GL_QUERY_RESULT, &uiSamples);
+			m_fOverdraw = (float) uiSamples / (float) (iWidth * iHeight);
+		}
+	}
+	m_iOverdrawFrame++;
+
+	static const glm::vec4 heatColours[8] = {
+		glm::vec4(0.0f, 0.0f, 0.5f, 1.0f), glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		glm::vec4(0.0f, 1.0f, 1.0f, 1.0f), glm::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+		glm::vec4(1.0f, 1.0f, 0.0f, 1.0f), glm::vec4(1.0f, 0.5f, 0.0f, 1.0f),
+		glm::vec4(1.0f, 0.0f, 0.0f, 1.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)
+	};
+
+	m_pOverdrawProgram->UseProgram();
+	glDisable(GL_DEPTH_TEST);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glBindVertexArray(m_uiOverdrawVAO);
+	for (int i = 0; i < 8; i++) {
+		// LEQUAL passes where i + 1 <= the count
+		glStencilFunc(i < 7 ? GL_EQUAL : GL_LEQUAL, i + 1, 0xFF);
+		m_pOverdrawProgram->SetUniform("vColour", heatColours[i]);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	CFrameProfiler::CountDraws(8);
+	glDisable(GL_STENCIL_TEST);
+	glEnable(GL_DEPTH_TEST);
+}
+
+// With STATIC_BATCH_BENCHMARK, keep each frame's static submission time.  Once both paths have enough frames, write the mean,
+// median and 95th percentile of each to a CSV.
+void Game::RecordStaticDrawTime(bool bBatched, double dElapsed)
+{
+	vector<double> &times = m_staticDrawTimes[bBatched ? 1 : 0];
+	if (!STATIC_BATCH_BENCHMARK || m_pStaticBatch == NULL || (int) times.size() >= STATIC_BATCH_BENCHMARK_FRAMES)
+		return;
+	times.push_back(dElapsed);
+	if ((int) m_staticDrawTimes[0].size() < STATIC_BATCH_BENCHMARK_FRAMES || (int) m_staticDrawTimes[1].size() < STATIC_BATCH_BENCHMARK_FRAMES)
+		return;
+
+	std::ofstream file("static_batch_benchmark.csv");
+	file << "path,draws,mean_ms,median_ms,p95_ms\n";
+	const char *szPaths[] = { "per_object", "multi_draw_indirect" };
+	for (int i = 0; i < 2; i++) {
+		vector<double> sorted = m_staticDrawTimes[i];
+		sort(sorted.begin(), sorted.end());
+		double dTotal = 0.0;
+		for (unsigned int j = 0; j < sorted.size(); j++)
+			dTotal += sorted[j];
+		UINT uiDraws = i == 0 ? m_pStaticBatch->GetNumDraws() : m_pStaticBatch->GetNumMultiDraws();
+		double dMean = dTotal / sorted.size(), dMedian = sorted[sorted.size() / 2], dP95 = sorted[sorted.size() * 95 / 100];
+		file << szPaths[i] << "," << uiDraws << "," << dMean << "," << dMedian << "," << dP95 << "\n";
+
+		char szLine[256];
+		sprintf_s(szLine, "Static geometry, %s: %u draw calls, mean %.3f ms, median %.3f ms, p95 %.3f ms\n", szPaths[i], uiDraws, dMean, dMedian, dP95);
+		OutputDebugString(szLine);
+	}
 }
 
 // Render method runs repeatedly in a loop
 void Game::Render() 
 {
-	
-	// Clear the buffers and enable depth testing (z-buffering)
-	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	CFrameArena::SetCurrent(m_pFrameArena);
+	CFrameArena::BeginHeapCheck();
+
+	// Pick up the latest state published by the simulation thread
+	m_snapshots.Update();
+	const GameSnapshot &state = m_snapshots.GetReadBuffer();
+
+	if (m_pFrameProfiler != NULL)
+		m_pFrameProfiler->BeginFrame(m_pCatmullRom->CurrentLap(state.trackDistance), state.trackDistance);
+
+	m_pStreamingBuffer->BeginFrame();
+
+	RECT dimensions = m_gameWindow.GetDimensions();
+	int width = dimensions.right - dimensions.left;
+	int height = dimensions.bottom - dimensions.top;
+	m_fTessProjScale = (*m_pCamera->GetPerspectiveProjectionMatrix())[1][1] * height / 2.0f;
+
+	// Clear the buffers and enable depth testing (z-buffering).  The stencil buffer counts overdraw.
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
 
-	// Set up a matrix stack
+	// Only the objects that move have their transforms set, and only they and their children are recomputed
+	m_pTransforms->SetLocal(m_iSceneNodes[NODE_SPHERE_PICKUP], state.objPos, glm::vec3(0, 1, 0), (float) state.timeElapsed, 2.0f);
+	m_pTransforms->SetLocal(m_iSceneNodes[NODE_CUBE_PICKUP], state.objPos2, glm::vec3(0, 1, 0), (float) state.timeElapsed * 0.1f,
+		3 + 5.0f * state.glow);
+	m_pTransforms->SetLocal(m_iSceneNodes[NODE_PLAYER], state.playerPos, glm::vec3(0.0f, 1.0f, 0.0f), 180.f, 0.05f);
+	m_pTransforms->Update();
+
+	// Set up a matrix stack for the view
 	glutil::MatrixStack modelViewMatrixStack;
 	modelViewMatrixStack.SetIdentity();
 
@@ -312,13 +1030,12 @@ void Game::Render()
 
 	// Set the projection and modelview matrix based on the current camera 	
 	pMainProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
-	modelViewMatrixStack.LookAt(m_pCamera->GetPosition(), m_pCamera->GetView(), m_pCamera->GetUpVector());
+	modelViewMatrixStack.LookAt(state.cameraPosition, state.cameraView, state.cameraUpVector);
 	
 	
 	// Set light and materials in main shader program
 	glm::vec4 vPosition(-100, 100, -100, 1);
 	glm::mat4 viewMatrix = modelViewMatrixStack.Top();
-	glm::mat3 normalMatrix = m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top());
 
 	// Convert light position to eye coordinates, since lighting is done in eye coordinates
 	glm::vec4 vLightEye = modelViewMatrixStack.Top()*vPosition;
@@ -332,46 +1049,122 @@ void Game::Render()
 	pMainProgram->SetUniform("material1.shininess", 15.0f);		// Shininess material property
 
 	//light and materials for the dynamic light
-	glm::vec4 lightPosition1(m_playerPos.x, 25, m_playerPos.z, 1); 
+	glm::vec4 lightPosition1(state.playerPos.x, 25, state.playerPos.z, 1); 
 	glm::vec4 lightPosition2(125.f, 50, -20.f, 1);
 
 	
 		
 
-	// Render the skybox and terrain with full ambient reflectance 
-	modelViewMatrixStack.Push();
-		// Translate the modelview matrix to the camera eye point so skybox stays centred around camera
-		glm::vec3 vEye = m_pCamera->GetPosition();
-		modelViewMatrixStack.Translate(vEye);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		m_pSkybox->Render();
-	modelViewMatrixStack.Pop();
-
+	// Render the terrain with full ambient reflectance 
 	
 
-	// Render the planar terrain
-	modelViewMatrixStack.Push();
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+	// Static geometry goes through the batch when it is available.  STATIC_BATCH_BENCHMARK alternates the two paths.
+	bool bBatched = m_pStaticBatch != NULL;
+	if (STATIC_BATCH_BENCHMARK && bBatched && (int) m_staticDrawTimes[1].size() < STATIC_BATCH_BENCHMARK_FRAMES)
+		bBatched = m_staticDrawTimes[1].size() < m_staticDrawTimes[0].size();
+
+	// Only the track in view is drawn, and in the chase views only the stretch around the player
+	CFrustum frustum;
+	frustum.Extract(*m_pCamera->GetPerspectiveProjectionMatrix() * viewMatrix);
+	if (state.freeLook)
+		m_pCatmullRom->CullTrack(frustum);
+	else
+		m_pCatmullRom->CullTrack(frustum, state.trackDistance, TRACK_WINDOW_BEHIND, TRACK_WINDOW_AHEAD);
+	m_pEntities->Cull(frustum);
+
+	// Opaque objects are drawn nearest first, so the depth test rejects what they hide before it is shaded
+	if (bBatched)
+		m_pStaticBatch->SortFrontToBack(state.cameraPosition, m_pStreamingBuffer);
+	SortFrontToBack(m_wallClusterCentres, state.cameraPosition, m_wallClusterOrder);
+
+	// Stream in the terrain tiles round the camera.  The cached shadow map was drawn with the tiles there were, so it is
+	// redrawn when they change.
+	if (m_pTiledTerrain != NULL && m_pTiledTerrain->Update(state.cameraPosition, TERRAIN_STREAM_RADIUS))
+		m_pShadowMap->Invalidate();
+
+	// The batch's commands for this frame are written, so the static shadow casters can go through it if it needs redrawing
+	RenderShadowMaps(bBatched, width, height);
+	if (IsTerrainDrawnApart()) {
+		// The displaced or streamed terrain is lit as the main program lights the mesh
+		CShaderProgram *pTerrainProgram = GetTerrainProgram(false, TESSELLATION);
+		pTerrainProgram->UseProgram();
+		pTerrainProgram->SetUniform("bUseTexture", true);
+		pTerrainProgram->SetUniform("sampler0", 0);
+		pTerrainProgram->SetUniform("light1.position", vLightEye);
+		pTerrainProgram->SetUniform("light1.La", glm::vec3(1.0f));
+		pTerrainProgram->SetUniform("light1.Ld", glm::vec3(1.0f));
+		pTerrainProgram->SetUniform("light1.Ls", glm::vec3(1.0f));
+		pTerrainProgram->SetUniform("material1.Ma", glm::vec3(1.0f));
+		pTerrainProgram->SetUniform("material1.Md", glm::vec3(0.0f));
+		pTerrainProgram->SetUniform("material1.Ms", glm::vec3(0.0f));
+		pTerrainProgram->SetUniform("material1.shininess", 15.0f);
+		m_pShadowMap->Bind(pTerrainProgram, viewMatrix, SHADOW_TEXTURE_UNIT);
+	}
+	pMainProgram->UseProgram();
+	m_pShadowMap->Bind(pMainProgram, viewMatrix, SHADOW_TEXTURE_UNIT);
+
+	// The wall clusters are tested against the occluders in the pre-pass.  Without it they are all drawn.
+	if (m_bDepthPrepass) {
+		RenderDepthPrepass(bBatched, viewMatrix);
+		m_pDepthProgram->UseProgram();
+		m_pDepthProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+		m_pOcclusionCuller->TestClusters(m_pDepthProgram, viewMatrix, state.cameraPosition);
+		pMainProgram->UseProgram();
+	}
+	else
+		m_pOcclusionCuller->SkipTests();
+	if (m_bOverdrawView)
+		BeginOverdraw();
+
+	CHighResolutionTimer staticTimer;
+	staticTimer.Start();
+
+	if (bBatched) {
+		// The walls use the same program and light as the occluders
+		RenderStaticBatch(STATIC_PASS_OCCLUDERS, viewMatrix, vLightEye);
+		for (unsigned int i = 0; i < m_wallClusterOrder.size(); i++) {
+			int iCluster = m_wallClusterOrder[i];
+			m_pOcclusionCuller->BeginCluster(iCluster);
+			m_pStaticBatch->Render(STATIC_PASS_WALLS + iCluster);
+			m_pOcclusionCuller->EndCluster(iCluster);
+		}
+		if (IsTerrainDrawnApart())
+			RenderHeightmapTerrain(NULL, false, TESSELLATION, m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix);
+	}
+	else {
+		// Render the planar terrain and the height map terrain
+		SetModelMatrices(pMainProgram, viewMatrix, m_iSceneNodes[NODE_TERRAIN]);
 		m_pPlanarTerrain->Render();
-	modelViewMatrixStack.Pop();
+		RenderHeightmapTerrain(pMainProgram, false, TESSELLATION, m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix);
 
-	modelViewMatrixStack.Push();
-	modelViewMatrixStack.Translate(glm::vec3(0.0f, 0.0f, 0.0f));
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	m_pHeightmapTerrain->Render();
-	modelViewMatrixStack.Pop();
 
 
+		// Turn on diffuse + specular materials
+		pMainProgram->SetUniform("material1.Ma", glm::vec3(0.5f));	// Ambient material reflectance
+		pMainProgram->SetUniform("material1.Md", glm::vec3(0.5f));	// Diffuse material reflectance
+		pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));	// Specular material reflectance	
 
-	// Turn on diffuse + specular materials
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.5f));	// Ambient material reflectance
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.5f));	// Diffuse material reflectance
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));	// Specular material reflectance	
-
-
+		//space ship in centre 
+		SetModelMatrices(pMainProgram, viewMatrix, m_iSceneNodes[NODE_POD]);
+		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
+		//pMainProgram->SetUniform("bUseTexture", false);
+		m_spacePod->Render();
+
+		// The walls, nearest cluster first
+		for (unsigned int i = 0; i < m_wallClusterOrder.size(); i++) {
+			int iCluster = m_wallClusterOrder[i];
+			unsigned int uiEnd = min((iCluster + 1) * WALLS_PER_CLUSTER, (int) m_wallEntities.size());
+			m_pOcclusionCuller->BeginCluster(iCluster);
+			for (unsigned int j = iCluster * WALLS_PER_CLUSTER; j < uiEnd; j++) {
+				glm::mat4 modelViewMatrix = viewMatrix * m_pEntities->GetModelMatrix(m_wallEntities[j]);
+				pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrix);
+				pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrix));
+				m_pWall->Render();
+			}
+			m_pOcclusionCuller->EndCluster(iCluster);
+		}
+	}
+	RecordStaticDrawTime(bBatched, staticTimer.Elapsed());
 
 	CShaderProgram* pSphereProgram = (*m_pShaderPrograms)[2];
 	pSphereProgram->UseProgram();
@@ -398,208 +1191,127 @@ void Game::Render()
 
 	pSphereProgram->UseProgram();
 	// Render the pickup set
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(m_objPos);
-		modelViewMatrixStack.Scale(2.0f);
-		modelViewMatrixStack.Rotate(glm::vec3(0, 1, 0), time_el);
 		pSphereProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
-		pSphereProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pSphereProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+		SetModelMatrices(pSphereProgram, viewMatrix, m_iSceneNodes[NODE_SPHERE_PICKUP]);
 		m_pPickUp->Render();
-		modelViewMatrixStack.Pop();
 	
 		pMainProgram->UseProgram();
 
-	//back
-	for (float i = -500; i < 500.f; i = i + 10.f) {
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(glm::vec3(i, 10, 250));
-		modelViewMatrixStack.Scale(5.0f);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-		//pMainProgram->SetUniform("bUseTexture", false);
-		m_pWall->Render();
-		modelViewMatrixStack.Pop();
-	}
-
-	// Render the front wall
-	for (float i = -500; i < 500.f; i = i + 10.f) {
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(glm::vec3(i, 10, -1700));
-		modelViewMatrixStack.Scale(5.0f);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-		//pMainProgram->SetUniform("bUseTexture", false);
-		m_pWall->Render();
-		modelViewMatrixStack.Pop();
-	}
-	//left wall
-	for (float i = -1700.f; i < 250.f; i = i + 10.f) {
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(glm::vec3(-500, 10, i));
-		modelViewMatrixStack.Rotate(glm::vec3(0, 1, 0), 90.f);
-		modelViewMatrixStack.Scale(5.0f);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-		//pMainProgram->SetUniform("bUseTexture", false);
-		m_pWall->Render();
-		modelViewMatrixStack.Pop();
-	}
-	//right wall
-	for (float i = -1700; i < 250.f; i = i + 10.f) {
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(glm::vec3(500, 10, i));
-		modelViewMatrixStack.Scale(5.0f);
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-		//pMainProgram->SetUniform("bUseTexture", false);
-		m_pWall->Render();
-		modelViewMatrixStack.Pop();
-	}
-
-
-
-	//space ship in centre 
-	modelViewMatrixStack.Push();
-	modelViewMatrixStack.Translate(glm::vec3(0, 5, -400.f));
-	modelViewMatrixStack.Scale(0.15f);
-	modelViewMatrixStack.Rotate(glm::vec3(0, 1, 0), 90.f);
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-	//pMainProgram->SetUniform("bUseTexture", false);
-	m_spacePod->Render();
-	modelViewMatrixStack.Pop();
-
-
-
-	//directional light
-	CShaderProgram* pLightProgram = (*m_pShaderPrograms)[0];
+	// The moving objects are lit by every light near them, through the light grid: the spotlight over the player, the blue
+	// one over the track, a light on each pickup and one above each track marker in view
+	m_pLightGrid->Clear();
+	m_pLightGrid->AddSpotLight(glm::vec3(lightPosition1), 150.0f, glm::vec3(1.0f), glm::vec3(0, -1, 0), 30.0f, 20.0f);
+	m_pLightGrid->AddSpotLight(glm::vec3(lightPosition2), 150.0f, glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0, -1, 0), 30.0f, 20.0f);
+	m_pLightGrid->AddPointLight(state.objPos, 40.0f, glm::vec3(0.2f, 1.0f, 0.3f));
+	m_pLightGrid->AddPointLight(state.objPos2, 40.0f, glm::vec3(1.0f, 0.2f, 0.1f));
+	const vector<glm::mat4> &markers = m_pEntities->GetDrawList(ENTITY_MESH_MARKER);
+	for (unsigned int i = 0; i < markers.size(); i++)
+		m_pLightGrid->AddPointLight(glm::vec3(markers[i][3]) + glm::vec3(0, 10, 0), 30.0f, glm::vec3(1.0f, 0.6f, 0.2f));
+	m_pLightGrid->Build(*m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix, width, height);
+
+	CShaderProgram* pLightProgram = (*m_pShaderPrograms)[3];
 	pLightProgram->UseProgram();
-
-
-	// Set light and materials
-	pLightProgram->SetUniform("light1.position", viewMatrix * lightPosition1);
-	pLightProgram->SetUniform("light1.La", glm::vec3(1.0f, 1.0f, 1.0f));
-	pLightProgram->SetUniform("light1.Ld", glm::vec3(1.0f, 1.0f, 1.0f));
-	pLightProgram->SetUniform("light1.Ls", glm::vec3(1.0f, 1.0f, 1.0f));
-	pLightProgram->SetUniform("light1.direction", glm::normalize(normalMatrix * glm::vec3(0, -1, 0)));
-	pLightProgram->SetUniform("light1.exponent", 20.0f);
-	pLightProgram->SetUniform("light1.cutoff", 30.0f);
-	pLightProgram->SetUniform("light2.position", viewMatrix * lightPosition2);
-	pLightProgram->SetUniform("light2.La", glm::vec3(0.0f, 0.0f, 1.0f));
-	pLightProgram->SetUniform("light2.Ld", glm::vec3(0.0f, 0.0f, 1.0f));
-	pLightProgram->SetUniform("light2.Ls", glm::vec3(0.0f, 0.0f, 1.0f));
-	pLightProgram->SetUniform("light2.direction", glm::normalize(normalMatrix * glm::vec3(0, -1, 0)));
-	pLightProgram->SetUniform("light2.exponent", 20.0f);
-	pLightProgram->SetUniform("light2.cutoff", 30.0f);
+	pLightProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	pLightProgram->SetUniform("sampler0", 0);
+	pLightProgram->SetUniform("vAmbient", glm::vec3(1.0f, 1.0f, 2.0f));
+	m_pLightGrid->Bind(pLightProgram, LIGHT_GRID_TEXTURE_UNIT);
+	m_pShadowMap->Bind(pLightProgram, viewMatrix, SHADOW_TEXTURE_UNIT);
+
+	// Set materials
+	pLightProgram->SetUniform("bUseTexture", false);
 	pLightProgram->SetUniform("material1.shininess", 15.0f);
-	pLightProgram->SetUniform("material1.Ma", glm::vec3(glow, 0.f, 0.2f));
+	pLightProgram->SetUniform("material1.Ma", glm::vec3(state.glow, 0.f, 0.2f));
 	pLightProgram->SetUniform("material1.Md", glm::vec3(1.0f, 1.0f, 1.0f));
 	pLightProgram->SetUniform("material1.Ms", glm::vec3(1.0f, 1.0f, 1.0f));
 
-	
-	//teetrahedron glow effect
-	if (glow >= 1.0f) {
-		glow_fade = true;
-	}
-	else if (glow < 0.f) {
-		glow_fade = false;
-	}
-	if (glow_fade) {
-		glow = glow- 0.01f;
-	}
-	else {
-		glow += 0.01f;
-	}
 
-	//toon based pickup
-	for (float i = 0; i < wallPoints.size(); i++) {
-		modelViewMatrixStack.Push();
-		modelViewMatrixStack.Translate(wallPoints[i]);
-		modelViewMatrixStack.Scale(8.0f);
-		pLightProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pLightProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-		// To turn off texture mapping and use the sphere colour only (currently white material), uncomment the next line
-		//pMainProgram->SetUniform("bUseTexture", false);
+	//toon based pickup, for the track markers in view
+	for (unsigned int i = 0; i < markers.size(); i++) {
+		glm::mat4 modelViewMatrix = viewMatrix * markers[i];
+		pLightProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrix);
+		pLightProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrix));
 		m_pObst->Render();
-		modelViewMatrixStack.Pop();
 	}
+	pLightProgram->SetUniform("bUseTexture", true);
 	pLightProgram->SetUniform("material1.shininess", 15.0f);
 	pLightProgram->SetUniform("material1.Ma", glm::vec3(0.f, 0.f, 0.f));
 	pLightProgram->SetUniform("material1.Md", glm::vec3(1.0f, 1.0f, 1.0f));
 	pLightProgram->SetUniform("material1.Ms", glm::vec3(1.0f, 1.0f, 1.0f));
 
 	// Render the player 
-	modelViewMatrixStack.Push();
-	modelViewMatrixStack.Translate(m_playerPos);
-	modelViewMatrixStack.Rotate(glm::vec3(0.0f, 1.0f, 0.0f), 180.f);
-	modelViewMatrixStack.Scale(0.05f);
-	pLightProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pLightProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+	SetModelMatrices(pLightProgram, viewMatrix, m_iSceneNodes[NODE_PLAYER]);
 	m_pPlayerMesh->Render();
-	modelViewMatrixStack.Pop();
 
 
 	//track
-	modelViewMatrixStack.Push();
-	pLightProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pLightProgram->SetUniform("matrices.normalMatrix",
-		m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	m_pCatmullRom->RenderTrack();
-	modelViewMatrixStack.Pop();
-
-	pMainProgram->UseProgram();
+	if (TESSELLATION) {
+		// The tessellated track is lit as the light program lights the strip
+		m_pTrackTessProgram->UseProgram();
+		m_pTrackTessProgram->SetUniform("sampler0", 0);
+		m_pTrackTessProgram->SetUniform("vAmbient", glm::vec3(1.0f, 1.0f, 2.0f));
+		m_pLightGrid->Bind(m_pTrackTessProgram, LIGHT_GRID_TEXTURE_UNIT);
+		m_pShadowMap->Bind(m_pTrackTessProgram, viewMatrix, SHADOW_TEXTURE_UNIT);
+		m_pTrackTessProgram->SetUniform("bUseTexture", true);
+		m_pTrackTessProgram->SetUniform("material1.shininess", 15.0f);
+		m_pTrackTessProgram->SetUniform("material1.Ma", glm::vec3(0.f, 0.f, 0.f));
+		m_pTrackTessProgram->SetUniform("material1.Md", glm::vec3(1.0f, 1.0f, 1.0f));
+		m_pTrackTessProgram->SetUniform("material1.Ms", glm::vec3(1.0f, 1.0f, 1.0f));
+	}
+	RenderTrack(pLightProgram, false, viewMatrix);
 
 	//cube pickup
-	modelViewMatrixStack.Push();
-	modelViewMatrixStack.Translate(m_objPos2);
-	modelViewMatrixStack.Scale(3+5.0f*glow);
-	modelViewMatrixStack.Rotate(glm::vec3(0, 1, 0), time_el * 0.1);
-	pMainProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+	SetModelMatrices(pLightProgram, viewMatrix, m_iSceneNodes[NODE_CUBE_PICKUP]);
 	m_pWall->Render();
-	modelViewMatrixStack.Pop();
+
+	glDepthFunc(GL_LESS);
+
+	// Render the skybox last, so it is only shaded where no opaque geometry was drawn
+	CShaderProgram* pSkyboxProgram = (*m_pShaderPrograms)[4];
+	pSkyboxProgram->UseProgram();
+	pSkyboxProgram->SetUniform("skybox", 0);
+	pSkyboxProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	pSkyboxProgram->SetUniform("matrices.viewMatrix", viewMatrix);
+	m_pSkybox->Render();
+
+	// Particles last, as they are blended over everything and write no depth
+	for (; m_uiBurstsSeen < state.numBursts; m_uiBurstsSeen++) {
+		if (state.numBursts - m_uiBurstsSeen > 4)
+			continue;		// Too old to still be in the snapshot
+		int iBurst = m_uiBurstsSeen % 4;
+		glm::vec4 vColour = state.burstKinds[iBurst] == 0 ? glm::vec4(0.2f, 1.0f, 0.3f, 1.0f) : glm::vec4(1.0f, 0.2f, 0.1f, 1.0f);
+		m_pParticles->Emit(state.burstPositions[iBurst], 100000, 40.0f, 2.0f, vColour);
+	}
+	if (state.offTrack && !state.freeLook)
+		m_pParticles->Emit(state.playerPos, (UINT) (m_dt * 20.0), 15.0f, 0.5f, glm::vec4(1.0f, 0.7f, 0.2f, 1.0f));
+	m_pParticles->Update((float) (m_dt * 0.001));
+	m_pParticles->Render(m_pCamera->GetPerspectiveProjectionMatrix(), viewMatrix);
+
+	if (m_bOverdrawView)
+		EndOverdraw(width, height);
 
 	pMainProgram->UseProgram();
 
 	CShaderProgram* fontProgram = (*m_pShaderPrograms)[1];
 
-	RECT dimensions = m_gameWindow.GetDimensions();
-	int height = dimensions.bottom - dimensions.top;
-
 	fontProgram->UseProgram();
 	glDisable(GL_DEPTH_TEST);
 	fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
 	fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
 	fontProgram->SetUniform("vColour", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-	m_pFtFont->Render(620, height - 20, 20, "Time elaspsed:%d", int(time_el *0.001f)); // div by thousand for milliseconds
-
-	if (int(time_el * 0.001f) == 60) {
-		freeLook = true;
-		gameOver = true;
-	}
-
+	m_pFtFont->Render(620, height - 20, 20, "Time elaspsed:%d", int(state.timeElapsed *0.001f)); // div by thousand for milliseconds
 
 	//controls fade out at the start of the game
-	if (int(time_el * 0.001f) < 5) {
+	if (int(state.timeElapsed * 0.001f) < 5) {
 		fontProgram->UseProgram();
 		glDisable(GL_DEPTH_TEST);
 		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
 		fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
-		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 0.0f, 0.0f, fadeout));
+		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 0.0f, 0.0f, state.fadeout));
 		m_pFtFont->Render(100, height - 300, 50, "Use A and D to control player");
 		m_pFtFont->Render(250, height - 400, 30, "You have 60 seconds!");
 	}
-	fadeout = fadeout - 0.01f;
-
 	//when free look is enabled
-	if (freeLook) {
+	if (state.freeLook) {
 		fontProgram->UseProgram();
 		glDisable(GL_DEPTH_TEST);
 		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
@@ -609,7 +1321,7 @@ void Game::Render()
 	}
 
 	//top down view is active
-	if (mapMode && !freeLook) {
+	if (state.mapMode && !state.freeLook) {
 			fontProgram->UseProgram();
 			glDisable(GL_DEPTH_TEST);
 			fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
@@ -617,7 +1329,7 @@ void Game::Render()
 			fontProgram->SetUniform("vColour", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
 			m_pFtFont->Render(275, height - 20, 20, "Top View: On");
 	}
-	else if(!freeLook) {
+	else if(!state.freeLook) {
 		fontProgram->UseProgram();
 		glDisable(GL_DEPTH_TEST);
 		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
@@ -631,9 +1343,18 @@ void Game::Render()
 	fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
 	fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
 	fontProgram->SetUniform("vColour", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
-	m_pFtFont->Render(20, height - 20, 20, "Score: %d", score);
+	m_pFtFont->Render(20, height - 20, 20, "Score: %d", state.score);
+
+	if (state.offTrack && !state.freeLook) {
+		fontProgram->UseProgram();
+		glDisable(GL_DEPTH_TEST);
+		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
+		fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
+		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+		m_pFtFont->Render(20, height - 50, 20, "Track edge!");
+	}
 
-	if (gameOver && freeLook) {
+	if (state.gameOver && state.freeLook) {
 		fontProgram->UseProgram();
 		glDisable(GL_DEPTH_TEST);
 		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
@@ -642,6 +1363,35 @@ void Game::Render()
 		m_pFtFont->Render(250, height - 300, 50, "Game Over");
 	}
 
+	if (m_bOverdrawView) {
+		fontProgram->UseProgram();
+		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+		m_pFtFont->Render(20, height - 80, 20, "Overdraw: %.2f  Depth pre-pass: %s", m_fOverdraw, m_bDepthPrepass ? "on" : "off");
+		m_pFtFont->Render(20, height - 110, 20, "Walls occluded: %d of %d", m_pOcclusionCuller->GetNumRejected(),
+			m_pOcclusionCuller->GetNumObjects());
+		m_pFtFont->Render(20, height - 140, 20, "Track segments drawn: %d of %d", m_pCatmullRom->GetNumVisibleTrackSegments(),
+			m_pCatmullRom->GetNumTrackSegments());
+	}
+
+	if (m_bMemoryView) {
+		// A line per subsystem, red when its peak is over budget
+		fontProgram->UseProgram();
+		for (int i = 0; i < NUM_MEMORY_TAGS; i++) {
+			bool bOver = (MEMORY_BUDGETS_MB[i][0] > 0.0f && CMemoryTracker::GetCpuPeak(i) > MEMORY_BUDGETS_MB[i][0] * 1048576) ||
+				(MEMORY_BUDGETS_MB[i][1] > 0.0f && CMemoryTracker::GetGpuPeak(i) > MEMORY_BUDGETS_MB[i][1] * 1048576);
+			fontProgram->SetUniform("vColour", bOver ? glm::vec4(1.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+			m_pFtFont->Render(width - 520, height - 30 - 25 * i, 18, "%s: CPU %.1f MB (peak %.1f), GPU %.1f MB (peak %.1f)",
+				CMemoryTracker::GetTagName(i), CMemoryTracker::GetCpuBytes(i) / 1048576.0, CMemoryTracker::GetCpuPeak(i) / 1048576.0,
+				CMemoryTracker::GetGpuBytes(i) / 1048576.0, CMemoryTracker::GetGpuPeak(i) / 1048576.0);
+		}
+		if (m_pTiledTerrain != NULL) {
+			fontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+			m_pFtFont->Render(width - 520, height - 30 - 25 * NUM_MEMORY_TAGS, 18, "Terrain tiles: %d of %d resident, %d loading, %u streamed",
+				m_pTiledTerrain->GetNumResidentTiles(), m_pTiledTerrain->GetNumTiles(), m_pTiledTerrain->GetNumLoadingTiles(),
+				m_pTiledTerrain->GetNumTilesStreamed());
+		}
+	}
+
 
 
 
@@ -650,17 +1400,53 @@ void Game::Render()
 	
 	DisplayFrameRate();
 
+	m_pStreamingBuffer->EndFrame();
+
+	// Inside the profiled frame, so the cost of capturing shows in the frame times
+	if (m_pFrameCapture != NULL) {
+		char szName[64];
+		sprintf_s(szName, "%s_%05d", FLYTHROUGH_VIEW_NAMES[m_iFlythroughView], m_iFlythroughFrame);
+		m_pFrameCapture->Capture(szName);
+	}
+
+	if (m_pFrameProfiler != NULL)
+		m_pFrameProfiler->EndFrame();
+
 	// Swap buffers to show the rendered image
 	SwapBuffers(m_gameWindow.Hdc());		
 
+	// The frame's arena allocations are finished with.  The matrix stack still holds some, but only to hand them back.
+	UINT uiHeapAllocations = CFrameArena::EndHeapCheck();
+	CFrameArena::SetCurrent(NULL);
+	m_pFrameArena->Reset();
+	m_uiFramesRendered++;
+
+	// A steady-state frame allocates nothing from the general heap.  The benchmarks keep their results as they go, so their
+	// frames are not held to it.
+	assert(uiHeapAllocations == 0 || m_uiFramesRendered <= HEAP_CHECK_WARMUP_FRAMES || m_pFrameProfiler != NULL ||
+		STATIC_BATCH_BENCHMARK);
 }
 
-// Update method runs repeatedly with the Render method
-void Game::Update() 
+// Update method runs once per simulation tick on the simulation thread, from Tick
+void Game::Update(const CameraInput &cameraInput) 
 {
+	//teetrahedron glow effect
+	if (glow >= 1.0f) {
+		glow_fade = true;
+	}
+	else if (glow < 0.f) {
+		glow_fade = false;
+	}
+	if (glow_fade) {
+		glow = glow- 0.01f;
+	}
+	else {
+		glow += 0.01f;
+	}
+	fadeout = fadeout - 0.01f;
 
 	if (freeLook) {
-		m_pCamera->Update(m_dt, true);
+		m_pCamera->Update(m_simDt, cameraInput);
 
 	}
 	
@@ -668,9 +1454,14 @@ void Game::Update()
 		m_prevPos = m_pCamera->GetPosition();
 		
 
-		time_el += m_dt;
+		time_el += m_simDt;
+
+		if (int(time_el * 0.001f) == 60) {
+			freeLook = true;
+			gameOver = true;
+		}
 
-		m_currentDistance += m_dt * 0.1f;
+		m_currentDistance += m_simDt * 0.1f;
 		glm::vec3 p;
 
 		m_pCatmullRom->Sample(m_currentDistance, p);
@@ -689,46 +1480,29 @@ void Game::Update()
 		p.x += m_cameraMovement *N.x;
 		p.z += m_cameraMovement * N.z;
 
-		//updating pickup points set 1 
-
-		if (abs(m_objPos.z) > abs(p.z)) {
-			if (abs(m_objPos.x) - abs(p.x) <= 5 && abs(m_objPos.z) - abs(p.z) <= 5) { // checking for collision
-				if (currentPickUp < pickupPoints.size() - 1) {
-					currentPickUp += 1;
-					score++;
-				}
-				m_objPos = pickupPoints[currentPickUp];
-
-				if (currentPickUp == pickupPoints.size() - 1) {
-					currentPickUp = 0;
-				}
-
+		// Keep the player between the offset curves, using the track frame at the player's position
+		TrackFrame frame;
+		if (m_pCatmullRom->ProjectOntoTrack(p, frame)) {
+			float halfWidth = m_pCatmullRom->GetTrackWidth() / 2.0f - 5.0f;
+			m_offTrack = fabs(frame.lateralOffset) > halfWidth;
+			if (m_offTrack) {
+				float offset = glm::clamp(frame.lateralOffset, -halfWidth, halfWidth);
+				m_cameraMovement = glm::clamp(m_cameraMovement, -halfWidth, halfWidth);
+				p.x = frame.point.x + offset * frame.N.x;
+				p.z = frame.point.z + offset * frame.N.z;
 			}
 		}
-		//updating set 2
-		if (abs(m_objPos2.z) > abs(p.z)) {
-			if (abs(m_objPos2.x) - abs(p.x) <= 5 && abs(m_objPos2.z) - abs(p.z) <= 5) { // checking for collision
-				if (currentPickUp2 < pickupPoints.size() - 1) {
-					currentPickUp2 += 1;
-					score++;
-				}
-				m_objPos2 = pickupPoints2[currentPickUp2];
-
-				if (currentPickUp2 == pickupPoints2.size() - 1) {
-					currentPickUp2 = 0;
-				}
 
-			}
+		//updating both pickup sets
+		m_collected.clear();
+		score += m_pEntities->CollectPickups(p, &m_collected);
+		for (unsigned int i = 0; i < m_collected.size(); i++) {
+			int iBurst = m_uiNumBursts++ % 4;
+			m_burstPositions[iBurst] = p;
+			m_burstKinds[iBurst] = m_collected[i] == m_pickupEntities[0] ? 0 : 1;
 		}
 
 
-
-
-		// Update the camera using the amount of time that has elapsed to avoid framerate dependent motion
-		m_pCamera->Update(m_dt, false);
-
-
-
 		if (mapMode) { //setting top down view while still having player controls 
 			
 
@@ -750,6 +1524,228 @@ void Game::Update()
 	}
 	}
 
+// Copy the state needed by Render into the next snapshot and hand it to the render thread
+void Game::PublishSnapshot()
+{
+	GameSnapshot &state = m_snapshots.GetWriteBuffer();
+	state.cameraPosition = m_pCamera->GetPosition();
+	state.cameraView = m_pCamera->GetView();
+	state.cameraUpVector = m_pCamera->GetUpVector();
+	state.playerPos = m_playerPos;
+	state.objPos = m_pEntities->GetPosition(m_pickupEntities[0]);
+	state.objPos2 = m_pEntities->GetPosition(m_pickupEntities[1]);
+	state.timeElapsed = time_el;
+	state.glow = glow;
+	state.fadeout = fadeout;
+	state.trackDistance = m_currentDistance;
+	state.score = score;
+	state.freeLook = freeLook;
+	state.mapMode = mapMode;
+	state.gameOver = gameOver;
+	state.offTrack = m_offTrack;
+	state.numBursts = m_uiNumBursts;
+	for (int i = 0; i < 4; i++) {
+		state.burstPositions[i] = m_burstPositions[i];
+		state.burstKinds[i] = m_burstKinds[i];
+	}
+	m_snapshots.Publish();
+}
+
+// Apply a key press from the window to the game state
+void Game::HandleKey(WPARAM key)
+{
+	switch (key) {
+	case '1':
+		m_pCamera->Set(glm::vec3(m_prevPos.x, 50.f, m_prevPos.z), m_playerPos, glm::vec3(0, 1, 0));
+		freeLook = true;
+		break;
+	case '2':
+		m_pCamera->SetPosition(m_prevPos);
+		freeLook = false;
+		break;
+	case 'M':
+		mapMode = true;
+		break;
+	case 'V':
+		mapMode = false;
+		break;
+	case 'D':
+		m_cameraMovement += m_simDt * 0.1f;
+		break;
+	case 'A':
+		m_cameraMovement -= m_simDt * 0.1f;
+		break;
+	}
+}
+
+// Runs one simulation tick.  The keys and the free-look camera's input come from the window, or from the replay when one is
+// playing, and are applied before and by Update.  Recording keeps them and the state checksum after the tick; playback compares
+// the checksum with the recording.
+void Game::Tick()
+{
+	vector<WPARAM> keys;
+	CameraInput cameraInput;
+	{
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		keys.swap(m_pendingKeys);
+		cameraInput = m_pendingCameraInput;
+		m_pendingCameraInput.mouseX = m_pendingCameraInput.mouseY = 0;
+	}
+	if (m_pReplay != NULL && m_pReplay->IsPlaying()) {
+		keys.clear();
+		m_pReplay->GetKeys(m_uiTick, keys);
+		cameraInput = m_pReplay->GetCamera(m_uiTick);
+	}
+
+	for (unsigned int i = 0; i < keys.size(); i++) {
+		if (m_pReplay != NULL && m_pReplay->IsRecording())
+			m_pReplay->RecordKey(m_uiTick, keys[i]);
+		HandleKey(keys[i]);
+	}
+
+	// The camera input only moves the free-look camera, so only the ticks it is applied on are kept
+	if (m_pReplay != NULL && m_pReplay->IsRecording() && freeLook && !cameraInput.IsEmpty())
+		m_pReplay->RecordCamera(m_uiTick, cameraInput);
+
+	Update(cameraInput);
+
+	if (m_pReplay != NULL) {
+		UINT uiChecksum = ComputeStateChecksum();
+		if (m_pReplay->IsRecording())
+			m_pReplay->RecordChecksum(m_uiTick, uiChecksum);
+		else
+			m_pReplay->CheckChecksum(m_uiTick, uiChecksum);
+	}
+	m_uiTick++;
+	if (m_pReplay != NULL && m_pReplay->IsFinished(m_uiTick))
+		m_bReplayFinished = true;
+}
+
+// Hash of the game state that Update changes.  Two runs given the same input on the same ticks must produce the same value
+// after every tick.
+UINT Game::ComputeStateChecksum()
+{
+	glm::vec3 vCamera[3] = { m_pCamera->GetPosition(), m_pCamera->GetView(), m_pCamera->GetUpVector() };
+	BYTE flags[4] = { (BYTE) freeLook, (BYTE) mapMode, (BYTE) gameOver, (BYTE) m_offTrack };
+	glm::vec3 vPickups[2] = { m_pEntities->GetPosition(m_pickupEntities[0]), m_pEntities->GetPosition(m_pickupEntities[1]) };
+	int iPickupStops[2] = { m_pEntities->GetPickupStop(m_pickupEntities[0]), m_pEntities->GetPickupStop(m_pickupEntities[1]) };
+
+	UINT uiHash = CInputReplay::Hash(&m_playerPos, sizeof(m_playerPos));
+	uiHash = CInputReplay::Hash(&m_currentDistance, sizeof(m_currentDistance), uiHash);
+	uiHash = CInputReplay::Hash(&m_cameraMovement, sizeof(m_cameraMovement), uiHash);
+	uiHash = CInputReplay::Hash(vCamera, sizeof(vCamera), uiHash);
+	uiHash = CInputReplay::Hash(vPickups, sizeof(vPickups), uiHash);
+	uiHash = CInputReplay::Hash(iPickupStops, sizeof(iPickupStops), uiHash);
+	uiHash = CInputReplay::Hash(&score, sizeof(score), uiHash);
+	uiHash = CInputReplay::Hash(&time_el, sizeof(time_el), uiHash);
+	uiHash = CInputReplay::Hash(&glow, sizeof(glow), uiHash);
+	uiHash = CInputReplay::Hash(&fadeout, sizeof(fadeout), uiHash);
+	return CInputReplay::Hash(flags, sizeof(flags), uiHash);
+}
+
+// Plays the whole replay back on this thread with nothing rendered, then writes how long the ticks took and whether the
+// state matched the recording to replay_check.csv.  Returns 0 if it matched and 2 if it diverged.
+int Game::RunHeadlessReplay()
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+	while (!m_bReplayFinished)
+		Tick();
+	double dElapsed = timer.Elapsed();
+
+	UINT uiTicks = m_pReplay->GetNumTicks();
+	int iDivergent = m_pReplay->GetFirstDivergentTick();
+	std::ofstream file("replay_check.csv");
+	file << "file,ticks,sim_ms,ms_per_tick,first_divergent_tick\n";
+	file << m_sReplayFile << "," << uiTicks << "," << dElapsed << "," << (uiTicks > 0 ? dElapsed / uiTicks : 0.0) << "," << iDivergent << "\n";
+
+	char szLine[512];
+	if (iDivergent < 0)
+		sprintf_s(szLine, "Replay %s: %u ticks matched in %.3f ms\n", m_sReplayFile.c_str(), uiTicks, dElapsed);
+	else
+		sprintf_s(szLine, "Replay %s: diverged at tick %d of %u\n", m_sReplayFile.c_str(), iDivergent, uiTicks);
+	OutputDebugString(szLine);
+	return iDivergent < 0 ? 0 : 2;
+}
+
+// Moves the benchmark camera FLYTHROUGH_SPEED along the centreline, placed as the current view places it, and publishes the
+// state for Render.  The step is per frame, not per unit of time, so every run renders the same frames.  After the requested
+// laps the view's results are written and the next view starts from the beginning.  Returns false when every view is done.
+bool Game::UpdateFlythrough()
+{
+	if (m_pCatmullRom->CurrentLap(m_currentDistance) >= m_iFlythroughLaps) {
+		const char *szView = FLYTHROUGH_VIEW_NAMES[m_iFlythroughView];
+		m_pFrameProfiler->WriteResults(string("flythrough_") + szView + ".csv", "flythrough_summary.csv", szView);
+		m_currentDistance = 0.0f;
+		m_iFlythroughFrame = -1;
+		if (++m_iFlythroughView > m_iFlythroughLastView)
+			return false;
+	}
+	m_iFlythroughFrame++;
+
+	m_currentDistance += FLYTHROUGH_SPEED;
+	glm::vec3 p, pNext;
+	m_pCatmullRom->Sample(m_currentDistance, p);
+	m_pCatmullRom->Sample(m_currentDistance + 1.0f, pNext);
+	glm::vec3 T = glm::normalize(pNext - p);
+	glm::vec3 look_at = p + 10.0f * T;
+
+	m_playerPos = p;
+	freeLook = m_iFlythroughView == FLYTHROUGH_FREE;
+	mapMode = m_iFlythroughView == FLYTHROUGH_MAP;
+	switch (m_iFlythroughView) {
+	case FLYTHROUGH_CHASE:
+		// As Update places the chase camera
+		m_pCamera->Set(glm::vec3(p.x, 20, pNext.z > p.z ? p.z - 100.f : p.z + 100.f), look_at, glm::vec3(0, 1, 0));
+		break;
+	case FLYTHROUGH_MAP:
+		m_pCamera->Set(glm::vec3(p.x, 300, p.z), look_at, glm::vec3(0, 1, 0));
+		break;
+	case FLYTHROUGH_FREE:
+		// High behind the player looking down the track, where the view frustum is all that culls it
+		m_pCamera->Set(p - 60.0f * T + glm::vec3(0, 80, 0), p + 200.0f * T, glm::vec3(0, 1, 0));
+		break;
+	}
+
+	PublishSnapshot();
+	return true;
+}
+
+// The simulation thread runs Update at a fixed tick and publishes a snapshot after each batch of ticks
+void Game::SimulationLoop()
+{
+	CHighResolutionTimer timer;
+	double accumulator = 0.0;
+	timer.Start();
+
+	while (m_bSimulationRunning) {
+		if (!m_bAppActive) {
+			Sleep(200); // Do not consume processor power if application isn't active
+			timer.Start();
+			continue;
+		}
+
+		accumulator += timer.Elapsed();
+		timer.Start();
+
+		// Avoid a spiral of catch-up ticks after a long stall
+		if (accumulator > 10 * m_simDt)
+			accumulator = 10 * m_simDt;
+
+		bool bUpdated = false;
+		while (accumulator >= m_simDt && !m_bReplayFinished) {
+			Tick();
+			accumulator -= m_simDt;
+			bUpdated = true;
+		}
+
+		if (bUpdated)
+			PublishSnapshot();
+		else
+			Sleep(1);
+	}
+}
+
 
 
 
@@ -776,8 +1772,6 @@ void Game::DisplayFrameRate()
 		elapsedTime = 0;
 		m_iFramesPerSecond = frameCount;
 
-		time_el += 1.f;
-
 		// Reset the frames per second
         frameCount = 0;
 		
@@ -813,9 +1807,17 @@ void Game::GameLoop()
 	*/
 	
 	
-	// Variable timer
+	// Variable timer.  Update runs on the simulation thread, so the game loop only renders, and reads the free-look camera's
+	// keys and mouse for it: the simulation thread has no message queue, so it cannot see them.  A replay brings its own.
+	if (m_bSimulationRunning && (m_pReplay == NULL || !m_pReplay->IsPlaying())) {
+		CameraInput input = CCamera::SampleInput(m_snapshots.GetReadBuffer().freeLook);
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		m_pendingCameraInput.moveKeys = input.moveKeys;
+		m_pendingCameraInput.mouseX += input.mouseX;
+		m_pendingCameraInput.mouseY += input.mouseY;
+	}
+
 	m_pHighResolutionTimer->Start();
-	Update();
 	Render();
 	m_dt = m_pHighResolutionTimer->Elapsed();
 	
@@ -834,12 +1836,29 @@ WPARAM Game::Execute()
 
 	Initialise();
 
+	if (m_bHeadless) {
+		int iResult = RunHeadlessReplay();
+		ReleaseGraphics();
+		m_gameWindow.Deinit();
+		return iResult;
+	}
+
 	m_pHighResolutionTimer->Start();
 
+	// The flythrough benchmark owns the game state, so the simulation does not run
+	bool bFlythrough = m_iFlythroughView != FLYTHROUGH_NONE;
+	m_bSimulationRunning = !bFlythrough;
+	if (!bFlythrough)
+		m_simulationThread = std::thread(&Game::SimulationLoop, this);
+
 	
 	MSG msg;
 
 	while(1) {													
+		if (m_bReplayFinished) {
+			msg.wParam = m_pReplay->GetFirstDivergentTick() < 0 ? 0 : 2;
+			break;
+		}
 		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) { 
 			if(msg.message == WM_QUIT) {
 				break;
@@ -847,17 +1866,64 @@ WPARAM Game::Execute()
 
 			TranslateMessage(&msg);	
 			DispatchMessage(&msg);
+		} else if (bFlythrough) {
+			if (!UpdateFlythrough()) {
+				msg.wParam = m_pFrameCapture == NULL || m_pFrameCapture->Finish() ? 0 : 3;
+				break;
+			}
+			GameLoop();
 		} else if (m_bAppActive) {
 			GameLoop();
 		} 
 		else Sleep(200); // Do not consume processor power if application isn't active
 	}
 
+	m_bSimulationRunning = false;
+	if (m_simulationThread.joinable())
+		m_simulationThread.join();
+
+	if (m_pReplay != NULL && m_pReplay->IsRecording() && !m_pReplay->Save(m_sReplayFile)) {
+		char message[1024];
+		sprintf_s(message, "Cannot save replay\n%s\n", m_sReplayFile.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+	}
+
+	// Reported once the GL objects are gone, so any current GPU usage left in the report is a leak; the peaks still show the
+	// most each subsystem held
+	ReleaseGraphics();
+	CMemoryTracker::WriteReport("memory_report.csv");
+	CMemoryTracker::CheckBudgets();
 	m_gameWindow.Deinit();
 
 	return(msg.wParam);
 }
 
+// Free the GL objects the subsystems own while the context they were made in is still current.  The game is a static, so its
+// destructor only runs once the window, and the context with it, are gone.  The tiled terrain also joins its loaders here.
+void Game::ReleaseGraphics()
+{
+	if (m_pTiledTerrain != NULL)
+		m_pTiledTerrain->Release();
+	if (m_pCatmullRom != NULL)
+		m_pCatmullRom->Release();
+	if (m_pStreamingBuffer != NULL)
+		m_pStreamingBuffer->Release();
+	if (m_pStaticBatch != NULL)
+		m_pStaticBatch->Release();
+	if (m_pOcclusionCuller != NULL)
+		m_pOcclusionCuller->Release();
+	if (m_pParticles != NULL)
+		m_pParticles->Release();
+	if (m_pLightGrid != NULL)
+		m_pLightGrid->Release();
+	if (m_pShadowMap != NULL)
+		m_pShadowMap->Release();
+	if (m_pFrameProfiler != NULL)
+		m_pFrameProfiler->Release();
+	if (m_pFrameCapture != NULL)
+		m_pFrameCapture->Release();
+}
+
 LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_param) 
 {
 	LRESULT result = 0;
@@ -898,30 +1964,30 @@ LRESULT Game::ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_p
 		case VK_ESCAPE:
 			PostQuitMessage(0);
 			break;
+		// Render settings belong to this thread, so they change straight away
+		case 'O':
+			m_bOverdrawView = !m_bOverdrawView;
+			m_iOverdrawFrame = 0;
+			break;
+		case 'P':
+			m_bDepthPrepass = !m_bDepthPrepass;
+			break;
+		case 'R':
+			m_bMemoryView = !m_bMemoryView;
+			break;
 		case '1':
-			
-				m_pCamera->Set(glm::vec3(m_prevPos.x, 50.f, m_prevPos.z), m_playerPos, glm::vec3(0, 1, 0));
-				freeLook = true;;
-				break;
 		case '2':
-				m_pCamera->SetPosition(m_prevPos);
-				freeLook = false;
-				break;
 		case 'M':
-			mapMode = true;
-			break;
 		case 'V':
-			mapMode = false;
-			break;
 		case 'D':
-			m_cameraMovement += m_dt * 0.1f;
-		
-			break;
 		case 'A':
-			m_cameraMovement -= m_dt * 0.1f;
-			
+		{
+			// Game state belongs to the simulation thread, so queue the key for the next tick
+			std::lock_guard<std::mutex> lock(m_inputMutex);
+			m_pendingKeys.push_back(w_param);
 			break;
 		}
+		}
 
 		break;
 
@@ -949,15 +2015,85 @@ void Game::SetHinstance(HINSTANCE hinstance)
 	m_hHinstance = hinstance;
 }
 
+// Reads the replay options.  -record <file> saves the session's input when it ends; -replay <file> plays one back in real time,
+// and with -headless as fast as possible without rendering.
+bool Game::ParseCommandLine(const char *szCommandLine)
+{
+	std::istringstream stream(szCommandLine != NULL ? szCommandLine : "");
+	string sOption;
+	bool bRecord = false, bReplay = false;
+	while (stream >> sOption) {
+		if (sOption == "-record" || sOption == "-replay") {
+			if (!(stream >> m_sReplayFile)) {
+				MessageBox(NULL, "Usage: -record <file> | -replay <file> [-headless]", "Error", MB_ICONERROR);
+				return false;
+			}
+			(sOption == "-record" ? bRecord : bReplay) = true;
+		}
+		else if (sOption == "-headless")
+			m_bHeadless = true;
+		else if (sOption == "-benchmark") {
+			string sView;
+			stream >> sView;
+			m_iFlythroughView = FLYTHROUGH_CHASE;
+			m_iFlythroughLastView = FLYTHROUGH_FREE;
+			for (int i = FLYTHROUGH_CHASE; i < FLYTHROUGH_NONE; i++) {
+				if (sView == FLYTHROUGH_VIEW_NAMES[i])
+					m_iFlythroughView = m_iFlythroughLastView = i;
+			}
+			if (sView != "all" && m_iFlythroughView != m_iFlythroughLastView) {
+				MessageBox(NULL, "Usage: -benchmark chase|map|free|all [-laps <n>]", "Error", MB_ICONERROR);
+				return false;
+			}
+		}
+		else if (sOption == "-capture")
+			stream >> m_sCaptureDirectory;
+		else if (sOption == "-golden")
+			stream >> m_sGoldenDirectory;
+		else if (sOption == "-laps") {
+			stream >> m_iFlythroughLaps;
+			if (m_iFlythroughLaps < 1)
+				m_iFlythroughLaps = 1;
+		}
+	}
+	if (m_iFlythroughView == FLYTHROUGH_NONE && (!m_sCaptureDirectory.empty() || !m_sGoldenDirectory.empty())) {
+		MessageBox(NULL, "-capture and -golden need -benchmark, so the frames are the same every run", "Error", MB_ICONERROR);
+		return false;
+	}
+	if (m_iFlythroughView != FLYTHROUGH_NONE && (bRecord || bReplay)) {
+		MessageBox(NULL, "-benchmark cannot be combined with -record or -replay", "Error", MB_ICONERROR);
+		return false;
+	}
+
+	if (bRecord) {
+		m_pReplay = new CInputReplay;
+		m_pReplay->BeginRecording(m_simDt);
+	}
+	else if (bReplay) {
+		m_pReplay = new CInputReplay;
+		if (!m_pReplay->Load(m_sReplayFile))
+			return false;
+		if (m_pReplay->GetTickLength() != m_simDt) {
+			MessageBox(NULL, "The replay was recorded with a different tick length", "Error", MB_ICONERROR);
+			return false;
+		}
+		m_bReplayFinished = m_pReplay->IsFinished(0);
+	}
+	m_bHeadless = m_bHeadless && bReplay;
+	return true;
+}
+
 LRESULT CALLBACK WinProc(HWND window, UINT message, WPARAM w_param, LPARAM l_param)
 {
 	return Game::GetInstance().ProcessEvents(window, message, w_param, l_param);
 }
 
-int WINAPI WinMain(HINSTANCE hinstance, HINSTANCE, PSTR, int) 
+int WINAPI WinMain(HINSTANCE hinstance, HINSTANCE, PSTR szCommandLine, int) 
 {
 	Game &game = Game::GetInstance();
 	game.SetHinstance(hinstance);
+	if (!game.ParseCommandLine(szCommandLine))
+		return 1;
 
 	return game.Execute();
 }
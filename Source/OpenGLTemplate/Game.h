@@ -2,6 +2,11 @@
 
 #include "Common.h"
 #include "GameWindow.h"
+#include "TripleBuffer.h"
+#include "EntityStore.h"
+#include "Camera.h"
+#include <thread>
+#include <mutex>
 
 // Classes used in game.  For a new class, declare it here and provide a pointer to an object of this class below.  Then, in Game.cpp, 
 // include the header.  In the Game constructor, set the pointer to NULL and in Game::Initialise, create a new object.  Don't forget to 
@@ -19,15 +24,98 @@ class CCube;
 class CCatmullRom;
 class CTetrahedron;
 class CHeightMapTerrain;
+class CTiledTerrain;
+class CJobSystem;
+class CStreamingBuffer;
+class CStaticBatch;
+class COcclusionCuller;
+class CInputReplay;
+class CFrameProfiler;
+class CFrameCapture;
+class CFrameArena;
+class CTransformHierarchy;
+class CParticleSystem;
+class CLightGrid;
+class CShadowMap;
+
+// Everything Render needs from the simulation.  A new snapshot is published at the end of every simulation tick.
+struct GameSnapshot
+{
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraView;
+	glm::vec3 cameraUpVector;
+	glm::vec3 playerPos;
+	glm::vec3 objPos;
+	glm::vec3 objPos2;
+	double timeElapsed;
+	float glow;
+	float fadeout;
+	float trackDistance;	// The player's arc length along the track
+	int score;
+	bool freeLook;
+	bool mapMode;
+	bool gameOver;
+	bool offTrack;
+	// Pickups collected, as a count since the start and the most recent few.  Render fires a burst for each one it has not
+	// seen, so none is lost however many ticks pass between frames.
+	UINT numBursts;
+	glm::vec3 burstPositions[4];
+	int burstKinds[4];			// Index into m_pickupEntities
+};
 
 class Game {
 private:
-	// Three main methods used in the game.  Initialise runs once, while Update and Render run repeatedly in the game loop.
+	// Three main methods used in the game.  Initialise runs once, Update runs at a fixed tick on the simulation thread, and 
+	// Render runs repeatedly in the game loop on the main thread, which owns the OpenGL context.
 	void Initialise();
-	void Update();
+	void Update(const CameraInput &cameraInput);
 	void Render();
-	
-	
+	void LoadShaders();
+	void BuildStaticBatch();
+	void RenderStaticBatch(int iPass, const glm::mat4 &viewMatrix, const glm::vec4 &lightEye);
+	void RenderDepthPrepass(bool bBatched, const glm::mat4 &viewMatrix);
+	void BeginOverdraw();
+	void EndOverdraw(int iWidth, int iHeight);
+	void RecordStaticDrawTime(bool bBatched, double dElapsed);
+	void SetModelMatrices(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, int iNode);
+	void RenderShadowMaps(bool bBatched, int iWidth, int iHeight);
+	void RenderHeightmapTerrain(CShaderProgram *pProgram, bool bDepthOnly, bool bTessellate, glm::mat4 *pProjectionMatrix, const glm::mat4 &viewMatrix);
+	bool IsTerrainDrawnApart();
+	CShaderProgram* GetTerrainProgram(bool bDepthOnly, bool bTessellate);
+	void RenderTrack(CShaderProgram *pProgram, bool bDepthOnly, const glm::mat4 &viewMatrix);
+	void SetTessellationUniforms(CShaderProgram *pProgram);
+
+	void SimulationLoop();
+	void Tick();
+	UINT ComputeStateChecksum();
+	int RunHeadlessReplay();
+	void ReleaseGraphics();
+	bool UpdateFlythrough();
+	void PublishSnapshot();
+	void HandleKey(WPARAM key);
+
+	std::thread m_simulationThread;
+	std::atomic<bool> m_bSimulationRunning;
+	CTripleBuffer<GameSnapshot> m_snapshots;	// Simulation thread -> render thread
+	std::mutex m_inputMutex;
+	vector<WPARAM> m_pendingKeys;				// Key presses waiting to be applied by the simulation thread
+	CameraInput m_pendingCameraInput;			// The free-look keys last held and the mouse movement not yet applied
+	UINT m_uiTick;								// Simulation ticks run so far
+	CInputReplay *m_pReplay;					// The input being recorded or played back, or NULL
+	string m_sReplayFile;
+	bool m_bHeadless;							// Play the replay back as fast as possible without rendering
+	std::atomic<bool> m_bReplayFinished;
+
+	// The flythrough benchmark drives the camera along the centreline from the render thread, in place of the simulation
+	enum FlythroughView { FLYTHROUGH_CHASE, FLYTHROUGH_MAP, FLYTHROUGH_FREE, FLYTHROUGH_NONE };
+	int m_iFlythroughView;						// The view being benchmarked, or FLYTHROUGH_NONE
+	int m_iFlythroughLastView;
+	int m_iFlythroughLaps;
+	CFrameProfiler *m_pFrameProfiler;			// Created only for the flythrough benchmark
+	int m_iFlythroughFrame;						// Frames rendered in the current view
+	CFrameCapture *m_pFrameCapture;				// Reads back every flythrough frame, if -capture or -golden was given
+	string m_sCaptureDirectory;
+	string m_sGoldenDirectory;
 
 	// Pointers to game objects.  They will get allocated in Game::Initialise()
 	CSkybox *m_pSkybox;
@@ -45,11 +133,45 @@ private:
 	CSphere *m_pSphere;
 	CHighResolutionTimer *m_pHighResolutionTimer;
 	CCube *m_pCube;
-	CHeightMapTerrain* m_pHeightmapTerrain;
+	CHeightMapTerrain* m_pHeightmapTerrain;		// NULL with STREAMING_TERRAIN
+	CTiledTerrain* m_pTiledTerrain;				// The heightmap terrain streamed in tiles with STREAMING_TERRAIN, or NULL
+	CShaderProgram* m_pDepthProgram;			// The main shader's vertex stage writing depth only, for the pre-pass and the shadows
+	CShaderProgram* m_pOverdrawProgram;			// The overdraw heatmap
+	CShaderProgram* m_pStaticProgram;			// staticShader.vert, for CStaticBatch, or NULL if it is unsupported
+	CShaderProgram* m_pStaticDepthProgram;
+	CShaderProgram* m_pTerrainProgram;			// terrainShader.vert, for the displaced heightmap terrain
+	CShaderProgram* m_pTerrainDepthProgram;
+	CShaderProgram* m_pTerrainTessProgram;		// The terrainTess shaders, for the displaced terrain with TESSELLATION
+	CShaderProgram* m_pTerrainTessDepthProgram;
+	CShaderProgram* m_pTrackTessProgram;		// The trackTess shaders, for the track with TESSELLATION
+	CShaderProgram* m_pTrackTessDepthProgram;
+	CShaderProgram* m_pTileProgram;				// terrainTile.vert, for the streamed terrain
+	CShaderProgram* m_pTileDepthProgram;
+	float m_fTessProjScale;						// Eye-space length at distance 1 to pixels, for this frame's tessellation levels
+	CJobSystem* m_pJobSystem;
+	CStreamingBuffer* m_pStreamingBuffer;		// Per-frame dynamic vertex and uniform data
+	CStaticBatch* m_pStaticBatch;				// Static scene geometry, or NULL if multi-draw indirect is unavailable
+	vector<double> m_staticDrawTimes[2];		// CPU time to submit the static geometry each frame, per path, for STATIC_BATCH_BENCHMARK
 	
 
 	CCube* m_pWall;
-	vector<glm::vec3> wallPoints;
+	CEntityStore* m_pEntities;					// The walls, track markers and pickups
+	enum EntityMesh { ENTITY_MESH_MARKER, NUM_ENTITY_MESHES };	// Meshes drawn from the entity store's draw lists
+	vector<EntityID> m_wallEntities;			// The boundary walls, which never move, in cluster order
+	vector<glm::vec3> m_wallClusterCentres;		// Runs of WALLS_PER_CLUSTER walls, culled together
+	vector<int> m_wallClusterOrder;				// Indices of m_wallClusterCentres, nearest the camera first
+	COcclusionCuller* m_pOcclusionCuller;		// The wall clusters, tested against the depth pre-pass
+	// Transforms of the objects drawn on their own.  The scenery never moves; the pickups and the player are set every frame.
+	CTransformHierarchy* m_pTransforms;
+	enum SceneNode { NODE_SCENERY, NODE_TERRAIN, NODE_TRACK, NODE_POD, NODE_PICKUPS, NODE_SPHERE_PICKUP, NODE_CUBE_PICKUP,
+		NODE_PLAYER, NUM_SCENE_NODES };
+	int m_iSceneNodes[NUM_SCENE_NODES];
+	CShadowMap* m_pShadowMap;					// The sun's shadows: the static casters cached, the moving ones redrawn each frame
+	CLightGrid* m_pLightGrid;					// The lights on the moving objects, sorted into clusters of the view each frame
+	CParticleSystem* m_pParticles;				// Pickup bursts and the sparks when the player scrapes the edge
+	CShaderProgram* m_pParticleUpdateProgram;
+	CShaderProgram* m_pParticleRenderProgram;
+	UINT m_uiBurstsSeen;						// Render thread: snapshot bursts already emitted
 	float glow;
 	bool glow_fade;
 
@@ -58,9 +180,19 @@ private:
 	float phase;
 
 	// Some other member variables
-	double m_dt;
+	double m_dt;			// Render frame time
+	double m_simDt;			// Simulation tick length
 	int m_iFramesPerSecond;
-	bool m_bAppActive;
+	std::atomic<bool> m_bAppActive;
+	bool m_bDepthPrepass;		// Lay down the terrain and track depths before shading anything, toggled with P
+	bool m_bOverdrawView;		// Show how many fragments each pixel shaded as a heatmap, toggled with O
+	GLuint m_uiOverdrawQueries[2];	// Samples shaded this frame and last frame; last frame's is read, so nothing waits
+	GLuint m_uiOverdrawVAO;		// Empty, for the full screen triangle
+	int m_iOverdrawFrame;
+	float m_fOverdraw;			// Average fragments shaded per pixel
+	bool m_bMemoryView;			// Show each subsystem's memory against its budget, toggled with R
+	CFrameArena *m_pFrameArena;	// Transient allocations made while rendering, freed at the swap
+	UINT m_uiFramesRendered;
 	double time_el;
 	
 
@@ -78,20 +210,19 @@ private:
 
 	float m_currentDistance;
 	float m_cameraMovement;
+	bool m_offTrack;		// Set when the player has been pushed back from the edge of the track
 
 
-	glm::vec3 m_objPos;
-	glm::vec3 m_objPos2;
+	EntityID m_pickupEntities[2];	// The sphere and the cube, each on its own route
+	vector<EntityID> m_collected;	// Pickups collected this tick
+	UINT m_uiNumBursts;				// Pickups collected so far, with the last few as in GameSnapshot
+	glm::vec3 m_burstPositions[4];
+	int m_burstKinds[4];
 	int score;
 	
-	vector<glm::vec3> pickupPoints;
-	vector<glm::vec3> pickupPoints2;
-	int currentPickUp;
-	int currentPickUp2;
 	glm::vec3 finalPickUp;
 	glm::vec3 finalPickUp2;
 
-	vector<glm::vec3> obstaclePoints;
 	CTetrahedron* m_pObst; //obstacles that reduce player score
 
 	//variables for player movement from camera class
@@ -107,12 +238,42 @@ public:
 	static Game& GetInstance();
 	LRESULT ProcessEvents(HWND window,UINT message, WPARAM w_param, LPARAM l_param);
 	void SetHinstance(HINSTANCE hinstance);
+	// -record <file>, -replay <file> with optional -headless, or -benchmark chase|map|free|all with optional -laps <n>,
+	// -capture <directory> and -golden <directory>
+	bool ParseCommandLine(const char *szCommandLine);
 	WPARAM Execute();
 	bool collision(glm::vec3 vec1, glm::vec3 vec2);
 	
 
 private:
 	static const int FPS = 60;
+	static const int TICKS_PER_SECOND = 60;
+	static const bool SERIAL_STARTUP = false;	// Load assets one at a time on the main thread, for a baseline startup trace
+	static const bool VERTEX_BUFFER_BENCHMARK = false;	// Time the vertex buffer fill paths at startup and write a CSV
+	static const bool GPU_TERRAIN = true;		// Displace a grid by the heightmap in the vertex shader, in place of the baked mesh
+	static const bool TESSELLATION = true;		// Subdivide the displaced terrain and the track on the GPU by their size on screen
+	static const float TESS_PIXELS_PER_EDGE;	// Length on screen the tessellation splits edges down to
+	static const bool STREAMING_TERRAIN = false;	// Stream the heightmap terrain in untessellated tiles from a memory-mapped file, in place of CHeightMapTerrain
+	static const int TERRAIN_TILE_SIZE = 51;	// Pixels a side, so the 201 pixel heightmap makes 4 by 4 tiles
+	static const int TERRAIN_TILE_BUDGET = 16;	// Tiles resident at once
+	static const int TERRAIN_TILE_LOADERS = 2;	// Threads paging tiles in
+	static const float TERRAIN_STREAM_RADIUS;	// Tiles within this distance of the camera are streamed in
+	static const bool ENTITY_BENCHMARK = false;	// Time the entity store's systems at up to 100k entities at startup and write a CSV
+	static const bool STATIC_BATCH_BENCHMARK = false;	// Alternate the static geometry between per-object draws and the batch, and write a CSV
+	static const int STATIC_BATCH_BENCHMARK_FRAMES = 1000;	// Frames to time on each path
+	static const int WALLS_PER_CLUSTER = 10;
+	static const float TRACK_WINDOW_BEHIND;		// Arc length of track drawn behind and ahead of the player in the chase views
+	static const float TRACK_WINDOW_AHEAD;
+	static const float FLYTHROUGH_SPEED;		// Arc length the flythrough camera moves each frame
+	static const int FRAME_ARENA_SIZE = 256 * 1024;
+	static const UINT PARTICLE_CAPACITY = 1 << 20;
+	static const int STATIC_SHADOW_MAP_SIZE = 2048;
+	static const int DYNAMIC_SHADOW_MAP_SIZE = 512;
+	static const float DYNAMIC_CASTER_RADIUS;	// Bounds each moving caster around its origin
+	static const int LIGHT_GRID_TEXTURE_UNIT = 1;	// And the two after it
+	static const int SHADOW_TEXTURE_UNIT = 4;		// And the one after it
+	static const int TERRAIN_HEIGHT_TEXTURE_UNIT = 6;
+	static const UINT HEAP_CHECK_WARMUP_FRAMES = 60;	// Frames for the reused render buffers to reach their size, before Render may not allocate
 	void DisplayFrameRate();
 	void GameLoop();
 	GameWindow m_gameWindow;
@@ -1,16 +1,24 @@
 #include "HeightMapTerrain.h"
+#include "StaticBatch.h"
+#include "Shaders.h"
+#include "FrameProfiler.h"
+#include <cfloat>
 #pragma comment(lib, "lib/FreeImage.lib")
 
 
 CHeightMapTerrain::CHeightMapTerrain()
 {
 	m_dib = NULL;
+	m_bDisplace = false;
+	m_heightScale = 1.0f;
+	m_uiHeightTexture = 0;
+	m_uiPatchVAO = 0;
+	m_iPatches = 0;
+	m_uiTessVAO = 0;
 }
 
 CHeightMapTerrain::~CHeightMapTerrain()
-{
-	delete[] m_heightMap;
-}
+{}
 
 // Convert a point from image (pixel) coordinates to world coordinates
 glm::vec3 CHeightMapTerrain::ImageToWorldCoordinates(glm::vec3 p)
@@ -81,7 +89,17 @@ bool CHeightMapTerrain::GetImageBytes(char* terrainFilename, BYTE** bDataPointer
 }
 
 // This function generates a heightmap terrain based on a bitmap
-bool CHeightMapTerrain::Create(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale)
+bool CHeightMapTerrain::Create(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale, bool bDisplace)
+{
+	if (Decode(terrainFilename, textureFilename, origin, terrainSizeX, terrainSizeZ, terrainHeightScale, bDisplace) == false)
+		return false;
+
+	Upload();
+	return true;
+}
+
+// Read the heightmap and texture and build the mesh, or the height texels, on the CPU
+bool CHeightMapTerrain::Decode(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale, bool bDisplace)
 {
 	BYTE* bDataPointer;
 	unsigned int width, height;
@@ -94,14 +112,25 @@ bool CHeightMapTerrain::Create(char* terrainFilename, char* textureFilename, glm
 	m_origin = origin;
 	m_terrainSizeX = terrainSizeX;
 	m_terrainSizeZ = terrainSizeZ;
+	m_heightScale = terrainHeightScale;
+	m_bDisplace = bDisplace;
 
 	// Allocate memory and initialize to store the image
-	m_heightMap = new float[m_width * m_height];
-	if (m_heightMap == NULL)
-		return false;
-
-	// Clear the heightmap
-	memset(m_heightMap, 0, m_width * m_height * sizeof(float));
+	m_heightMap.assign(m_width * m_height, 0.0f);
+
+	if (m_bDisplace) {
+		// The same heights as the mesh below, and the grey level normalised to 16 bits for the texture
+		m_heightTexels.resize(m_width * m_height);
+		for (int i = 0; i < m_width * m_height; i++) {
+			float grayScale = (bDataPointer[i * 3] + bDataPointer[i * 3 + 1] + bDataPointer[i * 3 + 2]) / 3.0f;
+			m_heightMap[i] = ((grayScale - 128.0f) / 128.0f + m_origin.y) * terrainHeightScale;
+			m_heightTexels[i] = (unsigned short) (grayScale / 255.0f * 65535.0f + 0.5f);
+		}
+		FreeImage_Unload(m_dib);
+		SetResolution(max(m_width, m_height) - 1);
+		m_texture.Decode(textureFilename);
+		return true;
+	}
 
 	// Form mesh
 	std::vector<CVertex> vertices;
@@ -152,15 +181,91 @@ bool CHeightMapTerrain::Create(char* terrainFilename, char* textureFilename, glm
 	}
 
 	// Create a face vertex mesh
-	m_mesh.CreateFromTriangleList(vertices, triangles);
+	m_mesh.BuildFromTriangleList(vertices, triangles);
 
 	// Load a texture for texture mapping the mesh
-	m_texture.Load(textureFilename, true);
+	m_texture.Decode(textureFilename);
 
 
 
 	return true;
 }
+
+// Create the OpenGL mesh and texture from the data read by Decode
+void CHeightMapTerrain::Upload()
+{
+	m_texture.Upload(true);
+	if (!m_bDisplace) {
+		m_mesh.Upload();
+		return;
+	}
+
+	glGenTextures(1, &m_uiHeightTexture);
+	glBindTexture(GL_TEXTURE_2D, m_uiHeightTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, m_width, m_height, 0, GL_RED, GL_UNSIGNED_SHORT, &m_heightTexels[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	CMemoryTracker::TrackTexture(m_uiHeightTexture, (size_t) m_width * m_height * 2);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	TrackedVector<unsigned short>().swap(m_heightTexels);
+
+	// One patch of PATCH_QUADS by PATCH_QUADS quads, split as the mesh's are
+	glGenVertexArrays(1, &m_uiPatchVAO);
+	glBindVertexArray(m_uiPatchVAO);
+	m_vboPatch.Create(true);
+	m_vboPatch.Bind();
+	const int iSide = PATCH_QUADS + 1;
+	m_vboPatch.Reserve(iSide * iSide, PATCH_QUADS * PATCH_QUADS * 6);
+	for (int z = 0; z < iSide; z++) {
+		for (int x = 0; x < iSide; x++)
+			m_vboPatch.AddVertex(glm::vec2((float) x, (float) z));
+	}
+	for (int z = 0; z < PATCH_QUADS; z++) {
+		for (int x = 0; x < PATCH_QUADS; x++) {
+			unsigned int index = x + z * iSide;
+			m_vboPatch.AddTriangle(index, index + 1 + iSide, index + 1);
+			m_vboPatch.AddTriangle(index, index + iSide, index + 1 + iSide);
+		}
+	}
+	m_vboPatch.UploadDataToGPU(GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+
+	// The coarse patches for tessellation, corners unshared so each carries its own patch's height range.  terrainTess.tcnl
+	// culls a patch by the box that range gives it.
+	glGenVertexArrays(1, &m_uiTessVAO);
+	glBindVertexArray(m_uiTessVAO);
+	m_vboTessPatches.Create();
+	m_vboTessPatches.Bind();
+	m_vboTessPatches.Reserve(TESS_PATCHES * TESS_PATCHES * 4);
+	for (int z = 0; z < TESS_PATCHES; z++) {
+		for (int x = 0; x < TESS_PATCHES; x++) {
+			int x0 = x * (m_width - 1) / TESS_PATCHES, x1 = ((x + 1) * (m_width - 1) + TESS_PATCHES - 1) / TESS_PATCHES;
+			int z0 = z * (m_height - 1) / TESS_PATCHES, z1 = ((z + 1) * (m_height - 1) + TESS_PATCHES - 1) / TESS_PATCHES;
+			float fMin = FLT_MAX, fMax = -FLT_MAX;
+			for (int pz = z0; pz <= z1; pz++) {
+				for (int px = x0; px <= x1; px++) {
+					fMin = min(fMin, m_heightMap[px + pz * m_width]);
+					fMax = max(fMax, m_heightMap[px + pz * m_width]);
+				}
+			}
+			// Corners in the order the patch's edges are numbered in terrainTess.tcnl
+			float u0 = (float) x / TESS_PATCHES, u1 = (float) (x + 1) / TESS_PATCHES;
+			float v0 = (float) z / TESS_PATCHES, v1 = (float) (z + 1) / TESS_PATCHES;
+			m_vboTessPatches.AddVertex(glm::vec4(u0, v0, fMin, fMax));
+			m_vboTessPatches.AddVertex(glm::vec4(u1, v0, fMin, fMax));
+			m_vboTessPatches.AddVertex(glm::vec4(u1, v1, fMin, fMax));
+			m_vboTessPatches.AddVertex(glm::vec4(u0, v1, fMin, fMax));
+		}
+	}
+	m_vboTessPatches.UploadDataToGPU(GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), 0);
+	glBindVertexArray(0);
+}
 // For a point p in world coordinates, return the height of the terrain
 float CHeightMapTerrain::ReturnGroundHeight(glm::vec3 p)
 {
@@ -190,5 +295,60 @@ float CHeightMapTerrain::ReturnGroundHeight(glm::vec3 p)
 void CHeightMapTerrain::Render()
 {
 	m_texture.Bind();
-	m_mesh.Render();
+	if (!m_bDisplace) {
+		m_mesh.Render();
+		return;
+	}
+
+	glBindVertexArray(m_uiPatchVAO);
+	glDrawElementsInstanced(GL_TRIANGLES, PATCH_QUADS * PATCH_QUADS * 6, GL_UNSIGNED_INT, 0, m_iPatches * m_iPatches);
+	CFrameProfiler::CountDraws();
+}
+
+void CHeightMapTerrain::RenderTessellated()
+{
+	m_texture.Bind();
+	glBindVertexArray(m_uiTessVAO);
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	glDrawArrays(GL_PATCHES, 0, TESS_PATCHES * TESS_PATCHES * 4);
+	CFrameProfiler::CountDraws();
+}
+
+void CHeightMapTerrain::AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds)
+{
+	if (!m_bDisplace)
+		meshIds.push_back(m_mesh.AddToStaticBatch(pBatch, &m_texture));
+}
+
+bool CHeightMapTerrain::IsDisplaced()
+{
+	return m_bDisplace;
+}
+
+// The grid spans the same world rectangle as the mesh, from the first pixel to the last, and samples each pixel at its centre,
+// so its heights, and ReturnGroundHeight's, agree wherever a grid vertex falls on a pixel
+void CHeightMapTerrain::BindDisplacement(CShaderProgram *pProgram, int iUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + iUnit);
+	glBindTexture(GL_TEXTURE_2D, m_uiHeightTexture);
+	glActiveTexture(GL_TEXTURE0);
+
+	glm::vec3 vFirst = ImageToWorldCoordinates(glm::vec3(0.0f));
+	glm::vec3 vLast = ImageToWorldCoordinates(glm::vec3((float) (m_width - 1), 0.0f, (float) (m_height - 1)));
+	glm::vec2 vPixels((float) m_width, (float) m_height);
+	pProgram->SetUniform("heightMap", iUnit);
+	pProgram->SetUniform("terrain.vOrigin", glm::vec2(vFirst.x, vFirst.z));
+	pProgram->SetUniform("terrain.vSize", glm::vec2(vLast.x - vFirst.x, vLast.z - vFirst.z));
+	pProgram->SetUniform("terrain.vTexelScale", (vPixels - 1.0f) / vPixels);
+	pProgram->SetUniform("terrain.vTexelSize", 1.0f / vPixels);
+	// Height = texel * scale + bias, undoing the normalisation in Decode
+	pProgram->SetUniform("terrain.fHeightScale", 255.0f / 128.0f * m_heightScale);
+	pProgram->SetUniform("terrain.fHeightBias", (m_origin.y - 1.0f) * m_heightScale);
+	pProgram->SetUniform("terrain.iPatches", m_iPatches);
+	pProgram->SetUniform("terrain.fPatchQuads", (float) PATCH_QUADS);
+}
+
+void CHeightMapTerrain::SetResolution(int iQuads)
+{
+	m_iPatches = max(1, (iQuads + PATCH_QUADS - 1) / PATCH_QUADS);
 }
\ No newline at end of file
@@ -2,20 +2,41 @@
 
 #include "Common.h"
 #include "FaceVertexMesh.h"
+#include "VertexBufferBuilder.h"
 #include "include\freeimage\FreeImage.h"
 
+class CShaderProgram;
+
+// A terrain shaped by a greyscale heightmap.  By default every heightmap pixel becomes a vertex of a baked mesh.  With
+// bDisplace, the heights instead go to the GPU as a 16-bit texture, and one small grid patch, instanced across the terrain, is
+// displaced by it in terrainShader.vert, so the terrain costs 2 bytes a pixel in video memory and its resolution is just the
+// number of instances.  A displaced terrain can also be drawn as a coarse grid of patches that terrainTess.tcnl subdivides
+// by their size on screen.  Either way ReturnGroundHeight reads a CPU copy of the heights.
 class CHeightMapTerrain
 {
 public:
 	CHeightMapTerrain();
 	~CHeightMapTerrain();
-	bool Create(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale);
+	bool Create(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale, bool bDisplace = false);
+	bool Decode(char* terrainFilename, char* textureFilename, glm::vec3 origin, float terrainSizeX, float terrainSizeZ, float terrainHeightScale, bool bDisplace = false);	// Safe on a worker thread
+	void Upload();
 	float ReturnGroundHeight(glm::vec3 p);
 	void Render();
+	void AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds);	// Adds nothing when displaced
+
+	bool IsDisplaced();
+	// Binds the height texture to texture unit iUnit and sets pProgram's terrain uniforms.  pProgram must use
+	// terrainShader.vert and be in use.
+	void BindDisplacement(CShaderProgram *pProgram, int iUnit);
+	// Quads along each side of the displaced grid, rounded up to whole patches.  Defaults to one per heightmap pixel.
+	void SetResolution(int iQuads);
+	// Draws the displaced terrain as TESS_PATCHES by TESS_PATCHES patches for the terrainTess shaders, which take the same
+	// uniforms as terrainShader.vert
+	void RenderTessellated();
 
 private:
 	int m_width, m_height;
-	float* m_heightMap;
+	TrackedVector<float> m_heightMap;	// World height at each pixel, for ReturnGroundHeight
 	CFaceVertexMesh m_mesh;
 	UINT m_hTexture;
 	float m_terrainSizeX, m_terrainSizeZ;
@@ -23,6 +44,21 @@ private:
 	CTexture m_texture;
 	FIBITMAP* m_dib;
 
+	// Displacement
+	static const int PATCH_QUADS = 64;			// Along each side of the patch
+	bool m_bDisplace;
+	float m_heightScale;
+	TrackedVector<unsigned short> m_heightTexels;	// The normalised heights, until Upload
+	GLuint m_uiHeightTexture;
+	GLuint m_uiPatchVAO;
+	CVertexBufferBuilder<glm::vec2> m_vboPatch;	// Grid coordinates, in quads
+	int m_iPatches;								// Along each side of the terrain
+
+	// Tessellation
+	static const int TESS_PATCHES = 32;			// Along each side of the terrain
+	GLuint m_uiTessVAO;
+	CVertexBufferBuilder<glm::vec4> m_vboTessPatches;	// Four corners a patch: grid coordinates from 0 to 1, then the patch's lowest and highest world height
+
 	glm::vec3 WorldToImageCoordinates(glm::vec3 p);
 	glm::vec3 ImageToWorldCoordinates(glm::vec3 p);
 	bool GetImageBytes(char* terrainFilename, BYTE** bDataPointer, unsigned int& width, unsigned int& height);
@@ -0,0 +1,223 @@
+#include "InputReplay.h"
+#include <fstream>
+
+static const char REPLAY_MAGIC[4] = { 'R', 'P', 'L', 'Y' };
+static const UINT REPLAY_VERSION = 2;
+
+// Bytes in the header and in each event, as Save writes them
+static const UINT REPLAY_HEADER_SIZE = sizeof(REPLAY_MAGIC) + 4 * sizeof(UINT) + sizeof(double);
+static const UINT KEY_EVENT_SIZE = sizeof(UINT) + sizeof(BYTE);
+static const UINT CAMERA_EVENT_SIZE = sizeof(UINT) + sizeof(BYTE) + 2 * sizeof(int);
+
+CInputReplay::CInputReplay()
+{
+	m_bRecording = false;
+	m_bPlaying = false;
+	m_dTickLength = 0.0;
+	m_uiNextEvent = 0;
+	m_uiNextCameraEvent = 0;
+	m_iFirstDivergentTick = -1;
+}
+
+CInputReplay::~CInputReplay()
+{}
+
+void CInputReplay::BeginRecording(double dTickLength)
+{
+	m_bRecording = true;
+	m_bPlaying = false;
+	m_dTickLength = dTickLength;
+	m_events.clear();
+	m_cameraEvents.clear();
+	m_checksums.clear();
+}
+
+bool CInputReplay::Save(const string &sFilename)
+{
+	std::ofstream file(sFilename.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	UINT uiNumTicks = (UINT) m_checksums.size();
+	UINT uiNumEvents = (UINT) m_events.size();
+	UINT uiNumCameraEvents = (UINT) m_cameraEvents.size();
+	file.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+	file.write((const char*) &REPLAY_VERSION, sizeof(UINT));
+	file.write((const char*) &m_dTickLength, sizeof(double));
+	file.write((const char*) &uiNumTicks, sizeof(UINT));
+	file.write((const char*) &uiNumEvents, sizeof(UINT));
+	file.write((const char*) &uiNumCameraEvents, sizeof(UINT));
+	for (unsigned int i = 0; i < m_events.size(); i++) {
+		file.write((const char*) &m_events[i].uiTick, sizeof(UINT));
+		file.write((const char*) &m_events[i].key, sizeof(BYTE));
+	}
+	for (unsigned int i = 0; i < m_cameraEvents.size(); i++) {
+		const CameraInput &input = m_cameraEvents[i].input;
+		file.write((const char*) &m_cameraEvents[i].uiTick, sizeof(UINT));
+		file.write((const char*) &input.moveKeys, sizeof(BYTE));
+		file.write((const char*) &input.mouseX, sizeof(int));
+		file.write((const char*) &input.mouseY, sizeof(int));
+	}
+	if (uiNumTicks > 0)
+		file.write((const char*) &m_checksums[0], uiNumTicks * sizeof(UINT));
+	return file.good();
+}
+
+bool CInputReplay::Load(const string &sFilename)
+{
+	std::ifstream file(sFilename.c_str(), std::ios::binary | std::ios::ate);
+	UINT64 fileSize = file ? (UINT64) file.tellg() : 0;
+	file.seekg(0);
+
+	char magic[4];
+	UINT uiVersion = 0, uiNumTicks = 0, uiNumEvents = 0, uiNumCameraEvents = 0;
+	file.read(magic, sizeof(magic));
+	file.read((char*) &uiVersion, sizeof(UINT));
+	file.read((char*) &m_dTickLength, sizeof(double));
+	file.read((char*) &uiNumTicks, sizeof(UINT));
+	file.read((char*) &uiNumEvents, sizeof(UINT));
+	file.read((char*) &uiNumCameraEvents, sizeof(UINT));
+	if (!file || memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 || uiVersion != REPLAY_VERSION) {
+		char message[1024];
+		sprintf_s(message, "Cannot load replay\n%s\n", sFilename.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	// The counts must account for the rest of the file exactly before anything is sized by them, so a truncated or corrupt
+	// header cannot ask for a huge allocation
+	UINT64 expectedSize = REPLAY_HEADER_SIZE + (UINT64) uiNumEvents * KEY_EVENT_SIZE +
+		(UINT64) uiNumCameraEvents * CAMERA_EVENT_SIZE + (UINT64) uiNumTicks * sizeof(UINT);
+	bool bValid = expectedSize == fileSize;
+	if (bValid) {
+		m_events.resize(uiNumEvents);
+		for (UINT i = 0; i < uiNumEvents && file; i++) {
+			file.read((char*) &m_events[i].uiTick, sizeof(UINT));
+			file.read((char*) &m_events[i].key, sizeof(BYTE));
+		}
+		m_cameraEvents.resize(uiNumCameraEvents);
+		for (UINT i = 0; i < uiNumCameraEvents && file; i++) {
+			CameraInput &input = m_cameraEvents[i].input;
+			file.read((char*) &m_cameraEvents[i].uiTick, sizeof(UINT));
+			file.read((char*) &input.moveKeys, sizeof(BYTE));
+			file.read((char*) &input.mouseX, sizeof(int));
+			file.read((char*) &input.mouseY, sizeof(int));
+		}
+		m_checksums.resize(uiNumTicks);
+		if (uiNumTicks > 0 && file)
+			file.read((char*) &m_checksums[0], uiNumTicks * sizeof(UINT));
+		bValid = file.good();
+
+		// Playback walks the events forward a tick at a time, so they must be in tick order and within the recording
+		for (UINT i = 0; i < uiNumEvents && bValid; i++)
+			bValid = m_events[i].uiTick < uiNumTicks && (i == 0 || m_events[i].uiTick >= m_events[i - 1].uiTick);
+		for (UINT i = 0; i < uiNumCameraEvents && bValid; i++)
+			bValid = m_cameraEvents[i].uiTick < uiNumTicks && (i == 0 || m_cameraEvents[i].uiTick > m_cameraEvents[i - 1].uiTick);
+	}
+	if (!bValid) {
+		m_events.clear();
+		m_cameraEvents.clear();
+		m_checksums.clear();
+		char message[1024];
+		sprintf_s(message, "Replay is truncated or corrupt\n%s\n", sFilename.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	m_bRecording = false;
+	m_bPlaying = true;
+	m_uiNextEvent = 0;
+	m_uiNextCameraEvent = 0;
+	m_iFirstDivergentTick = -1;
+	return true;
+}
+
+bool CInputReplay::IsRecording()
+{
+	return m_bRecording;
+}
+
+bool CInputReplay::IsPlaying()
+{
+	return m_bPlaying;
+}
+
+bool CInputReplay::IsFinished(UINT uiTick)
+{
+	return m_bPlaying && uiTick >= m_checksums.size();
+}
+
+UINT CInputReplay::GetNumTicks()
+{
+	return (UINT) m_checksums.size();
+}
+
+double CInputReplay::GetTickLength()
+{
+	return m_dTickLength;
+}
+
+void CInputReplay::RecordKey(UINT uiTick, WPARAM key)
+{
+	CEvent event;
+	event.uiTick = uiTick;
+	event.key = (BYTE) key;
+	m_events.push_back(event);
+}
+
+void CInputReplay::RecordCamera(UINT uiTick, const CameraInput &input)
+{
+	CCameraEvent event;
+	event.uiTick = uiTick;
+	event.input = input;
+	m_cameraEvents.push_back(event);
+}
+
+void CInputReplay::RecordChecksum(UINT uiTick, UINT uiChecksum)
+{
+	if (uiTick >= m_checksums.size())
+		m_checksums.resize(uiTick + 1, 0);
+	m_checksums[uiTick] = uiChecksum;
+}
+
+void CInputReplay::GetKeys(UINT uiTick, vector<WPARAM> &keys)
+{
+	while (m_uiNextEvent < m_events.size() && m_events[m_uiNextEvent].uiTick <= uiTick) {
+		if (m_events[m_uiNextEvent].uiTick == uiTick)
+			keys.push_back(m_events[m_uiNextEvent].key);
+		m_uiNextEvent++;
+	}
+}
+
+CameraInput CInputReplay::GetCamera(UINT uiTick)
+{
+	while (m_uiNextCameraEvent < m_cameraEvents.size() && m_cameraEvents[m_uiNextCameraEvent].uiTick < uiTick)
+		m_uiNextCameraEvent++;
+	if (m_uiNextCameraEvent < m_cameraEvents.size() && m_cameraEvents[m_uiNextCameraEvent].uiTick == uiTick)
+		return m_cameraEvents[m_uiNextCameraEvent++].input;
+	return CameraInput();
+}
+
+bool CInputReplay::CheckChecksum(UINT uiTick, UINT uiChecksum)
+{
+	if (uiTick >= m_checksums.size() || m_checksums[uiTick] == uiChecksum)
+		return true;
+	if (m_iFirstDivergentTick < 0)
+		m_iFirstDivergentTick = uiTick;
+	return false;
+}
+
+int CInputReplay::GetFirstDivergentTick()
+{
+	return m_iFirstDivergentTick;
+}
+
+UINT CInputReplay::Hash(const void *pData, size_t size, UINT uiHash)
+{
+	const BYTE *pBytes = (const BYTE*) pData;
+	for (size_t i = 0; i < size; i++) {
+		uiHash ^= pBytes[i];
+		uiHash *= 16777619u;
+	}
+	return uiHash;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Common.h"
+#include "Camera.h"
+
+// The input to the simulation, as the keys applied on each tick and the free-look camera's input on the ticks that moved it, and
+// a checksum of the game state after each tick.  Recording one run and playing it back reproduces it exactly, since the
+// simulation only changes on fixed ticks; a checksum that differs on playback shows where the two runs diverged.
+//
+// The file is "RPLY", a version, the tick length in milliseconds as a double, the tick, key event and camera event counts, the
+// key events as a 4 byte tick and a 1 byte key each, the camera events as a 4 byte tick, a 1 byte CameraMoveKey mask and a
+// 4 byte mouse x and y each, and then one 4 byte checksum per tick.
+class CInputReplay
+{
+public:
+	CInputReplay();
+	~CInputReplay();
+
+	void BeginRecording(double dTickLength);
+	bool Save(const string &sFilename);
+	bool Load(const string &sFilename);		// Loads a recording and begins playing it back
+
+	bool IsRecording();
+	bool IsPlaying();
+	bool IsFinished(UINT uiTick);			// Playback has passed the last recorded tick
+	UINT GetNumTicks();
+	double GetTickLength();
+
+	// Recording.  Call RecordKey for each key a tick applies and RecordCamera if it moved the camera, then RecordChecksum once
+	// the tick is done.
+	void RecordKey(UINT uiTick, WPARAM key);
+	void RecordCamera(UINT uiTick, const CameraInput &input);
+	void RecordChecksum(UINT uiTick, UINT uiChecksum);
+
+	// Playback.  GetKeys appends the keys recorded for uiTick and GetCamera returns its camera input, empty if there was none;
+	// CheckChecksum compares the state after it with the recording.
+	void GetKeys(UINT uiTick, vector<WPARAM> &keys);
+	CameraInput GetCamera(UINT uiTick);
+	bool CheckChecksum(UINT uiTick, UINT uiChecksum);
+	int GetFirstDivergentTick();			// -1 while playback matches
+
+	// FNV-1a, for building state checksums a field at a time
+	static UINT Hash(const void *pData, size_t size, UINT uiHash = 2166136261u);
+
+private:
+	struct CEvent
+	{
+		UINT uiTick;
+		BYTE key;
+	};
+	struct CCameraEvent
+	{
+		UINT uiTick;
+		CameraInput input;
+	};
+
+	bool m_bRecording;
+	bool m_bPlaying;
+	double m_dTickLength;
+	vector<CEvent> m_events;				// In tick order
+	vector<CCameraEvent> m_cameraEvents;	// In tick order, at most one per tick
+	vector<UINT> m_checksums;				// One per tick
+	unsigned int m_uiNextEvent;				// Playback position in m_events
+	unsigned int m_uiNextCameraEvent;		// and in m_cameraEvents
+	int m_iFirstDivergentTick;
+};
@@ -0,0 +1,327 @@
+#include "JobSystem.h"
+#include <fstream>
+#include <algorithm>
+#include <map>
+
+// Index of the worker running on this thread, or -1 on the main thread
+static thread_local int t_iWorkerIndex = -1;
+
+CJob::CJob(const string &sName, const std::function<void()> &function, bool bMainThread)
+	: m_sName(sName), m_function(function), m_bMainThread(bMainThread), m_iPending(1), m_bDone(false)
+{
+	m_dStart = -1.0;
+	m_dEnd = -1.0;
+	m_iThread = -1;
+}
+
+bool CJob::IsDone()
+{
+	return m_bDone;
+}
+
+
+CJobSystem::CJobSystem()
+	: m_iQueued(0), m_iUnfinished(0), m_uiNextQueue(0), m_bRunning(false)
+{
+	m_bTracing = false;
+	QueryPerformanceFrequency(&m_frequency);
+	QueryPerformanceCounter(&m_traceStart);
+}
+
+CJobSystem::~CJobSystem()
+{
+	Stop();
+	Reset();
+}
+
+// Start the worker threads
+void CJobSystem::Start(int iNumWorkers)
+{
+	Stop();
+
+	m_bRunning = true;
+	int iNumQueues = iNumWorkers > 0 ? iNumWorkers : 1;
+	for (int i = 0; i < iNumQueues; i++)
+		m_queues.push_back(new CWorkQueue);
+	for (int i = 0; i < iNumWorkers; i++)
+		m_workers.push_back(std::thread(&CJobSystem::WorkerLoop, this, i));
+}
+
+// Stop and join the worker threads.  Jobs still queued are abandoned.
+void CJobSystem::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_bRunning = false;
+	}
+	m_wake.notify_all();
+
+	for (unsigned int i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+	m_workers.clear();
+
+	for (unsigned int i = 0; i < m_queues.size(); i++)
+		delete m_queues[i];
+	m_queues.clear();
+	m_iQueued = 0;
+}
+
+int CJobSystem::GetNumWorkers()
+{
+	return (int) m_workers.size();
+}
+
+// Create a job.  It will not run until it has been submitted and all of its dependencies have finished.
+CJob* CJobSystem::CreateJob(const string &sName, const std::function<void()> &function, bool bMainThread)
+{
+	CJob *pJob = new CJob(sName, function, bMainThread);
+
+	std::lock_guard<std::mutex> lock(m_jobsMutex);
+	m_jobs.push_back(pJob);
+	return pJob;
+}
+
+// Make pJob wait for pDependsOn to finish
+void CJobSystem::AddDependency(CJob *pJob, CJob *pDependsOn)
+{
+	pJob->m_iPending++;
+	pJob->m_dependencies.push_back(pDependsOn);
+	pDependsOn->m_dependents.push_back(pJob);
+}
+
+// Release the job to the scheduler.  It is queued as soon as its dependencies are done.
+void CJobSystem::Submit(CJob *pJob)
+{
+	m_iUnfinished++;
+	if (--pJob->m_iPending == 0)
+		Enqueue(pJob);
+}
+
+// Put a runnable job on a queue.  Workers keep the jobs they unlock on their own deque; other jobs are dealt round robin.
+void CJobSystem::Enqueue(CJob *pJob)
+{
+	CWorkQueue *pQueue;
+	if (pJob->m_bMainThread)
+		pQueue = &m_mainQueue;
+	else if (t_iWorkerIndex >= 0)
+		pQueue = m_queues[t_iWorkerIndex];
+	else
+		pQueue = m_queues[m_uiNextQueue++ % m_queues.size()];
+
+	{
+		std::lock_guard<std::mutex> lock(pQueue->mutex);
+		pQueue->jobs.push_back(pJob);
+	}
+
+	if (!pJob->m_bMainThread) {
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_iQueued++;
+	}
+	m_wake.notify_one();
+}
+
+// Take the newest job from our own deque, or failing that the oldest job from someone else's.  iIndex is -1 for the main thread.
+CJob* CJobSystem::PopOrSteal(int iIndex)
+{
+	if (iIndex >= 0) {
+		CWorkQueue *pQueue = m_queues[iIndex];
+		std::lock_guard<std::mutex> lock(pQueue->mutex);
+		if (!pQueue->jobs.empty()) {
+			CJob *pJob = pQueue->jobs.back();
+			pQueue->jobs.pop_back();
+			m_iQueued--;
+			return pJob;
+		}
+	}
+
+	int iNumQueues = (int) m_queues.size();
+	for (int i = 1; i <= iNumQueues; i++) {
+		CWorkQueue *pQueue = m_queues[(iIndex + i + iNumQueues) % iNumQueues];
+		std::lock_guard<std::mutex> lock(pQueue->mutex);
+		if (!pQueue->jobs.empty()) {
+			CJob *pJob = pQueue->jobs.front();
+			pQueue->jobs.pop_front();
+			m_iQueued--;
+			return pJob;
+		}
+	}
+
+	return NULL;
+}
+
+void CJobSystem::WorkerLoop(int iIndex)
+{
+	t_iWorkerIndex = iIndex;
+
+	while (m_bRunning) {
+		CJob *pJob = PopOrSteal(iIndex);
+		if (pJob) {
+			Execute(pJob, iIndex);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wake.wait(lock, [this] { return m_iQueued > 0 || !m_bRunning; });
+	}
+}
+
+bool CJobSystem::RunOneMainThreadJob()
+{
+	CJob *pJob = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_mainQueue.mutex);
+		if (!m_mainQueue.jobs.empty()) {
+			pJob = m_mainQueue.jobs.front();
+			m_mainQueue.jobs.pop_front();
+		}
+	}
+	if (pJob == NULL)
+		return false;
+
+	Execute(pJob, -1);
+	return true;
+}
+
+// Run every main thread job that is ready now
+void CJobSystem::RunMainThreadJobs()
+{
+	while (RunOneMainThreadJob())
+		;
+}
+
+void CJobSystem::Wait(CJob *pJob)
+{
+	while (!pJob->IsDone()) {
+		if (RunOneMainThreadJob())
+			continue;
+
+		CJob *pOther = PopOrSteal(-1);
+		if (pOther)
+			Execute(pOther, -1);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void CJobSystem::WaitAll()
+{
+	while (m_iUnfinished > 0) {
+		if (RunOneMainThreadJob())
+			continue;
+
+		CJob *pOther = PopOrSteal(-1);
+		if (pOther)
+			Execute(pOther, -1);
+		else
+			std::this_thread::yield();
+	}
+}
+
+// Run a job, then release any dependents that were only waiting on it
+void CJobSystem::Execute(CJob *pJob, int iThread)
+{
+	pJob->m_iThread = iThread;
+	pJob->m_dStart = Now();
+	pJob->m_function();
+	pJob->m_dEnd = Now();
+	pJob->m_bDone = true;
+
+	for (unsigned int i = 0; i < pJob->m_dependents.size(); i++) {
+		if (--pJob->m_dependents[i]->m_iPending == 0)
+			Enqueue(pJob->m_dependents[i]);
+	}
+
+	m_iUnfinished--;
+}
+
+void CJobSystem::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_jobsMutex);
+	for (unsigned int i = 0; i < m_jobs.size(); i++)
+		delete m_jobs[i];
+	m_jobs.clear();
+}
+
+// Milliseconds since the trace began
+double CJobSystem::Now()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (t.QuadPart - m_traceStart.QuadPart) * 1000.0 / m_frequency.QuadPart;
+}
+
+void CJobSystem::BeginTrace()
+{
+	QueryPerformanceCounter(&m_traceStart);
+	m_bTracing = true;
+}
+
+// Write the jobs run since BeginTrace as a Chrome trace, and report the longest chain of dependent jobs.  When the critical
+// path is close to the wall clock time, adding workers will not help; the jobs on the path need to get faster or be split.
+void CJobSystem::EndTrace(const string &sFilename)
+{
+	if (!m_bTracing)
+		return;
+	m_bTracing = false;
+
+	vector<CJob*> jobs;
+	{
+		std::lock_guard<std::mutex> lock(m_jobsMutex);
+		for (unsigned int i = 0; i < m_jobs.size(); i++) {
+			if (m_jobs[i]->IsDone() && m_jobs[i]->m_dStart >= 0.0)
+				jobs.push_back(m_jobs[i]);
+		}
+	}
+	if (jobs.empty())
+		return;
+
+	// A job always ends after its dependencies, so one pass in order of end time sees every dependency first
+	std::sort(jobs.begin(), jobs.end(), [](CJob *a, CJob *b) { return a->m_dEnd < b->m_dEnd; });
+
+	std::map<CJob*, double> pathLength;
+	std::map<CJob*, CJob*> pathPrevious;
+	CJob *pLast = NULL;
+	double dWallStart = jobs[0]->m_dStart, dWallEnd = 0.0, dTotalWork = 0.0;
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		CJob *pJob = jobs[i];
+		double dLongest = 0.0;
+		CJob *pPrevious = NULL;
+		for (unsigned int j = 0; j < pJob->m_dependencies.size(); j++) {
+			CJob *pDependency = pJob->m_dependencies[j];
+			if (pathLength.count(pDependency) && pathLength[pDependency] > dLongest) {
+				dLongest = pathLength[pDependency];
+				pPrevious = pDependency;
+			}
+		}
+		double dDuration = pJob->m_dEnd - pJob->m_dStart;
+		pathLength[pJob] = dLongest + dDuration;
+		pathPrevious[pJob] = pPrevious;
+		if (pLast == NULL || pathLength[pJob] > pathLength[pLast])
+			pLast = pJob;
+
+		dWallStart = min(dWallStart, pJob->m_dStart);
+		dWallEnd = max(dWallEnd, pJob->m_dEnd);
+		dTotalWork += dDuration;
+	}
+
+	std::ofstream file(sFilename.c_str());
+	file << "{\"traceEvents\":[\n";
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		CJob *pJob = jobs[i];
+		file << "{\"name\":\"" << pJob->m_sName << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << pJob->m_iThread + 1
+			<< ",\"ts\":" << (long long) (pJob->m_dStart * 1000.0)
+			<< ",\"dur\":" << (long long) ((pJob->m_dEnd - pJob->m_dStart) * 1000.0) << "}"
+			<< (i + 1 < jobs.size() ? ",\n" : "\n");
+	}
+	file << "]}\n";
+
+	std::ostringstream report;
+	report << "Startup trace: " << jobs.size() << " jobs on " << GetNumWorkers() << " workers + main thread\n";
+	report << "  wall clock " << dWallEnd - dWallStart << " ms, total work " << dTotalWork << " ms, critical path "
+		<< pathLength[pLast] << " ms\n";
+	report << "  critical path (last job first):\n";
+	for (CJob *pJob = pLast; pJob != NULL; pJob = pathPrevious[pJob])
+		report << "    " << pJob->m_sName << "  " << pJob->m_dEnd - pJob->m_dStart << " ms\n";
+
+	OutputDebugString(report.str().c_str());
+}
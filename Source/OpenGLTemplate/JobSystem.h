@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+// A unit of work scheduled by CJobSystem.  A job becomes runnable once every job it depends on has finished.
+class CJob
+{
+public:
+	CJob(const string &sName, const std::function<void()> &function, bool bMainThread);
+
+	bool IsDone();
+
+private:
+	friend class CJobSystem;
+
+	string m_sName;
+	std::function<void()> m_function;
+	bool m_bMainThread;					// Job touches OpenGL, so it must run on the thread that owns the context
+	std::atomic<int> m_iPending;		// Unfinished dependencies, plus one until the job is submitted
+	std::atomic<bool> m_bDone;
+	vector<CJob*> m_dependents;			// Jobs waiting on this one
+	vector<CJob*> m_dependencies;		// Jobs this one waited on (kept for the trace)
+
+	double m_dStart, m_dEnd;			// Milliseconds since the trace began
+	int m_iThread;						// Worker index, or -1 for the main thread
+};
+
+// A work-stealing job scheduler.  Each worker owns a deque: it pushes and pops work at the back, and when it runs dry it
+// steals from the front of another worker's deque.  Jobs that need the OpenGL context go to a separate queue that only the
+// main thread services, from Wait() or RunMainThreadJobs().
+class CJobSystem
+{
+public:
+	CJobSystem();
+	~CJobSystem();
+
+	// Start iNumWorkers worker threads.  With no workers, every job runs on the main thread inside Wait().
+	void Start(int iNumWorkers);
+	void Stop();
+	int GetNumWorkers();
+
+	// Build the graph with CreateJob and AddDependency, then Submit each job.  A dependency must be added before the job it
+	// depends on is submitted.
+	CJob* CreateJob(const string &sName, const std::function<void()> &function, bool bMainThread = false);
+	void AddDependency(CJob *pJob, CJob *pDependsOn);
+	void Submit(CJob *pJob);
+
+	// Main thread only.  Runs main thread jobs, and helps out with worker jobs, until the given job (or every job) is done.
+	void Wait(CJob *pJob);
+	void WaitAll();
+	void RunMainThreadJobs();
+
+	// Delete all jobs.  Call after WaitAll.
+	void Reset();
+
+	// Record the start and end of every job from now on, then write a Chrome trace (chrome://tracing) and report the
+	// critical path of the jobs run since BeginTrace.
+	void BeginTrace();
+	void EndTrace(const string &sFilename);
+
+private:
+	struct CWorkQueue
+	{
+		std::mutex mutex;
+		std::deque<CJob*> jobs;
+	};
+
+	void WorkerLoop(int iIndex);
+	void Enqueue(CJob *pJob);
+	CJob* PopOrSteal(int iIndex);
+	bool RunOneMainThreadJob();
+	void Execute(CJob *pJob, int iThread);
+	double Now();
+
+	vector<std::thread> m_workers;
+	vector<CWorkQueue*> m_queues;		// One per worker, or a single queue drained by the main thread if there are no workers
+	CWorkQueue m_mainQueue;				// Jobs that must run on the main thread
+	std::atomic<int> m_iQueued;			// Jobs waiting in m_queues
+	std::atomic<int> m_iUnfinished;		// Jobs submitted but not yet done
+	std::atomic<unsigned int> m_uiNextQueue;
+	std::atomic<bool> m_bRunning;
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wake;
+
+	std::mutex m_jobsMutex;
+	vector<CJob*> m_jobs;				// Every job created since the last Reset
+
+	bool m_bTracing;
+	LARGE_INTEGER m_traceStart, m_frequency;
+};
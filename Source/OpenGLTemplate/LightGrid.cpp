@@ -0,0 +1,205 @@
+#include "LightGrid.h"
+#include "Shaders.h"
+#include "MemoryTracker.h"
+
+CLightGrid::CLightGrid()
+{
+	m_fNear = m_fFar = 1.0f;
+	m_fScaleX = m_fScaleY = 1.0f;
+	m_fSliceScale = m_fSliceBias = 0.0f;
+	m_vTileScale = glm::vec2(0.0f);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		m_uiBuffers[i] = 0;
+		m_uiTextures[i] = 0;
+	}
+	m_iNumIndices = 0;
+}
+
+CLightGrid::~CLightGrid()
+{}
+
+bool CLightGrid::Create()
+{
+	static const size_t sizes[NUM_BUFFERS] = { MAX_LIGHTS * 3 * sizeof(glm::vec4), NUM_CLUSTERS * 2 * sizeof(GLuint),
+		MAX_INDICES * sizeof(GLuint) };
+	static const GLenum formats[NUM_BUFFERS] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+
+	m_lights.reserve(MAX_LIGHTS);
+	m_lightData.reserve(MAX_LIGHTS * 3);
+	m_clusters.resize(NUM_CLUSTERS * 2);
+	m_cursors.resize(NUM_CLUSTERS);
+	m_indices.resize(MAX_INDICES);
+	m_viewCentres.reserve(MAX_LIGHTS);
+
+	glGenBuffers(NUM_BUFFERS, m_uiBuffers);
+	glGenTextures(NUM_BUFFERS, m_uiTextures);
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_uiBuffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_STREAM_DRAW);
+		CMemoryTracker::TrackBuffer(m_uiBuffers[i], sizes[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, m_uiTextures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_uiBuffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	return true;
+}
+
+void CLightGrid::Release()
+{
+	for (int i = 0; i < NUM_BUFFERS; i++)
+		CMemoryTracker::ForgetBuffer(m_uiBuffers[i]);
+	glDeleteTextures(NUM_BUFFERS, m_uiTextures);
+	glDeleteBuffers(NUM_BUFFERS, m_uiBuffers);
+}
+
+void CLightGrid::Clear()
+{
+	m_lights.clear();
+}
+
+void CLightGrid::AddPointLight(const glm::vec3 &vPosition, float fRadius, const glm::vec3 &vColour)
+{
+	AddSpotLight(vPosition, fRadius, vColour, glm::vec3(0.0f, -1.0f, 0.0f), 180.0f, 0.0f);
+}
+
+void CLightGrid::AddSpotLight(const glm::vec3 &vPosition, float fRadius, const glm::vec3 &vColour, const glm::vec3 &vDirection,
+	float fCutoff, float fExponent)
+{
+	if ((int) m_lights.size() == MAX_LIGHTS)
+		return;
+	CLight light;
+	light.vPosition = vPosition;
+	light.fRadius = fRadius;
+	light.vColour = vColour;
+	light.vDirection = glm::normalize(vDirection);
+	light.fCosCutoff = fCutoff >= 180.0f ? -1.0f : cos(glm::radians(glm::clamp(fCutoff, 0.0f, 90.0f)));
+	light.fExponent = fExponent;
+	m_lights.push_back(light);
+}
+
+// The sphere's box, from the nearest to the furthest depth of each slice it spans, is projected to find the tiles it covers.
+// The box holds the sphere, so no cluster it touches is missed; a few it only nearly touches are included.
+template <class Visit>
+void CLightGrid::VisitClusters(const glm::vec3 &vCentre, float fRadius, Visit visit)
+{
+	float fDepth = -vCentre.z;
+	float fMinDepth = max(fDepth - fRadius, m_fNear);
+	float fMaxDepth = min(fDepth + fRadius, m_fFar);
+	if (fMinDepth > fMaxDepth)
+		return;
+
+	int iFirstSlice = glm::clamp((int) (log(fMinDepth) * m_fSliceScale + m_fSliceBias), 0, SLICES - 1);
+	int iLastSlice = glm::clamp((int) (log(fMaxDepth) * m_fSliceScale + m_fSliceBias), 0, SLICES - 1);
+	for (int iSlice = iFirstSlice; iSlice <= iLastSlice; iSlice++) {
+		// The part of the slice inside the sphere's depth range
+		float d0 = max(fMinDepth, exp((iSlice - m_fSliceBias) / m_fSliceScale));
+		float d1 = min(fMaxDepth, exp((iSlice + 1 - m_fSliceBias) / m_fSliceScale));
+
+		// Box edges divided by the nearer and further depths; the extremes of the four bound the box's projection
+		float x0 = vCentre.x - fRadius, x1 = vCentre.x + fRadius;
+		float y0 = vCentre.y - fRadius, y1 = vCentre.y + fRadius;
+		float fMinX = min(x0 / d0, x0 / d1) * m_fScaleX, fMaxX = max(x1 / d0, x1 / d1) * m_fScaleX;
+		float fMinY = min(y0 / d0, y0 / d1) * m_fScaleY, fMaxY = max(y1 / d0, y1 / d1) * m_fScaleY;
+		if (fMaxX < -1.0f || fMinX > 1.0f || fMaxY < -1.0f || fMinY > 1.0f)
+			continue;
+
+		int iMinX = glm::clamp((int) ((fMinX * 0.5f + 0.5f) * TILES_X), 0, TILES_X - 1);
+		int iMaxX = glm::clamp((int) ((fMaxX * 0.5f + 0.5f) * TILES_X), 0, TILES_X - 1);
+		int iMinY = glm::clamp((int) ((fMinY * 0.5f + 0.5f) * TILES_Y), 0, TILES_Y - 1);
+		int iMaxY = glm::clamp((int) ((fMaxY * 0.5f + 0.5f) * TILES_Y), 0, TILES_Y - 1);
+		for (int y = iMinY; y <= iMaxY; y++) {
+			for (int x = iMinX; x <= iMaxX; x++)
+				visit((iSlice * TILES_Y + y) * TILES_X + x);
+		}
+	}
+}
+
+void CLightGrid::Build(const glm::mat4 &projectionMatrix, const glm::mat4 &viewMatrix, int iWidth, int iHeight)
+{
+	// The frustum's shape, read back from the perspective matrix
+	float a = projectionMatrix[2][2], b = projectionMatrix[3][2];
+	m_fNear = b / (a - 1.0f);
+	m_fFar = b / (a + 1.0f);
+	m_fScaleX = projectionMatrix[0][0];
+	m_fScaleY = projectionMatrix[1][1];
+	m_fSliceScale = SLICES / log(m_fFar / m_fNear);
+	m_fSliceBias = -log(m_fNear) * m_fSliceScale;
+	m_vTileScale = glm::vec2((float) TILES_X / iWidth, (float) TILES_Y / iHeight);
+
+	// Lights into view space
+	glm::mat3 viewRotation(viewMatrix);
+	m_lightData.clear();
+	m_viewCentres.clear();
+	for (unsigned int i = 0; i < m_lights.size(); i++) {
+		const CLight &light = m_lights[i];
+		glm::vec3 vCentre(viewMatrix * glm::vec4(light.vPosition, 1.0f));
+		m_viewCentres.push_back(vCentre);
+		m_lightData.push_back(glm::vec4(vCentre, light.fRadius));
+		m_lightData.push_back(glm::vec4(light.vColour, light.fCosCutoff));
+		m_lightData.push_back(glm::vec4(viewRotation * light.vDirection, light.fExponent));
+	}
+
+	// Count each cluster's lights, turn the counts into offsets, then fill in the indices
+	for (int i = 0; i < NUM_CLUSTERS; i++)
+		m_cursors[i] = 0;
+	for (unsigned int i = 0; i < m_lights.size(); i++)
+		VisitClusters(m_viewCentres[i], m_lights[i].fRadius, [this](int iCluster) { m_cursors[iCluster]++; });
+
+	GLuint uiOffset = 0;
+	for (int i = 0; i < NUM_CLUSTERS; i++) {
+		GLuint uiCount = min(m_cursors[i], (GLuint) MAX_INDICES - uiOffset);
+		m_clusters[i * 2] = uiOffset;
+		m_clusters[i * 2 + 1] = uiCount;
+		m_cursors[i] = 0;
+		uiOffset += uiCount;
+	}
+	m_iNumIndices = (int) uiOffset;
+
+	// Lights go in in order, so a cluster that ran out of room keeps its first lights
+	for (unsigned int i = 0; i < m_lights.size(); i++) {
+		VisitClusters(m_viewCentres[i], m_lights[i].fRadius, [this, i](int iCluster) {
+			if (m_cursors[iCluster] < m_clusters[iCluster * 2 + 1])
+				m_indices[m_clusters[iCluster * 2] + m_cursors[iCluster]++] = i;
+		});
+	}
+
+	// Orphan each buffer so the upload never waits for last frame's draws
+	if (!m_lightData.empty()) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_uiBuffers[LIGHT_BUFFER]);
+		glBufferData(GL_TEXTURE_BUFFER, MAX_LIGHTS * 3 * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, m_lightData.size() * sizeof(glm::vec4), &m_lightData[0]);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, m_uiBuffers[CLUSTER_BUFFER]);
+	glBufferData(GL_TEXTURE_BUFFER, NUM_CLUSTERS * 2 * sizeof(GLuint), &m_clusters[0], GL_STREAM_DRAW);
+	if (m_iNumIndices > 0) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_uiBuffers[INDEX_BUFFER]);
+		glBufferData(GL_TEXTURE_BUFFER, MAX_INDICES * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, m_iNumIndices * sizeof(GLuint), &m_indices[0]);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void CLightGrid::Bind(CShaderProgram *pProgram, int iFirstUnit)
+{
+	static const char *szSamplers[NUM_BUFFERS] = { "lightData", "lightClusters", "lightIndices" };
+	for (int i = 0; i < NUM_BUFFERS; i++) {
+		glActiveTexture(GL_TEXTURE0 + iFirstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, m_uiTextures[i]);
+		pProgram->SetUniform(szSamplers[i], iFirstUnit + i);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	pProgram->SetUniform("vTileScale", m_vTileScale);
+	pProgram->SetUniform("fSliceScale", m_fSliceScale);
+	pProgram->SetUniform("fSliceBias", m_fSliceBias);
+}
+
+int CLightGrid::GetNumLights()
+{
+	return (int) m_lights.size();
+}
+
+int CLightGrid::GetNumIndices()
+{
+	return m_iNumIndices;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Common.h"
+
+class CShaderProgram;
+
+// Clustered forward lighting.  The view frustum is cut into a grid of clusters, TILES_X by TILES_Y across the screen and
+// SLICES deep with the slices growing exponentially with distance, and each frame every light is added to the list of each
+// cluster its sphere of influence can touch.  A fragment then finds its cluster from its screen position and depth and loops
+// over that cluster's lights only, so the shading cost follows the lights near each pixel rather than the number in the scene.
+//
+// The lights, the cluster lists and the light indices reach the shader through texture buffers, which a 4.0 context has.
+class CLightGrid
+{
+public:
+	static const int TILES_X = 16;
+	static const int TILES_Y = 9;
+	static const int SLICES = 24;
+	static const int NUM_CLUSTERS = TILES_X * TILES_Y * SLICES;
+	static const int MAX_LIGHTS = 1024;
+	static const int MAX_INDICES = 64 * 1024;	// Cluster entries past this are dropped, dropping the lights added last
+
+	CLightGrid();
+	~CLightGrid();
+
+	bool Create();
+	void Release();
+
+	// Lights are given in world space and last until the next Clear.  The light fades to nothing at fRadius.
+	void Clear();
+	void AddPointLight(const glm::vec3 &vPosition, float fRadius, const glm::vec3 &vColour);
+	// fCutoff is the half angle of the cone in degrees
+	void AddSpotLight(const glm::vec3 &vPosition, float fRadius, const glm::vec3 &vColour, const glm::vec3 &vDirection, float fCutoff,
+		float fExponent);
+
+	// Assigns the lights to the clusters of the frustum given by the two matrices and uploads the result.  The projection must
+	// be a perspective one.
+	void Build(const glm::mat4 &projectionMatrix, const glm::mat4 &viewMatrix, int iWidth, int iHeight);
+	// Binds the texture buffers from texture unit iFirstUnit on and sets pProgram's grid uniforms.  pProgram must be in use.
+	void Bind(CShaderProgram *pProgram, int iFirstUnit);
+
+	int GetNumLights();
+	int GetNumIndices();		// Cluster entries in the last Build
+
+private:
+	struct CLight
+	{
+		glm::vec3 vPosition;
+		float fRadius;
+		glm::vec3 vColour;
+		glm::vec3 vDirection;
+		float fCosCutoff;		// -1 for a point light
+		float fExponent;
+	};
+
+	// Calls visit(iCluster) for every cluster the view space sphere may touch
+	template <class Visit>
+	void VisitClusters(const glm::vec3 &vCentre, float fRadius, Visit visit);
+
+	enum { LIGHT_BUFFER, CLUSTER_BUFFER, INDEX_BUFFER, NUM_BUFFERS };
+
+	vector<CLight> m_lights;
+	vector<glm::vec4> m_lightData;			// Three texels per light, in view space
+	vector<GLuint> m_clusters;				// Offset into m_indices and count, per cluster
+	vector<GLuint> m_cursors;				// Per cluster, while Build fills in the indices
+	vector<GLuint> m_indices;
+	vector<glm::vec3> m_viewCentres;
+
+	// Of the last Build's projection
+	float m_fNear, m_fFar;
+	float m_fScaleX, m_fScaleY;				// Projection of view space x / depth to NDC
+	float m_fSliceScale, m_fSliceBias;		// slice = log(depth) * scale + bias
+	glm::vec2 m_vTileScale;					// Window coordinates to tiles
+
+	GLuint m_uiBuffers[NUM_BUFFERS];
+	GLuint m_uiTextures[NUM_BUFFERS];
+	int m_iNumIndices;
+};
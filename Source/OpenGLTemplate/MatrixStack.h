@@ -15,6 +15,7 @@
 #include <vector>
 #include "include\glm\glm.hpp"
 #include "include\glm\gtc\type_ptr.hpp"
+#include "FrameArena.h"
 
 namespace glutil
 {
@@ -245,7 +246,8 @@ namespace glutil
 		///@}
 
 	private:
-		std::stack<glm::mat4, std::vector<glm::mat4> > m_stack;
+		// Taken from the frame arena when one is current, so a stack made in the render loop does not touch the heap
+		std::stack<glm::mat4, FrameVector<glm::mat4> > m_stack;
 		glm::mat4 m_currMatrix;
 	};
 
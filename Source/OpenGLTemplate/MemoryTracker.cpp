@@ -0,0 +1,149 @@
+#include "MemoryTracker.h"
+#include <fstream>
+
+CMemoryTracker::CCounter CMemoryTracker::s_cpu[NUM_MEMORY_TAGS];
+CMemoryTracker::CCounter CMemoryTracker::s_gpu[NUM_MEMORY_TAGS];
+size_t CMemoryTracker::s_cpuBudget[NUM_MEMORY_TAGS];
+size_t CMemoryTracker::s_gpuBudget[NUM_MEMORY_TAGS];
+std::mutex CMemoryTracker::s_mutex;
+std::map<GLuint, CMemoryTracker::CGLObject> CMemoryTracker::s_buffers;
+std::map<GLuint, CMemoryTracker::CGLObject> CMemoryTracker::s_textures;
+thread_local int CMemoryTracker::t_iTag = MEMORY_UNTAGGED;
+
+int CMemoryTracker::GetCurrentTag()
+{
+	return t_iTag;
+}
+
+const char* CMemoryTracker::GetTagName(int iTag)
+{
+	static const char *szNames[NUM_MEMORY_TAGS] = { "untagged", "terrain", "track", "meshes", "fonts", "skybox", "renderer", "particles", "shadows" };
+	return iTag >= 0 && iTag < NUM_MEMORY_TAGS ? szNames[iTag] : "invalid";
+}
+
+// Adds delta to a counter and raises its peak if the new value is higher
+void CMemoryTracker::Add(CCounter &counter, long long delta)
+{
+	long long value = counter.current.fetch_add(delta) + delta;
+	long long peak = counter.peak.load();
+	while (value > peak && !counter.peak.compare_exchange_weak(peak, value))
+		;
+}
+
+void CMemoryTracker::AddCpu(int iTag, size_t size)
+{
+	Add(s_cpu[iTag], (long long) size);
+}
+
+void CMemoryTracker::RemoveCpu(int iTag, size_t size)
+{
+	Add(s_cpu[iTag], -(long long) size);
+}
+
+void CMemoryTracker::Track(std::map<GLuint, CGLObject> &objects, GLuint uiName, size_t size)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::map<GLuint, CGLObject>::iterator it = objects.find(uiName);
+	if (it != objects.end())
+		Add(s_gpu[it->second.iTag], -(long long) it->second.size);
+	CGLObject object;
+	object.iTag = t_iTag;
+	object.size = size;
+	objects[uiName] = object;
+	Add(s_gpu[object.iTag], (long long) size);
+}
+
+void CMemoryTracker::Forget(std::map<GLuint, CGLObject> &objects, GLuint uiName)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	std::map<GLuint, CGLObject>::iterator it = objects.find(uiName);
+	if (it == objects.end())
+		return;
+	Add(s_gpu[it->second.iTag], -(long long) it->second.size);
+	objects.erase(it);
+}
+
+void CMemoryTracker::TrackBuffer(GLuint uiBuffer, size_t size)
+{
+	Track(s_buffers, uiBuffer, size);
+}
+
+void CMemoryTracker::ForgetBuffer(GLuint uiBuffer)
+{
+	Forget(s_buffers, uiBuffer);
+}
+
+void CMemoryTracker::TrackTexture(GLuint uiTexture, size_t size)
+{
+	Track(s_textures, uiTexture, size);
+}
+
+void CMemoryTracker::ForgetTexture(GLuint uiTexture)
+{
+	Forget(s_textures, uiTexture);
+}
+
+void CMemoryTracker::SetBudget(int iTag, size_t cpuBytes, size_t gpuBytes)
+{
+	s_cpuBudget[iTag] = cpuBytes;
+	s_gpuBudget[iTag] = gpuBytes;
+}
+
+bool CMemoryTracker::CheckBudgets()
+{
+	bool bWithinBudget = true;
+	for (int i = 0; i < NUM_MEMORY_TAGS; i++) {
+		bool bCpuOver = s_cpuBudget[i] > 0 && GetCpuPeak(i) > s_cpuBudget[i];
+		bool bGpuOver = s_gpuBudget[i] > 0 && GetGpuPeak(i) > s_gpuBudget[i];
+		if (!bCpuOver && !bGpuOver)
+			continue;
+
+		char szLine[256];
+		sprintf_s(szLine, "Memory budget exceeded by %s: CPU peak %.2f MB of %.2f MB, GPU peak %.2f MB of %.2f MB\n", GetTagName(i),
+			GetCpuPeak(i) / 1048576.0, s_cpuBudget[i] / 1048576.0, GetGpuPeak(i) / 1048576.0, s_gpuBudget[i] / 1048576.0);
+		OutputDebugString(szLine);
+		bWithinBudget = false;
+	}
+	return bWithinBudget;
+}
+
+size_t CMemoryTracker::GetCpuBytes(int iTag)
+{
+	return (size_t) max(s_cpu[iTag].current.load(), 0LL);
+}
+
+size_t CMemoryTracker::GetCpuPeak(int iTag)
+{
+	return (size_t) s_cpu[iTag].peak.load();
+}
+
+size_t CMemoryTracker::GetGpuBytes(int iTag)
+{
+	return (size_t) max(s_gpu[iTag].current.load(), 0LL);
+}
+
+size_t CMemoryTracker::GetGpuPeak(int iTag)
+{
+	return (size_t) s_gpu[iTag].peak.load();
+}
+
+void CMemoryTracker::WriteReport(const string &sFilename)
+{
+	std::ofstream file(sFilename.c_str());
+	file << "subsystem,cpu_bytes,cpu_peak_bytes,cpu_budget_bytes,gpu_bytes,gpu_peak_bytes,gpu_budget_bytes\n";
+	for (int i = 0; i < NUM_MEMORY_TAGS; i++) {
+		file << GetTagName(i) << "," << GetCpuBytes(i) << "," << GetCpuPeak(i) << "," << s_cpuBudget[i] << ","
+			<< GetGpuBytes(i) << "," << GetGpuPeak(i) << "," << s_gpuBudget[i] << "\n";
+	}
+}
+
+CMemoryScope::CMemoryScope(int iTag)
+{
+	m_iPrevious = CMemoryTracker::t_iTag;
+	CMemoryTracker::t_iTag = iTag;
+}
+
+CMemoryScope::~CMemoryScope()
+{
+	CMemoryTracker::t_iTag = m_iPrevious;
+}
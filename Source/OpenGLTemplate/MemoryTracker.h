@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Common.h"
+#include <atomic>
+#include <mutex>
+#include <map>
+
+// The subsystems memory is charged to
+enum MemoryTag { MEMORY_UNTAGGED, MEMORY_TERRAIN, MEMORY_TRACK, MEMORY_MESHES, MEMORY_FONTS, MEMORY_SKYBOX, MEMORY_RENDERER, MEMORY_PARTICLES, MEMORY_SHADOWS, NUM_MEMORY_TAGS };
+
+// Counts the CPU heap bytes and the GPU buffer and texture bytes each subsystem holds, with high-water marks, and checks them
+// against budgets.  Memory is charged to the tag of the innermost CMemoryScope on the allocating thread.  CPU memory is counted
+// by CTrackedAllocator, or by the caller for memory a library allocates.  GPU memory is counted by the buffer and texture
+// wrappers, which report an object's size whenever its storage is specified and forget it when the object is deleted.
+class CMemoryTracker
+{
+public:
+	static int GetCurrentTag();
+	static const char* GetTagName(int iTag);
+
+	static void AddCpu(int iTag, size_t size);
+	static void RemoveCpu(int iTag, size_t size);
+
+	// Charges a buffer's or texture's storage to the current tag, replacing whatever it held before
+	static void TrackBuffer(GLuint uiBuffer, size_t size);
+	static void ForgetBuffer(GLuint uiBuffer);
+	static void TrackTexture(GLuint uiTexture, size_t size);
+	static void ForgetTexture(GLuint uiTexture);
+
+	// A budget of 0 is unlimited
+	static void SetBudget(int iTag, size_t cpuBytes, size_t gpuBytes);
+	// Returns false, and reports each subsystem whose current or peak usage is over its budget, if any is
+	static bool CheckBudgets();
+
+	static size_t GetCpuBytes(int iTag);
+	static size_t GetCpuPeak(int iTag);
+	static size_t GetGpuBytes(int iTag);
+	static size_t GetGpuPeak(int iTag);
+
+	// Writes a row per subsystem with its current and peak usage and its budgets
+	static void WriteReport(const string &sFilename);
+
+private:
+	friend class CMemoryScope;
+
+	struct CCounter
+	{
+		std::atomic<long long> current;
+		std::atomic<long long> peak;
+	};
+
+	struct CGLObject
+	{
+		int iTag;
+		size_t size;
+	};
+
+	static void Add(CCounter &counter, long long delta);
+	static void Track(std::map<GLuint, CGLObject> &objects, GLuint uiName, size_t size);
+	static void Forget(std::map<GLuint, CGLObject> &objects, GLuint uiName);
+
+	static CCounter s_cpu[NUM_MEMORY_TAGS];
+	static CCounter s_gpu[NUM_MEMORY_TAGS];
+	static size_t s_cpuBudget[NUM_MEMORY_TAGS];
+	static size_t s_gpuBudget[NUM_MEMORY_TAGS];
+	static std::mutex s_mutex;						// Guards the object maps
+	static std::map<GLuint, CGLObject> s_buffers;
+	static std::map<GLuint, CGLObject> s_textures;
+	static thread_local int t_iTag;
+};
+
+// Charges the memory this thread allocates to iTag until the scope ends
+class CMemoryScope
+{
+public:
+	explicit CMemoryScope(int iTag);
+	~CMemoryScope();
+
+private:
+	int m_iPrevious;
+};
+
+// A standard allocator that charges each block to the tag current when it was allocated.  The tag and size are kept in a
+// header in front of the block, so the block is credited back to the same tag wherever it is freed.
+template <class T>
+class CTrackedAllocator
+{
+public:
+	typedef T value_type;
+
+	CTrackedAllocator() {}
+	template <class U>
+	CTrackedAllocator(const CTrackedAllocator<U> &) {}
+
+	T* allocate(size_t n)
+	{
+		size_t size = n * sizeof(T);
+		BYTE *pBlock = (BYTE*) ::operator new(size + HEADER_SIZE);
+		CHeader *pHeader = (CHeader*) pBlock;
+		pHeader->iTag = CMemoryTracker::GetCurrentTag();
+		pHeader->size = size;
+		CMemoryTracker::AddCpu(pHeader->iTag, size);
+		return (T*) (pBlock + HEADER_SIZE);
+	}
+
+	void deallocate(T *p, size_t)
+	{
+		BYTE *pBlock = (BYTE*) p - HEADER_SIZE;
+		CHeader *pHeader = (CHeader*) pBlock;
+		CMemoryTracker::RemoveCpu(pHeader->iTag, pHeader->size);
+		::operator delete(pBlock);
+	}
+
+	template <class U>
+	bool operator==(const CTrackedAllocator<U> &) const { return true; }
+	template <class U>
+	bool operator!=(const CTrackedAllocator<U> &) const { return false; }
+
+private:
+	struct CHeader
+	{
+		int iTag;
+		size_t size;
+	};
+	static const size_t HEADER_SIZE = 16;		// Keeps the block aligned for any vector element
+};
+
+template <class T>
+using TrackedVector = vector<T, CTrackedAllocator<T> >;
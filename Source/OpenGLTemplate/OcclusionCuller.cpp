@@ -0,0 +1,169 @@
+#include "OcclusionCuller.h"
+#include "Shaders.h"
+#include "FrameProfiler.h"
+
+COcclusionCuller::COcclusionCuller()
+{
+	m_iFrame = 0;
+	m_iSlot = 0;
+	m_iNumRejected = 0;
+	m_uiVAO = 0;
+}
+
+COcclusionCuller::~COcclusionCuller()
+{}
+
+int COcclusionCuller::AddCluster(const glm::vec3 &vMin, const glm::vec3 &vMax, int iNumObjects)
+{
+	CCluster cluster;
+	cluster.vMin = vMin;
+	cluster.vMax = vMax;
+	cluster.iNumObjects = iNumObjects;
+	cluster.uiQueries[0] = cluster.uiQueries[1] = 0;
+	cluster.bPending[0] = cluster.bPending[1] = false;
+	cluster.bVisible = true;
+	cluster.bTested = false;
+	m_clusters.push_back(cluster);
+	return (int) m_clusters.size() - 1;
+}
+
+void COcclusionCuller::Create()
+{
+	for (unsigned int i = 0; i < m_clusters.size(); i++)
+		glGenQueries(2, m_clusters[i].uiQueries);
+
+	glGenVertexArrays(1, &m_uiVAO);
+	glBindVertexArray(m_uiVAO);
+
+	m_vboBox.Create(true);
+	m_vboBox.Bind();
+
+	// A cube from -1 to 1, scaled and moved onto each box
+	m_vboBox.Reserve(8, 36);
+	for (int i = 0; i < 8; i++)
+		m_vboBox.AddVertex(glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f));
+	static const unsigned int faces[6][4] = {
+		{ 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 }
+	};
+	for (int i = 0; i < 6; i++) {
+		m_vboBox.AddTriangle(faces[i][0], faces[i][1], faces[i][2]);
+		m_vboBox.AddTriangle(faces[i][0], faces[i][2], faces[i][3]);
+	}
+	m_vboBox.UploadDataToGPU(GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+	glBindVertexArray(0);
+}
+
+void COcclusionCuller::TestClusters(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, const glm::vec3 &vEye)
+{
+	// Further than the near plane, so a box the camera is in, or nearly in, is never clipped into looking hidden
+	const float fEyeMargin = 1.0f;
+
+	m_iSlot = m_iFrame % 2;
+	int iSlot = m_iSlot;
+	int iLastSlot = 1 - iSlot;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	glBindVertexArray(m_uiVAO);
+
+	m_iNumRejected = 0;
+	for (unsigned int i = 0; i < m_clusters.size(); i++) {
+		CCluster &cluster = m_clusters[i];
+
+		if (cluster.bPending[iLastSlot]) {
+			GLuint uiAvailable = 0;
+			glGetQueryObjectuiv(cluster.uiQueries[iLastSlot], GL_QUERY_RESULT_AVAILABLE, &uiAvailable);
+			if (uiAvailable) {
+				GLuint uiAnySamples = 0;
+				glGetQueryObjectuiv(cluster.uiQueries[iLastSlot], GL_QUERY_RESULT, &uiAnySamples);
+				cluster.bVisible = uiAnySamples != 0;
+			}
+			// A result that is still not ready is dropped, since this slot is reused next frame
+			cluster.bPending[iLastSlot] = false;
+		}
+
+		bool bEyeInside = glm::all(glm::greaterThanEqual(vEye, cluster.vMin - fEyeMargin)) &&
+			glm::all(glm::lessThanEqual(vEye, cluster.vMax + fEyeMargin));
+		if (bEyeInside)
+			cluster.bVisible = true;
+		if (!cluster.bVisible)
+			m_iNumRejected += cluster.iNumObjects;
+
+		cluster.bTested = !bEyeInside && (!cluster.bVisible || (m_iFrame + i) % RETEST_INTERVAL == 0);
+		if (!cluster.bTested)
+			continue;
+
+		glm::vec3 vCentre = (cluster.vMin + cluster.vMax) * 0.5f;
+		glm::vec3 vHalfSize = (cluster.vMax - cluster.vMin) * 0.5f;
+		glm::mat4 modelViewMatrix = viewMatrix * glm::translate(glm::mat4(1.0f), vCentre) * glm::scale(glm::mat4(1.0f), vHalfSize);
+		pProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrix);
+
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, cluster.uiQueries[iSlot]);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		CFrameProfiler::CountDraws();
+		cluster.bPending[iSlot] = true;
+	}
+
+	glEnable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	m_iFrame++;
+}
+
+void COcclusionCuller::SkipTests()
+{
+	m_iNumRejected = 0;
+	for (unsigned int i = 0; i < m_clusters.size(); i++)
+		m_clusters[i].bTested = false;
+}
+
+// The wait is on the GPU, for a query it was given just before; the CPU carries on submitting
+void COcclusionCuller::BeginCluster(int iCluster)
+{
+	const CCluster &cluster = m_clusters[iCluster];
+	if (cluster.bTested)
+		glBeginConditionalRender(cluster.uiQueries[m_iSlot], GL_QUERY_WAIT);
+}
+
+void COcclusionCuller::EndCluster(int iCluster)
+{
+	if (m_clusters[iCluster].bTested)
+		glEndConditionalRender();
+}
+
+int COcclusionCuller::GetNumClusters()
+{
+	return (int) m_clusters.size();
+}
+
+glm::vec3 COcclusionCuller::GetCentre(int iCluster)
+{
+	return (m_clusters[iCluster].vMin + m_clusters[iCluster].vMax) * 0.5f;
+}
+
+int COcclusionCuller::GetNumObjects()
+{
+	int iNumObjects = 0;
+	for (unsigned int i = 0; i < m_clusters.size(); i++)
+		iNumObjects += m_clusters[i].iNumObjects;
+	return iNumObjects;
+}
+
+int COcclusionCuller::GetNumRejected()
+{
+	return m_iNumRejected;
+}
+
+void COcclusionCuller::Release()
+{
+	for (unsigned int i = 0; i < m_clusters.size(); i++)
+		glDeleteQueries(2, m_clusters[i].uiQueries);
+	m_clusters.clear();
+	glDeleteVertexArrays(1, &m_uiVAO);
+	m_vboBox.Release();
+}
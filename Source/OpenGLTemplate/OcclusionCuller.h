@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Common.h"
+#include "VertexBufferBuilder.h"
+
+class CShaderProgram;
+
+// Occlusion culling for clusters of objects.  Once the big occluders are in the depth buffer, each cluster's bounding box is
+// drawn into an occlusion query, and the cluster is then drawn inside glBeginConditionalRender, so the GPU skips it if no part
+// of its box was visible.  The CPU never waits on a query: results are read a frame late, when they are ready, and only decide
+// which clusters to test.  Clusters last seen hidden are tested every frame; clusters last seen visible are tested every
+// RETEST_INTERVAL frames, staggered, and simply drawn in between.
+class COcclusionCuller
+{
+public:
+	COcclusionCuller();
+	~COcclusionCuller();
+
+	// Adds a cluster of iNumObjects objects inside the box from vMin to vMax, and returns its id
+	int AddCluster(const glm::vec3 &vMin, const glm::vec3 &vMax, int iNumObjects);
+	// Creates the queries and the box mesh.  Call after adding the clusters.
+	void Create();
+
+	// Reads back the results that are ready, then draws the boxes of the clusters due for a test with colour and depth writes
+	// off.  pProgram must use mainShader.vert, be in use, and have its projection matrix set.
+	void TestClusters(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, const glm::vec3 &vEye);
+	// Draw every cluster unconditionally this frame, when there are no occluders to test against
+	void SkipTests();
+
+	// Bracket the draws of a cluster.  A cluster tested this frame is drawn only if its box passed.
+	void BeginCluster(int iCluster);
+	void EndCluster(int iCluster);
+
+	int GetNumClusters();
+	glm::vec3 GetCentre(int iCluster);
+	int GetNumObjects();
+	int GetNumRejected();		// Objects in clusters whose latest result was hidden.  Lags the frame by one.
+	void Release();
+
+private:
+	static const int RETEST_INTERVAL = 8;
+
+	struct CCluster
+	{
+		glm::vec3 vMin;
+		glm::vec3 vMax;
+		int iNumObjects;
+		GLuint uiQueries[2];	// This frame's and last frame's
+		bool bPending[2];		// Issued and not yet read
+		bool bVisible;			// Latest result
+		bool bTested;			// Tested this frame
+	};
+
+	vector<CCluster> m_clusters;
+	int m_iFrame;
+	int m_iSlot;			// Query slot of this frame's tests
+	int m_iNumRejected;
+
+	GLuint m_uiVAO;
+	CVertexBufferBuilder<glm::vec3> m_vboBox;
+};
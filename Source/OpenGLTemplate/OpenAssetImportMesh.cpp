@@ -18,6 +18,8 @@
 
 #include <assert.h>
 #include "OpenAssetImportMesh.h"
+#include "StaticBatch.h"
+#include "FrameProfiler.h"
 
 #pragma comment(lib, "lib/assimp.lib")
 
@@ -31,29 +33,37 @@ COpenAssetImportMesh::MeshEntry::MeshEntry()
 
 COpenAssetImportMesh::MeshEntry::~MeshEntry()
 {
-    if (VB != INVALID_OGL_VALUE)
+    if (VB != INVALID_OGL_VALUE) {
+        CMemoryTracker::ForgetBuffer(VB);
         glDeleteBuffers(1, &VB);
+    }
 
-    if (IB != INVALID_OGL_VALUE)
+    if (IB != INVALID_OGL_VALUE) {
+        CMemoryTracker::ForgetBuffer(IB);
         glDeleteBuffers(1, &IB);
+    }
 }
 
-void COpenAssetImportMesh::MeshEntry::Init(const std::vector<Vertex>& Vertices,
-                          const std::vector<unsigned int>& Indices)
+void COpenAssetImportMesh::MeshEntry::Init(const TrackedVector<Vertex>& Vertices,
+                          const TrackedVector<unsigned int>& Indices)
 {
     NumIndices = Indices.size();
+    NumVertices = Vertices.size();
 
 	glGenBuffers(1, &VB);
   	glBindBuffer(GL_ARRAY_BUFFER, VB);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW);
+	CMemoryTracker::TrackBuffer(VB, sizeof(Vertex) * Vertices.size());
 
     glGenBuffers(1, &IB);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IB);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * NumIndices, &Indices[0], GL_STATIC_DRAW);
+    CMemoryTracker::TrackBuffer(IB, sizeof(unsigned int) * NumIndices);
 }
 
 COpenAssetImportMesh::COpenAssetImportMesh()
 {
+    m_bImported = false;
 }
 
 
@@ -76,7 +86,12 @@ bool COpenAssetImportMesh::Load(const std::string& Filename)
 {
     // Release the previously loaded mesh (if it exists)
     Clear();
-    
+
+    return Import(Filename) && Upload();
+}
+
+bool COpenAssetImportMesh::Import(const std::string& Filename)
+{
     bool Ret = false;
     Assimp::Importer Importer;
 
@@ -89,16 +104,49 @@ bool COpenAssetImportMesh::Load(const std::string& Filename)
         MessageBox(NULL, Importer.GetErrorString(), "Error loading mesh model", MB_ICONHAND);
     }
 
+    m_bImported = Ret;
     return Ret;
 }
 
+bool COpenAssetImportMesh::Upload()
+{
+    if (!m_bImported)
+        return false;
+
+	glGenVertexArrays(1, &m_uiVAO); 
+	glBindVertexArray(m_uiVAO);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_Entries[i].Init(m_Entries[i].Vertices, m_Entries[i].Indices);
+        TrackedVector<Vertex>().swap(m_Entries[i].Vertices);
+        TrackedVector<unsigned int>().swap(m_Entries[i].Indices);
+    }
+
+    for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
+        if (m_Textures[i]) {
+            m_Textures[i]->Upload(true);
+        }
+        else {
+            // Load a single colour texture matching the diffuse colour if no texture added
+            const aiColor3D& color = m_DiffuseColours[i];
+			m_Textures[i] = new CTexture();
+			BYTE data[3];
+			data[0] = (BYTE) (color[2]*255);
+			data[1] = (BYTE) (color[1]*255);
+			data[2] = (BYTE) (color[0]*255);
+			m_Textures[i]->CreateFromData(data, 1, 1, 24, GL_BGR, false);
+        }
+    }
+
+    m_bImported = false;
+    return true;
+}
+
 bool COpenAssetImportMesh::InitFromScene(const aiScene* pScene, const std::string& Filename)
 {  
     m_Entries.resize(pScene->mNumMeshes);
     m_Textures.resize(pScene->mNumMaterials);
-
-	glGenVertexArrays(1, &m_uiVAO); 
-	glBindVertexArray(m_uiVAO);
+    m_DiffuseColours.resize(pScene->mNumMaterials);
 
 
     // Initialize the meshes in the scene one by one
@@ -114,8 +162,8 @@ void COpenAssetImportMesh::InitMesh(unsigned int Index, const aiMesh* paiMesh)
 {
     m_Entries[Index].MaterialIndex = paiMesh->mMaterialIndex;
     
-    std::vector<Vertex> Vertices;
-    std::vector<unsigned int> Indices;
+    TrackedVector<Vertex> Vertices;
+    TrackedVector<unsigned int> Indices;
 
     const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
@@ -139,7 +187,8 @@ void COpenAssetImportMesh::InitMesh(unsigned int Index, const aiMesh* paiMesh)
         Indices.push_back(Face.mIndices[2]);
     }
 
-    m_Entries[Index].Init(Vertices, Indices);
+    m_Entries[Index].Vertices.swap(Vertices);
+    m_Entries[Index].Indices.swap(Indices);
 }
 
 bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::string& Filename)
@@ -172,7 +221,7 @@ bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::strin
 			if (pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
                 std::string FullPath = Dir + "\\" + Path.data;
                 m_Textures[i] = new CTexture();
-                if (!m_Textures[i]->Load(FullPath, true)) {
+                if (!m_Textures[i]->Decode(FullPath)) {
  					MessageBox(NULL, FullPath.c_str(), "Error loading mesh texture", MB_ICONHAND);
                     delete m_Textures[i];
                     m_Textures[i] = NULL;
@@ -184,20 +233,10 @@ bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::strin
             }
         }
 
-        // Load a single colour texture matching the diffuse colour if no texture added
-        if (!m_Textures[i]) {
-		
-			aiColor3D color (0.f,0.f,0.f);
-			pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE,color);
-
-			m_Textures[i] = new CTexture();
-			BYTE data[3];
-			data[0] = (BYTE) (color[2]*255);
-			data[1] = (BYTE) (color[1]*255);
-			data[2] = (BYTE) (color[0]*255);
-			m_Textures[i]->CreateFromData(data, 1, 1, 24, GL_BGR, false);
-
-        }
+        // Remember the diffuse colour, for a single colour texture if no texture was found
+        aiColor3D color (0.f,0.f,0.f);
+        pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE,color);
+        m_DiffuseColours[i] = color;
     }
 
     return Ret;
@@ -228,6 +267,7 @@ void COpenAssetImportMesh::Render()
 
 
         glDrawElements(GL_TRIANGLES, m_Entries[i].NumIndices, GL_UNSIGNED_INT, 0);
+		CFrameProfiler::CountDraws();
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
@@ -236,3 +276,12 @@ void COpenAssetImportMesh::Render()
 
 
 }
+
+void COpenAssetImportMesh::AddToStaticBatch(CStaticBatch *pBatch, std::vector<int> &meshIds)
+{
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+        CTexture *pTexture = MaterialIndex < m_Textures.size() ? m_Textures[MaterialIndex] : NULL;
+        meshIds.push_back(pBatch->AddMesh(m_Entries[i].VB, m_Entries[i].NumVertices, m_Entries[i].IB, m_Entries[i].NumIndices, pTexture));
+    }
+}
@@ -28,8 +28,11 @@
 #include <PostProcess.h> // Post processing flags
 
 #include "Common.h"
+#include "MemoryTracker.h"
 #include "Texture.h"
 
+class CStaticBatch;
+
 #define INVALID_OGL_VALUE 0xFFFFFFFF
 #define SAFE_DELETE(p) if (p) { delete p; p = NULL; }
 
@@ -58,6 +61,12 @@ public:
     ~COpenAssetImportMesh();
     bool Load(const std::string& Filename);
     void Render();
+    void AddToStaticBatch(CStaticBatch *pBatch, std::vector<int> &meshIds);   // One mesh per entry, with its material's texture
+
+    // Load splits into Import, which reads the file and its textures and is safe on a worker thread, and Upload, which
+    // creates the buffers and textures in OpenGL
+    bool Import(const std::string& Filename);
+    bool Upload();
 
 private:
     bool InitFromScene(const aiScene* pScene, const std::string& Filename);
@@ -73,16 +82,21 @@ private:
 
         ~MeshEntry();
 
-        void Init(const std::vector<Vertex>& Vertices,
-                  const std::vector<unsigned int>& Indices);
+        void Init(const TrackedVector<Vertex>& Vertices,
+                  const TrackedVector<unsigned int>& Indices);
         GLuint VB;
         GLuint IB;
         unsigned int NumIndices;
+        unsigned int NumVertices;
         unsigned int MaterialIndex;
+        TrackedVector<Vertex> Vertices;        // Filled by Import, freed by Upload
+        TrackedVector<unsigned int> Indices;
     };
 
     std::vector<MeshEntry> m_Entries;
     std::vector<CTexture*> m_Textures;
+    std::vector<aiColor3D> m_DiffuseColours;   // Used for materials without a texture
+    bool m_bImported;
 	GLuint m_uiVAO;
 };
 
@@ -0,0 +1,218 @@
+#include "ParticleSystem.h"
+#include "Shaders.h"
+#include "FrameProfiler.h"
+#include "MemoryTracker.h"
+
+CParticleSystem::CParticleSystem()
+{
+	m_uiCapacity = 0;
+	for (int i = 0; i < 2; i++) {
+		m_uiBuffers[i] = 0;
+		m_uiUpdateVAOs[i] = 0;
+		m_uiRenderVAOs[i] = 0;
+		m_uiFeedback[i] = 0;
+	}
+	m_iCurrent = 0;
+	m_uiHead = 0;
+	m_iNumBursts = 0;
+	m_iFirstRun = 0;
+	m_iNumRuns = 0;
+	m_uiNumLive = 0;
+	m_fTime = 0.0f;
+	m_iFrame = 0;
+	m_pUpdateProgram = NULL;
+	m_pRenderProgram = NULL;
+}
+
+CParticleSystem::~CParticleSystem()
+{}
+
+bool CParticleSystem::Create(UINT uiCapacity, CShaderProgram *pUpdateProgram, CShaderProgram *pRenderProgram)
+{
+	m_uiCapacity = uiCapacity;
+	m_pUpdateProgram = pUpdateProgram;
+	m_pRenderProgram = pRenderProgram;
+
+	GLsizeiptr size = (GLsizeiptr) uiCapacity * sizeof(CParticle);
+	glGenBuffers(2, m_uiBuffers);
+	glGenVertexArrays(2, m_uiUpdateVAOs);
+	glGenVertexArrays(2, m_uiRenderVAOs);
+	glGenTransformFeedbacks(2, m_uiFeedback);
+	for (int i = 0; i < 2; i++) {
+		// Every particle starts dead, with no life left.  Zeroing through a mapping saves a copy of the whole buffer in memory.
+		glBindBuffer(GL_ARRAY_BUFFER, m_uiBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+		void *pData = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (pData == NULL)
+			return false;
+		memset(pData, 0, (size_t) size);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		CMemoryTracker::TrackBuffer(m_uiBuffers[i], (size_t) size);
+
+		glBindVertexArray(m_uiUpdateVAOs[i]);
+		SetAttributes(false, 0);
+		glBindVertexArray(m_uiRenderVAOs[i]);
+		SetAttributes(true, 0);
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_uiFeedback[i]);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_uiBuffers[i]);
+	}
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	glBindVertexArray(0);
+	return true;
+}
+
+// Attributes for the buffer bound to GL_ARRAY_BUFFER, advancing per vertex or per instance from particle uiFirst
+void CParticleSystem::SetAttributes(bool bInstanced, UINT uiFirst)
+{
+	size_t first = (size_t) uiFirst * sizeof(CParticle);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(CParticle), (void*) (first + offsetof(CParticle, position)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(CParticle), (void*) (first + offsetof(CParticle, velocity)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(CParticle), (void*) (first + offsetof(CParticle, uiColour)));
+	for (int i = 0; i < 3; i++)
+		glVertexAttribDivisor(i, bInstanced ? 1 : 0);
+}
+
+void CParticleSystem::Emit(const glm::vec3 &vOrigin, UINT uiCount, float fSpeed, float fLife, const glm::vec4 &vColour)
+{
+	if (m_iNumBursts == MAX_BURSTS || uiCount == 0 || m_uiCapacity == 0)
+		return;
+
+	uiCount = min(uiCount, m_uiCapacity);
+	int i = m_iNumBursts++;
+	m_burstFirsts[i] = (int) m_uiHead;
+	m_burstCounts[i] = (int) uiCount;
+	m_burstOrigins[i] = glm::vec4(vOrigin, fSpeed);
+	m_burstColours[i] = vColour;
+	m_burstLives[i] = fLife;
+	m_uiHead = (m_uiHead + uiCount) % m_uiCapacity;
+
+	// The burst's particles are live until its longest-lived one dies.  Once the runs are all in use, the newest covers it.
+	if (m_iNumRuns == MAX_RUNS) {
+		int iNewest = (m_iFirstRun + m_iNumRuns - 1) % MAX_RUNS;
+		m_runCounts[iNewest] += uiCount;
+		m_runEnds[iNewest] = max(m_runEnds[iNewest], m_fTime + fLife);
+	}
+	else {
+		int iRun = (m_iFirstRun + m_iNumRuns++) % MAX_RUNS;
+		m_runCounts[iRun] = uiCount;
+		m_runEnds[iRun] = m_fTime + fLife;
+	}
+	m_uiNumLive = min(m_uiNumLive + uiCount, m_uiCapacity);
+}
+
+// The particles that may be alive, as one span of the ring, or two if they wrap round its end.  Returns the number of spans.
+int CParticleSystem::GetLiveSpans(UINT uiFirsts[2], UINT uiCounts[2])
+{
+	UINT uiTail = (m_uiHead + m_uiCapacity - m_uiNumLive) % m_uiCapacity;
+	uiFirsts[0] = uiTail;
+	uiCounts[0] = min(m_uiNumLive, m_uiCapacity - uiTail);
+	uiFirsts[1] = 0;
+	uiCounts[1] = m_uiNumLive - uiCounts[0];
+	return uiCounts[1] > 0 ? 2 : 1;
+}
+
+void CParticleSystem::Update(float fDt)
+{
+	if (!IsActive())
+		return;
+
+	m_pUpdateProgram->UseProgram();
+	m_pUpdateProgram->SetUniform("fDt", fDt);
+	m_pUpdateProgram->SetUniform("iFrame", m_iFrame);
+	m_pUpdateProgram->SetUniform("vGravity", glm::vec3(0.0f, -9.8f, 0.0f));
+	m_pUpdateProgram->SetUniform("fDrag", 0.8f);
+	m_pUpdateProgram->SetUniform("iCapacity", (int) m_uiCapacity);
+	m_pUpdateProgram->SetUniform("iNumBursts", m_iNumBursts);
+	if (m_iNumBursts > 0) {
+		m_pUpdateProgram->SetUniform("burstFirsts", m_burstFirsts, m_iNumBursts);
+		m_pUpdateProgram->SetUniform("burstCounts", m_burstCounts, m_iNumBursts);
+		m_pUpdateProgram->SetUniform("burstOrigins", m_burstOrigins, m_iNumBursts);
+		m_pUpdateProgram->SetUniform("burstColours", m_burstColours, m_iNumBursts);
+		m_pUpdateProgram->SetUniform("burstLives", m_burstLives, m_iNumBursts);
+	}
+
+	// Read the live particles from the current buffer and capture them into the same place in the other.  The rest of the
+	// other buffer goes stale, but nothing reads it before a burst takes it again.
+	UINT uiFirsts[2], uiCounts[2];
+	int iNumSpans = GetLiveSpans(uiFirsts, uiCounts);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(m_uiUpdateVAOs[m_iCurrent]);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_uiFeedback[1 - m_iCurrent]);
+	for (int i = 0; i < iNumSpans; i++) {
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_uiBuffers[1 - m_iCurrent], (GLintptr) uiFirsts[i] * sizeof(CParticle),
+			(GLsizeiptr) uiCounts[i] * sizeof(CParticle));
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, uiFirsts[i], uiCounts[i]);
+		glEndTransformFeedback();
+	}
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	CFrameProfiler::CountDraws(iNumSpans);
+
+	m_iCurrent = 1 - m_iCurrent;
+	m_iNumBursts = 0;
+	m_fTime += fDt;
+	m_iFrame++;
+
+	// Bursts whose particles have all died leave the live stretch from its old end
+	while (m_iNumRuns > 0 && m_runEnds[m_iFirstRun] <= m_fTime) {
+		m_uiNumLive -= min(m_runCounts[m_iFirstRun], m_uiNumLive);
+		m_iFirstRun = (m_iFirstRun + 1) % MAX_RUNS;
+		m_iNumRuns--;
+	}
+	if (m_iNumRuns == 0)
+		m_uiNumLive = 0;
+}
+
+void CParticleSystem::Render(glm::mat4 *pProjectionMatrix, const glm::mat4 &viewMatrix)
+{
+	if (!IsActive())
+		return;
+
+	m_pRenderProgram->UseProgram();
+	m_pRenderProgram->SetUniform("matrices.projMatrix", pProjectionMatrix);
+	m_pRenderProgram->SetUniform("matrices.viewMatrix", viewMatrix);
+	m_pRenderProgram->SetUniform("fSize", 0.6f);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDepthMask(GL_FALSE);
+	// One instance per live particle.  There is no base instance in GL 4.0, so the attributes start at each span's first.
+	UINT uiFirsts[2], uiCounts[2];
+	int iNumSpans = GetLiveSpans(uiFirsts, uiCounts);
+	glBindVertexArray(m_uiRenderVAOs[m_iCurrent]);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiBuffers[m_iCurrent]);
+	for (int i = 0; i < iNumSpans; i++) {
+		SetAttributes(true, uiFirsts[i]);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, uiCounts[i]);
+	}
+	CFrameProfiler::CountDraws(iNumSpans);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+}
+
+void CParticleSystem::Release()
+{
+	for (int i = 0; i < 2; i++)
+		CMemoryTracker::ForgetBuffer(m_uiBuffers[i]);
+	glDeleteBuffers(2, m_uiBuffers);
+	glDeleteVertexArrays(2, m_uiUpdateVAOs);
+	glDeleteVertexArrays(2, m_uiRenderVAOs);
+	glDeleteTransformFeedbacks(2, m_uiFeedback);
+	m_uiCapacity = 0;
+}
+
+UINT CParticleSystem::GetCapacity()
+{
+	return m_uiCapacity;
+}
+
+// Bursts waiting for the next Update count as alive
+bool CParticleSystem::IsActive()
+{
+	return m_iNumRuns > 0;
+}
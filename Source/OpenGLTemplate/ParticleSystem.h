@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Common.h"
+
+class CShaderProgram;
+
+// Particles simulated entirely on the GPU.  Position, velocity, life and colour live in two buffers; each Update runs
+// particleUpdate.vert once per particle over one buffer and captures the result into the other with transform feedback, then
+// the two swap.  Render draws the current buffer as camera-facing quads, one instance per particle.
+//
+// The particles form a ring.  A burst takes the next run of particles round it, whatever they were doing, and is passed to
+// the update shader as a few uniforms, so the CPU's cost per frame depends on the number of bursts and never on the number of
+// particles.  The particles that may be alive are the stretch of the ring behind the next burst, back to the oldest burst
+// that has not yet died out, and Update and Render cover only that stretch.  While every particle is dead, they do nothing.
+class CParticleSystem
+{
+public:
+	CParticleSystem();
+	~CParticleSystem();
+
+	// pUpdateProgram is particleUpdate.vert, capturing vPosition, vVelocity and vColour.  pRenderProgram is particleRender.vert
+	// and particleRender.frag.
+	bool Create(UINT uiCapacity, CShaderProgram *pUpdateProgram, CShaderProgram *pRenderProgram);
+	void Release();
+
+	// Fires uiCount particles out from vOrigin in random directions at up to fSpeed units per second.  They live up to fLife
+	// seconds.  Takes effect at the next Update; bursts past MAX_BURSTS in one frame are dropped.
+	void Emit(const glm::vec3 &vOrigin, UINT uiCount, float fSpeed, float fLife, const glm::vec4 &vColour);
+
+	// Advances every particle by fDt seconds
+	void Update(float fDt);
+	// Additive, depth tested against the scene but not written
+	void Render(glm::mat4 *pProjectionMatrix, const glm::mat4 &viewMatrix);
+
+	UINT GetCapacity();
+	bool IsActive();			// Some particle may still be alive
+
+private:
+	static const int MAX_BURSTS = 16;	// Matches particleUpdate.vert
+	static const int MAX_RUNS = 256;	// Bursts still alive that are tracked apart; more extend the newest
+
+	// Layout of a particle in the buffers, and of the update shader's captured outputs
+	struct CParticle
+	{
+		glm::vec4 position;		// xyz, with the seconds of life left in w
+		glm::vec4 velocity;		// xyz, with the whole lifetime in w
+		GLuint uiColour;		// RGBA, 8 bits each
+	};
+
+	void SetAttributes(bool bInstanced, UINT uiFirst);
+	int GetLiveSpans(UINT uiFirsts[2], UINT uiCounts[2]);
+
+	UINT m_uiCapacity;
+	GLuint m_uiBuffers[2];
+	GLuint m_uiUpdateVAOs[2];			// Read buffer i one particle per vertex
+	GLuint m_uiRenderVAOs[2];			// Read buffer i one particle per instance, from the first live one
+	GLuint m_uiFeedback[2];				// Capture into buffer i
+	int m_iCurrent;						// The buffer holding the latest state
+
+	UINT m_uiHead;						// The next particle a burst takes
+	int m_iNumBursts;
+	int m_burstFirsts[MAX_BURSTS];
+	int m_burstCounts[MAX_BURSTS];
+	glm::vec4 m_burstOrigins[MAX_BURSTS];
+	glm::vec4 m_burstColours[MAX_BURSTS];
+	float m_burstLives[MAX_BURSTS];
+
+	// The bursts that may still have live particles, oldest first, as a ring of their particle counts and the times their
+	// longest-lived particles die
+	UINT m_runCounts[MAX_RUNS];
+	float m_runEnds[MAX_RUNS];
+	int m_iFirstRun;
+	int m_iNumRuns;
+	UINT m_uiNumLive;					// Particles in the runs, up to the ring behind m_uiHead
+
+	float m_fTime;						// Seconds of updates so far
+	int m_iFrame;
+
+	CShaderProgram *m_pUpdateProgram;
+	CShaderProgram *m_pRenderProgram;
+};
@@ -1,5 +1,7 @@
 #include "Common.h"
 #include "Plane.h"
+#include "StaticBatch.h"
+#include "FrameProfiler.h"
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 
@@ -13,15 +15,27 @@ CPlane::~CPlane()
 // Create the plane, including its geometry, texture mapping, normal, and colour
 void CPlane::Create(string sDirectory, string sFilename, float fWidth, float fHeight, float fTextureRepeat)
 {
-	
+	Decode(sDirectory, sFilename);
+	Upload(fWidth, fHeight, fTextureRepeat);
+}
+
+// Read the texture image
+bool CPlane::Decode(string sDirectory, string sFilename)
+{
+	m_sDirectory = sDirectory;
+	m_sFilename = sFilename;
+
+	return m_tTexture.Decode(sDirectory+sFilename);
+}
+
+// Upload the texture and create the geometry
+void CPlane::Upload(float fWidth, float fHeight, float fTextureRepeat)
+{
 	m_fwidth = fWidth;
 	m_fheight = fHeight;
 
 	// Load the texture
-	m_tTexture.Load(sDirectory+sFilename, true);
-
-	m_sDirectory = sDirectory;
-	m_sFilename = sFilename;
+	m_tTexture.Upload(true);
 
 	// Set parameters for texturing using sampler object
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -94,7 +108,15 @@ void CPlane::Render()
 	glBindVertexArray(m_uiVAO);
 	m_tTexture.Bind();
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	
+	CFrameProfiler::CountDraws();
+}
+
+// Adds the plane's quad, as two triangles, to a static batch
+void CPlane::AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds)
+{
+	vector<unsigned int> indices;
+	CStaticBatch::AppendStripIndices(0, 4, indices);
+	meshIds.push_back(pBatch->AddMesh(m_vbo.GetBufferID(), 4, indices, &m_tTexture));
 }
 
 // Release resources
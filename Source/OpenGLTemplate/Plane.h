@@ -3,6 +3,8 @@
 #include "Texture.h"
 #include "VertexBufferObject.h"
 
+class CStaticBatch;
+
 // Class for generating a xz plane of a given size
 class CPlane
 {
@@ -10,7 +12,10 @@ public:
 	CPlane();
 	~CPlane();
 	void Create(string sDirectory, string sFilename, float fWidth, float fHeight, float fTextureRepeat);
+	bool Decode(string sDirectory, string sFilename);	// Reads the texture; safe on a worker thread
+	void Upload(float fWidth, float fHeight, float fTextureRepeat);
 	void Render();
+	void AddToStaticBatch(CStaticBatch *pBatch, vector<int> &meshIds);
 	void Release();
 private:
 	UINT m_uiVAO;
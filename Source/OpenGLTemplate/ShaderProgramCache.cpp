@@ -0,0 +1,165 @@
+#include "ShaderProgramCache.h"
+
+typedef void (GLAPIENTRY *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+
+// Returns true if the context advertises the named extension
+static bool HasExtension(const char *szName)
+{
+	int iNumExtensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &iNumExtensions);
+	for (int i = 0; i < iNumExtensions; i++) {
+		const char *szExtension = (const char *) glGetStringi(GL_EXTENSIONS, i);
+		if (szExtension && strcmp(szExtension, szName) == 0)
+			return true;
+	}
+	return false;
+}
+
+CShaderProgramCache::CShaderProgramCache(string sCacheDirectory)
+{
+	m_sCacheDirectory = sCacheDirectory;
+
+	const char *szVendor = (const char *) glGetString(GL_VENDOR);
+	const char *szRenderer = (const char *) glGetString(GL_RENDERER);
+	const char *szVersion = (const char *) glGetString(GL_VERSION);
+	m_sDriver = string(szVendor ? szVendor : "") + "|" + (szRenderer ? szRenderer : "") + "|" + (szVersion ? szVersion : "");
+}
+
+CShaderProgramCache::~CShaderProgramCache()
+{
+	for (unsigned int i = 0; i < m_programs.size(); i++) {
+		for (unsigned int j = 0; j < m_programs[i].shaders.size(); j++)
+			delete m_programs[i].shaders[j];
+	}
+}
+
+CShaderProgram* CShaderProgramCache::AddProgram(const vector<string> &sShaderFileNames, const vector<string> &sFeedbackVaryings)
+{
+	CProgramEntry entry;
+	entry.pProgram = new CShaderProgram;
+	entry.feedbackVaryings = sFeedbackVaryings;
+	entry.bFromCache = false;
+	entry.bSourceLoaded = true;
+	for (unsigned int i = 0; i < sShaderFileNames.size(); i++) {
+		CShader *pShader = new CShader;
+		if (!pShader->LoadSource("resources\\shaders\\" + sShaderFileNames[i], ShaderTypeFromExtension(sShaderFileNames[i])))
+			entry.bSourceLoaded = false;
+		entry.shaders.push_back(pShader);
+	}
+	m_programs.push_back(entry);
+
+	return entry.pProgram;
+}
+
+int CShaderProgramCache::ShaderTypeFromExtension(const string &sFileName)
+{
+	string sExt = sFileName.substr((int) sFileName.size()-4, 4);
+	if (sExt == "vert") return GL_VERTEX_SHADER;
+	else if (sExt == "frag") return GL_FRAGMENT_SHADER;
+	else if (sExt == "geom") return GL_GEOMETRY_SHADER;
+	else if (sExt == "tcnl") return GL_TESS_CONTROL_SHADER;
+	else return GL_TESS_EVALUATION_SHADER;
+}
+
+// The cache file name is a 64-bit FNV-1a hash of the driver strings, the preprocessed source of every stage and the captured
+// varyings
+string CShaderProgramCache::ComputeCacheFile(const CProgramEntry &entry)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	string sKey = m_sDriver;
+	for (unsigned int i = 0; i < entry.shaders.size(); i++) {
+		stringstream ss;
+		ss << '\0' << entry.shaders[i]->GetType() << '\0';
+		sKey += ss.str() + entry.shaders[i]->GetSource();
+	}
+	for (unsigned int i = 0; i < entry.feedbackVaryings.size(); i++)
+		sKey += '\0' + entry.feedbackVaryings[i];
+	for (unsigned int i = 0; i < sKey.size(); i++) {
+		hash ^= (unsigned char) sKey[i];
+		hash *= 1099511628211ULL;
+	}
+
+	char sHash[17];
+	sprintf_s(sHash, "%016llx", hash);
+	return m_sCacheDirectory + sHash + ".bin";
+}
+
+bool CShaderProgramCache::Build()
+{
+	bool bBinaries = GLEW_ARB_get_program_binary == GL_TRUE;
+	if (bBinaries)
+		CreateDirectory(m_sCacheDirectory.c_str(), NULL);
+
+	// Try the cache first
+	bool bOK = true;
+	for (unsigned int i = 0; i < m_programs.size(); i++) {
+		CProgramEntry &entry = m_programs[i];
+		if (!entry.bSourceLoaded) {
+			bOK = false;
+			continue;
+		}
+		entry.sCacheFile = ComputeCacheFile(entry);
+		entry.pProgram->CreateProgram();
+		entry.bFromCache = bBinaries && entry.pProgram->LoadBinary(entry.sCacheFile);
+	}
+
+	// Let the driver use as many compiler threads as it likes
+	if (HasExtension("GL_KHR_parallel_shader_compile") || HasExtension("GL_ARB_parallel_shader_compile")) {
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR =
+			(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (glMaxShaderCompilerThreadsKHR)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+
+	// Issue every compile, then every link, before waiting on any of them
+	for (unsigned int i = 0; i < m_programs.size(); i++) {
+		if (m_programs[i].bFromCache || !m_programs[i].bSourceLoaded)
+			continue;
+		for (unsigned int j = 0; j < m_programs[i].shaders.size(); j++)
+			m_programs[i].shaders[j]->Compile();
+	}
+	for (unsigned int i = 0; i < m_programs.size(); i++) {
+		CProgramEntry &entry = m_programs[i];
+		if (entry.bFromCache || !entry.bSourceLoaded)
+			continue;
+		for (unsigned int j = 0; j < entry.shaders.size(); j++)
+			entry.pProgram->AddShaderToProgram(entry.shaders[j]);
+		if (bBinaries)
+			glProgramParameteri(entry.pProgram->GetProgramID(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		// Varyings must be named before the link
+		if (!entry.feedbackVaryings.empty()) {
+			vector<const char*> szVaryings;
+			for (unsigned int j = 0; j < entry.feedbackVaryings.size(); j++)
+				szVaryings.push_back(entry.feedbackVaryings[j].c_str());
+			glTransformFeedbackVaryings(entry.pProgram->GetProgramID(), (GLsizei) szVaryings.size(), &szVaryings[0],
+				GL_INTERLEAVED_ATTRIBS);
+		}
+		entry.pProgram->Link();
+	}
+
+	// Collect the results, reporting errors and saving the new binaries
+	for (unsigned int i = 0; i < m_programs.size(); i++) {
+		CProgramEntry &entry = m_programs[i];
+		if (entry.bFromCache || !entry.bSourceLoaded)
+			continue;
+
+		bool bCompiled = true;
+		for (unsigned int j = 0; j < entry.shaders.size(); j++) {
+			if (!entry.shaders[j]->CheckCompileStatus())
+				bCompiled = false;
+		}
+
+		if (bCompiled && entry.pProgram->CheckLinkStatus()) {
+			if (bBinaries)
+				entry.pProgram->SaveBinary(entry.sCacheFile);
+		}
+		else
+			bOK = false;
+
+		// The program keeps its own copy of the compiled code
+		for (unsigned int j = 0; j < entry.shaders.size(); j++)
+			entry.shaders[j]->DeleteShader();
+	}
+
+	return bOK;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Common.h"
+#include "Shaders.h"
+
+// Builds a set of shader programs together.  Programs whose binary is in the cache directory are loaded with glProgramBinary;
+// the rest have all of their compiles and links issued before any status is queried, so that drivers with
+// KHR_parallel_shader_compile can overlap them.  Newly linked programs are saved to the cache for the next launch.
+class CShaderProgramCache
+{
+public:
+	CShaderProgramCache(string sCacheDirectory);
+	~CShaderProgramCache();
+
+	// Add a program built from the given shader files in resources\shaders.  The program is usable after Build() succeeds.
+	// Outputs named in sFeedbackVaryings are captured, interleaved in that order, by transform feedback.
+	CShaderProgram* AddProgram(const vector<string> &sShaderFileNames, const vector<string> &sFeedbackVaryings = vector<string>());
+
+	// Returns false if any shader failed to compile or any program failed to link
+	bool Build();
+
+private:
+	struct CProgramEntry
+	{
+		CShaderProgram *pProgram;
+		vector<CShader*> shaders;
+		vector<string> feedbackVaryings;
+		string sCacheFile;
+		bool bSourceLoaded;
+		bool bFromCache;
+	};
+
+	static int ShaderTypeFromExtension(const string &sFileName);
+	string ComputeCacheFile(const CProgramEntry &entry);
+
+	string m_sCacheDirectory;
+	string m_sDriver;					// Vendor, renderer and version strings; binaries are only valid for the driver that made them
+	vector<CProgramEntry> m_programs;
+};
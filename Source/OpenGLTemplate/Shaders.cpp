@@ -5,6 +5,7 @@
 
 CShader::CShader()
 {
+	m_uiShader = 0;
 	m_bLoaded = false;
 }
 CShader::~CShader()
@@ -12,6 +13,16 @@ CShader::~CShader()
 
 // Loads a shader, stored as a text file with filename sFile.  The shader is of type iType (vertex, fragment, geometry, etc.)
 bool CShader::LoadShader(string sFile, int iType)
+{
+	if (!LoadSource(sFile, iType))
+		return false;
+
+	Compile();
+	return CheckCompileStatus();
+}
+
+// Reads the shader source, following #include directives.  Does not touch OpenGL.
+bool CShader::LoadSource(string sFile, int iType)
 {
 	vector<string> sLines;
 
@@ -22,17 +33,29 @@ bool CShader::LoadShader(string sFile, int iType)
 		return false;
 	}
 
-	const char** sProgram = new const char*[(int)sLines.size()];
+	m_sSource.clear();
 	for (int i = 0; i < (int)sLines.size(); i++) 
-		sProgram[i] = sLines[i].c_str();
-	
-	m_uiShader = glCreateShader(iType);
+		m_sSource += sLines[i];
 
-	glShaderSource(m_uiShader, (int)sLines.size(), sProgram, NULL);
-	glCompileShader(m_uiShader);
+	m_sFile = sFile;
+	m_iType = iType;
+	return true;
+}
+
+// Issues the compile of the source read by LoadSource.  The driver may compile in the background until the status is queried.
+void CShader::Compile()
+{
+	const char* sProgram = m_sSource.c_str();
 
-	delete[] sProgram;
+	m_uiShader = glCreateShader(m_iType);
 
+	glShaderSource(m_uiShader, 1, &sProgram, NULL);
+	glCompileShader(m_uiShader);
+}
+
+// Waits for the compile to finish, and reports any errors
+bool CShader::CheckCompileStatus()
+{
 	int iCompilationStatus;
 	glGetShaderiv(m_uiShader, GL_COMPILE_STATUS, &iCompilationStatus);
 
@@ -43,30 +66,40 @@ bool CShader::LoadShader(string sFile, int iType)
 		int iLogLength;
 		glGetShaderInfoLog(m_uiShader, 1024, &iLogLength, sInfoLog);
 		char sShaderType[64];
-		if (iType == GL_VERTEX_SHADER)
+		if (m_iType == GL_VERTEX_SHADER)
 			sprintf_s(sShaderType, "vertex shader");
-		else if (iType == GL_FRAGMENT_SHADER)
+		else if (m_iType == GL_FRAGMENT_SHADER)
 			sprintf_s(sShaderType, "fragment shader");
-		else if (iType == GL_GEOMETRY_SHADER)
+		else if (m_iType == GL_GEOMETRY_SHADER)
 			sprintf_s(sShaderType, "geometry shader");
-		else if (iType == GL_TESS_CONTROL_SHADER)
+		else if (m_iType == GL_TESS_CONTROL_SHADER)
 			sprintf_s(sShaderType, "tesselation control shader");
-		else if (iType == GL_TESS_EVALUATION_SHADER)
+		else if (m_iType == GL_TESS_EVALUATION_SHADER)
 			sprintf_s(sShaderType, "tesselation evaluation shader");
 		else
 			sprintf_s(sShaderType, "unknown shader type");
 
-		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, sFile.c_str(), sInfoLog);
+		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, m_sFile.c_str(), sInfoLog);
 
 		MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
 		return false;
 	}
-	m_iType = iType;
 	m_bLoaded = true;
 
 	return true;
 }
 
+// Returns the source read by LoadSource
+const string& CShader::GetSource()
+{
+	return m_sSource;
+}
+
+int CShader::GetType()
+{
+	return m_iType;
+}
+
 
 // Loads a file into a vector of strings (vResult)
 bool CShader::GetLinesFromFile(string sFile, bool bIncludePart, vector<string>* vResult)
@@ -155,10 +188,10 @@ void CShaderProgram::CreateProgram()
 	m_uiProgram = glCreateProgram();
 }
 
-// Adds a compiled shader to a program
+// Adds a compiled shader to a program.  The compile may still be in progress.
 bool CShaderProgram::AddShaderToProgram(CShader* shShader)
 {
-	if(!shShader->IsLoaded())
+	if(shShader->GetShaderID() == 0)
 		return false;
 
 	glAttachShader(m_uiProgram, shShader->GetShaderID());
@@ -168,8 +201,20 @@ bool CShaderProgram::AddShaderToProgram(CShader* shShader)
 
 // Performs final linkage of the OpenGL shader program
 bool CShaderProgram::LinkProgram()
+{
+	Link();
+	return CheckLinkStatus();
+}
+
+// Issues the link.  The driver may link in the background until the status is queried.
+void CShaderProgram::Link()
 {
 	glLinkProgram(m_uiProgram);
+}
+
+// Waits for the link to finish, and reports any errors
+bool CShaderProgram::CheckLinkStatus()
+{
 	int iLinkStatus;
 	glGetProgramiv(m_uiProgram, GL_LINK_STATUS, &iLinkStatus);
 
@@ -188,6 +233,66 @@ bool CShaderProgram::LinkProgram()
 	return m_bLinked;
 }
 
+// Loads a program binary saved by SaveBinary.  The file holds the binary format followed by the binary itself.
+bool CShaderProgram::LoadBinary(string sFile)
+{
+	if (!GLEW_ARB_get_program_binary)
+		return false;
+
+	FILE* fp;
+	fopen_s(&fp, sFile.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	GLenum format = 0;
+	vector<BYTE> binary;
+	fseek(fp, 0, SEEK_END);
+	long lSize = ftell(fp) - (long) sizeof(format);
+	fseek(fp, 0, SEEK_SET);
+	bool bRead = lSize > 0 && fread(&format, sizeof(format), 1, fp) == 1;
+	if (bRead) {
+		binary.resize(lSize);
+		bRead = fread(&binary[0], 1, lSize, fp) == (size_t) lSize;
+	}
+	fclose(fp);
+	if (!bRead)
+		return false;
+
+	glProgramBinary(m_uiProgram, format, &binary[0], (GLsizei) binary.size());
+
+	// A driver update invalidates old binaries; that is reported as a failed link, and the caller compiles from source instead
+	int iLinkStatus;
+	glGetProgramiv(m_uiProgram, GL_LINK_STATUS, &iLinkStatus);
+	m_bLinked = iLinkStatus == GL_TRUE;
+	return m_bLinked;
+}
+
+// Saves the linked program as a binary.  The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+bool CShaderProgram::SaveBinary(string sFile)
+{
+	if (!GLEW_ARB_get_program_binary || !m_bLinked)
+		return false;
+
+	int iLength = 0;
+	glGetProgramiv(m_uiProgram, GL_PROGRAM_BINARY_LENGTH, &iLength);
+	if (iLength <= 0)
+		return false;
+
+	vector<BYTE> binary(iLength);
+	GLenum format;
+	glGetProgramBinary(m_uiProgram, iLength, NULL, &format, &binary[0]);
+
+	FILE* fp;
+	fopen_s(&fp, sFile.c_str(), "wb");
+	if (!fp)
+		return false;
+	fwrite(&format, sizeof(format), 1, fp);
+	fwrite(&binary[0], 1, binary.size(), fp);
+	fclose(fp);
+
+	return true;
+}
+
 // Deletes the program and frees memory on the GPU
 void CShaderProgram::DeleteProgram()
 {
@@ -214,94 +319,94 @@ UINT CShaderProgram::GetProgramID()
 
 // Setting floats
 
-void CShaderProgram::SetUniform(string sName, float* fValues, int iCount)
+void CShaderProgram::SetUniform(const char *sName, float* fValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform1fv(iLoc, iCount, fValues);
 }
 
-void CShaderProgram::SetUniform(string sName, const float fValue)
+void CShaderProgram::SetUniform(const char *sName, const float fValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform1fv(iLoc, 1, &fValue);
 }
 
 // Setting vectors
 
-void CShaderProgram::SetUniform(string sName, glm::vec2* vVectors, int iCount)
+void CShaderProgram::SetUniform(const char *sName, glm::vec2* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform2fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec2 vVector)
+void CShaderProgram::SetUniform(const char *sName, const glm::vec2 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform2fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
-void CShaderProgram::SetUniform(string sName, glm::vec3* vVectors, int iCount)
+void CShaderProgram::SetUniform(const char *sName, glm::vec3* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform3fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec3 vVector)
+void CShaderProgram::SetUniform(const char *sName, const glm::vec3 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform3fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
-void CShaderProgram::SetUniform(string sName, glm::vec4* vVectors, int iCount)
+void CShaderProgram::SetUniform(const char *sName, glm::vec4* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform4fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::vec4 vVector)
+void CShaderProgram::SetUniform(const char *sName, const glm::vec4 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform4fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
 // Setting 3x3 matrices
 
-void CShaderProgram::SetUniform(string sName, glm::mat3* mMatrices, int iCount)
+void CShaderProgram::SetUniform(const char *sName, glm::mat3* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniformMatrix3fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::mat3 mMatrix)
+void CShaderProgram::SetUniform(const char *sName, const glm::mat3 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniformMatrix3fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
 // Setting 4x4 matrices
 
-void CShaderProgram::SetUniform(string sName, glm::mat4* mMatrices, int iCount)
+void CShaderProgram::SetUniform(const char *sName, glm::mat4* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniformMatrix4fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
-void CShaderProgram::SetUniform(string sName, const glm::mat4 mMatrix)
+void CShaderProgram::SetUniform(const char *sName, const glm::mat4 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniformMatrix4fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
 // Setting integers
 
-void CShaderProgram::SetUniform(string sName, int* iValues, int iCount)
+void CShaderProgram::SetUniform(const char *sName, int* iValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform1iv(iLoc, iCount, iValues);
 }
 
-void CShaderProgram::SetUniform(string sName, const int iValue)
+void CShaderProgram::SetUniform(const char *sName, const int iValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(m_uiProgram, sName);
 	glUniform1i(iLoc, iValue);
 }
\ No newline at end of file
@@ -13,6 +13,14 @@ public:
 	bool LoadShader(string sFile, int iType);
 	void DeleteShader();
 
+	// LoadShader in three steps, so that many shaders can be compiled before any status is queried.  LoadSource reads and
+	// preprocesses the file without touching OpenGL; Compile only issues the compile; CheckCompileStatus waits for it.
+	bool LoadSource(string sFile, int iType);
+	void Compile();
+	bool CheckCompileStatus();
+	const string& GetSource();
+	int GetType();
+
 	bool GetLinesFromFile(string sFile, bool bIncludePart, vector<string>* vResult);
 
 	bool IsLoaded();
@@ -23,6 +31,8 @@ private:
 	UINT m_uiShader; // ID of shader
 	int m_iType; // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER...
 	bool m_bLoaded; // Whether shader was loaded and compiled
+	string m_sFile; // File the source was read from
+	string m_sSource; // Source after #include processing
 };
 
 
@@ -38,33 +48,43 @@ public:
 	bool AddShaderToProgram(CShader* shShader);
 	bool LinkProgram();
 
+	// LinkProgram in two steps, so that many programs can be linked before any status is queried
+	void Link();
+	bool CheckLinkStatus();
+
+	// Program binaries (GL_ARB_get_program_binary).  LoadBinary returns false if the file is missing or the driver rejects it.
+	bool LoadBinary(string sFile);
+	bool SaveBinary(string sFile);
+
 	void UseProgram();
 
 	UINT GetProgramID();
 
+	// Uniform names are C strings, so the render loop sets them without building a std::string each time
+
 	// Setting vectors
-	void SetUniform(string sName, glm::vec2* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec2 vVector);
-	void SetUniform(string sName, glm::vec3* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec3 vVector);
-	void SetUniform(string sName, glm::vec4* vVectors, int iCount = 1);
-	void SetUniform(string sName, const glm::vec4 vVector);
+	void SetUniform(const char *sName, glm::vec2* vVectors, int iCount = 1);
+	void SetUniform(const char *sName, const glm::vec2 vVector);
+	void SetUniform(const char *sName, glm::vec3* vVectors, int iCount = 1);
+	void SetUniform(const char *sName, const glm::vec3 vVector);
+	void SetUniform(const char *sName, glm::vec4* vVectors, int iCount = 1);
+	void SetUniform(const char *sName, const glm::vec4 vVector);
 
 	// Setting floats
-	void SetUniform(string sName, float* fValues, int iCount = 1);
-	void SetUniform(string sName, const float fValue);
+	void SetUniform(const char *sName, float* fValues, int iCount = 1);
+	void SetUniform(const char *sName, const float fValue);
 
 	// Setting 3x3 matrices
-	void SetUniform(string sName, glm::mat3* mMatrices, int iCount = 1);
-	void SetUniform(string sName, const glm::mat3 mMatrix);
+	void SetUniform(const char *sName, glm::mat3* mMatrices, int iCount = 1);
+	void SetUniform(const char *sName, const glm::mat3 mMatrix);
 
 	// Setting 4x4 matrices
-	void SetUniform(string sName, glm::mat4* mMatrices, int iCount = 1);
-	void SetUniform(string sName, const glm::mat4 mMatrix);
+	void SetUniform(const char *sName, glm::mat4* mMatrices, int iCount = 1);
+	void SetUniform(const char *sName, const glm::mat4 mMatrix);
 
 	// Setting integers
-	void SetUniform(string sName, int* iValues, int iCount = 1);
-	void SetUniform(string sName, const int iValue);
+	void SetUniform(const char *sName, int* iValues, int iCount = 1);
+	void SetUniform(const char *sName, const int iValue);
 
 
 private:
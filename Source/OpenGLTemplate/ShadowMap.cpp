@@ -0,0 +1,171 @@
+#include "ShadowMap.h"
+#include "Shaders.h"
+#include "MemoryTracker.h"
+
+CShadowMap::CShadowMap()
+{
+	for (int i = 0; i < NUM_MAPS; i++) {
+		m_uiTextures[i] = 0;
+		m_uiFramebuffers[i] = 0;
+		m_iSizes[i] = 0;
+	}
+	m_iCurrent = STATIC_MAP;
+	m_fNear = 0.0f;
+	m_fFar = 1.0f;
+	m_bStaticValid = false;
+	m_uiNumStaticRenders = 0;
+}
+
+CShadowMap::~CShadowMap()
+{}
+
+bool CShadowMap::Create(int iStaticSize, int iDynamicSize)
+{
+	static const GLfloat border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	m_iSizes[STATIC_MAP] = iStaticSize;
+	m_iSizes[DYNAMIC_MAP] = iDynamicSize;
+
+	glGenTextures(NUM_MAPS, m_uiTextures);
+	glGenFramebuffers(NUM_MAPS, m_uiFramebuffers);
+	for (int i = 0; i < NUM_MAPS; i++) {
+		glBindTexture(GL_TEXTURE_2D, m_uiTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_iSizes[i], m_iSizes[i], 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		CMemoryTracker::TrackTexture(m_uiTextures[i], (size_t) m_iSizes[i] * m_iSizes[i] * 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiFramebuffers[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_uiTextures[i], 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			MessageBox(NULL, "Cannot create the shadow map framebuffer", "Error", MB_ICONERROR);
+			return false;
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+void CShadowMap::Release()
+{
+	for (int i = 0; i < NUM_MAPS; i++)
+		CMemoryTracker::ForgetTexture(m_uiTextures[i]);
+	glDeleteFramebuffers(NUM_MAPS, m_uiFramebuffers);
+	glDeleteTextures(NUM_MAPS, m_uiTextures);
+}
+
+// The light looks along -vDirection at the centre of the box, and the static map's orthographic projection is fitted to the
+// box's corners as the light sees them
+void CShadowMap::SetDirectionalLight(const glm::vec3 &vDirection, const glm::vec3 &vMin, const glm::vec3 &vMax)
+{
+	glm::vec3 vCentre = (vMin + vMax) * 0.5f;
+	glm::vec3 vUp = fabs(vDirection.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+	glm::mat4 viewMatrix = glm::lookAt(vCentre + glm::normalize(vDirection), vCentre, vUp);
+
+	glm::vec3 vLightMin(FLT_MAX), vLightMax(-FLT_MAX);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 vCorner(i & 1 ? vMax.x : vMin.x, i & 2 ? vMax.y : vMin.y, i & 4 ? vMax.z : vMin.z);
+		glm::vec3 vLight(viewMatrix * glm::vec4(vCorner, 1.0f));
+		vLightMin = glm::min(vLightMin, vLight);
+		vLightMax = glm::max(vLightMax, vLight);
+	}
+	float fNear = -vLightMax.z - 1.0f, fFar = -vLightMin.z + 1.0f;
+	glm::mat4 projectionMatrix = glm::ortho(vLightMin.x, vLightMax.x, vLightMin.y, vLightMax.y, fNear, fFar);
+
+	if (viewMatrix != m_viewMatrix || projectionMatrix != m_projectionMatrices[STATIC_MAP])
+		m_bStaticValid = false;
+	m_viewMatrix = viewMatrix;
+	m_projectionMatrices[STATIC_MAP] = projectionMatrix;
+	m_fNear = fNear;
+	m_fFar = fFar;
+}
+
+void CShadowMap::Invalidate()
+{
+	m_bStaticValid = false;
+}
+
+bool CShadowMap::BeginStatic()
+{
+	if (m_bStaticValid)
+		return false;
+	m_bStaticValid = true;
+	m_uiNumStaticRenders++;
+
+	m_iCurrent = STATIC_MAP;
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiFramebuffers[STATIC_MAP]);
+	glViewport(0, 0, m_iSizes[STATIC_MAP], m_iSizes[STATIC_MAP]);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	// Pushes the casters' depths back a little, so lit surfaces do not shadow themselves
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+	return true;
+}
+
+void CShadowMap::BeginDynamic(const glm::vec3 &vMin, const glm::vec3 &vMax)
+{
+	glm::vec3 vLightMin(FLT_MAX), vLightMax(-FLT_MAX);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 vCorner(i & 1 ? vMax.x : vMin.x, i & 2 ? vMax.y : vMin.y, i & 4 ? vMax.z : vMin.z);
+		glm::vec3 vLight(m_viewMatrix * glm::vec4(vCorner, 1.0f));
+		vLightMin = glm::min(vLightMin, vLight);
+		vLightMax = glm::max(vLightMax, vLight);
+	}
+	// Across, only the casters; in depth, all of the static map's range, so every receiver behind them is covered
+	m_projectionMatrices[DYNAMIC_MAP] = glm::ortho(vLightMin.x, vLightMax.x, vLightMin.y, vLightMax.y, m_fNear, m_fFar);
+
+	m_iCurrent = DYNAMIC_MAP;
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiFramebuffers[DYNAMIC_MAP]);
+	glViewport(0, 0, m_iSizes[DYNAMIC_MAP], m_iSizes[DYNAMIC_MAP]);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+}
+
+void CShadowMap::End(int iWidth, int iHeight)
+{
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, iWidth, iHeight);
+}
+
+const glm::mat4& CShadowMap::GetViewMatrix()
+{
+	return m_viewMatrix;
+}
+
+glm::mat4* CShadowMap::GetProjectionMatrix()
+{
+	return &m_projectionMatrices[m_iCurrent];
+}
+
+void CShadowMap::Bind(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, int iFirstUnit)
+{
+	static const char *szSamplers[NUM_MAPS] = { "staticShadowMap", "dynamicShadowMap" };
+	static const char *szMatrices[NUM_MAPS] = { "staticShadowMatrix", "dynamicShadowMatrix" };
+
+	// Eye coordinates to map coordinates in [0, 1]
+	glm::mat4 biasMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+	glm::mat4 eyeToWorld = glm::inverse(viewMatrix);
+	for (int i = 0; i < NUM_MAPS; i++) {
+		glActiveTexture(GL_TEXTURE0 + iFirstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, m_uiTextures[i]);
+		pProgram->SetUniform(szSamplers[i], iFirstUnit + i);
+		pProgram->SetUniform(szMatrices[i], biasMatrix * m_projectionMatrices[i] * m_viewMatrix * eyeToWorld);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	pProgram->SetUniform("fShadowStrength", 0.5f);
+}
+
+UINT CShadowMap::GetNumStaticRenders()
+{
+	return m_uiNumStaticRenders;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Common.h"
+
+class CShaderProgram;
+
+// Shadows from a directional light, in two depth maps sharing the light's view.  The static map covers the whole scene and
+// holds the geometry that never moves; it is drawn once and kept until the light or the scene's bounds change.  The dynamic
+// map is small and is fitted each frame around the moving casters only, so a frame's shadow cost follows them and not the
+// size of the scene.  A receiver is in shadow if either map says so.
+//
+// Both maps are depth textures compared in the shader with sampler2DShadow, which filters the four nearest results.  Outside a
+// map the comparison always passes, so the dynamic map can be far smaller than the area it is drawn over.
+class CShadowMap
+{
+public:
+	CShadowMap();
+	~CShadowMap();
+
+	bool Create(int iStaticSize, int iDynamicSize);
+	void Release();
+
+	// vDirection points towards the light.  The static map covers the box from vMin to vMax.  Changing either redraws it.
+	void SetDirectionalLight(const glm::vec3 &vDirection, const glm::vec3 &vMin, const glm::vec3 &vMax);
+	void Invalidate();
+
+	// Bind and clear the static map for drawing, returning false if the cached one is still good and nothing need be drawn
+	bool BeginStatic();
+	// Bind and clear the dynamic map, fitted around the casters in the box from vMin to vMax
+	void BeginDynamic(const glm::vec3 &vMin, const glm::vec3 &vMax);
+	// Back to the window's framebuffer and viewport
+	void End(int iWidth, int iHeight);
+
+	// For drawing casters into the map last begun
+	const glm::mat4& GetViewMatrix();
+	glm::mat4* GetProjectionMatrix();
+
+	// Binds both maps from texture unit iFirstUnit on and sets pProgram's shadow uniforms for receivers drawn with viewMatrix.
+	// pProgram must be in use.
+	void Bind(CShaderProgram *pProgram, const glm::mat4 &viewMatrix, int iFirstUnit);
+
+	UINT GetNumStaticRenders();
+
+private:
+	enum { STATIC_MAP, DYNAMIC_MAP, NUM_MAPS };
+
+	GLuint m_uiTextures[NUM_MAPS];
+	GLuint m_uiFramebuffers[NUM_MAPS];
+	int m_iSizes[NUM_MAPS];
+	glm::mat4 m_projectionMatrices[NUM_MAPS];
+	glm::mat4 m_viewMatrix;
+	int m_iCurrent;						// The map last begun
+
+	float m_fNear, m_fFar;				// The static map's depth range, which the dynamic map shares
+	bool m_bStaticValid;
+	UINT m_uiNumStaticRenders;
+};
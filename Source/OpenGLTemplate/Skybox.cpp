@@ -1,119 +1,192 @@
 #include "Common.h"
 
 #include "skybox.h"
+#include "FrameProfiler.h"
+
+#include "include\freeimage\FreeImage.h"
 
 
 CSkybox::CSkybox()
-{}
+{
+	m_uiVAO = 0;
+	m_uiCubemap = 0;
+	for (int i = 0; i < 6; i++) {
+		m_iFaceSize[i] = 0;
+		m_iFaceBPP[i] = 0;
+	}
+}
 
 CSkybox::~CSkybox()
 {}
 
 
-// Create a skybox of a given size with six textures
-void CSkybox::Create(string sDirectory, string sFront, string sBack, string sLeft, string sRight, string sTop, string sBottom, float fSize)
+// Create a skybox from six face images
+bool CSkybox::Create(string sDirectory, string sFront, string sBack, string sLeft, string sRight, string sTop, string sBottom)
+{
+	bool bOK = true;
+	bOK &= DecodeFace(FRONT, sDirectory + sFront);
+	bOK &= DecodeFace(BACK, sDirectory + sBack);
+	bOK &= DecodeFace(LEFT, sDirectory + sLeft);
+	bOK &= DecodeFace(RIGHT, sDirectory + sRight);
+	bOK &= DecodeFace(TOP, sDirectory + sTop);
+	bOK &= DecodeFace(BOTTOM, sDirectory + sBottom);
+	return bOK && Upload();
+}
+
+// Read one face image and rearrange its texels into cubemap orientation, so the sky looks as it did when each face was a
+// separate 2D texture.  Touches nothing shared with the other faces.
+bool CSkybox::DecodeFace(int iFace, string sPath)
+{
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(sPath.c_str(), 0);
+	if (fif == FIF_UNKNOWN)
+		fif = FreeImage_GetFIFFromFilename(sPath.c_str());
+
+	FIBITMAP *dib = NULL;
+	if (fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif))
+		dib = FreeImage_Load(fif, sPath.c_str());
+
+	if (dib == NULL) {
+		char message[1024];
+		sprintf_s(message, "Cannot load image\n%s\n", sPath.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	int iSize = FreeImage_GetWidth(dib);
+	int iBPP = FreeImage_GetBPP(dib);
+	if (iSize == 0 || (int) FreeImage_GetHeight(dib) != iSize || (iBPP != 24 && iBPP != 32)) {
+		char message[1024];
+		sprintf_s(message, "Skybox faces must be square 24 or 32 bit images\n%s\n", sPath.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		FreeImage_Unload(dib);
+		return false;
+	}
+
+	// Texel (x, y) of the cubemap face comes from texel (srcX, srcY) of the image as the old per-face quads mapped it.  The
+	// sides are turned half way round, and the top and bottom a quarter turn each way.
+	int iBytes = iBPP / 8;
+	int iPitch = FreeImage_GetPitch(dib);
+	BYTE *pSource = FreeImage_GetBits(dib);
+	TrackedVector<BYTE> &data = m_faceData[iFace];
+	data.resize(iSize * iSize * iBytes);
+	for (int y = 0; y < iSize; y++) {
+		for (int x = 0; x < iSize; x++) {
+			int srcX, srcY;
+			if (iFace == TOP) {
+				srcX = y;
+				srcY = iSize - 1 - x;
+			}
+			else if (iFace == BOTTOM) {
+				srcX = iSize - 1 - y;
+				srcY = x;
+			}
+			else {
+				srcX = iSize - 1 - x;
+				srcY = iSize - 1 - y;
+			}
+			memcpy(&data[(y * iSize + x) * iBytes], pSource + srcY * iPitch + srcX * iBytes, iBytes);
+		}
+	}
+	m_iFaceSize[iFace] = iSize;
+	m_iFaceBPP[iFace] = iBPP;
+
+	FreeImage_Unload(dib);
+	return true;
+}
+
+// Upload the faces into a cubemap and create the cube geometry
+bool CSkybox::Upload()
 {
-	m_tTextures[0].Load(sDirectory + sFront);
-	m_tTextures[1].Load(sDirectory + sBack);
-	m_tTextures[2].Load(sDirectory + sLeft);
-	m_tTextures[3].Load(sDirectory + sRight);
-	m_tTextures[4].Load(sDirectory + sTop);
-	m_tTextures[5].Load(sDirectory + sBottom);
-
-	m_sDirectory = sDirectory;
-
-	m_sFront = sFront;
-	m_sBack = sBack;
-	m_sLeft = sLeft;
-	m_sRight = sRight;
-	m_sTop = sTop;
-	m_sBottom = sBottom;
-	 
+	static const GLenum faceTargets[6] = {
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,		// Front, back
+		GL_TEXTURE_CUBE_MAP_NEGATIVE_X, GL_TEXTURE_CUBE_MAP_POSITIVE_X,		// Left, right
+		GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y		// Top, bottom
+	};
+
 	for (int i = 0; i < 6; i++) {
-		m_tTextures[i].SetSamplerParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		m_tTextures[i].SetSamplerParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		m_tTextures[i].SetSamplerParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		m_tTextures[i].SetSamplerParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		if (m_faceData[i].empty() || m_iFaceSize[i] != m_iFaceSize[0])
+			return false;
 	}
 
+	glGenTextures(1, &m_uiCubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiCubemap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	CMemoryTracker::TrackTexture(m_uiCubemap, (size_t) 6 * m_iFaceSize[0] * m_iFaceSize[0] * 4);
+	for (int i = 0; i < 6; i++) {
+		GLenum format = m_iFaceBPP[i] == 32 ? GL_BGRA : GL_BGR;
+		GLint internalFormat = m_iFaceBPP[i] == 32 ? GL_RGBA : GL_RGB;
+		glTexImage2D(faceTargets[i], 0, internalFormat, m_iFaceSize[i], m_iFaceSize[i], 0, format, GL_UNSIGNED_BYTE, &m_faceData[i][0]);
+		TrackedVector<BYTE>().swap(m_faceData[i]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
 	glGenVertexArrays(1, &m_uiVAO);
 	glBindVertexArray(m_uiVAO);
 
-	m_vboData.Create();
+	m_vboData.Create(true);
 	m_vboData.Bind();
 
-
-	glm::vec3 vSkyBoxVertices[24] = 
+	// A unit cube seen from inside.  The shader puts it at the far plane, so its size does not matter.
+	glm::vec3 vSkyBoxVertices[24] =
 	{
 		// Front face
-		glm::vec3(fSize, fSize, fSize), glm::vec3(fSize, -fSize, fSize), glm::vec3(-fSize, fSize, fSize), glm::vec3(-fSize, -fSize, fSize),
+		glm::vec3(1, 1, 1), glm::vec3(1, -1, 1), glm::vec3(-1, 1, 1), glm::vec3(-1, -1, 1),
 		// Back face
-		glm::vec3(-fSize, fSize, -fSize), glm::vec3(-fSize, -fSize, -fSize), glm::vec3(fSize, fSize, -fSize), glm::vec3(fSize, -fSize, -fSize),
+		glm::vec3(-1, 1, -1), glm::vec3(-1, -1, -1), glm::vec3(1, 1, -1), glm::vec3(1, -1, -1),
 		// Left face
-		glm::vec3(-fSize, fSize, fSize), glm::vec3(-fSize, -fSize, fSize), glm::vec3(-fSize, fSize, -fSize), glm::vec3(-fSize, -fSize, -fSize),
+		glm::vec3(-1, 1, 1), glm::vec3(-1, -1, 1), glm::vec3(-1, 1, -1), glm::vec3(-1, -1, -1),
 		// Right face
-		glm::vec3(fSize, fSize, -fSize), glm::vec3(fSize, -fSize, -fSize), glm::vec3(fSize, fSize, fSize), glm::vec3(fSize, -fSize, fSize),
+		glm::vec3(1, 1, -1), glm::vec3(1, -1, -1), glm::vec3(1, 1, 1), glm::vec3(1, -1, 1),
 		// Top face
-		glm::vec3(-fSize, fSize, -fSize), glm::vec3(fSize, fSize, -fSize), glm::vec3(-fSize, fSize, fSize), glm::vec3(fSize, fSize, fSize),
+		glm::vec3(-1, 1, -1), glm::vec3(1, 1, -1), glm::vec3(-1, 1, 1), glm::vec3(1, 1, 1),
 		// Bottom face
-		glm::vec3(fSize, -fSize, -fSize), glm::vec3(-fSize, -fSize, -fSize), glm::vec3(fSize, -fSize, fSize), glm::vec3(-fSize, -fSize, fSize),
-	};
-	glm::vec2 vSkyBoxTexCoords[4] =
-	{
-		glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, 0.0f)
+		glm::vec3(1, -1, -1), glm::vec3(-1, -1, -1), glm::vec3(1, -1, 1), glm::vec3(-1, -1, 1),
 	};
 
-	glm::vec3 vSkyBoxNormals[6] = 
-	{
-		glm::vec3(0.0f, 0.0f, -1.0f),
-		glm::vec3(0.0f, 0.0f, 1.0f),
-		glm::vec3(1.0f, 0.0f, 0.0f),
-		glm::vec3(-1.0f, 0.0f, 0.0f),
-		glm::vec3(0.0f, -1.0f, 0.0f),
-		glm::vec3(0.0f, 1.0f, 0.0f)
-	};
-
-	glm::vec4 vColour = glm::vec4(1, 1, 1, 1);
-	for (int i = 0; i < 24; i++) {
-		m_vboData.AddData(&vSkyBoxVertices[i], sizeof(glm::vec3));
-		m_vboData.AddData(&vSkyBoxTexCoords[i%4], sizeof(glm::vec2));
-		m_vboData.AddData(&vSkyBoxNormals[i/4], sizeof(glm::vec3));
+	m_vboData.Reserve(24, 36);
+	for (int i = 0; i < 24; i++)
+		m_vboData.AddVertex(vSkyBoxVertices[i]);
+	// Each face's quad as two triangles, wound as the strip was
+	for (unsigned int i = 0; i < 24; i += 4) {
+		m_vboData.AddTriangle(i, i+1, i+2);
+		m_vboData.AddTriangle(i+2, i+1, i+3);
 	}
 
 	m_vboData.UploadDataToGPU(GL_STATIC_DRAW);
 
-	// Set the vertex attribute locations
-	GLsizei istride = 2*sizeof(glm::vec3)+sizeof(glm::vec2);
-
 	// Vertex positions
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, istride, 0);
-	// Texture coordinates
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, istride, (void*)sizeof(glm::vec3));
-	// Normal vectors
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, istride, (void*)(sizeof(glm::vec3)+sizeof(glm::vec2)));
-	
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+
+	return true;
 }
 
-// Render the skybox
+// Render the skybox with one draw.  It is at the far plane, so with LEQUAL it only fills pixels that are still clear.
 void CSkybox::Render()
 {
+	glDepthFunc(GL_LEQUAL);
 	glDepthMask(0);
 	glBindVertexArray(m_uiVAO);
-	for (int i = 0; i < 6; i++) {
-		m_tTextures[i].Bind();
-		glDrawArrays(GL_TRIANGLE_STRIP, i*4, 4);
-	}
+	glActiveTexture(GL_TEXTURE0);
+	glBindSampler(0, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiCubemap);
+	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+	CFrameProfiler::CountDraws();
 	glDepthMask(1);
+	glDepthFunc(GL_LESS);
 }
 
 // Release the storage assocaited with the skybox
 void CSkybox::Release()
 {
-	for (int i = 0; i < 6; i++)
-		m_tTextures[i].Release();
+	CMemoryTracker::ForgetTexture(m_uiCubemap);
+	glDeleteTextures(1, &m_uiCubemap);
 	glDeleteVertexArrays(1, &m_uiVAO);
 	m_vboData.Release();
-}
\ No newline at end of file
+}
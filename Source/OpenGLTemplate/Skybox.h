@@ -1,22 +1,28 @@
 #pragma once
 
-#include "Texture.h"
-#include "VertexBufferObject.h"
+#include "Common.h"
+#include "VertexBufferBuilder.h"
 
-// This is a class for creating and rendering a skybox
+// This is a class for creating and rendering a skybox.  The six faces are one cubemap, drawn in a single call at the far plane
+// after the opaque geometry, so only pixels that nothing else covered are shaded.
 class CSkybox
 {
 public:
+	enum Face { FRONT, BACK, LEFT, RIGHT, TOP, BOTTOM };
+
 	CSkybox();
 	~CSkybox();
-	void Create(string sDirectory, string sFront, string sBack, string sLeft, string sRight, string sTop, string sBottom, float fSize);
-	void Render();
+	bool Create(string sDirectory, string sFront, string sBack, string sLeft, string sRight, string sTop, string sBottom);
+	bool DecodeFace(int iFace, string sPath);	// Reads one face image; faces can be decoded in parallel on worker threads
+	bool Upload();
+	void Render();								// Draw with skyboxShader in use, after the opaque geometry
 	void Release();
 
 private:
 	UINT m_uiVAO;
-	CVertexBufferObject m_vboData;
-	CTexture m_tTextures[6];
-	string m_sDirectory;
-	string m_sFront, m_sBack, m_sLeft, m_sRight, m_sTop, m_sBottom;
-};
\ No newline at end of file
+	CVertexBufferBuilder<glm::vec3> m_vboData;
+	GLuint m_uiCubemap;
+	TrackedVector<BYTE> m_faceData[6];			// Decoded faces, rearranged into cubemap orientation, until Upload
+	int m_iFaceSize[6];
+	int m_iFaceBPP[6];
+};
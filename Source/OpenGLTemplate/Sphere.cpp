@@ -4,6 +4,7 @@
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 #include "Sphere.h"
+#include "FrameProfiler.h"
 #include <math.h>
 
 CSphere::CSphere()
@@ -30,9 +31,9 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 	glGenVertexArrays(1, &m_uiVAO);
 	glBindVertexArray(m_uiVAO);
 
-	m_vboData.Create();
+	m_vboData.Create(true);
 	m_vboData.Bind();
-	
+	m_vboData.Reserve(stacksIn * (slicesIn + 1), stacksIn * slicesIn * 6);
 
 	// Compute vertex attributes and store in VBO
 	int vertexCount = 0;
@@ -45,9 +46,7 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 			glm::vec2 t = glm::vec2(slices / (float) slicesIn, stacks / (float) stacksIn);
 			glm::vec3 n = v;
 
-			m_vboData.AddVertexData(&v, sizeof(glm::vec3));
-			m_vboData.AddVertexData(&t, sizeof(glm::vec2));
-			m_vboData.AddVertexData(&n, sizeof(glm::vec3));
+			m_vboData.EmplaceVertex(v, t, n);
 
 			vertexCount++;
 
@@ -66,14 +65,10 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 			unsigned int index2 = stacks * (slicesIn+1) + nextSlice;
 			unsigned int index3 = nextStack * (slicesIn+1) + nextSlice;
 
-			m_vboData.AddIndexData(&index0, sizeof(unsigned int));
-			m_vboData.AddIndexData(&index1, sizeof(unsigned int));
-			m_vboData.AddIndexData(&index2, sizeof(unsigned int));
+			m_vboData.AddTriangle(index0, index1, index2);
 			m_iNumTriangles++;
 
-			m_vboData.AddIndexData(&index2, sizeof(unsigned int));
-			m_vboData.AddIndexData(&index1, sizeof(unsigned int));
-			m_vboData.AddIndexData(&index3, sizeof(unsigned int));
+			m_vboData.AddTriangle(index2, index1, index3);
 			m_iNumTriangles++;
 
 		}
@@ -101,6 +96,7 @@ void CSphere::Render()
 	glBindVertexArray(m_uiVAO);
 	m_tTexture.Bind();
 	glDrawElements(GL_TRIANGLES, m_iNumTriangles*3, GL_UNSIGNED_INT, 0);
+	CFrameProfiler::CountDraws();
 
 }
 
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "Texture.h"
-#include "VertexBufferObjectIndexed.h"
+#include "VertexBufferBuilder.h"
+#include "Vertex.h"
 
 // Class for generating a unit sphere
 class CSphere
@@ -14,7 +15,7 @@ public:
 	void Release();
 private:
 	UINT m_uiVAO;
-	CVertexBufferObjectIndexed m_vboData;
+	CVertexBufferBuilder<CVertex> m_vboData;
 	CTexture m_tTexture;
 	string m_sDirectory;
 	string m_sFilename;
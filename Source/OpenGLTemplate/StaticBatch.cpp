@@ -0,0 +1,295 @@
+#include "StaticBatch.h"
+#include "Texture.h"
+#include "Vertex.h"
+#include "StreamingBuffer.h"
+#include "MemoryTracker.h"
+#include "FrameProfiler.h"
+#include <algorithm>
+
+// std430 layout of DrawInfo in staticShader.vert
+struct CDrawInfo
+{
+	glm::mat4 modelMatrix;
+	glm::mat4 normalMatrix;
+	GLuint uiMaterial;
+	GLuint uiPadding[3];
+};
+
+CStaticBatch::CStaticBatch()
+{
+	m_uiVAO = 0;
+	m_uiVertexArena = 0;
+	m_uiIndexArena = 0;
+	m_uiIndirectBuffer = 0;
+	m_uiDrawBuffer = 0;
+	m_uiMaterialBuffer = 0;
+	m_uiIndirectSource = 0;
+	m_indirectOffset = 0;
+}
+
+CStaticBatch::~CStaticBatch()
+{}
+
+bool CStaticBatch::IsSupported()
+{
+	return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_ARB_shader_storage_buffer_object &&
+		GLEW_ARB_shader_draw_parameters && GLEW_ARB_shading_language_420pack;
+}
+
+int CStaticBatch::AddMesh(GLuint uiVertexBuffer, UINT uiNumVertices, GLuint uiIndexBuffer, UINT uiNumIndices, CTexture *pTexture)
+{
+	CMesh mesh;
+	mesh.uiVertexBuffer = uiVertexBuffer;
+	mesh.uiNumVertices = uiNumVertices;
+	mesh.uiIndexBuffer = uiIndexBuffer;
+	mesh.uiNumIndices = uiNumIndices;
+	mesh.pTexture = pTexture;
+	mesh.uiBaseVertex = 0;
+	mesh.uiFirstIndex = 0;
+	m_meshes.push_back(mesh);
+	return (int) m_meshes.size() - 1;
+}
+
+int CStaticBatch::AddMesh(GLuint uiVertexBuffer, UINT uiNumVertices, const vector<unsigned int> &indices, CTexture *pTexture)
+{
+	int iMesh = AddMesh(uiVertexBuffer, uiNumVertices, 0, (UINT) indices.size(), pTexture);
+	m_meshes[iMesh].indices = indices;
+	return iMesh;
+}
+
+// Even triangles of a strip are (k, k+1, k+2) and odd ones (k+1, k, k+2), so every triangle has the strip's winding
+void CStaticBatch::AppendStripIndices(UINT uiFirst, UINT uiCount, vector<unsigned int> &indices)
+{
+	for (UINT k = 0; k + 2 < uiCount; k++) {
+		if (k % 2 == 0) {
+			indices.push_back(uiFirst + k);
+			indices.push_back(uiFirst + k + 1);
+		}
+		else {
+			indices.push_back(uiFirst + k + 1);
+			indices.push_back(uiFirst + k);
+		}
+		indices.push_back(uiFirst + k + 2);
+	}
+}
+
+int CStaticBatch::AddMaterial(glm::vec3 Ma, glm::vec3 Md, glm::vec3 Ms, float fShininess)
+{
+	m_materials.push_back(glm::vec4(Ma, 0.0f));
+	m_materials.push_back(glm::vec4(Md, 0.0f));
+	m_materials.push_back(glm::vec4(Ms, fShininess));
+	return (int) m_materials.size() / 3 - 1;
+}
+
+void CStaticBatch::AddDraw(int iPass, int iMesh, const glm::mat4 &modelMatrix, int iMaterial)
+{
+	CDraw draw;
+	draw.iPass = iPass;
+	draw.iMesh = iMesh;
+	draw.modelMatrix = modelMatrix;
+	draw.iMaterial = iMaterial;
+	m_draws.push_back(draw);
+}
+
+void CStaticBatch::Build()
+{
+	// Lay the meshes out end to end
+	UINT uiNumVertices = 0, uiNumIndices = 0;
+	for (unsigned int i = 0; i < m_meshes.size(); i++) {
+		m_meshes[i].uiBaseVertex = uiNumVertices;
+		m_meshes[i].uiFirstIndex = uiNumIndices;
+		uiNumVertices += m_meshes[i].uiNumVertices;
+		uiNumIndices += m_meshes[i].uiNumIndices;
+	}
+
+	glGenVertexArrays(1, &m_uiVAO);
+	glBindVertexArray(m_uiVAO);
+
+	// Copy the vertices and indices into the arenas on the GPU.  Indices stay relative to their mesh; the draw's base vertex
+	// offsets them.
+	glGenBuffers(1, &m_uiVertexArena);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiVertexArena);
+	glBufferData(GL_ARRAY_BUFFER, uiNumVertices * sizeof(CVertex), NULL, GL_STATIC_DRAW);
+	CMemoryTracker::TrackBuffer(m_uiVertexArena, uiNumVertices * sizeof(CVertex));
+	glGenBuffers(1, &m_uiIndexArena);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiIndexArena);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiNumIndices * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+	CMemoryTracker::TrackBuffer(m_uiIndexArena, uiNumIndices * sizeof(GLuint));
+
+	for (unsigned int i = 0; i < m_meshes.size(); i++) {
+		CMesh &mesh = m_meshes[i];
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.uiVertexBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, mesh.uiBaseVertex * sizeof(CVertex), mesh.uiNumVertices * sizeof(CVertex));
+		if (mesh.uiIndexBuffer != 0) {
+			glBindBuffer(GL_COPY_READ_BUFFER, mesh.uiIndexBuffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0, mesh.uiFirstIndex * sizeof(GLuint), mesh.uiNumIndices * sizeof(GLuint));
+		}
+		else if (!mesh.indices.empty())
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh.uiFirstIndex * sizeof(GLuint), mesh.uiNumIndices * sizeof(GLuint), &mesh.indices[0]);
+		vector<unsigned int>().swap(mesh.indices);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	GLsizei stride = sizeof(CVertex);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)sizeof(glm::vec3));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(glm::vec3)+sizeof(glm::vec2)));
+	glBindVertexArray(0);
+
+	// Order the draws so that each pass and texture is one contiguous run of commands
+	vector<CMesh> &meshes = m_meshes;
+	stable_sort(m_draws.begin(), m_draws.end(), [&meshes](const CDraw &a, const CDraw &b) {
+		if (a.iPass != b.iPass)
+			return a.iPass < b.iPass;
+		return std::less<CTexture*>()(meshes[a.iMesh].pTexture, meshes[b.iMesh].pTexture);
+	});
+
+	vector<CDrawElementsIndirectCommand> &commands = m_commands;
+	commands.resize(m_draws.size());
+	vector<CDrawInfo> drawInfo(m_draws.size());
+	m_groups.clear();
+	for (unsigned int i = 0; i < m_draws.size(); i++) {
+		const CDraw &draw = m_draws[i];
+		const CMesh &mesh = m_meshes[draw.iMesh];
+
+		commands[i].uiCount = mesh.uiNumIndices;
+		commands[i].uiInstanceCount = 1;
+		commands[i].uiFirstIndex = mesh.uiFirstIndex;
+		commands[i].iBaseVertex = mesh.uiBaseVertex;
+		commands[i].uiBaseInstance = i;
+
+		drawInfo[i].modelMatrix = draw.modelMatrix;
+		drawInfo[i].normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(draw.modelMatrix))));
+		drawInfo[i].uiMaterial = draw.iMaterial;
+
+		if (m_groups.empty() || m_groups.back().iPass != draw.iPass || m_groups.back().pTexture != mesh.pTexture) {
+			CGroup group;
+			group.iPass = draw.iPass;
+			group.pTexture = mesh.pTexture;
+			group.uiFirstCommand = i;
+			group.uiNumCommands = 0;
+			m_groups.push_back(group);
+		}
+		m_groups.back().uiNumCommands++;
+	}
+
+	if (!commands.empty()) {
+		glGenBuffers(1, &m_uiIndirectBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiIndirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(CDrawElementsIndirectCommand), &commands[0], GL_STATIC_DRAW);
+		CMemoryTracker::TrackBuffer(m_uiIndirectBuffer, commands.size() * sizeof(CDrawElementsIndirectCommand));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		m_uiIndirectSource = m_uiIndirectBuffer;
+		m_indirectOffset = 0;
+
+		glGenBuffers(1, &m_uiDrawBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawInfo.size() * sizeof(CDrawInfo), &drawInfo[0], GL_STATIC_DRAW);
+		CMemoryTracker::TrackBuffer(m_uiDrawBuffer, drawInfo.size() * sizeof(CDrawInfo));
+	}
+	if (!m_materials.empty()) {
+		glGenBuffers(1, &m_uiMaterialBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiMaterialBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, m_materials.size() * sizeof(glm::vec4), &m_materials[0], GL_STATIC_DRAW);
+		CMemoryTracker::TrackBuffer(m_uiMaterialBuffer, m_materials.size() * sizeof(glm::vec4));
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void CStaticBatch::SortFrontToBack(const glm::vec3 &vEye, CStreamingBuffer *pStreamingBuffer)
+{
+	if (m_commands.empty())
+		return;
+
+	for (unsigned int i = 0; i < m_groups.size(); i++) {
+		const CGroup &group = m_groups[i];
+		m_sortKeys.resize(group.uiNumCommands);
+		for (UINT j = 0; j < group.uiNumCommands; j++) {
+			const CDrawElementsIndirectCommand &command = m_commands[group.uiFirstCommand + j];
+			glm::vec3 vOrigin = glm::vec3(m_draws[command.uiBaseInstance].modelMatrix[3]);
+			m_sortKeys[j] = make_pair(glm::length(vOrigin - vEye), command);
+		}
+		// stable_sort would take a temporary buffer from the heap every frame.  Equal distances are ordered by draw instead.
+		sort(m_sortKeys.begin(), m_sortKeys.end(),
+			[](const pair<float, CDrawElementsIndirectCommand> &a, const pair<float, CDrawElementsIndirectCommand> &b) {
+				if (a.first != b.first)
+					return a.first < b.first;
+				return a.second.uiBaseInstance < b.second.uiBaseInstance;
+			});
+		for (UINT j = 0; j < group.uiNumCommands; j++)
+			m_commands[group.uiFirstCommand + j] = m_sortKeys[j].second;
+	}
+
+	// Commands are 4-byte aligned; aligning to the command size keeps each one whole
+	UINT uiSize = (UINT) m_commands.size() * sizeof(CDrawElementsIndirectCommand);
+	GLintptr offset;
+	void *pCommands = pStreamingBuffer->AllocateVertices(uiSize, sizeof(CDrawElementsIndirectCommand), offset);
+	if (pCommands == NULL) {
+		m_uiIndirectSource = m_uiIndirectBuffer;
+		m_indirectOffset = 0;
+		return;
+	}
+	memcpy(pCommands, &m_commands[0], uiSize);
+	pStreamingBuffer->Commit();
+	m_uiIndirectSource = pStreamingBuffer->GetBufferID();
+	m_indirectOffset = offset;
+}
+
+void CStaticBatch::Render(int iPass)
+{
+	if (m_uiIndirectBuffer == 0)
+		return;
+
+	glBindVertexArray(m_uiVAO);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiIndirectSource);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_uiDrawBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_uiMaterialBuffer);
+
+	for (unsigned int i = 0; i < m_groups.size(); i++) {
+		const CGroup &group = m_groups[i];
+		if (group.iPass != iPass)
+			continue;
+		if (group.pTexture)
+			group.pTexture->Bind();
+
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(const void*) (m_indirectOffset + group.uiFirstCommand * sizeof(CDrawElementsIndirectCommand)), group.uiNumCommands, 0);
+		CFrameProfiler::CountDraws();
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void CStaticBatch::Release()
+{
+	GLuint uiBuffers[] = { m_uiVertexArena, m_uiIndexArena, m_uiIndirectBuffer, m_uiDrawBuffer, m_uiMaterialBuffer };
+	for (int i = 0; i < 5; i++)
+		CMemoryTracker::ForgetBuffer(uiBuffers[i]);
+	glDeleteBuffers(1, &m_uiVertexArena);
+	glDeleteBuffers(1, &m_uiIndexArena);
+	glDeleteBuffers(1, &m_uiIndirectBuffer);
+	glDeleteBuffers(1, &m_uiDrawBuffer);
+	glDeleteBuffers(1, &m_uiMaterialBuffer);
+	glDeleteVertexArrays(1, &m_uiVAO);
+	m_uiVAO = m_uiVertexArena = m_uiIndexArena = m_uiIndirectBuffer = m_uiDrawBuffer = m_uiMaterialBuffer = 0;
+	m_meshes.clear();
+	m_draws.clear();
+	m_materials.clear();
+	m_groups.clear();
+	m_commands.clear();
+	m_uiIndirectSource = 0;
+	m_indirectOffset = 0;
+}
+
+UINT CStaticBatch::GetNumDraws()
+{
+	return (UINT) m_draws.size();
+}
+
+UINT CStaticBatch::GetNumMultiDraws()
+{
+	return (UINT) m_groups.size();
+}
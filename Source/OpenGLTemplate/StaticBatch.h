@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Common.h"
+
+class CTexture;
+class CStreamingBuffer;
+
+// Static scene geometry merged into one vertex arena and one index arena, drawn with glMultiDrawElementsIndirect.  Each draw's
+// model matrix and material index live in a shader storage buffer that staticShader.vert indexes with the command's base
+// instance, so commands can be reordered without touching it.  Draws are grouped by pass (a set of light uniforms the caller
+// sets) and by texture, and each group is a single multi-draw.
+//
+// Meshes are copied from existing buffers in the pos/tex/normal CVertex layout, so the objects that own them can be drawn
+// either way.  Add meshes, materials and draws, then call Build while the source buffers still exist.
+class CStaticBatch
+{
+public:
+	CStaticBatch();
+	~CStaticBatch();
+
+	// Multi-draw indirect with base instances, shader storage buffers, gl_BaseInstanceARB and GLSL buffer bindings are needed
+	static bool IsSupported();
+
+	// Adds a mesh whose vertices are in uiVertexBuffer and whose triangle list indices are in uiIndexBuffer or in indices.
+	// Returns the mesh's id.
+	int AddMesh(GLuint uiVertexBuffer, UINT uiNumVertices, GLuint uiIndexBuffer, UINT uiNumIndices, CTexture *pTexture);
+	int AddMesh(GLuint uiVertexBuffer, UINT uiNumVertices, const vector<unsigned int> &indices, CTexture *pTexture);
+
+	// Appends triangle list indices for a triangle strip of uiCount vertices starting at uiFirst, keeping the strip's winding
+	static void AppendStripIndices(UINT uiFirst, UINT uiCount, vector<unsigned int> &indices);
+
+	int AddMaterial(glm::vec3 Ma, glm::vec3 Md, glm::vec3 Ms, float fShininess);
+	void AddDraw(int iPass, int iMesh, const glm::mat4 &modelMatrix, int iMaterial);
+
+	// Copies the meshes into the arenas and uploads the draws
+	void Build();
+	// Reorders the draws in each group nearest first, by the distance from vEye to each draw's origin, and writes the commands
+	// into pStreamingBuffer for this frame's Render calls.  Call once per frame before rendering, or never.
+	void SortFrontToBack(const glm::vec3 &vEye, CStreamingBuffer *pStreamingBuffer);
+	// Draws every group in iPass.  A program using staticShader.vert must be in use, with its matrices and light set.
+	void Render(int iPass);
+	void Release();
+
+	UINT GetNumDraws();
+	UINT GetNumMultiDraws();
+
+private:
+	struct CMesh
+	{
+		GLuint uiVertexBuffer;
+		UINT uiNumVertices;
+		GLuint uiIndexBuffer;			// 0 if the indices are in indices
+		UINT uiNumIndices;
+		vector<unsigned int> indices;
+		CTexture *pTexture;
+		UINT uiBaseVertex;				// Position in the arenas, set by Build
+		UINT uiFirstIndex;
+	};
+
+	struct CDraw
+	{
+		int iPass;
+		int iMesh;
+		glm::mat4 modelMatrix;
+		int iMaterial;
+	};
+
+	// Layout of glMultiDrawElementsIndirect's commands
+	struct CDrawElementsIndirectCommand
+	{
+		GLuint uiCount;
+		GLuint uiInstanceCount;
+		GLuint uiFirstIndex;
+		GLint iBaseVertex;
+		GLuint uiBaseInstance;		// Index of the draw's data in m_uiDrawBuffer
+	};
+
+	// One glMultiDrawElementsIndirect
+	struct CGroup
+	{
+		int iPass;
+		CTexture *pTexture;
+		UINT uiFirstCommand;
+		UINT uiNumCommands;
+	};
+
+	vector<CMesh> m_meshes;
+	vector<CDraw> m_draws;
+	vector<glm::vec4> m_materials;		// Ma, Md, and Ms with shininess in w, for each material
+	vector<CGroup> m_groups;
+	vector<CDrawElementsIndirectCommand> m_commands;
+	vector<pair<float, CDrawElementsIndirectCommand> > m_sortKeys;
+
+	GLuint m_uiIndirectSource;			// Buffer holding this frame's commands: m_uiIndirectBuffer, or the streaming buffer once sorted
+	GLintptr m_indirectOffset;
+
+	GLuint m_uiVAO;
+	GLuint m_uiVertexArena;
+	GLuint m_uiIndexArena;
+	GLuint m_uiIndirectBuffer;
+	GLuint m_uiDrawBuffer;				// Per-draw model matrix, normal matrix and material, in command order
+	GLuint m_uiMaterialBuffer;
+};
@@ -0,0 +1,164 @@
+#include "StreamingBuffer.h"
+
+CStreamingBuffer::CStreamingBuffer()
+{
+	m_uiBuffer = 0;
+	m_bPersistent = false;
+	m_pMapped = NULL;
+	m_uiFrameSize = 0;
+	m_iNumFrames = 0;
+	m_iFrame = 0;
+	m_uiHead = 0;
+	m_uiCommitted = 0;
+	m_uiUniformAlignment = 256;
+}
+
+CStreamingBuffer::~CStreamingBuffer()
+{}
+
+// Creates a buffer of iNumFrames regions of uiFrameSize bytes each
+bool CStreamingBuffer::Create(UINT uiFrameSize, int iNumFrames)
+{
+	GLint iAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &iAlignment);
+	if (iAlignment > 0)
+		m_uiUniformAlignment = iAlignment;
+
+	// Keep every region start aligned for any allocation
+	m_uiFrameSize = ((uiFrameSize + 255) / 256) * 256;
+	m_iNumFrames = iNumFrames;
+	m_iFrame = 0;
+	m_uiHead = 0;
+	m_uiCommitted = 0;
+	m_fences.assign(iNumFrames, (GLsync) NULL);
+	GLsizeiptr size = (GLsizeiptr) m_uiFrameSize * iNumFrames;
+
+	glGenBuffers(1, &m_uiBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiBuffer);
+
+	m_bPersistent = GLEW_ARB_buffer_storage == GL_TRUE;
+	if (m_bPersistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+		m_pMapped = (BYTE *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		if (m_pMapped == NULL) {
+			MessageBox(NULL, "Failed to map the streaming buffer", "Error", MB_ICONERROR);
+			return false;
+		}
+	}
+	else {
+		glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+		m_shadow.resize(size);
+		m_pMapped = &m_shadow[0];
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	CMemoryTracker::TrackBuffer(m_uiBuffer, size);
+	return true;
+}
+
+void CStreamingBuffer::Release()
+{
+	for (unsigned int i = 0; i < m_fences.size(); i++) {
+		if (m_fences[i])
+			glDeleteSync(m_fences[i]);
+	}
+	m_fences.clear();
+
+	if (m_bPersistent && m_pMapped) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiBuffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	m_pMapped = NULL;
+	TrackedVector<BYTE>().swap(m_shadow);
+
+	CMemoryTracker::ForgetBuffer(m_uiBuffer);
+	glDeleteBuffers(1, &m_uiBuffer);
+	m_uiBuffer = 0;
+}
+
+// Moves to the next region, waiting for the GPU to finish the frame that last used it
+void CStreamingBuffer::BeginFrame()
+{
+	m_iFrame = (m_iFrame + 1) % m_iNumFrames;
+	m_uiHead = 0;
+	m_uiCommitted = 0;
+
+	GLsync fence = m_fences[m_iFrame];
+	if (fence == NULL)
+		return;
+
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	while (result == GL_TIMEOUT_EXPIRED)
+		result = glClientWaitSync(fence, 0, 1000000000);
+	glDeleteSync(fence);
+	m_fences[m_iFrame] = NULL;
+}
+
+void CStreamingBuffer::EndFrame()
+{
+	Commit();
+	m_fences[m_iFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* CStreamingBuffer::Allocate(UINT uiSize, UINT uiAlignment, GLintptr &offset)
+{
+	// Align the absolute offset, since that is what draw calls and glBindBufferRange see
+	UINT uiRegionStart = m_iFrame * m_uiFrameSize;
+	UINT uiStart = ((uiRegionStart + m_uiHead + uiAlignment - 1) / uiAlignment) * uiAlignment;
+	if (uiStart + uiSize > uiRegionStart + m_uiFrameSize)
+		return NULL;
+
+	m_uiHead = uiStart + uiSize - uiRegionStart;
+	offset = uiStart;
+	return m_pMapped + uiStart;
+}
+
+void* CStreamingBuffer::AllocateVertices(UINT uiSize, UINT uiStride, GLintptr &offset)
+{
+	return Allocate(uiSize, uiStride, offset);
+}
+
+void* CStreamingBuffer::AllocateIndices(UINT uiSize, GLintptr &offset)
+{
+	return Allocate(uiSize, sizeof(GLuint), offset);
+}
+
+void* CStreamingBuffer::AllocateUniforms(UINT uiSize, GLintptr &offset)
+{
+	return Allocate(uiSize, m_uiUniformAlignment, offset);
+}
+
+// A coherent persistent mapping needs no flush.  Otherwise send the bytes written since the last Commit.
+void CStreamingBuffer::Commit()
+{
+	if (m_bPersistent || m_uiCommitted == m_uiHead)
+		return;
+
+	UINT uiStart = m_iFrame * m_uiFrameSize + m_uiCommitted;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, uiStart, m_uiHead - m_uiCommitted, m_pMapped + uiStart);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	m_uiCommitted = m_uiHead;
+}
+
+void CStreamingBuffer::Bind(GLenum target)
+{
+	glBindBuffer(target, m_uiBuffer);
+}
+
+void CStreamingBuffer::BindUniformBlock(GLuint uiBindingPoint, GLintptr offset, UINT uiSize)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, uiBindingPoint, m_uiBuffer, offset, uiSize);
+}
+
+GLuint CStreamingBuffer::GetBufferID()
+{
+	return m_uiBuffer;
+}
+
+bool CStreamingBuffer::IsPersistent()
+{
+	return m_bPersistent;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Common.h"
+#include "MemoryTracker.h"
+
+// A ring buffer for data that is rewritten every frame (HUD text, debug lines, particles, per-draw uniforms).  The buffer is split
+// into one region per frame in flight.  Each frame sub-allocates from its region and writes straight into mapped memory, so an
+// upload is a memcpy and an offset, with no glBufferData re-specification.  A fence at the end of each frame stops a region
+// being reused while the GPU may still be reading it.
+//
+// With ARB_buffer_storage the buffer is mapped once, persistently and coherently.  Without it, allocations are written to a
+// CPU copy and Commit() sends the new range with glBufferSubData.
+class CStreamingBuffer
+{
+public:
+	CStreamingBuffer();
+	~CStreamingBuffer();
+
+	bool Create(UINT uiFrameSize, int iNumFrames = 3);
+	void Release();
+
+	// Call at the start of a frame, before any allocations.  Waits if the GPU is still using this frame's region.
+	void BeginFrame();
+	// Call after the frame's last draw that reads from the buffer
+	void EndFrame();
+
+	// Each returns a pointer to write to and sets offset to its byte offset in the buffer, or returns NULL if this frame's
+	// region is full.  Vertex allocations are aligned to the stride, so offset / uiStride is the first vertex for glDrawArrays.
+	void* AllocateVertices(UINT uiSize, UINT uiStride, GLintptr &offset);
+	void* AllocateIndices(UINT uiSize, GLintptr &offset);
+	void* AllocateUniforms(UINT uiSize, GLintptr &offset);
+
+	// Makes everything allocated so far visible to the GPU.  Call before drawing from new allocations.
+	void Commit();
+
+	void Bind(GLenum target);
+	void BindUniformBlock(GLuint uiBindingPoint, GLintptr offset, UINT uiSize);
+
+	GLuint GetBufferID();
+	bool IsPersistent();
+
+private:
+	void* Allocate(UINT uiSize, UINT uiAlignment, GLintptr &offset);
+
+	GLuint m_uiBuffer;
+	bool m_bPersistent;					// Mapped once with ARB_buffer_storage, otherwise written through m_shadow
+	BYTE *m_pMapped;					// Start of the buffer in CPU-visible memory
+	TrackedVector<BYTE> m_shadow;		// CPU copy of the buffer when it cannot be persistently mapped
+	UINT m_uiFrameSize;
+	int m_iNumFrames;
+	int m_iFrame;						// Region in use this frame
+	UINT m_uiHead;						// Next free byte in this frame's region, relative to the start of the region
+	UINT m_uiCommitted;					// Bytes of this frame's region already sent by Commit
+	UINT m_uiUniformAlignment;			// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	vector<GLsync> m_fences;			// One per region; set when the region's frame was submitted
+};
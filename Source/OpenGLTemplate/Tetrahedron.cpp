@@ -1,4 +1,5 @@
 #include "Tetrahedron.h"
+#include "FrameProfiler.h"
 
 CTetrahedron::CTetrahedron()
 {}
@@ -10,7 +11,18 @@ CTetrahedron::~CTetrahedron()
 
 void CTetrahedron::Create(string filename)
 {
-	m_tTexture.Load(filename);
+	Decode(filename);
+	Upload();
+}
+
+bool CTetrahedron::Decode(string filename)
+{
+	return m_tTexture.Decode(filename);
+}
+
+void CTetrahedron::Upload()
+{
+	m_tTexture.Upload();
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	m_tTexture.SetSamplerParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -127,6 +139,7 @@ void CTetrahedron::Render()
 	glDrawArrays(GL_TRIANGLE_STRIP, 3, 3);
 	glDrawArrays(GL_TRIANGLE_STRIP, 6, 3);
 	glDrawArrays(GL_TRIANGLE_STRIP, 9, 3);
+	CFrameProfiler::CountDraws(4);
 }
 
 void CTetrahedron::Release()
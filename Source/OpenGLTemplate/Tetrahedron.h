@@ -11,6 +11,8 @@ public:
 	CTetrahedron();
 	~CTetrahedron();
 	void Create(string filename);
+	bool Decode(string filename);	// Reads the texture; safe on a worker thread
+	void Upload();					// Creates the OpenGL objects
 	void Render();
 	void Release();
 private:
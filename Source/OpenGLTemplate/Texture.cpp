@@ -1,6 +1,7 @@
 #include "Common.h"
 
 #include "texture.h"
+#include "MemoryTracker.h"
 
 #include "include\freeimage\FreeImage.h"
 #pragma comment(lib, "lib/FreeImage.lib")
@@ -8,9 +9,24 @@
 CTexture::CTexture()
 {
 	m_bMipMapsGenerated = false;
+	m_pDecoded = NULL;
+	m_iDecodedTag = MEMORY_UNTAGGED;
+	m_uiTexture = 0;
 }
 CTexture::~CTexture()
-{}
+{
+	FreeDecoded();
+}
+
+// Frees the image read by Decode, if it is still held
+void CTexture::FreeDecoded()
+{
+	if (m_pDecoded == NULL)
+		return;
+	CMemoryTracker::RemoveCpu(m_iDecodedTag, FreeImage_GetPitch(m_pDecoded) * FreeImage_GetHeight(m_pDecoded));
+	FreeImage_Unload(m_pDecoded);
+	m_pDecoded = NULL;
+}
 
 // Create a texture from the data stored in bData.  
 void CTexture::CreateFromData(BYTE* bData, int iWidth, int iHeight, int iBPP, GLenum format, bool bGenerateMipMaps)
@@ -28,6 +44,10 @@ void CTexture::CreateFromData(BYTE* bData, int iWidth, int iHeight, int iBPP, GL
 	if(bGenerateMipMaps)glGenerateMipmap(GL_TEXTURE_2D);
 	glGenSamplers(1, &m_uiSampler);
 
+	// Drivers keep 24 bit images as 32 bits a texel, and a full mip chain adds a third
+	size_t size = (size_t) iWidth * iHeight * (iBPP >= 24 ? 4 : max(iBPP / 8, 1));
+	CMemoryTracker::TrackTexture(m_uiTexture, bGenerateMipMaps ? size * 4 / 3 : size);
+
 	m_sPath = "";
 	m_bMipMapsGenerated = bGenerateMipMaps;
 	m_iWidth = iWidth;
@@ -37,6 +57,12 @@ void CTexture::CreateFromData(BYTE* bData, int iWidth, int iHeight, int iBPP, GL
 
 // Loads a 2D texture given the filename (sPath).  bGenerateMipMaps will generate a mipmapped texture if true
 bool CTexture::Load(string sPath, bool bGenerateMipMaps)
+{
+	return Decode(sPath) && Upload(bGenerateMipMaps);
+}
+
+// Reads the image file into memory.  Does not touch OpenGL, so it can run on a worker thread.
+bool CTexture::Decode(string sPath)
 {
 	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
 	FIBITMAP* dib(0);
@@ -59,21 +85,37 @@ bool CTexture::Load(string sPath, bool bGenerateMipMaps)
 		return false;
 	}
 
-	BYTE* bDataPointer = FreeImage_GetBits(dib); // Retrieve the image data
-
 	// If somehow one of these failed (they shouldn't), return failure
-	if(bDataPointer == NULL || FreeImage_GetWidth(dib) == 0 || FreeImage_GetHeight(dib) == 0) 
+	if(FreeImage_GetBits(dib) == NULL || FreeImage_GetWidth(dib) == 0 || FreeImage_GetHeight(dib) == 0) {
+		FreeImage_Unload(dib);
 		return false;
-	
+	}
+
+	FreeDecoded();
+	m_pDecoded = dib;
+	m_iDecodedTag = CMemoryTracker::GetCurrentTag();
+	CMemoryTracker::AddCpu(m_iDecodedTag, FreeImage_GetPitch(dib) * FreeImage_GetHeight(dib));
+	m_sPath = sPath;
+
+	return true;
+}
+
+// Creates the OpenGL texture from the image read by Decode, and frees the image
+bool CTexture::Upload(bool bGenerateMipMaps)
+{
+	if (m_pDecoded == NULL)
+		return false;
+
+	BYTE* bDataPointer = FreeImage_GetBits(m_pDecoded); // Retrieve the image data
 
 	GLenum format;
-	int bada = FreeImage_GetBPP(dib);
-	if(FreeImage_GetBPP(dib) == 32)format = GL_BGRA;
-	if(FreeImage_GetBPP(dib) == 24)format = GL_BGR;
-	if(FreeImage_GetBPP(dib) == 8)format = GL_LUMINANCE;
-	CreateFromData(bDataPointer, FreeImage_GetWidth(dib), FreeImage_GetHeight(dib), FreeImage_GetBPP(dib), format, bGenerateMipMaps);
+	if(FreeImage_GetBPP(m_pDecoded) == 32)format = GL_BGRA;
+	if(FreeImage_GetBPP(m_pDecoded) == 24)format = GL_BGR;
+	if(FreeImage_GetBPP(m_pDecoded) == 8)format = GL_LUMINANCE;
+	string sPath = m_sPath;
+	CreateFromData(bDataPointer, FreeImage_GetWidth(m_pDecoded), FreeImage_GetHeight(m_pDecoded), FreeImage_GetBPP(m_pDecoded), format, bGenerateMipMaps);
 	
-	FreeImage_Unload(dib);
+	FreeDecoded();
 
 	m_sPath = sPath;
 
@@ -102,6 +144,7 @@ void CTexture::Bind(int iTextureUnit)
 // Frees memory on the GPU of the texture
 void CTexture::Release()
 {
+	CMemoryTracker::ForgetTexture(m_uiTexture);
 	glDeleteSamplers(1, &m_uiSampler);
 	glDeleteTextures(1, &m_uiTexture);
 }
@@ -1,11 +1,17 @@
 #pragma once
 
+struct FIBITMAP;
+
 // Class that provides a texture for texture mapping in OpenGL
 class CTexture
 {
 public:
 	void CreateFromData(BYTE* bData, int iWidth, int iHeight, int iBPP, GLenum format, bool bGenerateMipMaps = false);
 	bool Load(string sPath, bool bGenerateMipMaps = true);
+
+	// Load splits into Decode, which only reads the image and is safe on any thread, and Upload, which needs the OpenGL context
+	bool Decode(string sPath);
+	bool Upload(bool bGenerateMipMaps = true);
 	void Bind(int iTextureUnit = 0);
 
 	void SetSamplerParameter(GLenum parameter, GLenum value);
@@ -26,5 +32,9 @@ private:
 	bool m_bMipMapsGenerated;
 
 	string m_sPath;
+	FIBITMAP* m_pDecoded; // Image read by Decode, waiting for Upload
+	int m_iDecodedTag; // Memory tag the decoded image is charged to
+
+	void FreeDecoded();
 };
 
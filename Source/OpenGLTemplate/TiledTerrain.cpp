@@ -0,0 +1,489 @@
+#include "TiledTerrain.h"
+#include "Shaders.h"
+#include "Frustum.h"
+#include "FrameProfiler.h"
+#include "include\freeimage\FreeImage.h"
+#include <fstream>
+#include <cfloat>
+
+static const char TILE_MAGIC[4] = { 'T', 'I', 'L', 'E' };
+static const UINT TILE_VERSION = 1;
+
+CTiledTerrain::CTiledTerrain()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pView = NULL;
+	m_pHeader = NULL;
+	m_pEntries = NULL;
+	m_iApronSize = 0;
+	m_fTileWorldSize = 0.0f;
+	m_uiTexture = 0;
+	m_uiFrame = 0;
+	m_uiNumStreamed = 0;
+	m_iNumResident = 0;
+	m_iNumLoading = 0;
+	m_iFirstRequest = m_iNumRequests = 0;
+	m_iFirstLoaded = m_iNumLoaded = 0;
+	m_bRunning = false;
+	m_uiVAO = 0;
+}
+
+CTiledTerrain::~CTiledTerrain()
+{}
+
+// Tile (i, j) starts at pixel (i, j) * (iTileSize - 1), so neighbours share a row or column, and is stored with the pixel
+// beyond it on each side.  Pixels past the image repeat its edge.  The pixels are square, fSizeX / width apart, so fSizeZ only
+// places the first row.
+bool CTiledTerrain::BuildTileFile(const char *szHeightmap, const char *szTileFile, int iTileSize, glm::vec3 origin, float fSizeX,
+	float fSizeZ, float fHeightScale)
+{
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(szHeightmap, 0);
+	if (fif == FIF_UNKNOWN)
+		fif = FreeImage_GetFIFFromFilename(szHeightmap);
+
+	FIBITMAP *dib = NULL;
+	if (fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif))
+		dib = FreeImage_Load(fif, szHeightmap);
+
+	if (dib == NULL) {
+		char message[1024];
+		sprintf_s(message, "Cannot load image\n%s\n", szHeightmap);
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	int iWidth = FreeImage_GetWidth(dib);
+	int iHeight = FreeImage_GetHeight(dib);
+	int iBytes = FreeImage_GetBPP(dib) / 8;
+	if (iWidth < 2 || iHeight < 2 || iBytes < 1 || iTileSize < 2) {
+		FreeImage_Unload(dib);
+		return false;
+	}
+
+	// The grey level, as CHeightMapTerrain::Decode averages it, normalised to 16 bits
+	vector<unsigned short> texels(iWidth * iHeight);
+	for (int z = 0; z < iHeight; z++) {
+		BYTE *pRow = FreeImage_GetScanLine(dib, z);
+		for (int x = 0; x < iWidth; x++) {
+			BYTE *pPixel = pRow + x * iBytes;
+			float grayScale = iBytes >= 3 ? (pPixel[0] + pPixel[1] + pPixel[2]) / 3.0f : pPixel[0];
+			texels[x + z * iWidth] = (unsigned short) (grayScale / 255.0f * 65535.0f + 0.5f);
+		}
+	}
+	FreeImage_Unload(dib);
+
+	CHeader header;
+	memcpy(header.magic, TILE_MAGIC, sizeof(TILE_MAGIC));
+	header.uiVersion = TILE_VERSION;
+	header.uiTileSize = iTileSize;
+	header.uiTilesX = max(1, (iWidth - 1 + iTileSize - 2) / (iTileSize - 1));
+	header.uiTilesZ = max(1, (iHeight - 1 + iTileSize - 2) / (iTileSize - 1));
+	header.fOriginX = origin.x - fSizeX / 2.0f;
+	header.fOriginZ = origin.z - fSizeZ / 2.0f;
+	header.fPixelSize = fSizeX / iWidth;
+	header.fHeightScale = 255.0f / 128.0f * fHeightScale;
+	header.fHeightBias = (origin.y - 1.0f) * fHeightScale;
+
+	int iApronSize = iTileSize + 2;
+	UINT uiNumTiles = header.uiTilesX * header.uiTilesZ;
+	UINT64 tileBytes = (UINT64) iApronSize * iApronSize * sizeof(unsigned short);
+	vector<CTileEntry> entries(uiNumTiles);
+	vector<unsigned short> tile(iApronSize * iApronSize);
+
+	std::ofstream file(szTileFile, std::ios::binary);
+	if (!file)
+		return false;
+	// The index is written again once the tiles' height ranges are known
+	file.write((const char*) &header, sizeof(header));
+	file.write((const char*) &entries[0], uiNumTiles * sizeof(CTileEntry));
+
+	for (UINT j = 0; j < header.uiTilesZ; j++) {
+		for (UINT i = 0; i < header.uiTilesX; i++) {
+			CTileEntry &entry = entries[i + j * header.uiTilesX];
+			entry.offset = sizeof(header) + uiNumTiles * sizeof(CTileEntry) + (i + j * header.uiTilesX) * tileBytes;
+			unsigned short minTexel = 65535, maxTexel = 0;
+			for (int z = 0; z < iApronSize; z++) {
+				int pz = min(max((int) j * (iTileSize - 1) + z - 1, 0), iHeight - 1);
+				for (int x = 0; x < iApronSize; x++) {
+					int px = min(max((int) i * (iTileSize - 1) + x - 1, 0), iWidth - 1);
+					unsigned short texel = texels[px + pz * iWidth];
+					tile[x + z * iApronSize] = texel;
+					if (x > 0 && x <= iTileSize && z > 0 && z <= iTileSize) {
+						minTexel = min(minTexel, texel);
+						maxTexel = max(maxTexel, texel);
+					}
+				}
+			}
+			entry.fMinHeight = minTexel / 65535.0f * header.fHeightScale + header.fHeightBias;
+			entry.fMaxHeight = maxTexel / 65535.0f * header.fHeightScale + header.fHeightBias;
+			file.write((const char*) &tile[0], tileBytes);
+		}
+	}
+
+	file.seekp(sizeof(header));
+	file.write((const char*) &entries[0], uiNumTiles * sizeof(CTileEntry));
+	return file.good();
+}
+
+bool CTiledTerrain::CheckTileFile(const char *szTileFile)
+{
+	HANDLE hFile = CreateFile(szTileFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	// An empty file cannot be mapped
+	bool bValid = false;
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= (LONGLONG) sizeof(CHeader)) {
+		HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping != NULL) {
+			const BYTE *pView = (const BYTE*) MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+			if (pView != NULL) {
+				bValid = IsValidView(pView, (UINT64) fileSize.QuadPart);
+				UnmapViewOfFile(pView);
+			}
+			CloseHandle(hMapping);
+		}
+	}
+	CloseHandle(hFile);
+	return bValid;
+}
+
+// The sizes are compared by division, so a corrupt count or tile size cannot overflow them
+bool CTiledTerrain::IsValidView(const BYTE *pView, UINT64 fileSize)
+{
+	const CHeader *pHeader = (const CHeader*) pView;
+	if (fileSize < sizeof(CHeader) || memcmp(pHeader->magic, TILE_MAGIC, sizeof(TILE_MAGIC)) != 0 ||
+		pHeader->uiVersion != TILE_VERSION || pHeader->uiTileSize < 2)
+		return false;
+
+	UINT64 apronSize = (UINT64) pHeader->uiTileSize + 2;
+	if (apronSize * apronSize > fileSize / sizeof(unsigned short))
+		return false;
+	UINT64 tileBytes = apronSize * apronSize * sizeof(unsigned short);
+	UINT64 uiNumTiles = (UINT64) pHeader->uiTilesX * pHeader->uiTilesZ;
+	if (uiNumTiles == 0 || uiNumTiles > (fileSize - sizeof(CHeader)) / (sizeof(CTileEntry) + tileBytes))
+		return false;
+
+	UINT64 indexEnd = sizeof(CHeader) + uiNumTiles * sizeof(CTileEntry);
+	const CTileEntry *pEntries = (const CTileEntry*) (pView + sizeof(CHeader));
+	for (UINT64 i = 0; i < uiNumTiles; i++) {
+		if (pEntries[i].offset < indexEnd || pEntries[i].offset > fileSize - tileBytes)
+			return false;
+	}
+	return true;
+}
+
+bool CTiledTerrain::Decode(const char *szTileFile, const char *szTextureFile, int iBudgetTiles, int iNumLoaders)
+{
+	m_hFile = CreateFile(szTileFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER fileSize;
+	if (m_hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_hFile, &fileSize) || fileSize.QuadPart < (LONGLONG) sizeof(CHeader)) {
+		char message[1024];
+		sprintf_s(message, "Cannot open terrain tiles\n%s\n", szTileFile);
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		return false;
+	}
+
+	// Mapping the file costs the same however big it is.  Pages are only read when a loader touches them.
+	m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping != NULL)
+		m_pView = (const BYTE*) MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	m_pHeader = (const CHeader*) m_pView;
+	if (m_pView == NULL || !IsValidView(m_pView, (UINT64) fileSize.QuadPart)) {
+		char message[1024];
+		sprintf_s(message, "Terrain tiles are not in the expected format\n%s\n", szTileFile);
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		Unmap();
+		return false;
+	}
+
+	m_pEntries = (const CTileEntry*) (m_pView + sizeof(CHeader));
+	m_iApronSize = m_pHeader->uiTileSize + 2;
+	m_fTileWorldSize = (m_pHeader->uiTileSize - 1) * m_pHeader->fPixelSize;
+
+	int iNumTiles = GetNumTiles();
+	int iNumSlots = min(iBudgetTiles, iNumTiles);
+	m_tileSlots.assign(iNumTiles, -1);
+	m_slotTiles.assign(iNumSlots, -1);
+	m_slotStates.assign(iNumSlots, SLOT_FREE);
+	m_slotLastWanted.assign(iNumSlots, 0);
+	m_slotStaging.resize(iNumSlots);
+	for (int i = 0; i < iNumSlots; i++)
+		m_slotStaging[i].resize(m_iApronSize * m_iApronSize);
+	m_requests.assign(iNumSlots, -1);
+	m_loaded.assign(iNumSlots, -1);
+
+	m_bRunning = true;
+	for (int i = 0; i < max(iNumLoaders, 1); i++)
+		m_loaders.push_back(std::thread(&CTiledTerrain::LoaderLoop, this));
+
+	return m_texture.Decode(szTextureFile);
+}
+
+// Create the texture array, with a layer per slot, and the tile grid
+void CTiledTerrain::Upload()
+{
+	// Nothing to upload if Decode failed; Update and Render then draw no tiles
+	if (m_pHeader == NULL)
+		return;
+
+	m_texture.Upload(true);
+
+	int iNumSlots = (int) m_slotTiles.size();
+	glGenTextures(1, &m_uiTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, m_iApronSize, m_iApronSize, iNumSlots, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+	CMemoryTracker::TrackTexture(m_uiTexture, (size_t) m_iApronSize * m_iApronSize * 2 * iNumSlots);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// One grid of tile pixels, split as the heightmap mesh's quads are
+	int iSide = m_pHeader->uiTileSize;
+	int iQuads = iSide - 1;
+	glGenVertexArrays(1, &m_uiVAO);
+	glBindVertexArray(m_uiVAO);
+	m_vboGrid.Create(true);
+	m_vboGrid.Bind();
+	m_vboGrid.Reserve(iSide * iSide, iQuads * iQuads * 6);
+	for (int z = 0; z < iSide; z++) {
+		for (int x = 0; x < iSide; x++)
+			m_vboGrid.AddVertex(glm::vec2((float) x, (float) z));
+	}
+	for (int z = 0; z < iQuads; z++) {
+		for (int x = 0; x < iQuads; x++) {
+			unsigned int index = x + z * iSide;
+			m_vboGrid.AddTriangle(index, index + 1 + iSide, index + 1);
+			m_vboGrid.AddTriangle(index, index + iSide, index + 1 + iSide);
+		}
+	}
+	m_vboGrid.UploadDataToGPU(GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+	glBindVertexArray(0);
+}
+
+void CTiledTerrain::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bRunning = false;
+	}
+	m_wake.notify_all();
+	for (unsigned int i = 0; i < m_loaders.size(); i++)
+		m_loaders[i].join();
+	m_loaders.clear();
+
+	Unmap();
+
+	CMemoryTracker::ForgetTexture(m_uiTexture);
+	glDeleteTextures(1, &m_uiTexture);
+	glDeleteVertexArrays(1, &m_uiVAO);
+	m_uiTexture = m_uiVAO = 0;
+	m_vboGrid.Release();
+	m_texture.Release();
+	vector<TrackedVector<unsigned short> >().swap(m_slotStaging);
+}
+
+void CTiledTerrain::Unmap()
+{
+	if (m_pView != NULL)
+		UnmapViewOfFile(m_pView);
+	if (m_hMapping != NULL)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_pView = NULL;
+	m_pHeader = NULL;
+	m_pEntries = NULL;
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+}
+
+// Each loader copies requested tiles out of the mapping into their slot's staging heights.  Reading the mapping is what pages
+// the tile in, so any wait on the disk is here and not on the main thread.
+void CTiledTerrain::LoaderLoop()
+{
+	int iNumSlots = (int) m_requests.size();
+	for (;;) {
+		int iSlot;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return !m_bRunning || m_iNumRequests > 0; });
+			if (!m_bRunning)
+				return;
+			iSlot = m_requests[m_iFirstRequest];
+			m_iFirstRequest = (m_iFirstRequest + 1) % iNumSlots;
+			m_iNumRequests--;
+		}
+
+		const CTileEntry &entry = m_pEntries[m_slotTiles[iSlot]];
+		memcpy(&m_slotStaging[iSlot][0], m_pView + entry.offset, m_slotStaging[iSlot].size() * sizeof(unsigned short));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_loaded[(m_iFirstLoaded + m_iNumLoaded) % iNumSlots] = iSlot;
+		m_iNumLoaded++;
+	}
+}
+
+// A free slot, or else the resident one whose tile was wanted longest ago and not this frame.  -1 if every slot is wanted.
+int CTiledTerrain::FindSlot()
+{
+	int iBest = -1;
+	for (unsigned int i = 0; i < m_slotStates.size(); i++) {
+		if (m_slotStates[i] == SLOT_FREE)
+			return i;
+		if (m_slotStates[i] == SLOT_RESIDENT && m_slotLastWanted[i] != m_uiFrame &&
+			(iBest < 0 || m_slotLastWanted[i] < m_slotLastWanted[iBest]))
+			iBest = i;
+	}
+	return iBest;
+}
+
+bool CTiledTerrain::Update(const glm::vec3 &vCamera, float fRadius)
+{
+	if (m_pView == NULL)
+		return false;
+
+	m_uiFrame++;
+	int iNumSlots = (int) m_slotTiles.size();
+	bool bChanged = false;
+
+	// Upload a few of the finished tiles, so a burst of them is spread over several frames
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	for (int i = 0; i < MAX_UPLOADS_PER_FRAME; i++) {
+		int iSlot;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_iNumLoaded == 0)
+				break;
+			iSlot = m_loaded[m_iFirstLoaded];
+			m_iFirstLoaded = (m_iFirstLoaded + 1) % iNumSlots;
+			m_iNumLoaded--;
+		}
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, iSlot, m_iApronSize, m_iApronSize, 1, GL_RED, GL_UNSIGNED_SHORT,
+			&m_slotStaging[iSlot][0]);
+		m_slotStates[iSlot] = SLOT_RESIDENT;
+		m_iNumLoading--;
+		m_iNumResident++;
+		m_uiNumStreamed++;
+		bChanged = true;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Walk the square rings of tiles round the camera's, nearest ring first, wanting those the radius reaches.  A wanted tile
+	// that is not resident takes a slot, if one can be had, and goes to the loaders.
+	int iTilesX = m_pHeader->uiTilesX, iTilesZ = m_pHeader->uiTilesZ;
+	int iCameraX = (int) floor((vCamera.x - m_pHeader->fOriginX) / m_fTileWorldSize);
+	int iCameraZ = (int) floor((vCamera.z - m_pHeader->fOriginZ) / m_fTileWorldSize);
+	int iRings = (int) ceil(fRadius / m_fTileWorldSize);
+	int iNumRequested = 0;
+	for (int iRing = 0; iRing <= iRings; iRing++) {
+		for (int z = iCameraZ - iRing; z <= iCameraZ + iRing; z++) {
+			int iStep = (z == iCameraZ - iRing || z == iCameraZ + iRing) ? 1 : max(2 * iRing, 1);
+			for (int x = iCameraX - iRing; x <= iCameraX + iRing; x += iStep) {
+				if (x < 0 || x >= iTilesX || z < 0 || z >= iTilesZ)
+					continue;
+				glm::vec3 vMin, vMax;
+				int iTile = x + z * iTilesX;
+				GetTileBounds(iTile, vMin, vMax);
+				float dx = max(max(vMin.x - vCamera.x, vCamera.x - vMax.x), 0.0f);
+				float dz = max(max(vMin.z - vCamera.z, vCamera.z - vMax.z), 0.0f);
+				if (dx * dx + dz * dz > fRadius * fRadius)
+					continue;
+
+				int iSlot = m_tileSlots[iTile];
+				if (iSlot < 0) {
+					iSlot = FindSlot();
+					if (iSlot < 0)
+						continue;
+					if (m_slotStates[iSlot] == SLOT_RESIDENT) {
+						m_tileSlots[m_slotTiles[iSlot]] = -1;
+						m_iNumResident--;
+						bChanged = true;
+					}
+					m_slotTiles[iSlot] = iTile;
+					m_slotStates[iSlot] = SLOT_LOADING;
+					m_tileSlots[iTile] = iSlot;
+					m_iNumLoading++;
+
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_requests[(m_iFirstRequest + m_iNumRequests) % iNumSlots] = iSlot;
+					m_iNumRequests++;
+					iNumRequested++;
+				}
+				m_slotLastWanted[iSlot] = m_uiFrame;
+			}
+		}
+	}
+	if (iNumRequested == 1)
+		m_wake.notify_one();
+	else if (iNumRequested > 1)
+		m_wake.notify_all();
+
+	return bChanged;
+}
+
+void CTiledTerrain::GetTileBounds(int iTile, glm::vec3 &vMin, glm::vec3 &vMax)
+{
+	int x = iTile % m_pHeader->uiTilesX;
+	int z = iTile / m_pHeader->uiTilesX;
+	vMin = glm::vec3(m_pHeader->fOriginX + x * m_fTileWorldSize, m_pEntries[iTile].fMinHeight, m_pHeader->fOriginZ + z * m_fTileWorldSize);
+	vMax = glm::vec3(vMin.x + m_fTileWorldSize, m_pEntries[iTile].fMaxHeight, vMin.z + m_fTileWorldSize);
+}
+
+void CTiledTerrain::Render(CShaderProgram *pProgram, const CFrustum &frustum, int iUnit)
+{
+	if (m_iNumResident == 0)
+		return;
+
+	m_texture.Bind();
+	glActiveTexture(GL_TEXTURE0 + iUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glActiveTexture(GL_TEXTURE0);
+	pProgram->SetUniform("heightTiles", iUnit);
+	pProgram->SetUniform("tiles.fPixelSize", m_pHeader->fPixelSize);
+	pProgram->SetUniform("tiles.fHeightScale", m_pHeader->fHeightScale);
+	pProgram->SetUniform("tiles.fHeightBias", m_pHeader->fHeightBias);
+
+	glBindVertexArray(m_uiVAO);
+	int iQuads = m_pHeader->uiTileSize - 1;
+	for (unsigned int i = 0; i < m_slotStates.size(); i++) {
+		if (m_slotStates[i] != SLOT_RESIDENT)
+			continue;
+		glm::vec3 vMin, vMax;
+		GetTileBounds(m_slotTiles[i], vMin, vMax);
+		if (!frustum.IntersectsBox(vMin, vMax))
+			continue;
+		pProgram->SetUniform("tiles.vTileOrigin", glm::vec2(vMin.x, vMin.z));
+		pProgram->SetUniform("tiles.iLayer", (int) i);
+		glDrawElements(GL_TRIANGLES, iQuads * iQuads * 6, GL_UNSIGNED_INT, 0);
+		CFrameProfiler::CountDraws();
+	}
+}
+
+int CTiledTerrain::GetNumTiles()
+{
+	return m_pHeader == NULL ? 0 : (int) (m_pHeader->uiTilesX * m_pHeader->uiTilesZ);
+}
+
+int CTiledTerrain::GetNumResidentTiles()
+{
+	return m_iNumResident;
+}
+
+int CTiledTerrain::GetNumLoadingTiles()
+{
+	return m_iNumLoading;
+}
+
+UINT CTiledTerrain::GetNumTilesStreamed()
+{
+	return m_uiNumStreamed;
+}
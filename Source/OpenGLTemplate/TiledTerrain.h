@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Common.h"
+#include "VertexBufferBuilder.h"
+#include "Texture.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class CShaderProgram;
+class CFrustum;
+
+// A heightmap terrain streamed from a tile file.  The file holds 16-bit heights in square tiles behind an index, and is memory
+// mapped, so opening it reads only the header and index however large the world is.  Tiles near the camera are copied out of
+// the mapping by loader threads, which take the page faults, and uploaded to layers of a texture array on the main thread.
+// The array holds a fixed budget of tiles; once it is full, the tile wanted least recently makes way for a nearer one.
+//
+// Each tile is drawn as one grid displaced by its layer in terrainTile.vert.  A tile shares its edge pixels with its neighbours
+// and carries a one pixel apron from them, so the seams agree in height and in normal.
+class CTiledTerrain
+{
+public:
+	CTiledTerrain();
+	~CTiledTerrain();
+
+	// Writes a tile file from a greyscale image, with the heights CHeightMapTerrain gives it, placed where it places them.
+	// iTileSize is the pixels along each side of a tile, counting the edge it shares with the next.
+	static bool BuildTileFile(const char *szHeightmap, const char *szTileFile, int iTileSize, glm::vec3 origin, float fSizeX,
+		float fSizeZ, float fHeightScale);
+	// True if the tile file exists and passes the checks Decode makes, so it can be used as it is rather than built again
+	static bool CheckTileFile(const char *szTileFile);
+
+	// Maps the tile file, sizes the tile budget and starts the loaders.  Safe on a worker thread.
+	bool Decode(const char *szTileFile, const char *szTextureFile, int iBudgetTiles, int iNumLoaders);
+	void Upload();
+	void Release();
+
+	// Main thread, once a frame.  Uploads the tiles the loaders have finished, then asks for every tile within fRadius of
+	// vCamera, nearest first.  Returns true if the resident tiles changed.
+	bool Update(const glm::vec3 &vCamera, float fRadius);
+
+	// Draws the resident tiles in the frustum, which is in the terrain's model space.  pProgram must use terrainTile.vert and
+	// be in use with its matrices set.
+	void Render(CShaderProgram *pProgram, const CFrustum &frustum, int iUnit);
+
+	int GetNumTiles();
+	int GetNumResidentTiles();
+	int GetNumLoadingTiles();
+	UINT GetNumTilesStreamed();		// Tiles uploaded since Decode
+
+private:
+	static const int MAX_UPLOADS_PER_FRAME = 4;
+
+	// The file starts with the header, then an entry per tile, row by row, then the tiles' heights
+	struct CHeader
+	{
+		char magic[4];
+		UINT uiVersion;
+		UINT uiTileSize;			// Pixels along a side, counting the edge shared with the next tile but not the apron
+		UINT uiTilesX, uiTilesZ;
+		float fOriginX, fOriginZ;	// World xz of the first pixel
+		float fPixelSize;			// World distance between pixels
+		float fHeightScale;			// World height = texel / 65535 * fHeightScale + fHeightBias
+		float fHeightBias;
+	};
+	struct CTileEntry
+	{
+		UINT64 offset;				// From the start of the file, to (uiTileSize + 2) squared heights
+		float fMinHeight;			// World heights, for culling
+		float fMaxHeight;
+	};
+
+	enum SlotState { SLOT_FREE, SLOT_LOADING, SLOT_RESIDENT };
+
+	// The header is ours and every tile lies past the index and within the file, so the loaders never read beyond the mapping
+	static bool IsValidView(const BYTE *pView, UINT64 fileSize);
+	void Unmap();
+	void LoaderLoop();
+	int FindSlot();
+	void GetTileBounds(int iTile, glm::vec3 &vMin, glm::vec3 &vMax);
+
+	// The mapping
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const BYTE *m_pView;
+	const CHeader *m_pHeader;
+	const CTileEntry *m_pEntries;
+	int m_iApronSize;				// uiTileSize + 2
+	float m_fTileWorldSize;
+
+	// Texture array layers, by slot.  The loaders write a slot's staging heights; only the main thread reads the rest.
+	GLuint m_uiTexture;
+	vector<int> m_tileSlots;		// By tile; its slot, or -1
+	vector<int> m_slotTiles;		// By slot; its tile, or -1
+	vector<int> m_slotStates;
+	vector<UINT> m_slotLastWanted;	// Frame the slot's tile was last within the radius
+	vector<TrackedVector<unsigned short> > m_slotStaging;
+	UINT m_uiFrame;
+	UINT m_uiNumStreamed;
+	int m_iNumResident;
+	int m_iNumLoading;
+
+	// Slots waiting for a loader, and slots loaded and waiting to upload, each a ring as long as the budget
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	vector<int> m_requests;
+	int m_iFirstRequest, m_iNumRequests;
+	vector<int> m_loaded;
+	int m_iFirstLoaded, m_iNumLoaded;
+	bool m_bRunning;
+	vector<std::thread> m_loaders;
+
+	// One grid of (uiTileSize - 1) quads a side, drawn once per tile
+	GLuint m_uiVAO;
+	CVertexBufferBuilder<glm::vec2> m_vboGrid;	// Pixel coordinates within the tile
+	CTexture m_texture;
+};
@@ -0,0 +1,133 @@
+#include "TransformHierarchy.h"
+#include <algorithm>
+
+#include "include\glm\gtc\matrix_transform.hpp"
+
+CTransformHierarchy::CTransformHierarchy()
+{
+	m_bSorted = true;
+	m_uiNumUpdated = 0;
+
+	// The root is the world
+	m_parentIDs.push_back(-1);
+	m_depths.push_back(0);
+	m_indices.push_back(0);
+	m_ids.push_back(ROOT);
+	m_parents.push_back(-1);
+	m_localMatrices.push_back(glm::mat4(1.0f));
+	m_worldMatrices.push_back(glm::mat4(1.0f));
+	m_normalMatrices.push_back(glm::mat3(1.0f));
+	m_dirty.push_back(1);
+	m_changed.push_back(0);
+}
+
+CTransformHierarchy::~CTransformHierarchy()
+{}
+
+int CTransformHierarchy::AddNode(int iParent)
+{
+	int iNode = (int) m_parentIDs.size();
+	int iDepth = m_depths[iParent] + 1;
+
+	// Appending keeps breadth-first order only if nothing deeper is already there
+	if (iDepth < m_depths[m_ids.back()])
+		m_bSorted = false;
+
+	m_parentIDs.push_back(iParent);
+	m_depths.push_back(iDepth);
+	m_indices.push_back((int) m_ids.size());
+	m_ids.push_back(iNode);
+	m_parents.push_back(m_indices[iParent]);
+	m_localMatrices.push_back(glm::mat4(1.0f));
+	m_worldMatrices.push_back(glm::mat4(1.0f));
+	m_normalMatrices.push_back(glm::mat3(1.0f));
+	m_dirty.push_back(1);
+	m_changed.push_back(0);
+	return iNode;
+}
+
+void CTransformHierarchy::SetLocal(int iNode, const glm::vec3 &vTranslation, const glm::vec3 &vAxis, float fAngle, float fScale)
+{
+	glm::mat4 localMatrix = glm::translate(glm::mat4(1.0f), vTranslation);
+	if (fAngle != 0.0f)
+		localMatrix = glm::rotate(localMatrix, fAngle, vAxis);
+	localMatrix = glm::scale(localMatrix, glm::vec3(fScale));
+	SetLocalMatrix(iNode, localMatrix);
+}
+
+void CTransformHierarchy::SetLocalMatrix(int iNode, const glm::mat4 &localMatrix)
+{
+	int iIndex = m_indices[iNode];
+	m_localMatrices[iIndex] = localMatrix;
+	m_dirty[iIndex] = 1;
+}
+
+// Reorders the arrays by depth.  The sort is stable, so nodes at the same depth keep the order they were added in.
+void CTransformHierarchy::Sort()
+{
+	vector<int> order(m_ids);
+	stable_sort(order.begin(), order.end(), [this](int a, int b) { return m_depths[a] < m_depths[b]; });
+
+	vector<glm::mat4> localMatrices(order.size());
+	vector<BYTE> dirty(order.size());
+	for (unsigned int i = 0; i < order.size(); i++) {
+		localMatrices[i] = m_localMatrices[m_indices[order[i]]];
+		dirty[i] = m_dirty[m_indices[order[i]]];
+	}
+	for (unsigned int i = 0; i < order.size(); i++)
+		m_indices[order[i]] = i;
+	for (unsigned int i = 0; i < order.size(); i++) {
+		int iParent = m_parentIDs[order[i]];
+		m_parents[i] = iParent < 0 ? -1 : m_indices[iParent];
+		// Every world matrix moved, so recompute them all
+		dirty[i] = 1;
+	}
+
+	m_ids.swap(order);
+	m_localMatrices.swap(localMatrices);
+	m_dirty.swap(dirty);
+	m_bSorted = true;
+}
+
+// One pass in breadth-first order.  A node is recomputed if its own transform was set or its parent was recomputed in this
+// pass, which, since parents come first, has already been decided.
+void CTransformHierarchy::Update()
+{
+	if (!m_bSorted)
+		Sort();
+
+	m_uiNumUpdated = 0;
+	UINT uiNumNodes = (UINT) m_ids.size();
+	for (UINT i = 0; i < uiNumNodes; i++) {
+		int iParent = m_parents[i];
+		if (!m_dirty[i] && (iParent < 0 || !m_changed[iParent])) {
+			m_changed[i] = 0;
+			continue;
+		}
+		m_worldMatrices[i] = iParent < 0 ? m_localMatrices[i] : m_worldMatrices[iParent] * m_localMatrices[i];
+		m_normalMatrices[i] = glm::transpose(glm::inverse(glm::mat3(m_worldMatrices[i])));
+		m_dirty[i] = 0;
+		m_changed[i] = 1;
+		m_uiNumUpdated++;
+	}
+}
+
+const glm::mat4& CTransformHierarchy::GetWorldMatrix(int iNode)
+{
+	return m_worldMatrices[m_indices[iNode]];
+}
+
+const glm::mat3& CTransformHierarchy::GetNormalMatrix(int iNode)
+{
+	return m_normalMatrices[m_indices[iNode]];
+}
+
+UINT CTransformHierarchy::GetNumNodes()
+{
+	return (UINT) m_ids.size();
+}
+
+UINT CTransformHierarchy::GetNumUpdated()
+{
+	return m_uiNumUpdated;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Common.h"
+
+// A tree of transforms.  Each node has a local transform relative to its parent, and caches its world matrix and the normal
+// matrix for it (the inverse transpose of the world matrix's upper 3x3).  Update recomputes only the nodes whose local
+// transform was set since the last Update, and their descendants, so nodes that never move cost nothing after the first.
+//
+// The nodes are kept in breadth-first order, so every parent comes before its children and Update is a single pass front to
+// back through arrays, reading each parent's result just after it was written.  Node ids are stable; adding nodes reorders
+// the arrays behind them at the next Update.
+class CTransformHierarchy
+{
+public:
+	static const int ROOT = 0;
+
+	CTransformHierarchy();
+	~CTransformHierarchy();
+
+	// Returns the new node's id.  Its local transform is the identity.
+	int AddNode(int iParent);
+
+	// Local transform as translate * rotate * scale, the order the matrix stack applies them in.  fAngle is in degrees.
+	void SetLocal(int iNode, const glm::vec3 &vTranslation, const glm::vec3 &vAxis, float fAngle, float fScale);
+	void SetLocalMatrix(int iNode, const glm::mat4 &localMatrix);
+
+	void Update();
+
+	const glm::mat4& GetWorldMatrix(int iNode);
+	// With a rigid view matrix, mat3(view) * this is the normal matrix for view * GetWorldMatrix
+	const glm::mat3& GetNormalMatrix(int iNode);
+
+	UINT GetNumNodes();
+	UINT GetNumUpdated();		// Nodes the last Update recomputed
+
+private:
+	void Sort();
+
+	// By id
+	vector<int> m_parentIDs;
+	vector<int> m_depths;
+	vector<int> m_indices;				// Each node's position in the arrays below
+
+	// In breadth-first order
+	vector<int> m_ids;
+	vector<int> m_parents;				// Position of the parent, or -1 for the root
+	vector<glm::mat4> m_localMatrices;
+	vector<glm::mat4> m_worldMatrices;
+	vector<glm::mat3> m_normalMatrices;
+	vector<BYTE> m_dirty;				// Local transform set since the last Update
+	vector<BYTE> m_changed;				// World matrix recomputed by the current Update
+
+	bool m_bSorted;
+	UINT m_uiNumUpdated;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+
+// A lock-free triple buffer for handing whole objects from one producer thread to one consumer thread.  The producer always
+// has a slot to write into and the consumer always holds the most recently published slot, so neither side ever waits.
+template <class T>
+class CTripleBuffer
+{
+public:
+	CTripleBuffer() : m_state(1)
+	{
+		m_writeIndex = 0;
+		m_readIndex = 2;
+	}
+
+	// Producer: the slot to fill in before calling Publish()
+	T& GetWriteBuffer()
+	{
+		return m_buffers[m_writeIndex];
+	}
+
+	// Producer: make the write slot visible to the consumer, and take the old middle slot as the next write slot
+	void Publish()
+	{
+		int iPrevious = m_state.exchange(m_writeIndex | NEW_DATA, std::memory_order_acq_rel);
+		m_writeIndex = iPrevious & INDEX_MASK;
+	}
+
+	// Consumer: pick up the most recently published slot, if there is one.  Returns true if the read slot changed.
+	bool Update()
+	{
+		if ((m_state.load(std::memory_order_acquire) & NEW_DATA) == 0)
+			return false;
+		int iPrevious = m_state.exchange(m_readIndex, std::memory_order_acq_rel);
+		m_readIndex = iPrevious & INDEX_MASK;
+		return true;
+	}
+
+	// Consumer: the slot picked up by the last call to Update()
+	const T& GetReadBuffer() const
+	{
+		return m_buffers[m_readIndex];
+	}
+
+private:
+	enum { INDEX_MASK = 3, NEW_DATA = 4 };
+
+	T m_buffers[3];
+	std::atomic<int> m_state;	// Index of the middle slot, plus NEW_DATA if it holds an object the consumer has not seen
+	int m_writeIndex;			// Only touched by the producer
+	int m_readIndex;			// Only touched by the consumer
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Common.h"
+
+// The interleaved vertex used by most meshes: position, texture coordinate and normal at attribute locations 0, 1 and 2
+class CVertex
+{
+public:
+	CVertex() {};
+	CVertex(glm::vec3 positionIn, glm::vec2 textureCoordIn, glm::vec3 normalIn)
+	{
+		position = positionIn;
+		textureCoord = textureCoordIn;
+		normal = normalIn;
+	};
+
+	glm::vec3 position;
+	glm::vec2 textureCoord;
+	glm::vec3 normal;
+};
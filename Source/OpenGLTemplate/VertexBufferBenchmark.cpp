@@ -0,0 +1,259 @@
+#include "VertexBufferBenchmark.h"
+#include "VertexBufferObject.h"
+#include "VertexBufferObjectIndexed.h"
+#include "VertexBufferBuilder.h"
+#include "Vertex.h"
+#include "CatmullRom.h"
+#include "HighResolutionTimer.h"
+#include <fstream>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+static const int NUM_REPEATS = 5;
+
+// The same vertex CSphere::Create generates
+static CVertex SphereVertex(int stacks, int slices, int stacksIn, int slicesIn)
+{
+	float phi = (stacks / (float) (stacksIn - 1)) * (float) M_PI;
+	float theta = (slices / (float) slicesIn) * 2 * (float) M_PI;
+	glm::vec3 v = glm::vec3(cos(theta) * sin(phi), sin(theta) * sin(phi), cos(phi));
+	return CVertex(v, glm::vec2(slices / (float) slicesIn, stacks / (float) stacksIn), v);
+}
+
+static void SphereIndices(int stacks, int slices, int stacksIn, int slicesIn, unsigned int indices[6])
+{
+	unsigned int nextStack = (stacks + 1) % stacksIn;
+	indices[0] = stacks * (slicesIn+1) + slices;
+	indices[1] = nextStack * (slicesIn+1) + slices;
+	indices[2] = stacks * (slicesIn+1) + slices + 1;
+	indices[3] = indices[2];
+	indices[4] = indices[1];
+	indices[5] = nextStack * (slicesIn+1) + slices + 1;
+}
+
+static double TimeSphereByteWise(int n)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferObjectIndexed vbo;
+	vbo.Create();
+	vbo.Bind();
+	for (int stacks = 0; stacks < n; stacks++) {
+		for (int slices = 0; slices <= n; slices++) {
+			CVertex v = SphereVertex(stacks, slices, n, n);
+			vbo.AddVertexData(&v.position, sizeof(glm::vec3));
+			vbo.AddVertexData(&v.textureCoord, sizeof(glm::vec2));
+			vbo.AddVertexData(&v.normal, sizeof(glm::vec3));
+		}
+	}
+	for (int stacks = 0; stacks < n; stacks++) {
+		for (int slices = 0; slices < n; slices++) {
+			unsigned int indices[6];
+			SphereIndices(stacks, slices, n, n, indices);
+			for (int i = 0; i < 6; i++)
+				vbo.AddIndexData(&indices[i], sizeof(unsigned int));
+		}
+	}
+	vbo.UploadDataToGPU(GL_STATIC_DRAW);
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+static double TimeSphereBuilder(int n)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferBuilder<CVertex> vbo;
+	vbo.Create(true);
+	vbo.Bind();
+	vbo.Reserve(n * (n + 1), n * n * 6);
+	for (int stacks = 0; stacks < n; stacks++) {
+		for (int slices = 0; slices <= n; slices++)
+			vbo.AddVertex(SphereVertex(stacks, slices, n, n));
+	}
+	for (int stacks = 0; stacks < n; stacks++) {
+		for (int slices = 0; slices < n; slices++) {
+			unsigned int indices[6];
+			SphereIndices(stacks, slices, n, n, indices);
+			vbo.AddTriangle(indices[0], indices[1], indices[2]);
+			vbo.AddTriangle(indices[3], indices[4], indices[5]);
+		}
+	}
+	vbo.UploadDataToGPU(GL_STATIC_DRAW);
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+static double TimeSphereMapped(int n)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferBuilder<CVertex> vbo;
+	vbo.Create(true);
+	vbo.Bind();
+	vector<unsigned int> indices(n * n * 6);
+	for (int stacks = 0; stacks < n; stacks++) {
+		for (int slices = 0; slices < n; slices++)
+			SphereIndices(stacks, slices, n, n, &indices[(stacks * n + slices) * 6]);
+	}
+	vbo.UploadDataToGPU(NULL, 0, &indices[0], (UINT) indices.size(), GL_STATIC_DRAW);
+
+	CVertex *pVertices = vbo.MapVertices(n * (n + 1), GL_STATIC_DRAW);
+	if (pVertices) {
+		for (int stacks = 0; stacks < n; stacks++) {
+			for (int slices = 0; slices <= n; slices++)
+				*pVertices++ = SphereVertex(stacks, slices, n, n);
+		}
+		vbo.UnmapVertices();
+	}
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+// Left and right edges of the track at n evenly spaced samples, as the track was built before it was sampled adaptively
+static void SampleTrackEdges(CCatmullRom *pTrack, int n, vector<glm::vec3> &left, vector<glm::vec3> &right)
+{
+	float fLength = pTrack->GetTotalLength();
+	float w = pTrack->GetTrackWidth();
+	left.resize(n);
+	right.resize(n);
+	glm::vec3 p, pNext;
+	for (int i = 0; i < n; i++) {
+		pTrack->Sample(fLength * i / n, p);
+		pTrack->Sample(fLength * (i + 1) / n, pNext);
+		glm::vec3 N = glm::normalize(glm::cross(glm::normalize(pNext - p), glm::vec3(0, 1.f, 0)));
+		left[i] = p - (w / 2) * N;
+		right[i] = p + (w / 2) * N;
+	}
+}
+
+static double TimeTrackByteWise(const vector<glm::vec3> &left, const vector<glm::vec3> &right)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferObject vbo;
+	vbo.Create();
+	vbo.Bind();
+	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	for (unsigned int i = 0; i < left.size(); i++) {
+		glm::vec2 leftTex(0.0f, i / 100.0f), rightTex(1.0f, i / 100.0f);
+		glm::vec3 l = left[i], r = right[i];
+		vbo.AddData(&l, sizeof(glm::vec3));
+		vbo.AddData(&leftTex, sizeof(glm::vec2));
+		vbo.AddData(&normal, sizeof(glm::vec3));
+		vbo.AddData(&r, sizeof(glm::vec3));
+		vbo.AddData(&rightTex, sizeof(glm::vec2));
+		vbo.AddData(&normal, sizeof(glm::vec3));
+	}
+	vbo.UploadDataToGPU(GL_STATIC_DRAW);
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+static double TimeTrackBuilder(const vector<glm::vec3> &left, const vector<glm::vec3> &right)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferBuilder<CVertex> vbo;
+	vbo.Create();
+	vbo.Bind();
+	vbo.Reserve(2 * (UINT) left.size());
+	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	for (unsigned int i = 0; i < left.size(); i++) {
+		vbo.EmplaceVertex(left[i], glm::vec2(0.0f, i / 100.0f), normal);
+		vbo.EmplaceVertex(right[i], glm::vec2(1.0f, i / 100.0f), normal);
+	}
+	vbo.UploadDataToGPU(GL_STATIC_DRAW);
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+static double TimeTrackMapped(const vector<glm::vec3> &left, const vector<glm::vec3> &right)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	CVertexBufferBuilder<CVertex> vbo;
+	vbo.Create();
+	vbo.Bind();
+	glm::vec3 normal(0.0f, 1.0f, 0.0f);
+	CVertex *pVertices = vbo.MapVertices(2 * (UINT) left.size(), GL_STATIC_DRAW);
+	if (pVertices) {
+		for (unsigned int i = 0; i < left.size(); i++) {
+			*pVertices++ = CVertex(left[i], glm::vec2(0.0f, i / 100.0f), normal);
+			*pVertices++ = CVertex(right[i], glm::vec2(1.0f, i / 100.0f), normal);
+		}
+		vbo.UnmapVertices();
+	}
+	glFinish();
+
+	double dElapsed = timer.Elapsed();
+	vbo.Release();
+	return dElapsed;
+}
+
+// Median of NUM_REPEATS runs
+template <class TFunction>
+static double Median(TFunction function)
+{
+	vector<double> times;
+	for (int i = 0; i < NUM_REPEATS; i++)
+		times.push_back(function());
+	sort(times.begin(), times.end());
+	return times[NUM_REPEATS / 2];
+}
+
+void RunVertexBufferBenchmark(CCatmullRom *pTrack, const string &sFilename)
+{
+	std::ofstream file(sFilename.c_str());
+	file << "geometry,tessellation,vertices,bytewise_ms,builder_ms,mapped_ms\n";
+
+	// A VAO must be bound for the index buffer binding
+	GLuint uiVAO;
+	glGenVertexArrays(1, &uiVAO);
+	glBindVertexArray(uiVAO);
+
+	int sphereSizes[] = { 64, 256, 1024 };
+	for (int i = 0; i < 3; i++) {
+		int n = sphereSizes[i];
+		file << "sphere," << n << "," << n * (n + 1) << ","
+			<< Median([n] { return TimeSphereByteWise(n); }) << ","
+			<< Median([n] { return TimeSphereBuilder(n); }) << ","
+			<< Median([n] { return TimeSphereMapped(n); }) << "\n";
+	}
+
+	int trackSizes[] = { 600, 20000, 500000 };
+	for (int i = 0; i < 3; i++) {
+		vector<glm::vec3> left, right;
+		SampleTrackEdges(pTrack, trackSizes[i], left, right);
+		file << "track," << trackSizes[i] << "," << 2 * trackSizes[i] << ","
+			<< Median([&] { return TimeTrackByteWise(left, right); }) << ","
+			<< Median([&] { return TimeTrackBuilder(left, right); }) << ","
+			<< Median([&] { return TimeTrackMapped(left, right); }) << "\n";
+	}
+
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &uiVAO);
+}
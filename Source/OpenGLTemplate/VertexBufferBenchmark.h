@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Common.h"
+
+class CCatmullRom;
+
+// Times filling and uploading sphere and track geometry at several tessellations in three ways: the byte-wise AddData of
+// CVertexBufferObject/CVertexBufferObjectIndexed, CVertexBufferBuilder with a reserved array, and CVertexBufferBuilder writing
+// through a mapped buffer.  Needs a current OpenGL context; the track must already have been created.  Results go to a CSV file.
+void RunVertexBufferBenchmark(CCatmullRom *pTrack, const string &sFilename);
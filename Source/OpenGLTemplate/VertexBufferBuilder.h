@@ -0,0 +1,154 @@
+#pragma once
+
+#include "Common.h"
+#include "MemoryTracker.h"
+#include <utility>
+
+// A vertex buffer built from whole vertices of type TVertex, with optional 32-bit indices.  Reserve the final size up front,
+// then add or emplace vertices; there is no per-attribute byte copying and no reallocation.  Data can also go to the GPU
+// straight from a caller's array, or be written in place through MapVertices.
+template <class TVertex>
+class CVertexBufferBuilder
+{
+public:
+	CVertexBufferBuilder()
+	{
+		m_uiVBOVertices = 0;
+		m_uiVBOIndices = 0;
+		m_bMapped = false;
+	}
+
+	// Creates the buffer objects.  The index buffer is only created if bIndexed is true.
+	void Create(bool bIndexed = false)
+	{
+		glGenBuffers(1, &m_uiVBOVertices);
+		if (bIndexed)
+			glGenBuffers(1, &m_uiVBOIndices);
+	}
+
+	// Binds the buffers.  Bind with the VAO bound so that the index buffer is recorded in it.
+	void Bind()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_uiVBOVertices);
+		if (m_uiVBOIndices != 0)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIndices);
+	}
+
+	// Releases the buffers and any data not yet uploaded
+	void Release()
+	{
+		CMemoryTracker::ForgetBuffer(m_uiVBOVertices);
+		glDeleteBuffers(1, &m_uiVBOVertices);
+		if (m_uiVBOIndices != 0) {
+			CMemoryTracker::ForgetBuffer(m_uiVBOIndices);
+			glDeleteBuffers(1, &m_uiVBOIndices);
+		}
+		m_uiVBOVertices = 0;
+		m_uiVBOIndices = 0;
+		ClearData();
+	}
+
+	void Reserve(UINT uiNumVertices, UINT uiNumIndices = 0)
+	{
+		m_vertices.reserve(uiNumVertices);
+		m_indices.reserve(uiNumIndices);
+	}
+
+	void AddVertex(const TVertex &vertex)
+	{
+		m_vertices.push_back(vertex);
+	}
+
+	// Constructs the vertex in place from TVertex's constructor arguments
+	template <class... Args>
+	void EmplaceVertex(Args&&... args)
+	{
+		m_vertices.emplace_back(std::forward<Args>(args)...);
+	}
+
+	void AddIndex(unsigned int uiIndex)
+	{
+		m_indices.push_back(uiIndex);
+	}
+
+	void AddTriangle(unsigned int uiIndex0, unsigned int uiIndex1, unsigned int uiIndex2)
+	{
+		m_indices.push_back(uiIndex0);
+		m_indices.push_back(uiIndex1);
+		m_indices.push_back(uiIndex2);
+	}
+
+	UINT GetNumVertices()
+	{
+		return (UINT) m_vertices.size();
+	}
+
+	UINT GetNumIndices()
+	{
+		return (UINT) m_indices.size();
+	}
+
+	GLuint GetVertexBufferID()
+	{
+		return m_uiVBOVertices;
+	}
+
+	GLuint GetIndexBufferID()
+	{
+		return m_uiVBOIndices;
+	}
+
+	// Uploads the vertices and indices added so far to the bound buffers, then frees them.
+	// iUsageHint - GL_STATIC_DRAW, GL_DYNAMIC_DRAW...
+	void UploadDataToGPU(int iUsageHint)
+	{
+		UploadDataToGPU(m_vertices.empty() ? NULL : &m_vertices[0], (UINT) m_vertices.size(),
+			m_indices.empty() ? NULL : &m_indices[0], (UINT) m_indices.size(), iUsageHint);
+		ClearData();
+	}
+
+	// Uploads straight from the caller's arrays to the bound buffers, without copying them first
+	void UploadDataToGPU(const TVertex *pVertices, UINT uiNumVertices, const unsigned int *pIndices, UINT uiNumIndices, int iUsageHint)
+	{
+		glBufferData(GL_ARRAY_BUFFER, uiNumVertices * sizeof(TVertex), pVertices, iUsageHint);
+		CMemoryTracker::TrackBuffer(m_uiVBOVertices, uiNumVertices * sizeof(TVertex));
+		if (m_uiVBOIndices != 0) {
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiNumIndices * sizeof(unsigned int), pIndices, iUsageHint);
+			CMemoryTracker::TrackBuffer(m_uiVBOIndices, uiNumIndices * sizeof(unsigned int));
+		}
+	}
+
+	// Allocates storage for uiNumVertices in the bound vertex buffer and maps it, so the caller can write vertices directly
+	// into GPU-visible memory.  Call UnmapVertices when done.  Returns NULL on failure.
+	TVertex* MapVertices(UINT uiNumVertices, int iUsageHint)
+	{
+		GLsizeiptr size = uiNumVertices * sizeof(TVertex);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, iUsageHint);
+		CMemoryTracker::TrackBuffer(m_uiVBOVertices, size);
+		TVertex *pVertices = (TVertex *) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		m_bMapped = pVertices != NULL;
+		return pVertices;
+	}
+
+	// Returns false if the buffer contents were lost while mapped (for example, on a display mode change)
+	bool UnmapVertices()
+	{
+		if (!m_bMapped)
+			return false;
+		m_bMapped = false;
+		return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+	}
+
+private:
+	void ClearData()
+	{
+		TrackedVector<TVertex>().swap(m_vertices);
+		TrackedVector<unsigned int>().swap(m_indices);
+	}
+
+	GLuint m_uiVBOVertices;				// VBO id for vertices
+	GLuint m_uiVBOIndices;				// VBO id for indices, or 0 if not indexed
+	TrackedVector<TVertex> m_vertices;		// Vertices to be uploaded
+	TrackedVector<unsigned int> m_indices;	// Indices to be uploaded
+	bool m_bMapped;
+};
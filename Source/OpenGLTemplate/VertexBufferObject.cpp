@@ -20,6 +20,7 @@ void CVertexBufferObject::Create()
 // Release the VBO and any associated data
 void CVertexBufferObject::Release()
 {
+	CMemoryTracker::ForgetBuffer(m_uiVBO);
 	glDeleteBuffers(1, &m_uiVBO);
 	m_bDataUploaded = false;
 	m_data.clear();
@@ -38,8 +39,9 @@ void CVertexBufferObject::Bind()
 void CVertexBufferObject::UploadDataToGPU(int iDrawingHint)
 {
 	glBufferData(GL_ARRAY_BUFFER, m_data.size(), &m_data[0], iDrawingHint);
+	CMemoryTracker::TrackBuffer(m_uiVBO, m_data.size());
 	m_bDataUploaded = true;
-	m_data.clear();
+	TrackedVector<BYTE>().swap(m_data);
 }
 
 // Adds data to the VBO.  
@@ -48,5 +50,8 @@ void CVertexBufferObject::AddData(void* ptrData, UINT uiDataSize)
 	m_data.insert(m_data.end(), (BYTE*)ptrData, (BYTE*)ptrData+uiDataSize);
 }
 
-
-
+// Returns the VBO id
+UINT CVertexBufferObject::GetBufferID()
+{
+	return m_uiVBO;
+}
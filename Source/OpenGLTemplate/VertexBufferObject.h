@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Common.h"
+#include "MemoryTracker.h"
 
 // This class provides a wrapper around an OpenGL Vertex Buffer Object
 class CVertexBufferObject
@@ -15,10 +16,11 @@ public:
 
 	void AddData(void* ptrData, UINT uiDataSize);	// Adds data to the VBO
 	void UploadDataToGPU(int iUsageHint);			// Uploads the VBO to the GPU
+	UINT GetBufferID();								// Returns the VBO id
 
 	
 private:
 	UINT m_uiVBO;									// VBO id
-	vector<BYTE> m_data;							// Data to be put in the VBO
+	TrackedVector<BYTE> m_data;						// Data to be put in the VBO
 	bool m_bDataUploaded;							// A flag indicating if the data has been sent to the GPU
 };
\ No newline at end of file
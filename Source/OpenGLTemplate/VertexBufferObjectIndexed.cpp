@@ -21,6 +21,8 @@ void CVertexBufferObjectIndexed::Create()
 // Release the buffers and any associated data
 void CVertexBufferObjectIndexed::Release()
 {
+	CMemoryTracker::ForgetBuffer(m_uiVBOVertices);
+	CMemoryTracker::ForgetBuffer(m_uiVBOIndices);
 	glDeleteBuffers(1, &m_uiVBOVertices);
 	glDeleteBuffers(1, &m_uiVBOIndices);
 	m_bDataUploaded = false;
@@ -44,9 +46,11 @@ void CVertexBufferObjectIndexed::UploadDataToGPU(int iUsageHint)
 
 	glBufferData(GL_ARRAY_BUFFER, m_vertexData.size(), &m_vertexData[0], iUsageHint);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexData.size(), &m_indexData[0], iUsageHint);
+	CMemoryTracker::TrackBuffer(m_uiVBOVertices, m_vertexData.size());
+	CMemoryTracker::TrackBuffer(m_uiVBOIndices, m_indexData.size());
 	m_bDataUploaded = true;
-	m_vertexData.clear();
-	m_indexData.clear();
+	TrackedVector<BYTE>().swap(m_vertexData);
+	TrackedVector<BYTE>().swap(m_indexData);
 }
 
 // Adds data to the VBO.  
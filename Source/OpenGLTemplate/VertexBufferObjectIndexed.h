@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Common.h"
+#include "MemoryTracker.h"
 
 class CVertexBufferObjectIndexed
 {
@@ -21,8 +22,8 @@ private:
 	GLuint m_uiVBOVertices;		// VBO id for vertices
 	GLuint m_uiVBOIndices;		// VBO id for indices
 
-	vector<BYTE> m_vertexData;	// Vertex data to be uploaded
-	vector<BYTE> m_indexData;	// Index data to be uploaded
+	TrackedVector<BYTE> m_vertexData;	// Vertex data to be uploaded
+	TrackedVector<BYTE> m_indexData;	// Index data to be uploaded
 
 	bool m_bDataUploaded;		// Flag indicating if data is uploaded to the GPU
 };
\ No newline at end of file
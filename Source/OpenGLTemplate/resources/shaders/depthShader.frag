@@ -0,0 +1,7 @@
+#version 400 core
+
+// Depth pre-pass.  Colour writes are masked off, so there is nothing to output; the depth comes from the vertex stage.
+
+void main()
+{
+}
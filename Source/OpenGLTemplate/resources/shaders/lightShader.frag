@@ -1,18 +1,9 @@
 #version 400 core 
 
-out vec4 vOutputColour;
-
+// Blinn-Phong lighting from every light near the fragment.  CLightGrid divides the frustum into clusters and lists the lights
+// reaching each one, so this loops over the lights of the fragment's cluster only.
 
-struct LightInfo
-{
-	vec4 position;
-	vec3 La;
-	vec3 Ld;
-	vec3 Ls;
-	vec3 direction;
-	float exponent;
-	float cutoff;
-};
+out vec4 vOutputColour;
 
 
 struct MaterialInfo
@@ -23,60 +14,94 @@ struct MaterialInfo
 	float shininess;
 };
 
-uniform LightInfo light1; 
-uniform LightInfo light2; 
 uniform MaterialInfo material1; 
+uniform vec3 vAmbient;				// Ambient light, the same everywhere
+
+uniform sampler2D sampler0;
+uniform bool bUseTexture;
+
+// Three texels per light, in eye coordinates: position and radius; colour and the cosine of the cone's half angle, or -1 for a
+// point light; direction and spot exponent
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightClusters;	// The first index in lightIndices and the number of lights, per cluster
+uniform usamplerBuffer lightIndices;
+uniform vec2 vTileScale;				// Window coordinates to tiles
+uniform float fSliceScale;				// The slice is log(depth) * fSliceScale + fSliceBias
+uniform float fSliceBias;
+
+const int TILES_X = 16;					// As CLightGrid
+const int TILES_Y = 9;
+const int SLICES = 24;
 
 in vec4 p;
 in vec3 n;
+in vec2 vTexCoord;
 
+// The directional light's shadow maps; see CShadowMap
+uniform sampler2DShadow staticShadowMap;
+uniform sampler2DShadow dynamicShadowMap;
+uniform float fShadowStrength;		// How much of the light a shadow takes away
 
-vec3 BlinnPhongSpotlightModel(LightInfo light, vec4 p, vec3 n)
+in vec4 vStaticShadowCoord;
+in vec4 vDynamicShadowCoord;
+
+// 1 where lit, down to 1 - fShadowStrength in full shadow.  Depths past the maps' far plane are clamped to it, so the terrain
+// beyond the static map's box is lit rather than shadowed.
+float ShadowFactor()
 {
-	vec3 s = normalize(vec3(light.position - p));
-	float angle = acos(dot(-s, light.direction));
-	float cutoff = radians(clamp(light.cutoff, 0.0, 90.0));
-	vec3 ambient = light.La * material1.Ma;
-	if (angle < cutoff) {
-		float spotFactor = pow(dot(-s, light.direction), light.exponent);
-		vec3 v = normalize(-p.xyz);
-		vec3 h = normalize(v + s);
-		float sDotN = max(dot(s, n), 0.0);
-		vec3 diffuse = light.Ld * material1.Md * sDotN;
-		vec3 specular = vec3(0.0);
-		if (sDotN > 0.0)
-			specular = light.Ls * material1.Ms * pow(max(dot(h, n), 0.0), material1.shininess);
-		return ambient + spotFactor * (diffuse + specular);
-	} else 
-		return ambient;
+	float fStatic = texture(staticShadowMap, vec3(vStaticShadowCoord.xy, min(vStaticShadowCoord.z, 1.0)));
+	float fDynamic = texture(dynamicShadowMap, vec3(vDynamicShadowCoord.xy, min(vDynamicShadowCoord.z, 1.0)));
+	return 1.0 - fShadowStrength * (1.0 - min(fStatic, fDynamic));
 }
 
 
-// This function implements the Phong shading model
-// The code is based on the OpenGL 4.0 Shading Language Cookbook, Chapter 2, pp. 62 - 63, with a few tweaks. 
-// Please see Chapter 2 of the book for a detailed discussion.
-vec3 PhongModel(vec4 p, vec3 n)
+vec3 BlinnPhongModel(int iLight, vec3 p, vec3 n)
 {
-	vec3 s = normalize(vec3(light1.position - p));
-	vec3 v = normalize(-p.xyz);
-	vec3 r = reflect(-s, n);
+	vec4 position = texelFetch(lightData, iLight * 3);
+	vec4 colour = texelFetch(lightData, iLight * 3 + 1);
+	vec4 direction = texelFetch(lightData, iLight * 3 + 2);
+
+	vec3 toLight = position.xyz - p;
+	float d = length(toLight);
+	vec3 s = toLight / d;
+
+	// Falls smoothly to nothing at the radius, so lights can be left out of clusters beyond it
+	float x = clamp(d / position.w, 0.0, 1.0);
+	float falloff = 1.0 - x * x;
+	falloff *= falloff;
+
+	float cosAngle = dot(-s, direction.xyz);
+	if (colour.w >= 0.0) {
+		if (cosAngle < colour.w)
+			return vec3(0.0);
+		falloff *= pow(cosAngle, direction.w);
+	}
+
+	vec3 v = normalize(-p);
 	vec3 h = normalize(v + s);
-	vec3 ambient = light1.La * material1.Ma;
 	float sDotN = max(dot(s, n), 0.0);
-	vec3 diffuse = light1.Ld * material1.Md * sDotN;
+	vec3 diffuse = material1.Md * sDotN;
 	vec3 specular = vec3(0.0);
 	if (sDotN > 0.0)
-		specular = light1.Ls * material1.Ms * pow(max(dot(h, n), 0.0), material1.shininess);
-	
-	return ambient + diffuse + specular;
-
+		specular = material1.Ms * pow(max(dot(h, n), 0.0), material1.shininess);
+	return colour.rgb * falloff * (diffuse + specular);
 }
 
 
 void main()
 {	
-	vec3 vColour = BlinnPhongSpotlightModel (light1, p, normalize(n)) + BlinnPhongSpotlightModel (light2, p, normalize(n));
-	vOutputColour = vec4(vColour, 1.0);	
+	ivec2 tile = min(ivec2(gl_FragCoord.xy * vTileScale), ivec2(TILES_X - 1, TILES_Y - 1));
+	int slice = clamp(int(log(-p.z) * fSliceScale + fSliceBias), 0, SLICES - 1);
+	uvec2 cluster = texelFetch(lightClusters, (slice * TILES_Y + tile.y) * TILES_X + tile.x).xy;
+
+	vec3 normal = normalize(n);
+	vec3 vColour = vAmbient * material1.Ma;
+	for (uint i = 0u; i < cluster.y; i++)
+		vColour += BlinnPhongModel(int(texelFetch(lightIndices, int(cluster.x + i)).x), p.xyz, normal);
 
-	
+	if (bUseTexture)
+		vOutputColour = texture(sampler0, vTexCoord) * vec4(vColour, 1.0);
+	else
+		vOutputColour = vec4(vColour, 1.0);
+	vOutputColour.rgb *= ShadowFactor();
 }
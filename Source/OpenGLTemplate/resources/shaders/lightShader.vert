@@ -8,6 +8,10 @@ uniform struct Matrices
 	mat3 normalMatrix;
 } matrices;
 
+// Eye coordinates to each shadow map's coordinates, set by CShadowMap
+uniform mat4 staticShadowMatrix;
+uniform mat4 dynamicShadowMatrix;
+
 
 
 // Layout of vertex attributes in VBO
@@ -17,6 +21,9 @@ layout (location = 2) in vec3 inNormal;
 
 out vec4 p;
 out vec3 n;
+out vec2 vTexCoord;
+out vec4 vStaticShadowCoord;
+out vec4 vDynamicShadowCoord;
 
 void main()
 {	
@@ -27,6 +34,9 @@ void main()
 	// Get the vertex normal and vertex position in eye coordinates
 	n = normalize(matrices.normalMatrix * inNormal);
 	p = matrices.modelViewMatrix * vec4(inPosition, 1.0f);
+	vTexCoord = inCoord;
+	vStaticShadowCoord = staticShadowMatrix * p;
+	vDynamicShadowCoord = dynamicShadowMatrix * p;
 
 	
 } 
@@ -8,6 +8,23 @@ out vec4 vOutputColour;		// The output colour
 uniform sampler2D sampler0;  // The texture sampler
 uniform bool bUseTexture;    // A flag indicating if texture-mapping should be applied
 
+// The directional light's shadow maps; see CShadowMap
+uniform sampler2DShadow staticShadowMap;
+uniform sampler2DShadow dynamicShadowMap;
+uniform float fShadowStrength;		// How much of the light a shadow takes away
+
+in vec4 vStaticShadowCoord;
+in vec4 vDynamicShadowCoord;
+
+// 1 where lit, down to 1 - fShadowStrength in full shadow.  Depths past the maps' far plane are clamped to it, so the terrain
+// beyond the static map's box is lit rather than shadowed.
+float ShadowFactor()
+{
+	float fStatic = texture(staticShadowMap, vec3(vStaticShadowCoord.xy, min(vStaticShadowCoord.z, 1.0)));
+	float fDynamic = texture(dynamicShadowMap, vec3(vDynamicShadowCoord.xy, min(vDynamicShadowCoord.z, 1.0)));
+	return 1.0 - fShadowStrength * (1.0 - min(fStatic, fDynamic));
+}
+
 void main()
 {
 	// Get the texel colour from the texture sampler
@@ -17,6 +34,7 @@ void main()
 		vOutputColour = vTexColour*vec4(vColour, 1.0f);	// Combine object colour and texture 
 	else
 		vOutputColour = vec4(vColour, 1.0f);	// Just use the colour instead
+	vOutputColour.rgb *= ShadowFactor();
 
 	
 	
@@ -30,6 +30,10 @@ struct MaterialInfo
 uniform LightInfo light1; 
 uniform MaterialInfo material1; 
 
+// Eye coordinates to each shadow map's coordinates, set by CShadowMap
+uniform mat4 staticShadowMatrix;
+uniform mat4 dynamicShadowMatrix;
+
 // Layout of vertex attributes in VBO
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec2 inCoord;
@@ -38,6 +42,11 @@ layout (location = 2) in vec3 inNormal;
 // Vertex colour output to fragment shader -- using Gouraud (interpolated) shading
 out vec3 vColour;	// Colour computed using reflectance model
 out vec2 vTexCoord;	// Texture coordinate
+out vec4 vStaticShadowCoord;
+out vec4 vDynamicShadowCoord;
+
+// The depth pre-pass uses this stage too, so its depths must match exactly
+invariant gl_Position;
 
 // This function implements the Phong shading model
 // The code is based on the OpenGL 4.0 Shading Language Cookbook, Chapter 2, pp. 62 - 63, with a few tweaks. 
@@ -76,4 +85,7 @@ void main()
 	
 	// Pass through the texture coordinate
 	vTexCoord = inCoord;
+
+	vStaticShadowCoord = staticShadowMatrix * vEyePosition;
+	vDynamicShadowCoord = dynamicShadowMatrix * vEyePosition;
 } 
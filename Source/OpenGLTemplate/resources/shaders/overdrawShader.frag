@@ -0,0 +1,12 @@
+#version 400 core
+
+// Overdraw heatmap.  The stencil test picks the pixels shaded a given number of times, and they are drawn in that count's colour.
+
+out vec4 vOutputColour;		// The output colour
+
+uniform vec4 vColour;
+
+void main()
+{
+	vOutputColour = vColour;
+}
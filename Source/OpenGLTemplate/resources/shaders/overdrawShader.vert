@@ -0,0 +1,9 @@
+#version 400 core
+
+// A triangle that covers the whole screen, made from gl_VertexID so that no vertex buffer is needed
+
+void main()
+{
+	vec2 vPosition = vec2((gl_VertexID & 1) * 4.0f - 1.0f, (gl_VertexID >> 1) * 4.0f - 1.0f);
+	gl_Position = vec4(vPosition, 0.0f, 1.0f);
+}
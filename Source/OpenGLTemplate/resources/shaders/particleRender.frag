@@ -0,0 +1,14 @@
+#version 400 core
+
+in vec2 vCorner;
+in vec4 vColour;
+out vec4 vOutputColour;
+
+// A round spot, brightest in the middle, for additive blending
+void main()
+{
+	float r2 = dot(vCorner, vCorner);
+	if (r2 > 1.0)
+		discard;
+	vOutputColour = vec4(vColour.rgb * vColour.a * (1.0 - r2), 1.0);
+}
@@ -0,0 +1,39 @@
+#version 400 core
+
+// Draws each particle as a quad facing the camera.  There is one instance per particle, with the particle's attributes
+// advancing once per instance, and the quad is a four-vertex strip whose corners come from gl_VertexID.
+
+uniform struct Matrices
+{
+	mat4 projMatrix;
+	mat4 viewMatrix;
+} matrices;
+
+uniform float fSize;			// Half the width of a new particle's quad
+
+layout (location = 0) in vec4 inPosition;		// xyz, with the seconds of life left in w
+layout (location = 1) in vec4 inVelocity;		// xyz, with the whole lifetime in w
+layout (location = 2) in uint inColour;
+
+out vec2 vCorner;
+out vec4 vColour;
+
+void main()
+{
+	vCorner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	if (inPosition.w <= 0.0) {
+		// Dead particles go behind the near plane and are clipped
+		gl_Position = vec4(0.0, 0.0, -2.0, 1.0);
+		vColour = vec4(0.0);
+		return;
+	}
+
+	// Particles shrink and fade as they age
+	float fFade = clamp(inPosition.w / inVelocity.w, 0.0, 1.0);
+	vec4 vEyePosition = matrices.viewMatrix * vec4(inPosition.xyz, 1.0);
+	vEyePosition.xy += vCorner * fSize * (0.5 + 0.5 * fFade);
+	gl_Position = matrices.projMatrix * vEyePosition;
+
+	vColour = unpackUnorm4x8(inColour);
+	vColour.a *= fFade;
+}
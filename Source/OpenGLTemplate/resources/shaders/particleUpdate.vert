@@ -0,0 +1,74 @@
+#version 400 core
+
+// Moves every particle on by one step.  CParticleSystem runs this once per particle with rasterisation off, and transform
+// feedback writes the outputs into its other buffer.  Particles inside a burst's range of the ring are respawned at the
+// burst's origin instead, so a burst costs the CPU a few uniforms however many particles it has.
+
+const int MAX_BURSTS = 16;
+
+layout (location = 0) in vec4 inPosition;		// xyz, with the seconds of life left in w
+layout (location = 1) in vec4 inVelocity;		// xyz, with the whole lifetime in w
+layout (location = 2) in uint inColour;			// RGBA, 8 bits each
+
+out vec4 vPosition;
+out vec4 vVelocity;
+flat out uint vColour;
+
+uniform float fDt;					// Seconds since the last step
+uniform int iFrame;					// Seeds the random directions
+uniform vec3 vGravity;
+uniform float fDrag;				// Fraction of the velocity lost per second
+uniform int iCapacity;
+uniform int iNumBursts;
+uniform int burstFirsts[MAX_BURSTS];	// Each burst takes burstCounts particles from burstFirsts on, wrapping round the ring
+uniform int burstCounts[MAX_BURSTS];
+uniform vec4 burstOrigins[MAX_BURSTS];	// xyz, with the greatest speed in w
+uniform vec4 burstColours[MAX_BURSTS];
+uniform float burstLives[MAX_BURSTS];
+
+// A number in [0, 1) from an integer, by Wang's hash
+float Random(uint n)
+{
+	n = (n ^ 61u) ^ (n >> 16);
+	n *= 9u;
+	n = n ^ (n >> 4);
+	n *= 0x27d4eb2du;
+	n = n ^ (n >> 15);
+	return float(n) / 4294967296.0;
+}
+
+void main()
+{
+	for (int i = 0; i < iNumBursts; i++) {
+		int offset = gl_VertexID - burstFirsts[i];
+		if (offset < 0)
+			offset += iCapacity;
+		if (offset < burstCounts[i]) {
+			// A random direction, uniform over the sphere, and a random speed and lifetime
+			uint seed = uint(gl_VertexID) * 4u ^ uint(iFrame) * 0x9e3779b9u;
+			float z = 2.0 * Random(seed) - 1.0;
+			float a = 6.2831853 * Random(seed + 1u);
+			float r = sqrt(1.0 - z * z);
+			vec3 vDirection = vec3(r * cos(a), z, r * sin(a));
+			float fSpeed = burstOrigins[i].w * (0.25 + 0.75 * Random(seed + 2u));
+			float fLife = burstLives[i] * (0.5 + 0.5 * Random(seed + 3u));
+
+			vPosition = vec4(burstOrigins[i].xyz, fLife);
+			vVelocity = vec4(vDirection * fSpeed, fLife);
+			vColour = packUnorm4x8(burstColours[i]);
+			return;
+		}
+	}
+
+	vColour = inColour;
+	if (inPosition.w <= 0.0) {
+		// Dead, until a burst takes it
+		vPosition = inPosition;
+		vVelocity = inVelocity;
+		return;
+	}
+
+	vec3 v = inVelocity.xyz * max(1.0 - fDrag * fDt, 0.0) + vGravity * fDt;
+	vPosition = vec4(inPosition.xyz + v * fDt, inPosition.w - fDt);
+	vVelocity = vec4(v, inVelocity.w);
+}
@@ -0,0 +1,12 @@
+#version 400 core
+
+in vec3 vDirection;			// Interpolated direction from the vertex shader
+
+out vec4 vOutputColour;		// The output colour
+
+uniform samplerCube skybox;	// The cubemap sampler
+
+void main()
+{
+	vOutputColour = texture(skybox, vDirection);
+}
@@ -0,0 +1,24 @@
+#version 400 core
+
+// Structure for matrices
+uniform struct Matrices
+{
+	mat4 projMatrix;
+	mat4 viewMatrix;
+} matrices;
+
+// Layout of vertex attributes in VBO
+layout (location = 0) in vec3 inPosition;
+
+out vec3 vDirection;	// Direction from the camera, used to look up the cubemap
+
+void main()
+{
+	// Rotate only, so the sky stays centred on the camera
+	vec4 vPosition = matrices.projMatrix * vec4(mat3(matrices.viewMatrix) * inPosition, 1.0f);
+
+	// Set z to w so that the depth is 1, at the far plane
+	gl_Position = vPosition.xyww;
+
+	vDirection = inPosition;
+}
@@ -0,0 +1,102 @@
+#version 400 core
+#extension GL_ARB_shader_storage_buffer_object : require
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_ARB_shading_language_420pack : require
+
+// The main shader's vertex stage for CStaticBatch.  Each draw's model matrix and material come from shader storage buffers,
+// indexed by the command's base instance, which stays with the draw however the commands are ordered.
+
+// Structure for matrices
+uniform struct Matrices
+{
+	mat4 projMatrix;
+	mat4 viewMatrix;
+} matrices;
+
+// Structure holding light information:  its position as well as ambient, diffuse, and specular colours
+struct LightInfo
+{
+	vec4 position;
+	vec3 La;
+	vec3 Ld;
+	vec3 Ls;
+};
+
+// Per-draw data
+struct DrawInfo
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;	// Inverse transpose of the model matrix's upper 3x3, in a mat4 for alignment
+	uint material;
+};
+
+// Ambient, diffuse, and specular colours, with shininess in Ms.w
+struct MaterialInfo
+{
+	vec4 Ma;
+	vec4 Md;
+	vec4 Ms;
+};
+
+layout (std430, binding = 0) buffer Draws
+{
+	DrawInfo draws[];
+};
+
+layout (std430, binding = 1) buffer Materials
+{
+	MaterialInfo materials[];
+};
+
+uniform LightInfo light1;
+
+// Eye coordinates to each shadow map's coordinates, set by CShadowMap
+uniform mat4 staticShadowMatrix;
+uniform mat4 dynamicShadowMatrix;
+
+// Layout of vertex attributes in VBO
+layout (location = 0) in vec3 inPosition;
+layout (location = 1) in vec2 inCoord;
+layout (location = 2) in vec3 inNormal;
+
+// Vertex colour output to fragment shader -- using Gouraud (interpolated) shading
+out vec3 vColour;	// Colour computed using reflectance model
+out vec2 vTexCoord;	// Texture coordinate
+out vec4 vStaticShadowCoord;
+out vec4 vDynamicShadowCoord;
+
+// The depth pre-pass uses this stage too, so its depths must match exactly
+invariant gl_Position;
+
+// The same Phong model as mainShader.vert, with the material passed in
+vec3 PhongModel(vec4 eyePosition, vec3 eyeNorm, MaterialInfo material)
+{
+	vec3 s = normalize(vec3(light1.position - eyePosition));
+	vec3 v = normalize(-eyePosition.xyz);
+	vec3 r = reflect(-s, eyeNorm);
+	vec3 n = eyeNorm;
+	vec3 ambient = light1.La * material.Ma.rgb;
+	float sDotN = max(dot(s, n), 0.0f);
+	vec3 diffuse = light1.Ld * material.Md.rgb * sDotN;
+	vec3 specular = vec3(0.0f);
+	float eps = 0.000001f; // add eps to shininess below -- pow not defined if second argument is 0 (as described in GLSL documentation)
+	if (sDotN > 0.0f)
+		specular = light1.Ls * material.Ms.rgb * pow(max(dot(r, v), 0.0f), material.Ms.w + eps);
+
+	return ambient + diffuse + specular;
+}
+
+void main()
+{
+	DrawInfo draw = draws[gl_BaseInstanceARB];
+
+	// The view matrix is a rotation and translation, so it can transform normals directly
+	vec4 vEyePosition = matrices.viewMatrix * draw.modelMatrix * vec4(inPosition, 1.0f);
+	vec3 vEyeNorm = normalize(mat3(matrices.viewMatrix) * (mat3(draw.normalMatrix) * inNormal));
+	gl_Position = matrices.projMatrix * vEyePosition;
+
+	vColour = PhongModel(vEyePosition, vEyeNorm, materials[draw.material]);
+	vTexCoord = inCoord;
+	vStaticShadowCoord = staticShadowMatrix * vEyePosition;
+	vDynamicShadowCoord = dynamicShadowMatrix * vEyePosition;
+}
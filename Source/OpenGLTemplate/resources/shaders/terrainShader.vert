@@ -0,0 +1,120 @@
+#version 400 core
+
+// mainShader.vert for the displaced heightmap terrain.  Each instance is one patch of the grid; its vertices are placed over the
+// terrain by the instance and their grid coordinates, lifted by the height texture, and given normals from the neighbouring
+// heights.  mainShader.frag and depthShader.frag follow it as they follow mainShader.vert.
+
+// Structure for matrices
+uniform struct Matrices
+{
+	mat4 projMatrix;
+	mat4 modelViewMatrix; 
+	mat3 normalMatrix;
+} matrices;
+
+// Structure holding light information:  its position as well as ambient, diffuse, and specular colours
+struct LightInfo
+{
+	vec4 position;
+	vec3 La;
+	vec3 Ld;
+	vec3 Ls;
+};
+
+// Structure holding material information:  its ambient, diffuse, and specular colours, and shininess
+struct MaterialInfo
+{
+	vec3 Ma;
+	vec3 Md;
+	vec3 Ms;
+	float shininess;
+};
+
+// Lights and materials passed in as uniform variables from client programme
+uniform LightInfo light1; 
+uniform MaterialInfo material1; 
+
+// Eye coordinates to each shadow map's coordinates, set by CShadowMap
+uniform mat4 staticShadowMatrix;
+uniform mat4 dynamicShadowMatrix;
+
+// The grid and the heights, set by CHeightMapTerrain::BindDisplacement
+uniform struct Terrain
+{
+	vec2 vOrigin;			// World xz of the first pixel
+	vec2 vSize;				// World xz from the first pixel to the last
+	vec2 vTexelScale;		// Grid [0, 1] to texture coordinates at pixel centres: * vTexelScale + vTexelSize / 2
+	vec2 vTexelSize;
+	float fHeightScale;		// World height = texel * fHeightScale + fHeightBias
+	float fHeightBias;
+	int iPatches;			// Along each side
+	float fPatchQuads;
+} terrain;
+
+uniform sampler2D heightMap;
+
+// Grid coordinates within the patch, in quads
+layout (location = 0) in vec2 inGrid;
+
+// Vertex colour output to fragment shader -- using Gouraud (interpolated) shading
+out vec3 vColour;	// Colour computed using reflectance model
+out vec2 vTexCoord;	// Texture coordinate
+out vec4 vStaticShadowCoord;
+out vec4 vDynamicShadowCoord;
+
+// The depth pre-pass uses this stage too, so its depths must match exactly
+invariant gl_Position;
+
+// The same Phong model as mainShader.vert
+vec3 PhongModel(vec4 eyePosition, vec3 eyeNorm)
+{
+	vec3 s = normalize(vec3(light1.position - eyePosition));
+	vec3 v = normalize(-eyePosition.xyz);
+	vec3 r = reflect(-s, eyeNorm);
+	vec3 n = eyeNorm;
+	vec3 ambient = light1.La * material1.Ma;
+	float sDotN = max(dot(s, n), 0.0f);
+	vec3 diffuse = light1.Ld * material1.Md * sDotN;
+	vec3 specular = vec3(0.0f);
+	float eps = 0.000001f; // add eps to shininess below -- pow not defined if second argument is 0 (as described in GLSL documentation)
+	if (sDotN > 0.0f) 
+		specular = light1.Ls * material1.Ms * pow(max(dot(r, v), 0.0f), material1.shininess + eps);
+	
+	return ambient + diffuse + specular;
+}
+
+float Height(vec2 texCoord)
+{
+	return texture(heightMap, texCoord).r * terrain.fHeightScale + terrain.fHeightBias;
+}
+
+void main()
+{
+	// Where this vertex is over the whole terrain, from 0 to 1
+	vec2 patchCoord = vec2(gl_InstanceID % terrain.iPatches, gl_InstanceID / terrain.iPatches);
+	vec2 grid = (patchCoord + inGrid / terrain.fPatchQuads) / float(terrain.iPatches);
+	vec2 texCoord = grid * terrain.vTexelScale + 0.5 * terrain.vTexelSize;
+
+	vec2 xz = terrain.vOrigin + grid * terrain.vSize;
+	vec3 position = vec3(xz.x, Height(texCoord), xz.y);
+
+	// Central differences one pixel either way
+	vec2 pixelSize = terrain.vSize * terrain.vTexelSize / terrain.vTexelScale;
+	float hL = Height(texCoord - vec2(terrain.vTexelSize.x, 0.0));
+	float hR = Height(texCoord + vec2(terrain.vTexelSize.x, 0.0));
+	float hD = Height(texCoord - vec2(0.0, terrain.vTexelSize.y));
+	float hU = Height(texCoord + vec2(0.0, terrain.vTexelSize.y));
+	vec3 normal = normalize(vec3((hL - hR) / (2.0 * pixelSize.x), 1.0, (hD - hU) / (2.0 * pixelSize.y)));
+
+	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(position, 1.0f);
+
+	vec3 vEyeNorm = normalize(matrices.normalMatrix * normal);
+	vec4 vEyePosition = matrices.modelViewMatrix * vec4(position, 1.0f);
+	vColour = PhongModel(vEyePosition, vEyeNorm);
+
+	// As the mesh's, from ComputeTextureCoordsXZ
+	vTexCoord = xz / 20.0;
+
+	vStaticShadowCoord = staticShadowMatrix * vEyePosition;
+	vDynamicShadowCoord = dynamicShadowMatrix * vEyePosition;
+}
@@ -0,0 +1,35 @@
+#version 400 core
+
+// The corners of CHeightMapTerrain::RenderTessellated's coarse patches, lifted onto the terrain so terrainTess.tcnl can measure
+// the patch edges on screen
+
+// The grid and the heights, set by CHeightMapTerrain::BindDisplacement
+uniform struct Terrain
+{
+	vec2 vOrigin;			// World xz of the first pixel
+	vec2 vSize;				// World xz from the first pixel to the last
+	vec2 vTexelScale;		// Grid [0, 1] to texture coordinates at pixel centres: * vTexelScale + vTexelSize / 2
+	vec2 vTexelSize;
+	float fHeightScale;		// World height = texel * fHeightScale + fHeightBias
+	float fHeightBias;
+	int iPatches;			// Along each side
+	float fPatchQuads;
+} terrain;
+
+uniform sampler2D heightMap;
+
+// Grid coordinates over the whole terrain, from 0 to 1, then the lowest and highest world height in the corner's patch
+layout (location = 0) in vec4 inCorner;
+
+out vec3 vPosition;
+out vec2 vGrid;
+out vec2 vHeightRange;
+
+void main()
+{
+	vec2 texCoord = inCorner.xy * terrain.vTexelScale + 0.5 * terrain.vTexelSize;
+	vec2 xz = terrain.vOrigin + inCorner.xy * terrain.vSize;
+	vPosition = vec3(xz.x, texture(heightMap, texCoord).r * terrain.fHeightScale + terrain.fHeightBias, xz.y);
+	vGrid = inCorner.xy;
+	vHeightRange = inCorner.zw;
+}
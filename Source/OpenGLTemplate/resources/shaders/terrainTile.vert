@@ -0,0 +1,113 @@
+#version 400 core
+
+// mainShader.vert for one tile of CTiledTerrain.  Each vertex of the tile's grid is lifted by its pixel in the tile's layer
+// of the height array and given a normal from the neighbouring pixels, which the apron round the tile supplies at its edges.
+// mainShader.frag and depthShader.frag follow it as they follow mainShader.vert.
+
+// Structure for matrices
+uniform struct Matrices
+{
+	mat4 projMatrix;
+	mat4 modelViewMatrix; 
+	mat3 normalMatrix;
+} matrices;
+
+// Structure holding light information:  its position as well as ambient, diffuse, and specular colours
+struct LightInfo
+{
+	vec4 position;
+	vec3 La;
+	vec3 Ld;
+	vec3 Ls;
+};
+
+// Structure holding material information:  its ambient, diffuse, and specular colours, and shininess
+struct MaterialInfo
+{
+	vec3 Ma;
+	vec3 Md;
+	vec3 Ms;
+	float shininess;
+};
+
+// Lights and materials passed in as uniform variables from client programme
+uniform LightInfo light1; 
+uniform MaterialInfo material1; 
+
+// Eye coordinates to each shadow map's coordinates, set by CShadowMap
+uniform mat4 staticShadowMatrix;
+uniform mat4 dynamicShadowMatrix;
+
+// The tile, set by CTiledTerrain::Render
+uniform struct TiledTerrain
+{
+	float fPixelSize;		// World distance between pixels
+	float fHeightScale;		// World height = texel * fHeightScale + fHeightBias
+	float fHeightBias;
+	vec2 vTileOrigin;		// World xz of the tile's first pixel
+	int iLayer;
+} tiles;
+
+uniform sampler2DArray heightTiles;
+
+// Pixel coordinates within the tile
+layout (location = 0) in vec2 inGrid;
+
+// Vertex colour output to fragment shader -- using Gouraud (interpolated) shading
+out vec3 vColour;	// Colour computed using reflectance model
+out vec2 vTexCoord;	// Texture coordinate
+out vec4 vStaticShadowCoord;
+out vec4 vDynamicShadowCoord;
+
+// The depth pre-pass uses this stage too, so its depths must match exactly
+invariant gl_Position;
+
+// The same Phong model as mainShader.vert
+vec3 PhongModel(vec4 eyePosition, vec3 eyeNorm)
+{
+	vec3 s = normalize(vec3(light1.position - eyePosition));
+	vec3 v = normalize(-eyePosition.xyz);
+	vec3 r = reflect(-s, eyeNorm);
+	vec3 n = eyeNorm;
+	vec3 ambient = light1.La * material1.Ma;
+	float sDotN = max(dot(s, n), 0.0f);
+	vec3 diffuse = light1.Ld * material1.Md * sDotN;
+	vec3 specular = vec3(0.0f);
+	float eps = 0.000001f; // add eps to shininess below -- pow not defined if second argument is 0 (as described in GLSL documentation)
+	if (sDotN > 0.0f) 
+		specular = light1.Ls * material1.Ms * pow(max(dot(r, v), 0.0f), material1.shininess + eps);
+	
+	return ambient + diffuse + specular;
+}
+
+// Texel (0, 0) is the apron, so the tile's first pixel is (1, 1)
+float Height(ivec2 pixel)
+{
+	return texelFetch(heightTiles, ivec3(pixel + ivec2(1), tiles.iLayer), 0).r * tiles.fHeightScale + tiles.fHeightBias;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(inGrid);
+	vec2 xz = tiles.vTileOrigin + inGrid * tiles.fPixelSize;
+	vec3 position = vec3(xz.x, Height(pixel), xz.y);
+
+	// Central differences one pixel either way
+	float hL = Height(pixel - ivec2(1, 0));
+	float hR = Height(pixel + ivec2(1, 0));
+	float hD = Height(pixel - ivec2(0, 1));
+	float hU = Height(pixel + ivec2(0, 1));
+	vec3 normal = normalize(vec3((hL - hR) / (2.0 * tiles.fPixelSize), 1.0, (hD - hU) / (2.0 * tiles.fPixelSize)));
+
+	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(position, 1.0f);
+
+	vec3 vEyeNorm = normalize(matrices.normalMatrix * normal);
+	vec4 vEyePosition = matrices.modelViewMatrix * vec4(position, 1.0f);
+	vColour = PhongModel(vEyePosition, vEyeNorm);
+
+	// As the mesh's, from ComputeTextureCoordsXZ
+	vTexCoord = xz / 20.0;
+
+	vStaticShadowCoord = staticShadowMatrix * vEyePosition;
+	vDynamicShadowCoord = dynamicShadowMatrix * vEyePosition;
+}
@@ -0,0 +1,13 @@
+#version 400 core
+
+// The track's control points, from CCatmullRom::CreateTrackPatches, passed through to trackTess.tcnl as they are
+
+// The control point, then its distance along the control polygon
+layout (location = 0) in vec4 inControl;
+
+out vec4 vControl;
+
+void main()
+{
+	vControl = inControl;
+}